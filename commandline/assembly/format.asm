@@ -10,9 +10,9 @@
 	
 	jsr led_on
 	
-	lda #$41 ; Set ID for formatting. TODO(aeckleder): Don't hardcode.
-	sta disc_id_0
-	lda #$45
+	lda input_buffer + 0x07	; Set ID for formatting (offset 7 and 8 after
+	sta disc_id_0		; M-E<mem_lo><mem_hi><first_track><end_track>).
+	lda input_buffer + 0x08
 	sta disc_id_1
 
 	jsr close_all_channels
@@ -59,6 +59,7 @@ format_job:
 	
 	lda #$01
 	sta dc_current_track_number
+	lda input_buffer + 0x05	; First track to format.
 	sta format_current_track
 
 	lda #$a4		; Move 46 tracks outwards to produce BUMP.
@@ -125,8 +126,8 @@ normal_range:
 	sta via1_timer_value_high
 	sta via1_timer_trigger_by_write
 
-	ldy #$00
-	ldx #$00
+	tay
+	tax
 wait_for_sync_start:
 	bit via2_drive_port
 	bmi wait_for_sync_start
@@ -149,6 +150,7 @@ wait_for_timer_interrupt_or_new_sync_zone:
 	iny
 	bne wait_for_new_sync_zone
 
+disc_not_rotating:
 	; It took way too long to find the next sync marker. Disc not rotating?
 	lda #errno_readerror_20
 	jmp format_print_error
@@ -178,8 +180,7 @@ wait_for_timer_interrupt_or_end_of_sync_zone:
 	bne wait_for_end_sync_zone
 	
 	; It took way too long to find end of sync zone. Disc not rotating?
-	lda #errno_readerror_20
-	jmp format_print_error
+	beq disc_not_rotating
 
 sync_zone_end_found:
 	sec
@@ -282,12 +283,9 @@ no_overflow:
 
 	eor #$ff
 	sec
-	adc #$00 			   	; a = -a
-	clc
-	adc format_num_bytes_per_track_low
+	adc format_num_bytes_per_track_low	; a = format_num_bytes_per_track_low - a
 	bcs carry_set
-	dec format_num_bytes_per_track_high 	; We wrapped to positive due to the addition.
-						; Decrease high byte as well.
+	dec format_num_bytes_per_track_high 	; We had to borrow. Decrease high byte as well.
 carry_set:
 	; a = total_bytes_in_gap % 256
 	; Now calculate the high byte of total_bytes_in_gap.
@@ -296,9 +294,7 @@ carry_set:
 	tya
 	eor #$ff
 	sec
-	adc #$00				; a = -y
-	clc
-	adc format_num_bytes_per_track_high
+	adc format_num_bytes_per_track_high	; a = format_num_bytes_per_track_high - y
 	bpl total_bytes_in_gap_positive
 
 	lda #errno_readerror_22	; Not enough capacity to fit our payload.
@@ -331,8 +327,7 @@ bytes_per_gap_division_done:
 num_bytes_per_gap_ok:
 	lda #$00
 	sta format_sector_counter
-	tay
-	tax			; x = y = format_sector_counter = 0 
+	tay			; y = format_sector_counter = 0
 
 prepare_sector_header_loop:
 	lda sector_header_signature_byte
@@ -360,8 +355,7 @@ prepare_sector_header_loop:
 	; Calculate checksum from header content and store it in the
 	; corresponding field
 	offset_from_header_start = 8 ; y = offset_from_header_start + header_start
-	lda #$00
-	eor format_sector_header_buffer - offset_from_header_start + 2, y
+	lda format_sector_header_buffer - offset_from_header_start + 2, y
 	eor format_sector_header_buffer - offset_from_header_start + 3, y
 	eor format_sector_header_buffer - offset_from_header_start + 4, y
 	eor format_sector_header_buffer - offset_from_header_start + 5, y	
@@ -429,6 +423,7 @@ write_pre_content_empty_bytes_loop:
 	sta via2_drive_data
 	dex
 	bne write_pre_content_empty_bytes_loop 
+	sty current_buffer_track_ptr	; Move to header of next sector.
 
 	lda #gcr_sync_byte
 	ldx #$05
@@ -450,6 +445,7 @@ write_aux_buffer_sector_content_loop:
 	bne write_aux_buffer_sector_content_loop
 
 	ldy #$00  ; Now write the rest of the sector content.
+	ldx format_num_bytes_per_gap ; Loaded here, there's less time after the last byte.
 write_sector_content_loop:	
 	bvc write_sector_content_loop
 	clv
@@ -459,18 +455,12 @@ write_sector_content_loop:
 	bne write_sector_content_loop
 	
 	lda #gcr_empty_byte
-	ldx format_num_bytes_per_gap
 write_post_sector_gap_loop:
 	bvc write_post_sector_gap_loop
 	clv
 	sta via2_drive_data
 	dex
 	bne write_post_sector_gap_loop
-	
-	lda current_buffer_track_ptr ; Move to header of next sector.
-	clc
-	adc #$0a
-	sta current_buffer_track_ptr
 
 	dec format_sector_counter
 	bne write_sectors_loop
@@ -487,13 +477,55 @@ write_last_track_byte_loop:	; Not exactly sure what this is for, but I assume
 
 	jsr dc_set_head_to_read ; Turn off writing, otherwise we just overwrite all we did above.
 
-	; We don't verify anything during format. We'll find out soon enough
-	; if anything's broken when copying.
+	; Verify what we just wrote. All data blocks have the same content, but every one
+	; must follow its own header, and the headers must come in writing order. The first
+	; header we see is almost certainly not the one of sector 0, so we allow a generous
+	; number of retries.
+	lda #$c8
+	sta verify_retry_counter	; 200 retries.
+
+verify_track_retry_loop:
+	ldx #$00			; Offset of the next sector header to find.
+verify_sectors_loop:
+	jsr dc_wait_for_sync
+	ldy #$0a			; Expecting 10 bytes of block header.
+verify_sector_header_loop:
+	bvc verify_sector_header_loop
+	clv
+	lda via2_drive_data
+	cmp format_sector_header_buffer, x
+	bne verification_failed
+	inx
+	dey
+	bne verify_sector_header_loop
+
+	jsr dc_wait_for_sync		; The data block of the sector we just found.
+	ldy #$bb
+verify_aux_sector_content_loop:
+	bvc verify_aux_sector_content_loop
+	clv
+	lda via2_drive_data
+	cmp processor_stack_page, y
+	bne verification_failed
+	iny
+	bne verify_aux_sector_content_loop
+
+verify_sector_content_loop:
+	bvc verify_sector_content_loop
+	clv
+	lda via2_drive_data
+	cmp format_sector_content_buffer, y
+	bne verification_failed
+	iny
+	bne verify_sector_content_loop
+
+	cpx current_buffer_track_ptr	; Behind the last header written?
+	bne verify_sectors_loop
 
 	inc format_current_track
 	lda format_current_track
-	cmp #$29		; Do we have all 40 tracks yet?
-	bcs done_formatting	; TODO(aeckleder): Should we have an option to do 40 vs. 35?
+	cmp input_buffer + 0x06	; Reached the end track (exclusive)?
+	bcs done_formatting
 
 	jmp dc_end_of_job_loop
 
@@ -506,6 +538,11 @@ exit_with_error:
 	sty buffer_gcr_status
 	jmp dc_end_job_loop_with_status
 
+verification_failed:
+	dec verify_retry_counter
+	bne verify_track_retry_loop
+	lda #errno_readerror_24	; Format this track again.
+
 	; Decrease max error count and bail out if too many errors occurred.
 format_print_error:
 	dec max_format_errors
@@ -0,0 +1,182 @@
+	!cpu 6502 ; We want to run on a 1541 disc station.
+	*= $0300
+
+	!source "assembly/definitions.asm" ; Include standard definitions.
+
+	; Table driven replacement for read_convert_gcr_to_binary, kept to measure GCR decoding
+	; against the ROM (see drive_emulator_test.cc and the read path in rw_block.asm).
+	; Expects the 325 GCR bytes of a data block in buffer 3 and the auxiliary space
+	; ($01ba-$01ff), exactly as left by the read loop in rw_block.asm. Decodes in place: the
+	; signature goes to data_block_signature_byte, the content to buffer 3 and the stored
+	; checksum to sector_data_checksum.
+	; Uses the zero page scratch space of the ROM GCR routines ($52-$5c), $05fb-$05ff behind
+	; rw_block.asm and $01b9, which lies between the processor stack and the auxiliary space.
+
+	gcr_decode_buffer = $0600		; Same as block_read_data_buffer_start in rw_block.asm.
+	gcr_decode_aux_start = processor_stack_page + $b9 ; GCR byte 255 is copied here.
+	gcr_decode_last_group = gcr_decode_buffer - 5	; Output of the last group.
+
+	gcr_decode_zp = $52			; Scratch space of the ROM GCR routines.
+	gcr_decode_in = gcr_decode_zp + 0	; Pointer to the current group of 5 GCR bytes.
+	gcr_decode_out = gcr_decode_zp + 2	; Pointer to where the current 4 bytes go.
+	gcr_decode_bytes = gcr_decode_zp + 4	; 5 GCR bytes of the current group.
+	gcr_decode_tmp0 = gcr_decode_zp + 9
+	gcr_decode_tmp1 = gcr_decode_zp + 10
+
+decode_gcr_block:
+	lda gcr_decode_buffer + $ff	; Make GCR bytes 255..324 contiguous, group 51
+	sta gcr_decode_aux_start	; straddles the buffer and the aux space otherwise.
+
+	ldx #>(gcr_decode_buffer - 1)	; The signature goes right before the buffer.
+	stx gcr_decode_out + 1
+	inx
+	stx gcr_decode_in + 1
+	ldx #<(gcr_decode_buffer - 1)
+	stx gcr_decode_out
+	inx
+	stx gcr_decode_in
+
+decode_group_loop:
+	jsr decode_gcr_group
+
+	lda gcr_decode_out
+	clc
+	adc #$04
+	sta gcr_decode_out
+	bcc no_out_carry
+	inc gcr_decode_out + 1
+no_out_carry:
+	cmp #$ff			; Behind the buffer: only the last content byte and the
+	bne no_last_group		; checksum are left, don't overwrite what follows.
+	lda #<gcr_decode_last_group
+	sta gcr_decode_out
+	dec gcr_decode_out + 1
+no_last_group:
+
+	lda gcr_decode_in		; Neither part of the input crosses a page.
+	clc
+	adc #$05
+	sta gcr_decode_in
+	cmp #$ff			; End of the buffer or of the aux space.
+	bne decode_group_loop
+	ldx gcr_decode_in + 1
+	dex				; In the aux space already?
+	beq decode_done
+	lda #<gcr_decode_aux_start
+	sta gcr_decode_in
+	lda #>gcr_decode_aux_start
+	sta gcr_decode_in + 1
+	bne decode_group_loop		; Always taken.
+
+decode_done:
+	lda gcr_decode_buffer - 1
+	sta data_block_signature_byte
+	lda gcr_decode_last_group
+	sta gcr_decode_buffer + $ff
+	lda gcr_decode_last_group + 1
+	sta sector_data_checksum
+	rts
+
+	; Decode the 5 GCR bytes at (gcr_decode_in) to 4 bytes at (gcr_decode_out).
+	; Nibbles are located as follows:
+	; 00000111 11222223 33334444 45555566 66677777
+decode_gcr_group:
+	ldy #$04
+load_group_loop:
+	lda (gcr_decode_in), y
+	sta gcr_decode_bytes, y
+	dey
+	bpl load_group_loop
+
+	lda gcr_decode_bytes + 0	; Nibble 0.
+	lsr
+	lsr
+	lsr
+	tax
+	lda gcr_nibble, x
+	and #$f0
+	sta gcr_decode_tmp0
+	lda gcr_decode_bytes + 1	; Shift the top of nibble 1 into byte 0.
+	asl
+	rol gcr_decode_bytes + 0
+	asl
+	rol gcr_decode_bytes + 0
+	lsr				; Nibble 2.
+	lsr
+	lsr
+	tax
+	lda gcr_nibble, x
+	and #$f0
+	sta gcr_decode_tmp1
+	lda gcr_decode_bytes + 0	; Nibble 1.
+	and #$1f
+	tax
+	lda gcr_nibble, x
+	and #$0f
+	ora gcr_decode_tmp0
+	iny				; $ff after the load loop.
+	sta (gcr_decode_out), y
+
+	lda gcr_decode_bytes + 2	; Nibble 3.
+	lsr gcr_decode_bytes + 1
+	ror
+	lsr
+	lsr
+	lsr
+	tax
+	lda gcr_nibble, x
+	and #$0f
+	ora gcr_decode_tmp1
+	iny
+	sta (gcr_decode_out), y
+
+	lda gcr_decode_bytes + 3	; Nibble 4.
+	asl
+	lda gcr_decode_bytes + 2
+	rol
+	and #$1f
+	tax
+	lda gcr_nibble, x
+	and #$f0
+	sta gcr_decode_tmp0
+	lda gcr_decode_bytes + 3	; Nibble 5.
+	lsr
+	lsr
+	and #$1f
+	tax
+	lda gcr_nibble, x
+	and #$0f
+	ora gcr_decode_tmp0
+	iny
+	sta (gcr_decode_out), y
+
+	lda gcr_decode_bytes + 4	; Shift the top of nibble 7 into byte 3.
+	asl
+	rol gcr_decode_bytes + 3
+	asl
+	rol gcr_decode_bytes + 3
+	asl
+	rol gcr_decode_bytes + 3
+	lsr				; Nibble 7.
+	lsr
+	lsr
+	tax
+	lda gcr_nibble, x
+	and #$0f
+	sta gcr_decode_tmp0
+	lda gcr_decode_bytes + 3	; Nibble 6.
+	and #$1f
+	tax
+	lda gcr_nibble, x
+	and #$f0
+	ora gcr_decode_tmp0
+	iny
+	sta (gcr_decode_out), y
+	rts
+
+	; GCR quintuple to nibble, in both the high and the low half of each entry. Only codes
+	; $09-$1e are valid, so the table starts there and invalid codes decode to garbage.
+gcr_nibble = * - $09
+	!8 $88, $00, $11, $00, $cc, $44, $55
+	!8 $00, $00, $22, $33, $00, $ff, $66, $77
+	!8 $00, $99, $aa, $bb, $00, $dd, $ee
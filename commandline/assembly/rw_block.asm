@@ -34,8 +34,10 @@ ok:
 read_or_write_block_job:
 	; Figure out whether to read or write (offset 7 after M-E<mem_lo><mem_hi><track><sector>).
 	lda input_buffer + 0x07
-	beq read_sector 	; Zero: Read sector, write sector otherwise.
+	bne write_sector 	; Zero: Read sector, write sector otherwise.
+	jmp read_sector
 
+write_sector:
 	; We're writing.
 
 	; We started in the wrong buffer. Change to the buffer whose data should be written.
@@ -44,9 +46,6 @@ read_or_write_block_job:
 	lda #>block_write_data_buffer_start
 	sta current_buffer_start_high
 	
-	jsr format_calculate_checksum	
-	sta sector_data_checksum
-
 	lda via2_drive_port
 	and #via2_drive_port_write_protect_bit
 	bne disc_is_writable
@@ -55,7 +54,16 @@ read_or_write_block_job:
 	jmp dc_end_job_loop_with_status
 
 disc_is_writable:
+	; One: Write the buffer's content. Two: The host already GCR encoded the
+	; data block, the first 69 bytes are in aux space and the rest in the buffer.
+	lda input_buffer + 0x07
+	lsr
+	bcc content_is_gcr
+
+	jsr format_calculate_checksum	
+	sta sector_data_checksum
 	jsr format_convert_content_to_gcr
+content_is_gcr:
 	jsr dc_search_block_header
 
 	ldx #$09
@@ -112,8 +120,12 @@ wait_last_content_byte_loop:
 	lda #via2_drive_direction_read
 	sta via2_drive_direction
 
+	lda input_buffer + 0x07	; Only convert back what we encoded ourselves.
+	lsr
+	bcc write_successful
 	jsr format_convert_gcr_to_binary
 
+write_successful:
 	; TODO(aeckleder): Should we verify what was written here?
 
 	lda #$01
@@ -146,6 +158,13 @@ read_content_aux_loop:
 	iny
 	bne read_content_aux_loop ; Read another 70 bytes into aux space.
 
+	; Decoding after the fact costs 22884 cycles plus 2569 for the checksum, roughly
+	; an eighth of a revolution. Decoding on the fly within the 26 cycles per byte of zone 1
+	; would need several 256 byte lookup tables, which don't fit next to the DOS buffers we
+	; keep allocated. The table driven decoder in gcr_decode.asm takes 22854 cycles, about
+	; 350 per group of 5 GCR bytes, which pass under the head in 130 to 160 cycles. So we
+	; stick with the ROM routine, see TableGCRDecodeTimingTest in drive_emulator_test.cc.
+	; The IEC transfer dominates per sector anyway.
 	jsr read_convert_gcr_to_binary
 
 	lda data_block_signature_byte
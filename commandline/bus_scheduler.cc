@@ -0,0 +1,244 @@
+#include "bus_scheduler.h"
+
+namespace {
+// A connection forwarding every request to the scheduler.
+class ScheduledConnection : public IECBusConnection {
+public:
+  ScheduledConnection(IECBusScheduler *scheduler,
+                      IECBusScheduler::Priority priority)
+      : IECBusConnection(-1, nullptr), scheduler_(scheduler),
+        priority_(priority) {}
+
+  bool Reset(IECStatus *status) override {
+    // Resetting affects all devices, it doesn't belong to any of them.
+    return scheduler_->Run(
+        0, priority_,
+        [](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->Reset(bus_status);
+        },
+        status);
+  }
+
+  bool OpenChannel(char device_number, char channel,
+                   const std::string &data_string,
+                   IECStatus *status) override {
+    return scheduler_->Run(
+        device_number, priority_,
+        [&](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->OpenChannel(device_number, channel, data_string,
+                                  bus_status);
+        },
+        status);
+  }
+
+  bool ReadFromChannel(char device_number, char channel, std::string *result,
+                       IECStatus *status) override {
+    return scheduler_->Run(
+        device_number, priority_,
+        [&](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->ReadFromChannel(device_number, channel, result,
+                                      bus_status);
+        },
+        status);
+  }
+
+  bool WriteToChannel(char device_number, char channel,
+                      const std::string &data_string,
+                      IECStatus *status) override {
+    return scheduler_->Run(
+        device_number, priority_,
+        [&](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->WriteToChannel(device_number, channel, data_string,
+                                     bus_status);
+        },
+        status);
+  }
+
+  bool CloseChannel(char device_number, char channel,
+                    IECStatus *status) override {
+    return scheduler_->Run(
+        device_number, priority_,
+        [&](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->CloseChannel(device_number, channel, bus_status);
+        },
+        status);
+  }
+
+  // The asynchronous requests run the blocking ones on the scheduler's
+  // thread, done is called there as well.
+  void OpenChannelAsync(char device_number, char channel,
+                        const std::string &data_string,
+                        Callback done) override {
+    scheduler_->SubmitAsync(
+        device_number, priority_,
+        [=](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->OpenChannel(device_number, channel, data_string,
+                                  bus_status);
+        },
+        [done](const IECStatus &status) { done(status, std::string()); });
+  }
+
+  void ReadFromChannelAsync(char device_number, char channel,
+                            Callback done) override {
+    auto result = std::make_shared<std::string>();
+    scheduler_->SubmitAsync(
+        device_number, priority_,
+        [=](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->ReadFromChannel(device_number, channel, result.get(),
+                                      bus_status);
+        },
+        [done, result](const IECStatus &status) { done(status, *result); });
+  }
+
+  void WriteToChannelAsync(char device_number, char channel,
+                           const std::string &data_string,
+                           Callback done) override {
+    scheduler_->SubmitAsync(
+        device_number, priority_,
+        [=](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->WriteToChannel(device_number, channel, data_string,
+                                     bus_status);
+        },
+        [done](const IECStatus &status) { done(status, std::string()); });
+  }
+
+  void CloseChannelAsync(char device_number, char channel,
+                         Callback done) override {
+    scheduler_->SubmitAsync(
+        device_number, priority_,
+        [=](IECBusConnection *bus, IECStatus *bus_status) {
+          return bus->CloseChannel(device_number, channel, bus_status);
+        },
+        [done](const IECStatus &status) { done(status, std::string()); });
+  }
+
+private:
+  IECBusScheduler *scheduler_;
+  IECBusScheduler::Priority priority_;
+};
+} // namespace
+
+IECBusScheduler::IECBusScheduler(IECBusConnection *bus, int max_batch)
+    : bus_(bus), max_batch_(max_batch) {
+  worker_ = std::thread([this]() { Serve(); });
+}
+
+IECBusScheduler::~IECBusScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queued_.notify_one();
+  worker_.join();
+
+  // Nothing gets queued anymore, see Queue().
+  IECStatus status;
+  SetError(IECStatus::CONNECTION_FAILURE, "Scheduler shut down", &status);
+  for (auto &queues : queues_) {
+    for (auto &queue : queues) {
+      for (auto &request : queue.second) {
+        Finish(&request, false, status);
+      }
+    }
+  }
+}
+
+std::future<std::pair<bool, IECStatus>>
+IECBusScheduler::Submit(char device_number, Priority priority, Work work) {
+  Request request;
+  request.work = std::move(work);
+  auto result = request.result.get_future();
+  Queue(device_number, priority, std::move(request));
+  return result;
+}
+
+void IECBusScheduler::SubmitAsync(char device_number, Priority priority,
+                                  Work work, Done done) {
+  Request request;
+  request.work = std::move(work);
+  request.done = std::move(done);
+  Queue(device_number, priority, std::move(request));
+}
+
+bool IECBusScheduler::Run(char device_number, Priority priority,
+                          const Work &work, IECStatus *status) {
+  auto result = Submit(device_number, priority, work).get();
+  *status = result.second;
+  return result.first;
+}
+
+void IECBusScheduler::Queue(char device_number, Priority priority,
+                            Request request) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!stopping_) {
+      queues_[priority][device_number].push_back(std::move(request));
+      ++num_queued_;
+      queued_.notify_one();
+      return;
+    }
+  }
+  // E.g. made from done while shutting down.
+  IECStatus status;
+  SetError(IECStatus::CONNECTION_FAILURE, "Scheduler shut down", &status);
+  Finish(&request, false, status);
+}
+
+void IECBusScheduler::Finish(Request *request, bool success,
+                             const IECStatus &status) {
+  if (request->done) {
+    request->done(status);
+  } else {
+    request->result.set_value(std::make_pair(success, status));
+  }
+}
+
+std::unique_ptr<IECBusConnection>
+IECBusScheduler::CreateClient(Priority priority) {
+  return std::make_unique<ScheduledConnection>(this, priority);
+}
+
+void IECBusScheduler::Serve() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_.wait(lock, [this]() { return stopping_ || num_queued_ > 0; });
+    if (stopping_) {
+      return;
+    }
+    Request request = NextRequest();
+    lock.unlock();
+    IECStatus status;
+    bool success = request.work(bus_, &status);
+    Finish(&request, success, status);
+    lock.lock();
+  }
+}
+
+IECBusScheduler::Request IECBusScheduler::NextRequest() {
+  for (auto &queues : queues_) {
+    if (queues.empty()) {
+      continue;
+    }
+    auto device = queues.find(last_device_);
+    if (device == queues.end() || batch_size_ >= max_batch_) {
+      // Next device in round robin order. Falls back to the last one if no
+      // other device is waiting.
+      device = queues.upper_bound(last_device_);
+      if (device == queues.end()) {
+        device = queues.begin();
+      }
+    }
+    batch_size_ = device->first == last_device_ ? batch_size_ + 1 : 1;
+    last_device_ = device->first;
+
+    Request request = std::move(device->second.front());
+    device->second.pop_front();
+    if (device->second.empty()) {
+      queues.erase(device);
+    }
+    --num_queued_;
+    return request;
+  }
+  // Not reached, callers make sure something is queued.
+  return Request();
+}
@@ -0,0 +1,113 @@
+// Sharing a single IECBusConnection between threads, e.g. to drive several
+// CBM1541Drive instances on the same bus in parallel.
+
+#ifndef BUS_SCHEDULER_H
+#define BUS_SCHEDULER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "iec_host_lib.h"
+#include "utils.h"
+
+// IECBusScheduler owns the only thread talking to the underlying connection.
+// Requests are queued per device and priority. Interactive requests run ahead
+// of bulk ones. Within a priority, requests for the device served last run
+// back to back, up to a limit, before the other devices get their turn in
+// round robin order.
+class IECBusScheduler {
+public:
+  enum Priority {
+    INTERACTIVE, // e.g. status queries, a user is waiting for them.
+    BULK,        // e.g. sector traffic.
+    kNumPriorities,
+  };
+
+  // A unit of work run with exclusive access to the bus. Returns true if
+  // successful, sets status otherwise.
+  typedef std::function<bool(IECBusConnection *bus, IECStatus *status)> Work;
+
+  // Called with the outcome of work submitted with SubmitAsync(), on the
+  // scheduler's thread. It must not wait for other scheduled requests.
+  typedef std::function<void(const IECStatus &status)> Done;
+
+  // Default number of requests for one device run back to back while other
+  // devices are waiting.
+  static const int kDefaultMaxBatch = 8;
+
+  // Schedule requests to bus. Ownership is not transferred, bus must outlive
+  // the scheduler.
+  explicit IECBusScheduler(IECBusConnection *bus,
+                           int max_batch = kDefaultMaxBatch);
+
+  // Requests still queued, or made while shutting down, fail with
+  // CONNECTION_FAILURE.
+  ~IECBusScheduler();
+
+  // Queue work for device_number. The future is fulfilled with the result and
+  // status once it ran. Can be called from any thread.
+  std::future<std::pair<bool, IECStatus>>
+  Submit(char device_number, Priority priority, Work work);
+
+  // Queue work for device_number and call done once it ran. Can be called
+  // from any thread, including from done.
+  void SubmitAsync(char device_number, Priority priority, Work work,
+                   Done done);
+
+  // Queue work and wait for it. Returns true if successful, sets status
+  // otherwise.
+  bool Run(char device_number, Priority priority, const Work &work,
+           IECStatus *status);
+
+  // Create a connection whose requests are all scheduled with priority, to be
+  // handed to e.g. a CBM1541Drive. Ownership is transferred to the caller,
+  // the connection must not outlive the scheduler. The usual rule of a
+  // device being managed by only one client at a time still applies,
+  // requests of different clients for the same device may interleave.
+  std::unique_ptr<IECBusConnection> CreateClient(Priority priority);
+
+private:
+  struct Request {
+    Work work;
+    // Where the outcome goes: done if set, result otherwise.
+    Done done;
+    std::promise<std::pair<bool, IECStatus>> result;
+  };
+
+  // Queue request for device_number.
+  void Queue(char device_number, Priority priority, Request request);
+
+  // Pass the outcome of request on.
+  static void Finish(Request *request, bool success, const IECStatus &status);
+
+  // Run on worker_, serving requests until stopping_ is set.
+  void Serve();
+
+  // Remove the request to serve next from the queues and return it. Must be
+  // called with mutex_ held and at least one request queued.
+  Request NextRequest();
+
+  IECBusConnection *bus_;
+  const int max_batch_;
+
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  // Queued requests by priority and device number.
+  std::map<char, std::deque<Request>> queues_[kNumPriorities];
+  size_t num_queued_ = 0;
+  // The device served last and how many of its requests ran in a row.
+  char last_device_ = 0;
+  int batch_size_ = 0;
+  bool stopping_ = false;
+
+  std::thread worker_;
+};
+
+#endif // BUS_SCHEDULER_H
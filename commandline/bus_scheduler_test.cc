@@ -0,0 +1,179 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bus_scheduler.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::ElementsAre;
+
+// Answers reads with the device number and channel, and counts requests
+// running at the same time.
+class FakeIECBusConnection : public IECBusConnection {
+public:
+  FakeIECBusConnection() : IECBusConnection(-1, nullptr) {}
+
+  bool ReadFromChannel(char device_number, char channel, std::string *result,
+                       IECStatus *status) override {
+    if (++running_ > 1) {
+      overlapped_ = true;
+    }
+    std::this_thread::yield();
+    *result = std::to_string(device_number) + ":" + std::to_string(channel);
+    --running_;
+    return true;
+  }
+
+  bool CloseChannel(char device_number, char channel,
+                    IECStatus *status) override {
+    SetError(IECStatus::DRIVE_ERROR, "not open", status);
+    return false;
+  }
+
+  std::atomic<int> running_{0};
+  std::atomic<bool> overlapped_{false};
+};
+
+class IECBusSchedulerTest : public ::testing::Test {
+protected:
+  // Keep the scheduler busy until Release() is called, so that requests
+  // queue up.
+  void Block(IECBusScheduler *scheduler) {
+    auto gate = gate_.get_future().share();
+    blocked_ = scheduler->Submit(
+        0, IECBusScheduler::INTERACTIVE,
+        [gate](IECBusConnection *, IECStatus *) {
+          gate.wait();
+          return true;
+        });
+  }
+
+  void Release() {
+    gate_.set_value();
+    blocked_.get();
+  }
+
+  // Queue work recording device_number in served_ when it runs.
+  void Queue(IECBusScheduler *scheduler, char device_number,
+             IECBusScheduler::Priority priority) {
+    results_.push_back(scheduler->Submit(
+        device_number, priority,
+        [this, device_number](IECBusConnection *, IECStatus *) {
+          served_.push_back(device_number);
+          return true;
+        }));
+  }
+
+  void WaitForAll() {
+    for (auto &result : results_) {
+      EXPECT_TRUE(result.get().first);
+    }
+  }
+
+  FakeIECBusConnection bus_;
+  std::promise<void> gate_;
+  std::future<std::pair<bool, IECStatus>> blocked_;
+  std::vector<std::future<std::pair<bool, IECStatus>>> results_;
+  std::vector<int> served_;
+};
+
+TEST_F(IECBusSchedulerTest, SerializesClientsOnThreads) {
+  IECBusScheduler scheduler(&bus_);
+  std::vector<std::thread> threads;
+  for (char device = 8; device < 12; ++device) {
+    threads.emplace_back([&scheduler, device]() {
+      auto client = scheduler.CreateClient(IECBusScheduler::BULK);
+      for (int i = 0; i < 50; ++i) {
+        std::string result;
+        IECStatus status;
+        ASSERT_TRUE(client->ReadFromChannel(device, 2, &result, &status));
+        ASSERT_EQ(result, std::to_string(device) + ":2");
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_FALSE(bus_.overlapped_);
+
+  // Errors are passed back to the client.
+  auto client = scheduler.CreateClient(IECBusScheduler::INTERACTIVE);
+  IECStatus status;
+  EXPECT_FALSE(client->CloseChannel(8, 2, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+}
+
+TEST_F(IECBusSchedulerTest, ClientsMakeAsyncRequests) {
+  IECBusScheduler scheduler(&bus_);
+  auto client = scheduler.CreateClient(IECBusScheduler::BULK);
+  std::promise<std::string> read;
+  std::promise<IECStatus> closed;
+  // Further requests can be made from the callback.
+  client->ReadFromChannelAsync(
+      8, 2, [&](const IECStatus &status, const std::string &result) {
+        EXPECT_TRUE(status.ok());
+        client->CloseChannelAsync(
+            8, 2, [&closed](const IECStatus &status, const std::string &) {
+              closed.set_value(status);
+            });
+        read.set_value(result);
+      });
+  EXPECT_EQ(read.get_future().get(), "8:2");
+  EXPECT_EQ(closed.get_future().get().status_code, IECStatus::DRIVE_ERROR);
+}
+
+TEST_F(IECBusSchedulerTest, RunsInteractiveRequestsFirst) {
+  IECBusScheduler scheduler(&bus_);
+  Block(&scheduler);
+  Queue(&scheduler, 8, IECBusScheduler::BULK);
+  Queue(&scheduler, 8, IECBusScheduler::BULK);
+  Queue(&scheduler, 9, IECBusScheduler::INTERACTIVE);
+  Release();
+  WaitForAll();
+  EXPECT_THAT(served_, ElementsAre(9, 8, 8));
+}
+
+TEST_F(IECBusSchedulerTest, BatchesRequestsPerDeviceFairly) {
+  IECBusScheduler scheduler(&bus_, 2);
+  Block(&scheduler);
+  for (int i = 0; i < 3; ++i) {
+    Queue(&scheduler, 9, IECBusScheduler::BULK);
+    Queue(&scheduler, 8, IECBusScheduler::BULK);
+    Queue(&scheduler, 10, IECBusScheduler::BULK);
+  }
+  Release();
+  WaitForAll();
+  EXPECT_THAT(served_, ElementsAre(8, 8, 9, 9, 10, 10, 8, 9, 10));
+}
+
+TEST_F(IECBusSchedulerTest, FailsRequestsQueuedAtShutdown) {
+  std::future<std::pair<bool, IECStatus>> pending;
+  IECStatus pending_async;
+  std::thread release;
+  {
+    IECBusScheduler scheduler(&bus_);
+    Block(&scheduler);
+    pending = scheduler.Submit(
+        8, IECBusScheduler::BULK,
+        [](IECBusConnection *, IECStatus *) { return true; });
+    scheduler.SubmitAsync(
+        9, IECBusScheduler::BULK,
+        [](IECBusConnection *, IECStatus *) { return true; },
+        [&pending_async](const IECStatus &status) { pending_async = status; });
+    // Let the destructor find the request still queued.
+    release = std::thread([this]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      gate_.set_value();
+    });
+  }
+  release.join();
+  auto result = pending.get();
+  EXPECT_FALSE(result.first);
+  EXPECT_EQ(result.second.status_code, IECStatus::CONNECTION_FAILURE);
+  EXPECT_EQ(pending_async.status_code, IECStatus::CONNECTION_FAILURE);
+}
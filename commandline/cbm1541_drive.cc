@@ -2,9 +2,13 @@
 
 #include "cbm1541_drive.h"
 
+#include <atomic>
+#include <memory>
+
 #include "assembly/format_h.h"
 #include "assembly/rw_block_h.h"
 #include "boost/format.hpp"
+#include "gcr.h"
 
 // Logical OK response.
 static const char kOKResponse[] = "00, OK,00,00\r";
@@ -16,12 +20,22 @@ static const size_t kMaxMWSize = 35;
 static const size_t kReadWriteBlockEntryPoint = 0x503;
 
 // The third parameter to the read/write job. If zero, read. If non-zero, write.
+// When writing a GCR encoded block, the drive skips its own encoding.
 static const size_t kReadBlockOption = 0x00;
 static const size_t kWriteBlockOption = 0x01;
+static const size_t kWriteGCRBlockOption = 0x02;
+
+// A GCR encoded data block doesn't fit into a buffer. Like the drive's own
+// encoder, we put the first kNumGCRAuxBytes bytes into the auxiliary space.
+static const unsigned short int kGCRAuxBufferStart = 0x1bb;
+static const size_t kNumGCRAuxBytes = 69;
 
 // We skip the first three bytes, because they're a jmp into the format job.
 static const size_t kFormatEntryPoint = 0x503;
 
+// Disc ID used when formatting the entire disc.
+static const char kDefaultDiscId[] = "AE";
+
 static const size_t kNumBytesPerSector = 0x100;
 
 // The direct access channels to use.
@@ -32,6 +46,40 @@ static const int kReadDirectAccessChannel = 3;
 // the hardware.
 static const int kMaxTrackNumber = 41;
 
+// Returns the M-E command running the read/write job on track and sector.
+static std::string ReadWriteBlockRequest(unsigned int track,
+                                         unsigned int sector, size_t option) {
+  std::string request = "M-E";
+  request.append(1, char(kReadWriteBlockEntryPoint & 0xff));
+  request.append(1, char(kReadWriteBlockEntryPoint >> 8));
+  request.append(1, char(track));
+  request.append(1, char(sector));
+  request.append(1, char(option));
+  return request;
+}
+
+// Returns the M-W commands writing num_bytes from source to target_address.
+static std::vector<std::string>
+MemoryWriteRequests(unsigned short int target_address, size_t num_bytes,
+                    const unsigned char *source) {
+  std::vector<std::string> requests;
+  size_t bytes_written = 0;
+  while (num_bytes - bytes_written > 0) {
+    std::string request = "M-W";
+    unsigned short int mem_pos = target_address + bytes_written;
+    request.append(1, mem_pos & 0xff);
+    request.append(1, mem_pos >> 8);
+    size_t num_data_bytes = std::min(kMaxMWSize, num_bytes - bytes_written);
+    request.append(1, num_data_bytes);
+    for (size_t i = 0; i < num_data_bytes; ++i) {
+      request.append(1, source[bytes_written + i]);
+    }
+    requests.push_back(request);
+    bytes_written += num_data_bytes;
+  }
+  return requests;
+}
+
 const std::map<CBM1541Drive::FirmwareState,
                CBM1541Drive::CustomFirmwareFragment>
     CBM1541Drive::fw_fragment_map_ = {
@@ -43,34 +91,46 @@ CBM1541Drive::CBM1541Drive(IECBusConnection *bus_conn, char device_number)
     : bus_conn_(bus_conn), device_number_(device_number),
       fw_state_(FW_NO_CUSTOM_CODE) {}
 
-CBM1541Drive::~CBM1541Drive() {
-  // Close direct access channels that have been initialized.
-  // Ignore the result of this operation. It shouldn't fail, but if it
-  // does, there's nothing we can (and should) beyond destroying ourselves.
-  // TODO(aeckleder): Log any error that occurs here.
-  if (write_da_chan_ != -1) {
-    IECStatus status;
-    bus_conn_->CloseChannel(device_number_, write_da_chan_, &status);
-    write_da_chan_ = -1;
-  }
-  if (read_da_chan_ != -1) {
-    IECStatus status;
-    bus_conn_->CloseChannel(device_number_, read_da_chan_, &status);
-    read_da_chan_ = -1;
-  }
-}
+CBM1541Drive::~CBM1541Drive() { CloseDirectAccessChannels(); }
 
 bool CBM1541Drive::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
+  return FormatTracks(1, num_tracks, kDefaultDiscId, status);
+}
+
+bool CBM1541Drive::FormatTracks(unsigned int first_track,
+                                unsigned int last_track,
+                                const std::string &disc_id,
+                                IECStatus *status) {
+  if (first_track < 1 || first_track > last_track ||
+      last_track > kMaxTrackNumber) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to format tracks %u to %u") %
+              first_track % last_track)
+                 .str(),
+             status);
+    return false;
+  }
+  if (disc_id.size() != 2) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("disc_id.size(%u) != 2") % disc_id.size()).str(),
+             status);
+    return false;
+  }
   if (!SetFirmwareState(FW_CUSTOM_FORMATTING_CODE, status))
     return false;
 
-  // TODO(aeckleder): Pass num_tracks to format code.
   std::string request = "M-E";
   request.append(1, char(kFormatEntryPoint & 0xff));
   request.append(1, char(kFormatEntryPoint >> 8));
+  request.append(1, char(first_track));
+  request.append(1, char(last_track + 1));
+  request.append(disc_id);
   if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
     return false;
   }
+  // The format code closes all channels.
+  ResetDirectAccessChannels();
+
   // Get the result for the disc format.
   std::string response;
   if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
@@ -83,6 +143,36 @@ bool CBM1541Drive::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
   return true;
 }
 
+bool CBM1541Drive::FormatDiscQuick(const std::string &disc_name,
+                                   IECStatus *status) {
+  // Without an ID, the drive's NEW command only writes BAM and directory.
+  // A comma would start one.
+  if (disc_name.find(',') != std::string::npos) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("disc_name(%s) contains ','") % disc_name).str(),
+             status);
+    return false;
+  }
+  // It needs buffers for that, so give ours back and don't rely on any
+  // custom code surviving it.
+  CloseDirectAccessChannels();
+  fw_state_ = FW_NO_CUSTOM_CODE;
+
+  if (!bus_conn_->WriteToChannel(device_number_, 15, "N0:" + disc_name,
+                                 status)) {
+    return false;
+  }
+  std::string response;
+  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    return false;
+  }
+  if (response != kOKResponse) {
+    SetError(IECStatus::DRIVE_ERROR, response, status);
+    return false;
+  }
+  return true;
+}
+
 bool CBM1541Drive::GetNumSectors(size_t *num_sectors, IECStatus *status) {
   // Hardcoded 35 tracks disc.
   // TODO(aeckleder): 40 track discs have 768 blocks.
@@ -112,12 +202,7 @@ bool CBM1541Drive::ReadSector(size_t sector_number, std::string *content,
     return false;
 
   // Read from disc.
-  std::string request = "M-E";
-  request.append(1, char(kReadWriteBlockEntryPoint & 0xff));
-  request.append(1, char(kReadWriteBlockEntryPoint >> 8));
-  request.append(1, char(track));
-  request.append(1, char(sector));
-  request.append(1, char(kReadBlockOption));
+  std::string request = ReadWriteBlockRequest(track, sector, kReadBlockOption);
   if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
     return false;
   }
@@ -182,12 +267,95 @@ bool CBM1541Drive::WriteSector(size_t sector_number, const std::string &content,
   }
 
   // Write the buffer to disc.
-  std::string request = "M-E";
-  request.append(1, char(kReadWriteBlockEntryPoint & 0xff));
-  request.append(1, char(kReadWriteBlockEntryPoint >> 8));
-  request.append(1, char(track));
-  request.append(1, char(sector));
-  request.append(1, char(kWriteBlockOption));
+  std::string request = ReadWriteBlockRequest(track, sector, kWriteBlockOption);
+  if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
+    return false;
+  }
+
+  // Get the result for the write command.
+  std::string response;
+  if (!bus_conn_->ReadFromChannel(device_number_, 15, &response, status)) {
+    return false;
+  }
+  if (response != kOKResponse) {
+    SetError(IECStatus::DRIVE_ERROR, response, status);
+    return false;
+  }
+  return true;
+}
+
+bool CBM1541Drive::WriteTrack(unsigned int track,
+                              const std::vector<std::string> &content,
+                              IECStatus *status) {
+  if (content.size() != GetNumSectorsOnTrack(track)) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("content.size(%u) != number of sectors on track "
+                            "%u (%u)") %
+              content.size() % track % GetNumSectorsOnTrack(track))
+                 .str(),
+             status);
+    return false;
+  }
+  for (unsigned int sector = 0; sector < content.size(); ++sector) {
+    if (content[sector].size() != kNumBytesPerSector) {
+      SetError(
+          IECStatus::INVALID_ARGUMENT,
+          (boost::format("content[%u].size(%u) != kNumBytesPerSector(%u)") %
+           sector % content[sector].size() % kNumBytesPerSector)
+              .str(),
+          status);
+      return false;
+    }
+  }
+  for (unsigned int sector = 0; sector < content.size(); ++sector) {
+    if (!WriteGCRDataBlock(track, sector, EncodeDataBlock(content[sector]),
+                           status)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool CBM1541Drive::WriteGCRDataBlock(unsigned int track, unsigned int sector,
+                                     const std::string &gcr_block,
+                                     IECStatus *status) {
+  if (gcr_block.size() != kNumGCRDataBlockBytes) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("gcr_block.size(%u) != kNumGCRDataBlockBytes(%u)") %
+              gcr_block.size() % kNumGCRDataBlockBytes)
+                 .str(),
+             status);
+    return false;
+  }
+  if (track < 1 || track > kMaxTrackNumber ||
+      sector >= GetNumSectorsOnTrack(track)) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to write to track %u, sector %u") %
+              track % sector)
+                 .str(),
+             status);
+    return false;
+  }
+
+  if (!SetFirmwareState(FW_CUSTOM_READ_WRITE_CODE, status))
+    return false;
+  if (!InitDirectAccessChannel(status))
+    return false;
+
+  // The start of the block goes to the auxiliary space, the rest to the buffer.
+  if (!WriteMemory(
+          kGCRAuxBufferStart, kNumGCRAuxBytes,
+          reinterpret_cast<const unsigned char *>(gcr_block.data()), status)) {
+    return false;
+  }
+  if (!bus_conn_->WriteToChannel(device_number_, write_da_chan_,
+                                 gcr_block.substr(kNumGCRAuxBytes), status)) {
+    return false;
+  }
+
+  // Write the block to disc.
+  std::string request =
+      ReadWriteBlockRequest(track, sector, kWriteGCRBlockOption);
   if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
     return false;
   }
@@ -204,6 +372,102 @@ bool CBM1541Drive::WriteSector(size_t sector_number, const std::string &content,
   return true;
 }
 
+void CBM1541Drive::ReadSectorAsync(size_t sector_number,
+                                   IECBusConnection::Callback done) {
+  unsigned int track = 1;
+  unsigned int sector = 0;
+  GetTrackSector(sector_number, &track, &sector);
+  if (track > kMaxTrackNumber) {
+    IECStatus status;
+    SetError(
+        IECStatus::INVALID_ARGUMENT,
+        (boost::format("not trying to read from track %u as it might cause "
+                       "hardware damage") %
+         track)
+            .str(),
+        &status);
+    done(status, std::string());
+    return;
+  }
+
+  RunExclusive(
+      [this, track, sector](IECBusConnection::Callback operation_done) {
+        auto content = std::make_shared<std::string>();
+        std::vector<IECAsyncStep> steps;
+        AppendPrepareSteps(&steps);
+        steps.push_back(CommandStep(
+            ReadWriteBlockRequest(track, sector, kReadBlockOption)));
+        // Reposition buffer pointer, see ReadSector().
+        steps.push_back(CommandStep(
+            (boost::format("B-P:%u 0") % kReadDirectAccessChannel).str()));
+        steps.push_back([this, content](IECBusConnection::Callback step_done) {
+          bus_conn_->ReadFromChannelAsync(
+              device_number_, kReadDirectAccessChannel,
+              [content, step_done](const IECStatus &status,
+                                   const std::string &result) {
+                *content = result;
+                step_done(status, result);
+              });
+        });
+        steps.push_back(StatusStep());
+        RunAsyncSteps(std::move(steps),
+                      [content, operation_done](const IECStatus &status,
+                                                const std::string &) {
+                        operation_done(status, status.ok() ? *content
+                                                           : std::string());
+                      });
+      },
+      std::move(done));
+}
+
+void CBM1541Drive::WriteSectorAsync(size_t sector_number,
+                                    const std::string &content,
+                                    IECBusConnection::Callback done) {
+  IECStatus status;
+  if (content.size() != kNumBytesPerSector) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("content.size(%u) != kNumBytesPerSector(%u)") %
+              content.size() % kNumBytesPerSector)
+                 .str(),
+             &status);
+    done(status, std::string());
+    return;
+  }
+  unsigned int track = 1;
+  unsigned int sector = 0;
+  GetTrackSector(sector_number, &track, &sector);
+  if (track > kMaxTrackNumber) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("not trying to write to track %u as it might cause "
+                            "hardware damage") %
+              track)
+                 .str(),
+             &status);
+    done(status, std::string());
+    return;
+  }
+
+  RunExclusive(
+      [this, track, sector,
+       content](IECBusConnection::Callback operation_done) {
+        std::vector<IECAsyncStep> steps;
+        AppendPrepareSteps(&steps);
+        steps.push_back([this, content](IECBusConnection::Callback step_done) {
+          bus_conn_->WriteToChannelAsync(
+              device_number_, kWriteDirectAccessChannel, content, step_done);
+        });
+        steps.push_back(CommandStep(
+            ReadWriteBlockRequest(track, sector, kWriteBlockOption)));
+        steps.push_back(StatusStep());
+        RunAsyncSteps(std::move(steps),
+                      [operation_done](const IECStatus &status,
+                                       const std::string &) {
+                        operation_done(status, std::string());
+                      });
+      },
+      std::move(done));
+}
+
 bool CBM1541Drive::ReadCommandChannel(std::string *response,
                                       IECStatus *status) {
   // Accessing the command channel is always ok, no open call necessary.
@@ -238,6 +502,16 @@ void CBM1541Drive::GetTrackSector(unsigned int s, unsigned int *track,
   *sector = *sector % 21;
 }
 
+unsigned int CBM1541Drive::GetNumSectorsOnTrack(unsigned int track) {
+  if (track >= 31)
+    return 17;
+  if (track >= 25)
+    return 18;
+  if (track >= 18)
+    return 19;
+  return 21;
+}
+
 bool CBM1541Drive::SetFirmwareState(CBM1541Drive::FirmwareState firmware_state,
                                     IECStatus *status) {
   // Exit early if we're already in the desired state.
@@ -256,17 +530,8 @@ bool CBM1541Drive::SetFirmwareState(CBM1541Drive::FirmwareState firmware_state,
 bool CBM1541Drive::WriteMemory(unsigned short int target_address,
                                size_t num_bytes, const unsigned char *source,
                                IECStatus *status) {
-  size_t bytes_written = 0;
-  while (num_bytes - bytes_written > 0) {
-    std::string request = "M-W";
-    unsigned short int mem_pos = target_address + bytes_written;
-    request.append(1, mem_pos & 0xff);
-    request.append(1, mem_pos >> 8);
-    size_t num_data_bytes = std::min(kMaxMWSize, num_bytes - bytes_written);
-    request.append(1, num_data_bytes);
-    for (size_t i = 0; i < num_data_bytes; ++i) {
-      request.append(1, source[bytes_written + i]);
-    }
+  for (const auto &request :
+       MemoryWriteRequests(target_address, num_bytes, source)) {
     if (!bus_conn_->WriteToChannel(device_number_, 15, request, status)) {
       return false;
     }
@@ -278,7 +543,6 @@ bool CBM1541Drive::WriteMemory(unsigned short int target_address,
       SetError(IECStatus::DRIVE_ERROR, response, status);
       return false;
     }
-    bytes_written += num_data_bytes;
   }
   return true;
 }
@@ -299,6 +563,27 @@ bool CBM1541Drive::InitDirectAccessChannel(IECStatus *status) {
   return true;
 }
 
+void CBM1541Drive::CloseDirectAccessChannels() {
+  // Close direct access channels that have been initialized.
+  // Ignore the result of this operation. It shouldn't fail, but if it
+  // does, there's nothing we can (and should) do about it.
+  // TODO(aeckleder): Log any error that occurs here.
+  if (write_da_chan_ != -1) {
+    IECStatus status;
+    bus_conn_->CloseChannel(device_number_, write_da_chan_, &status);
+  }
+  if (read_da_chan_ != -1) {
+    IECStatus status;
+    bus_conn_->CloseChannel(device_number_, read_da_chan_, &status);
+  }
+  ResetDirectAccessChannels();
+}
+
+void CBM1541Drive::ResetDirectAccessChannels() {
+  write_da_chan_ = -1;
+  read_da_chan_ = -1;
+}
+
 bool CBM1541Drive::OpenChannelWithBuffer(int channel, int buffer,
                                          IECStatus *status) {
   if (!bus_conn_->OpenChannel(device_number_, channel,
@@ -312,3 +597,116 @@ bool CBM1541Drive::OpenChannelWithBuffer(int channel, int buffer,
   }
   return true;
 }
+
+void CBM1541Drive::RunExclusive(IECAsyncStep operation,
+                                IECBusConnection::Callback done) {
+  {
+    std::lock_guard<std::mutex> lock(async_mutex_);
+    async_ops_.emplace_back(std::move(operation), std::move(done));
+    if (async_busy_) {
+      return;
+    }
+    async_busy_ = true;
+  }
+  RunNextOperation();
+}
+
+void CBM1541Drive::RunNextOperation() {
+  // Operations completing while they're started, e.g. because the connection
+  // is gone, are followed by the next one in this loop rather than from their
+  // callback, so a long queue doesn't nest one call per operation.
+  enum StartState { kStarting, kStarted, kCompletedWhileStarting };
+  while (true) {
+    std::pair<IECAsyncStep, IECBusConnection::Callback> operation;
+    {
+      std::lock_guard<std::mutex> lock(async_mutex_);
+      if (async_ops_.empty()) {
+        async_busy_ = false;
+        return;
+      }
+      operation = std::move(async_ops_.front());
+      async_ops_.pop_front();
+    }
+    // Not a member, the last callback may see us deleted.
+    auto state = std::make_shared<std::atomic<int>>(kStarting);
+    auto done = std::move(operation.second);
+    operation.first([this, done, state](const IECStatus &status,
+                                        const std::string &result) {
+      // Tell the caller about this operation before the next one starts. If
+      // it was the last one, we're idle before the caller hears about it,
+      // which allows it to delete us then.
+      bool more;
+      {
+        std::lock_guard<std::mutex> lock(async_mutex_);
+        more = !async_ops_.empty();
+        if (!more) {
+          async_busy_ = false;
+        }
+      }
+      done(status, result);
+      if (more && state->exchange(kCompletedWhileStarting) == kStarted) {
+        RunNextOperation();
+      }
+    });
+    if (state->exchange(kStarted) != kCompletedWhileStarting) {
+      // The callback runs the next operation, if there is one, and may have
+      // been the last to use us.
+      return;
+    }
+  }
+}
+
+IECAsyncStep CBM1541Drive::CommandStep(const std::string &cmd) {
+  return [this, cmd](IECBusConnection::Callback done) {
+    bus_conn_->WriteToChannelAsync(device_number_, 15, cmd, done);
+  };
+}
+
+IECAsyncStep CBM1541Drive::StatusStep() {
+  return [this](IECBusConnection::Callback done) {
+    bus_conn_->ReadFromChannelAsync(
+        device_number_, 15,
+        [done](const IECStatus &status, const std::string &response) {
+          if (status.ok() && response != kOKResponse) {
+            IECStatus drive_status;
+            SetError(IECStatus::DRIVE_ERROR, response, &drive_status);
+            done(drive_status, response);
+            return;
+          }
+          done(status, response);
+        });
+  };
+}
+
+void CBM1541Drive::AppendPrepareSteps(std::vector<IECAsyncStep> *steps) {
+  if (fw_state_ != FW_CUSTOM_READ_WRITE_CODE) {
+    const auto &fragment = fw_fragment_map_.at(FW_CUSTOM_READ_WRITE_CODE);
+    for (const auto &request :
+         MemoryWriteRequests(fragment.loading_address, fragment.binary_size,
+                             fragment.binary)) {
+      steps->push_back(CommandStep(request));
+      steps->push_back(StatusStep());
+    }
+    steps->push_back([this](IECBusConnection::Callback done) {
+      fw_state_ = FW_CUSTOM_READ_WRITE_CODE;
+      done(IECStatus(), std::string());
+    });
+  }
+  // Same as InitDirectAccessChannel(), see OpenChannelWithBuffer().
+  auto open_channel = [this, steps](int channel, int buffer, int *da_chan) {
+    if (*da_chan != -1) {
+      return;
+    }
+    steps->push_back([this, channel, buffer](IECBusConnection::Callback done) {
+      bus_conn_->OpenChannelAsync(device_number_, channel,
+                                  (boost::format("#%u") % buffer).str(), done);
+    });
+    steps->push_back(CommandStep((boost::format("B-P:%u 0") % channel).str()));
+    steps->push_back([channel, da_chan](IECBusConnection::Callback done) {
+      *da_chan = channel;
+      done(IECStatus(), std::string());
+    });
+  };
+  open_channel(kWriteDirectAccessChannel, 1, &write_da_chan_);
+  open_channel(kReadDirectAccessChannel, 3, &read_da_chan_);
+}
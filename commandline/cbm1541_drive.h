@@ -3,7 +3,11 @@
 #ifndef CBM1541_DRIVE_H
 #define CBM1541_DRIVE_H
 
+#include <deque>
 #include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "drive_interface.h"
 #include "iec_host_lib.h"
@@ -21,6 +25,10 @@ public:
   ~CBM1541Drive();
 
   bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  bool FormatTracks(unsigned int first_track, unsigned int last_track,
+                    const std::string &disc_id, IECStatus *status) override;
+  bool FormatDiscQuick(const std::string &disc_name,
+                       IECStatus *status) override;
   bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
   bool ReadSector(size_t sector_number, std::string *content,
                   IECStatus *status) override;
@@ -28,12 +36,40 @@ public:
                    IECStatus *status) override;
   bool ReadCommandChannel(std::string *response, IECStatus *status) override;
 
+  // Asynchronous versions of ReadSector and WriteSector. They return right
+  // away and call done on the response thread of the connection once
+  // finished, ReadSectorAsync passing the sector content as result.
+  // Operations on this drive run one after another, while those on other
+  // drives sharing the connection overlap with them. Don't mix them with
+  // blocking calls on the same drive, and keep the drive alive until all of
+  // them are done.
+  void ReadSectorAsync(size_t sector_number, IECBusConnection::Callback done);
+  void WriteSectorAsync(size_t sector_number, const std::string &content,
+                        IECBusConnection::Callback done);
+
+  // Write all sectors of track, with content holding the 256 bytes for each
+  // sector in order. The data blocks are GCR encoded on the host, so the
+  // drive only has to find each sector and write the block out.
+  // Returns true if successful, sets status otherwise.
+  bool WriteTrack(unsigned int track, const std::vector<std::string> &content,
+                  IECStatus *status);
+
+  // Write a data block that was GCR encoded already (kNumGCRDataBlockBytes
+  // bytes) to the given track and sector. Nothing about the block is checked,
+  // which allows writing blocks as they were taken from a raw disc image.
+  // Returns true if successful, sets status otherwise.
+  bool WriteGCRDataBlock(unsigned int track, unsigned int sector,
+                         const std::string &gcr_block, IECStatus *status);
+
   // GetTrackSector translates from a sector index to corresponding
   // track and (track local) sector number according to a hardcoded
   // schema matching the 1541's sectors / track configuration.
   static void GetTrackSector(unsigned int s, unsigned int *track,
                              unsigned int *sector);
 
+  // Returns the number of sectors on track, following the same schema.
+  static unsigned int GetNumSectorsOnTrack(unsigned int track);
+
 private:
   // FirmareState represents the different custom firmware code fragments
   // we use to operate the drive.
@@ -56,10 +92,37 @@ private:
   // Initialize direct access channel if it hasn't been initialized yet.
   bool InitDirectAccessChannel(IECStatus *status);
 
+  // Close direct access channels that have been initialized. They will be
+  // opened again when needed.
+  void CloseDirectAccessChannels();
+
+  // Forget about the direct access channels after the drive closed them, e.g.
+  // when formatting. They will be opened again when needed.
+  void ResetDirectAccessChannels();
+
   // Open the specified channel, associate it with buffer and set the buffer
   // pointer to zero. Returns true if successful, sets status otherwise.
   bool OpenChannelWithBuffer(int channel, int buffer, IECStatus *status);
 
+  // Run operation once the operations started before it are done, then call
+  // done with its outcome.
+  void RunExclusive(IECAsyncStep operation, IECBusConnection::Callback done);
+
+  // Start the operations queued by RunExclusive() one after another, calling
+  // the done callback of each before the next one starts.
+  void RunNextOperation();
+
+  // Returns a step sending cmd to the command channel.
+  IECAsyncStep CommandStep(const std::string &cmd);
+
+  // Returns a step reading the command channel, failing with DRIVE_ERROR
+  // unless the drive reports OK.
+  IECAsyncStep StatusStep();
+
+  // Append the steps uploading the read/write code and opening the direct
+  // access channels to steps, as far as they're needed.
+  void AppendPrepareSteps(std::vector<IECAsyncStep> *steps);
+
   // A pointer to the bus we'll be using to talk to the physical device.
   IECBusConnection *bus_conn_;
 
@@ -81,6 +144,12 @@ private:
   // Direct access channel to use for reading sector content.
   // Initialized lazily by InitDirectAccessChannel().
   int read_da_chan_ = -1;
+
+  // Guards the asynchronous operations waiting for their turn, and whether
+  // one is in progress.
+  std::mutex async_mutex_;
+  std::deque<std::pair<IECAsyncStep, IECBusConnection::Callback>> async_ops_;
+  bool async_busy_ = false;
 };
 
 #endif // CBM1541_DRIVE_H
@@ -1,7 +1,16 @@
 #include "cbm1541_drive.h"
 
+#include <algorithm>
+#include <future>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
 #include "boost/format.hpp"
+#include "gcr.h"
 #include "iec_host_lib.h"
+#include "transport.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -30,6 +39,51 @@ public:
                bool(char device_number, char channel, IECStatus *status));
 };
 
+// A connection holding on to the first request it's given until it breaks,
+// failing that one and all requests after it right away.
+class BreakingIECBusConnection : public IECBusConnection {
+public:
+  BreakingIECBusConnection() : IECBusConnection(0, nullptr) {}
+
+  void OpenChannelAsync(char device_number, char channel,
+                        const std::string &data_string,
+                        Callback done) override {
+    Request(done);
+  }
+  void ReadFromChannelAsync(char device_number, char channel,
+                            Callback done) override {
+    Request(done);
+  }
+  void WriteToChannelAsync(char device_number, char channel,
+                           const std::string &data_string,
+                           Callback done) override {
+    Request(done);
+  }
+  void CloseChannelAsync(char device_number, char channel,
+                         Callback done) override {
+    Request(done);
+  }
+
+  void Break() {
+    broken_ = true;
+    Request(held_);
+  }
+
+private:
+  void Request(Callback done) {
+    if (!broken_) {
+      held_ = done;
+      return;
+    }
+    IECStatus status;
+    SetError(IECStatus::CONNECTION_FAILURE, "connection broken", &status);
+    done(status, std::string());
+  }
+
+  bool broken_ = false;
+  Callback held_;
+};
+
 class CBM1541DriveTest : public ::testing::Test {};
 
 TEST_F(CBM1541DriveTest, FormatDiscTest) {
@@ -92,6 +146,77 @@ TEST_F(CBM1541DriveTest, FormatDiscTest) {
   EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
 }
 
+TEST_F(CBM1541DriveTest, FormatTracksTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-W"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  // Track range is passed as first and one past last track, followed by the ID.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq(std::string("M-E\x03\x05"
+                                                            "\x11\x14"
+                                                            "XY",
+                                                            9)),
+                                   &status))
+      .Times(1)
+      .WillOnce(Return(true));
+
+  EXPECT_TRUE(drive.FormatTracks(17, 19, "XY", &status)) << status.message;
+
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+
+  // Invalid arguments are rejected without talking to the drive.
+  EXPECT_FALSE(drive.FormatTracks(0, 3, "XY", &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  EXPECT_FALSE(drive.FormatTracks(20, 19, "XY", &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  EXPECT_FALSE(drive.FormatTracks(1, 42, "XY", &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  EXPECT_FALSE(drive.FormatTracks(1, 35, "XYZ", &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+}
+
+TEST_F(CBM1541DriveTest, FormatDiscQuickTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("N0:GAMES"), &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(1)
+      .WillOnce(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+
+  EXPECT_TRUE(drive.FormatDiscQuick("GAMES", &status)) << status.message;
+
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+
+  // A disc that was never formatted can't be quick formatted.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("N0:GAMES"), &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(1)
+      .WillOnce(DoAll(SetArgPointee<2>("21, READ ERROR,18,00\r"),
+                      Return(true)));
+
+  EXPECT_FALSE(drive.FormatDiscQuick("GAMES", &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+
+  // Anything behind a comma would be taken as a new disc ID.
+  EXPECT_CALL(conn, WriteToChannel(_, _, _, _)).Times(0);
+  EXPECT_FALSE(drive.FormatDiscQuick("GAMES,01", &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+}
+
 TEST_F(CBM1541DriveTest, WriteSectorTest) {
   MockIECBusConnection conn;
   CBM1541Drive drive(&conn, 8);
@@ -325,3 +450,168 @@ TEST_F(CBM1541DriveTest, ReadSectorTest) {
   EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
   EXPECT_CALL(conn, CloseChannel(8, 3, _)).Times(1).WillOnce(Return(true));
 }
+
+TEST_F(CBM1541DriveTest, WriteTrackTest) {
+  MockIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  IECStatus status;
+
+  // Track 18 has 19 sectors, anything else is rejected.
+  std::vector<std::string> content(18, std::string(256, 0x42));
+  EXPECT_FALSE(drive.WriteTrack(18, content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  content.push_back(std::string(255, 0x42));
+  EXPECT_FALSE(drive.WriteTrack(18, content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  content.back().append(1, 0x42);
+
+  // Uploading the firmware and the start of each block.
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StartsWith("M-W"), &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(conn, ReadFromChannel(8, 15, _, &status))
+      .Times(AtLeast(1))
+      .WillRepeatedly(DoAll(SetArgPointee<2>("00, OK,00,00\r"), Return(true)));
+  EXPECT_CALL(conn, OpenChannel(8, 2, "#1", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:2 0"), &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, OpenChannel(8, 3, "#3", &status))
+      .Times(1)
+      .WillOnce(Return(true));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq("B-P:3 0"), &status))
+      .Times(1)
+      .WillOnce(Return(true));
+
+  // The end of each GCR encoded block goes through the DA channel.
+  std::string gcr_block = EncodeDataBlock(content[0]);
+  EXPECT_CALL(conn, WriteToChannel(8, 2, StrEq(gcr_block.substr(69)), &status))
+      .Times(19)
+      .WillRepeatedly(Return(true));
+  // The start of the block is written to the auxiliary space.
+  std::string aux_write = "M-W";
+  aux_write.append("\xbb\x01\x23");
+  aux_write.append(gcr_block.substr(0, 35));
+  EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq(aux_write), &status))
+      .Times(19)
+      .WillRepeatedly(Return(true));
+
+  // One memory execute per sector, asking to write a GCR block.
+  for (int sector = 0; sector < 19; ++sector) {
+    std::string request = "M-E";
+    request.append("\x03\x05\x12");
+    request.append(1, char(sector));
+    request.append(1, 0x02);
+    EXPECT_CALL(conn, WriteToChannel(8, 15, StrEq(request), &status))
+        .Times(1)
+        .WillOnce(Return(true));
+  }
+
+  EXPECT_TRUE(drive.WriteTrack(18, content, &status)) << status.message;
+
+  // Done with one call, prepare for the next one.
+  ::testing::Mock::VerifyAndClearExpectations(&conn);
+
+  // A block of the wrong size is rejected before anything is sent.
+  EXPECT_FALSE(drive.WriteGCRDataBlock(18, 0, gcr_block.substr(1), &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  EXPECT_FALSE(drive.WriteGCRDataBlock(18, 19, gcr_block, &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  // The destructor of our CBM1541Drive will call CloseChannel.
+  EXPECT_CALL(conn, CloseChannel(8, 2, _)).Times(1).WillOnce(Return(true));
+  EXPECT_CALL(conn, CloseChannel(8, 3, _)).Times(1).WillOnce(Return(true));
+}
+
+TEST_F(CBM1541DriveTest, AsyncSectorAccessTest) {
+  // Two drives, each with a disc holding a pattern in every sector that
+  // wasn't written to.
+  std::map<std::tuple<char, char, char>, std::string> written;
+  std::map<char, std::string> write_buffer;
+  std::map<char, std::string> read_buffer;
+  EmulatedArduino arduino([&](const std::string &request, std::string *data) {
+    char device = request[1];
+    char channel = request[2];
+    if (request[0] == 'p' && channel == 2) {
+      write_buffer[device] += request.substr(4);
+    } else if (request[0] == 'p' && channel == 15 &&
+               request.compare(4, 3, "M-E") == 0) {
+      auto block = std::make_tuple(device, request[9], request[10]);
+      if (request[11] == 0) {
+        read_buffer[device] = written.count(block)
+                                  ? written[block]
+                                  : std::string(256, request[9] + request[10]);
+      } else {
+        written[block] = write_buffer[device];
+        write_buffer[device].clear();
+      }
+    } else if (request[0] == 'g') {
+      *data = channel == 15 ? "00, OK,00,00\r" : read_buffer[device];
+    }
+    return std::string();
+  });
+  IECStatus status;
+  std::unique_ptr<IECBusConnection> conn(IECBusConnection::Create(
+      std::make_unique<LoopbackTransport>(&arduino), nullptr, &status));
+  ASSERT_TRUE(conn != nullptr) << status.message;
+  CBM1541Drive drive8(conn.get(), 8);
+  CBM1541Drive drive9(conn.get(), 9);
+
+  // Start everything at once, collecting the results.
+  std::vector<std::future<std::string>> results;
+  auto collect = [&results]() {
+    auto result = std::make_shared<std::promise<std::string>>();
+    results.push_back(result->get_future());
+    return [result](const IECStatus &status, const std::string &content) {
+      result->set_value(status.ok() ? content : status.message);
+    };
+  };
+  for (size_t sector = 0; sector < 3; ++sector) {
+    drive8.ReadSectorAsync(sector, collect());
+    drive9.ReadSectorAsync(sector + 21, collect());
+  }
+  drive8.WriteSectorAsync(1, std::string(256, 'w'), collect());
+  drive8.ReadSectorAsync(1, collect());
+  drive9.ReadSectorAsync(1, collect());
+  drive9.ReadSectorAsync(785, collect());
+
+  std::vector<std::string> expected;
+  for (char sector = 0; sector < 3; ++sector) {
+    expected.push_back(std::string(256, 1 + sector));
+    expected.push_back(std::string(256, 2 + sector));
+  }
+  expected.push_back("");
+  expected.push_back(std::string(256, 'w'));
+  expected.push_back(std::string(256, 2));
+  expected.push_back("not trying to read from track 42 as it might cause "
+                     "hardware damage: Invalid argument");
+  ASSERT_EQ(results.size(), expected.size());
+  for (size_t i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].get(), expected[i]) << "operation " << i;
+  }
+}
+
+TEST_F(CBM1541DriveTest, AsyncOperationsFailInOrder) {
+  BreakingIECBusConnection conn;
+  CBM1541Drive drive(&conn, 8);
+  // Enough operations to run out of stack if each failing one started the
+  // next from its callback.
+  const size_t kNumOperations = 100000;
+  std::vector<size_t> completed;
+  for (size_t i = 0; i < kNumOperations; ++i) {
+    drive.ReadSectorAsync(
+        0, [&completed, i](const IECStatus &status, const std::string &) {
+          EXPECT_EQ(status.status_code, IECStatus::CONNECTION_FAILURE);
+          completed.push_back(i);
+        });
+  }
+  EXPECT_TRUE(completed.empty());
+
+  // The first operation fails, then the ones queued after it do while they're
+  // started. Each is reported before the next one gets going.
+  conn.Break();
+  ASSERT_EQ(completed.size(), kNumOperations);
+  EXPECT_TRUE(std::is_sorted(completed.begin(), completed.end()));
+}
@@ -0,0 +1,401 @@
+#include "disc_files.h"
+
+#include <algorithm>
+
+#include "boost/format.hpp"
+#include "cbm1541_drive.h"
+
+// Track holding BAM and directory, and the sector of the BAM.
+static const unsigned int kDirectoryTrack = 18;
+static const unsigned int kBAMSector = 0;
+// Number of tracks covered by the BAM, files are only put onto these.
+static const unsigned int kNumBAMTracks = 35;
+// Highest track a chain may lead to, on 40 track discs.
+static const unsigned int kMaxChainTrack = 40;
+// Longer chains than the number of sectors on a 40 track disc loop.
+static const size_t kMaxChainLength = 768;
+
+// Offset of the first BAM entry (track 1), four bytes per track: the number
+// of free sectors followed by a bitmap with a bit set for each free sector.
+static const size_t kBAMEntriesOffset = 4;
+static const size_t kBAMEntrySize = 4;
+
+// Directory entries, eight per sector.
+static const size_t kEntrySize = 32;
+static const size_t kEntryTypeOffset = 2;
+static const size_t kEntryTrackOffset = 3;
+static const size_t kEntrySectorOffset = 4;
+static const size_t kEntryNameOffset = 5;
+static const size_t kEntryBlocksOffset = 30;
+static const size_t kNameLength = 16;
+static const char kNamePadding = '\xa0';
+
+// Sector interleave the drive uses for files and for the directory.
+static const unsigned int kFileInterleave = 10;
+static const unsigned int kDirectoryInterleave = 3;
+
+// Bytes of data per block, the first two hold the link to the next one.
+static const size_t kDataBytesPerBlock = DriveInterface::kNumBytesPerSector - 2;
+
+// Returns the linear sector number of sector on track.
+static size_t GetSectorNumber(unsigned int track, unsigned int sector) {
+  size_t sector_number = sector;
+  for (unsigned int t = 1; t < track; ++t) {
+    sector_number += CBM1541Drive::GetNumSectorsOnTrack(t);
+  }
+  return sector_number;
+}
+
+// File names on disc are in PETSCII, where unshifted letters are upper case.
+static std::string ToPetscii(const std::string &name) {
+  std::string result = name;
+  for (auto &c : result) {
+    if (c >= 'a' && c <= 'z') {
+      c = c - 'a' + 'A';
+    }
+  }
+  return result;
+}
+
+std::string GetFileTypeName(unsigned char type) {
+  static const char *kTypeNames[] = {"DEL", "SEQ", "PRG", "USR", "REL"};
+  unsigned int index = type & 0x07;
+  return index < 5 ? kTypeNames[index] : "???";
+}
+
+std::string GetHostFileName(const DirectoryEntry &entry) {
+  std::string name = entry.name + "." + GetFileTypeName(entry.type);
+  for (auto &c : name) {
+    if (c >= 'A' && c <= 'Z') {
+      c = c - 'A' + 'a';
+    } else if (c == '/' || c < ' ' || c > '~') {
+      c = '_';
+    }
+  }
+  return name;
+}
+
+DiscFiles::DiscFiles(DriveInterface *drive) : drive_(drive) {}
+
+bool DiscFiles::ReadDirectory(IECStatus *status) {
+  entries_.clear();
+  directory_sector_numbers_.clear();
+  directory_sectors_.clear();
+  if (!drive_->ReadSector(GetSectorNumber(kDirectoryTrack, kBAMSector), &bam_,
+                          status)) {
+    return false;
+  }
+  if (!ReadChain(static_cast<unsigned char>(bam_[0]),
+                 static_cast<unsigned char>(bam_[1]),
+                 &directory_sector_numbers_, &directory_sectors_, status)) {
+    return false;
+  }
+  for (const auto &sector : directory_sectors_) {
+    for (size_t offset = 0; offset < sector.size(); offset += kEntrySize) {
+      DirectoryEntry entry;
+      entry.type = sector[offset + kEntryTypeOffset];
+      if (entry.type == 0) {
+        // Unused, or the file was scratched.
+        continue;
+      }
+      entry.track =
+          static_cast<unsigned char>(sector[offset + kEntryTrackOffset]);
+      entry.sector =
+          static_cast<unsigned char>(sector[offset + kEntrySectorOffset]);
+      entry.name = sector.substr(offset + kEntryNameOffset, kNameLength);
+      entry.name.erase(entry.name.find_last_not_of(kNamePadding) + 1);
+      entry.num_blocks =
+          static_cast<unsigned char>(sector[offset + kEntryBlocksOffset]) +
+          256 * static_cast<unsigned char>(
+                    sector[offset + kEntryBlocksOffset + 1]);
+      entries_.push_back(entry);
+    }
+  }
+  return true;
+}
+
+const DirectoryEntry *DiscFiles::FindFile(const std::string &name) const {
+  std::string petscii_name = ToPetscii(name);
+  for (const auto &entry : entries_) {
+    if (entry.name == petscii_name) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+size_t DiscFiles::GetNumFreeBlocks() const {
+  size_t num_free = 0;
+  for (unsigned int track = 1; track <= kNumBAMTracks; ++track) {
+    if (track != kDirectoryTrack) {
+      num_free += static_cast<unsigned char>(
+          bam_[kBAMEntriesOffset + (track - 1) * kBAMEntrySize]);
+    }
+  }
+  return num_free;
+}
+
+bool DiscFiles::ReadFile(const DirectoryEntry &entry, std::string *content,
+                         IECStatus *status) {
+  std::vector<size_t> sector_numbers;
+  std::vector<std::string> sectors;
+  if (!ReadChain(entry.track, entry.sector, &sector_numbers, &sectors,
+                 status)) {
+    return false;
+  }
+  content->clear();
+  for (size_t i = 0; i + 1 < sectors.size(); ++i) {
+    content->append(sectors[i], 2, kDataBytesPerBlock);
+  }
+  // The last block gives the position of its last byte in place of a link.
+  size_t last_byte = static_cast<unsigned char>(sectors.back()[1]);
+  if (last_byte >= 2) {
+    content->append(sectors.back(), 2, last_byte - 1);
+  }
+  return true;
+}
+
+bool DiscFiles::WriteFile(const std::string &name, unsigned char type,
+                          const std::string &content, IECStatus *status) {
+  std::string petscii_name = ToPetscii(name);
+  if (petscii_name.empty() || petscii_name.size() > kNameLength) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("invalid file name '%s'") % name).str(), status);
+    return false;
+  }
+  if (FindFile(petscii_name) != nullptr) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("file '%s' exists") % name).str(), status);
+    return false;
+  }
+
+  // What we hold of BAM and directory only changes once the file is on the
+  // disc, FindFreeSlot() may have added a directory sector by then.
+  const std::string original_bam = bam_;
+  const std::vector<size_t> original_sector_numbers =
+      directory_sector_numbers_;
+  const std::vector<std::string> original_sectors = directory_sectors_;
+  auto fail = [&]() {
+    bam_ = original_bam;
+    directory_sector_numbers_ = original_sector_numbers;
+    directory_sectors_ = original_sectors;
+    return false;
+  };
+  size_t num_blocks =
+      std::max<size_t>(1, (content.size() + kDataBytesPerBlock - 1) /
+                              kDataBytesPerBlock);
+  std::vector<std::pair<unsigned int, unsigned int>> blocks;
+  size_t index = 0, offset = 0;
+  if (!AllocateFileBlocks(num_blocks, &blocks, status) ||
+      !FindFreeSlot(&index, &offset, status)) {
+    return fail();
+  }
+
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    std::string data = content.substr(i * kDataBytesPerBlock,
+                                      kDataBytesPerBlock);
+    std::string block(DriveInterface::kNumBytesPerSector, '\0');
+    if (i + 1 < blocks.size()) {
+      block[0] = blocks[i + 1].first;
+      block[1] = blocks[i + 1].second;
+    } else {
+      block[0] = 0;
+      block[1] = data.size() + 1;
+    }
+    block.replace(2, data.size(), data);
+    if (!drive_->WriteSector(GetSectorNumber(blocks[i].first,
+                                             blocks[i].second),
+                             block, status)) {
+      return fail();
+    }
+  }
+
+  std::string &sector = directory_sectors_[index];
+  DirectoryEntry entry;
+  entry.name = petscii_name;
+  entry.type = type;
+  entry.track = blocks[0].first;
+  entry.sector = blocks[0].second;
+  entry.num_blocks = blocks.size();
+  // Keep the link, which only the first entry of each sector holds.
+  sector.replace(offset + kEntryTypeOffset, kEntrySize - kEntryTypeOffset,
+                 kEntrySize - kEntryTypeOffset, '\0');
+  sector[offset + kEntryTypeOffset] = entry.type;
+  sector[offset + kEntryTrackOffset] = entry.track;
+  sector[offset + kEntrySectorOffset] = entry.sector;
+  std::string padded_name = petscii_name;
+  padded_name.resize(kNameLength, kNamePadding);
+  sector.replace(offset + kEntryNameOffset, kNameLength, padded_name);
+  sector[offset + kEntryBlocksOffset] = entry.num_blocks & 0xff;
+  sector[offset + kEntryBlocksOffset + 1] = entry.num_blocks >> 8;
+
+  // A new directory sector needs the one before it linked up, too.
+  size_t first_index = index;
+  if (index > 0 && directory_sectors_[index - 1][0] == 0) {
+    directory_sectors_[index - 1][0] = kDirectoryTrack;
+    directory_sectors_[index - 1][1] =
+        directory_sector_numbers_[index] -
+        GetSectorNumber(kDirectoryTrack, 0);
+    first_index = index - 1;
+  }
+  for (size_t i = first_index; i <= index; ++i) {
+    if (!drive_->WriteSector(directory_sector_numbers_[i],
+                             directory_sectors_[i], status)) {
+      return fail();
+    }
+  }
+  if (!drive_->WriteSector(GetSectorNumber(kDirectoryTrack, kBAMSector), bam_,
+                           status)) {
+    return fail();
+  }
+  entries_.push_back(entry);
+  return true;
+}
+
+bool DiscFiles::ReadChain(unsigned int track, unsigned int sector,
+                          std::vector<size_t> *sector_numbers,
+                          std::vector<std::string> *sectors,
+                          IECStatus *status) {
+  sector_numbers->clear();
+  sectors->clear();
+  while (true) {
+    // Check every link before following it, the drive would seek to
+    // whatever track it is given.
+    if (track < 1 || track > kMaxChainTrack ||
+        sector >= CBM1541Drive::GetNumSectorsOnTrack(track)) {
+      SetError(IECStatus::DRIVE_ERROR,
+               (boost::format("invalid link to track %u, sector %u") % track %
+                sector)
+                   .str(),
+               status);
+      return false;
+    }
+    if (sectors->size() >= kMaxChainLength) {
+      SetError(IECStatus::DRIVE_ERROR, "chain of sectors loops", status);
+      return false;
+    }
+    size_t sector_number = GetSectorNumber(track, sector);
+    std::string content;
+    if (!drive_->ReadSector(sector_number, &content, status)) {
+      return false;
+    }
+    sector_numbers->push_back(sector_number);
+    sectors->push_back(content);
+    if (content[0] == 0) {
+      return true;
+    }
+    track = static_cast<unsigned char>(content[0]);
+    sector = static_cast<unsigned char>(content[1]);
+  }
+}
+
+bool DiscFiles::IsFree(unsigned int track, unsigned int sector) const {
+  size_t entry = kBAMEntriesOffset + (track - 1) * kBAMEntrySize;
+  return (bam_[entry + 1 + sector / 8] >> (sector % 8)) & 1;
+}
+
+void DiscFiles::Allocate(unsigned int track, unsigned int sector) {
+  size_t entry = kBAMEntriesOffset + (track - 1) * kBAMEntrySize;
+  bam_[entry + 1 + sector / 8] &= ~(1 << (sector % 8));
+  --bam_[entry];
+}
+
+bool DiscFiles::AllocateFileBlocks(
+    size_t num_blocks,
+    std::vector<std::pair<unsigned int, unsigned int>> *blocks,
+    IECStatus *status) {
+  if (num_blocks > GetNumFreeBlocks()) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("%u blocks needed, %u free") % num_blocks %
+              GetNumFreeBlocks())
+                 .str(),
+             status);
+    return false;
+  }
+  // Like the drive, start as close to the directory as possible, then move
+  // outwards. Each side is filled up before the other one is used.
+  std::vector<unsigned int> tracks;
+  for (unsigned int distance = 1; distance < kDirectoryTrack; ++distance) {
+    tracks.push_back(kDirectoryTrack - distance);
+    if (kDirectoryTrack + distance <= kNumBAMTracks) {
+      tracks.push_back(kDirectoryTrack + distance);
+    }
+  }
+  unsigned int track = 0;
+  for (unsigned int candidate : tracks) {
+    if (bam_[kBAMEntriesOffset + (candidate - 1) * kBAMEntrySize] != 0) {
+      track = candidate;
+      break;
+    }
+  }
+  std::vector<unsigned int> order;
+  for (unsigned int t = track; t >= 1 && t < kDirectoryTrack; --t) {
+    order.push_back(t);
+  }
+  for (unsigned int t = track; t > kDirectoryTrack && t <= kNumBAMTracks;
+       ++t) {
+    order.push_back(t);
+  }
+  for (unsigned int candidate : tracks) {
+    if (track < kDirectoryTrack ? candidate > kDirectoryTrack
+                                : candidate < kDirectoryTrack) {
+      order.push_back(candidate);
+    }
+  }
+
+  blocks->clear();
+  unsigned int sector = 0;
+  for (unsigned int t : order) {
+    unsigned int num_sectors = CBM1541Drive::GetNumSectorsOnTrack(t);
+    while (blocks->size() < num_blocks &&
+           bam_[kBAMEntriesOffset + (t - 1) * kBAMEntrySize] != 0) {
+      // Leave the drive time to pass on the previous block before the next
+      // one comes around.
+      if (!blocks->empty() && blocks->back().first == t) {
+        sector = (sector + kFileInterleave) % num_sectors;
+      } else {
+        sector = 0;
+      }
+      while (!IsFree(t, sector)) {
+        sector = (sector + 1) % num_sectors;
+      }
+      Allocate(t, sector);
+      blocks->push_back(std::make_pair(t, sector));
+    }
+  }
+  return true;
+}
+
+bool DiscFiles::FindFreeSlot(size_t *index, size_t *offset,
+                             IECStatus *status) {
+  for (*index = 0; *index < directory_sectors_.size(); ++*index) {
+    for (*offset = 0; *offset < DriveInterface::kNumBytesPerSector;
+         *offset += kEntrySize) {
+      if (directory_sectors_[*index][*offset + kEntryTypeOffset] == 0) {
+        return true;
+      }
+    }
+  }
+  // All sectors are full, add one to the end of the directory.
+  const unsigned int num_sectors =
+      CBM1541Drive::GetNumSectorsOnTrack(kDirectoryTrack);
+  unsigned int sector =
+      (directory_sector_numbers_.back() -
+       GetSectorNumber(kDirectoryTrack, 0) + kDirectoryInterleave) %
+      num_sectors;
+  for (unsigned int i = 0; i < num_sectors && !IsFree(kDirectoryTrack, sector);
+       ++i) {
+    sector = (sector + 1) % num_sectors;
+  }
+  if (!IsFree(kDirectoryTrack, sector)) {
+    SetError(IECStatus::DRIVE_ERROR, "directory full", status);
+    return false;
+  }
+  Allocate(kDirectoryTrack, sector);
+  std::string new_sector(DriveInterface::kNumBytesPerSector, '\0');
+  new_sector[1] = '\xff';
+  directory_sector_numbers_.push_back(GetSectorNumber(kDirectoryTrack, sector));
+  directory_sectors_.push_back(new_sector);
+  *offset = 0;
+  return true;
+}
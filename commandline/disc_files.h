@@ -0,0 +1,111 @@
+// Access to the files on a disc in CBM DOS format, through any
+// DriveInterface. BAM and directory are read once, after that reading a file
+// only touches the sectors it occupies, following the chain of links at the
+// start of each. With a CBM1541Drive, every sector goes through the custom
+// read/write code instead of the drive's file channels.
+
+#ifndef DISC_FILES_H
+#define DISC_FILES_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "drive_interface.h"
+#include "utils.h"
+
+// A file as listed in the directory.
+struct DirectoryEntry {
+  // The name in PETSCII, without the padding.
+  std::string name;
+  // The file type byte, e.g. 0x82 for a properly closed PRG file.
+  unsigned char type = 0;
+  // Track and sector of the first block of the file.
+  unsigned int track = 0;
+  unsigned int sector = 0;
+  // Size in blocks, as given by the directory.
+  size_t num_blocks = 0;
+};
+
+// Returns the three letter name of the file type given by type, e.g. "PRG".
+std::string GetFileTypeName(unsigned char type);
+
+// Returns a name to store the file described by entry under on the host,
+// e.g. "hello.prg" for the PRG file "HELLO".
+std::string GetHostFileName(const DirectoryEntry &entry);
+
+class DiscFiles {
+public:
+  enum {
+    // File type byte of a properly closed PRG or SEQ file.
+    kTypePRG = 0x82,
+    kTypeSEQ = 0x81,
+  };
+
+  // Ownership of drive is not transferred, it must outlive this instance.
+  explicit DiscFiles(DriveInterface *drive);
+
+  // Read BAM and directory from the disc. Needs to be called before anything
+  // else. Returns true if successful, sets status otherwise.
+  bool ReadDirectory(IECStatus *status);
+
+  // The files on the disc, in directory order.
+  const std::vector<DirectoryEntry> &entries() const { return entries_; }
+
+  // Returns the entry of the file called name, which may be given in ASCII,
+  // or nullptr if there is no such file.
+  const DirectoryEntry *FindFile(const std::string &name) const;
+
+  // Number of blocks available for files.
+  size_t GetNumFreeBlocks() const;
+
+  // Read the content of the file described by entry. Returns true if
+  // successful, sets status otherwise.
+  bool ReadFile(const DirectoryEntry &entry, std::string *content,
+                IECStatus *status);
+
+  // Write content to a new file called name (which may be given in ASCII) of
+  // the given type. Blocks are allocated the way the drive's DOS does, then
+  // written along with the directory entry and the BAM. Returns true if
+  // successful, sets status otherwise.
+  bool WriteFile(const std::string &name, unsigned char type,
+                 const std::string &content, IECStatus *status);
+
+private:
+  // Read the chain of sectors starting at track and sector. Sets
+  // *sector_numbers and *sectors to the number and content of each in order.
+  // Returns true if successful, sets status otherwise.
+  bool ReadChain(unsigned int track, unsigned int sector,
+                 std::vector<size_t> *sector_numbers,
+                 std::vector<std::string> *sectors, IECStatus *status);
+
+  // Returns true if the BAM lists sector on track as free.
+  bool IsFree(unsigned int track, unsigned int sector) const;
+
+  // Mark sector on track as used in the BAM.
+  void Allocate(unsigned int track, unsigned int sector);
+
+  // Allocate num_blocks sectors for a file, setting *blocks to the track and
+  // sector of each, in order. Returns true if successful, sets status
+  // otherwise.
+  bool AllocateFileBlocks(
+      size_t num_blocks,
+      std::vector<std::pair<unsigned int, unsigned int>> *blocks,
+      IECStatus *status);
+
+  // Find a free directory slot, adding a directory sector if needed. Sets
+  // *index to the directory sector and *offset to the start of the entry
+  // within it. Returns true if successful, sets status otherwise.
+  bool FindFreeSlot(size_t *index, size_t *offset, IECStatus *status);
+
+  DriveInterface *drive_;
+
+  // Content of the BAM sector.
+  std::string bam_;
+  // Sector numbers and content of the directory sectors, in order.
+  std::vector<size_t> directory_sector_numbers_;
+  std::vector<std::string> directory_sectors_;
+  std::vector<DirectoryEntry> entries_;
+};
+
+#endif // DISC_FILES_H
@@ -0,0 +1,227 @@
+#include <string>
+#include <vector>
+
+#include "cbm1541_drive.h"
+#include "disc_files.h"
+
+#include "gtest/gtest.h"
+
+// Number of sectors on a 35 track disc.
+static const size_t kNumSectors = 683;
+// Sector numbers of BAM and the first directory sector (track 18, sectors 0
+// and 1).
+static const size_t kBAMSectorNumber = 357;
+static const size_t kDirectorySectorNumber = 358;
+
+// A disc held in memory.
+class MemoryDrive : public DriveInterface {
+public:
+  MemoryDrive()
+      : sectors_(kNumSectors, std::string(kNumBytesPerSector, '\0')) {}
+
+  bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override {
+    return false;
+  }
+  bool FormatTracks(unsigned int first_track, unsigned int last_track,
+                    const std::string &disc_id, IECStatus *status) override {
+    return false;
+  }
+  bool FormatDiscQuick(const std::string &disc_name,
+                       IECStatus *status) override {
+    // An empty BAM and directory.
+    std::string &bam = sectors_[kBAMSectorNumber];
+    bam[0] = 18;
+    bam[1] = 1;
+    bam[2] = 'A';
+    for (unsigned int track = 1; track <= 35; ++track) {
+      unsigned int num_sectors = CBM1541Drive::GetNumSectorsOnTrack(track);
+      bam[4 * track] = num_sectors;
+      for (unsigned int sector = 0; sector < num_sectors; ++sector) {
+        bam[4 * track + 1 + sector / 8] |= 1 << (sector % 8);
+      }
+    }
+    // BAM and directory are in use.
+    bam[4 * 18] -= 2;
+    bam[4 * 18 + 1] &= ~0x03;
+    bam.replace(0x90, disc_name.size(), disc_name);
+    sectors_[kDirectorySectorNumber][1] = '\xff';
+    return true;
+  }
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override {
+    *num_sectors = sectors_.size();
+    return true;
+  }
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override {
+    ++num_reads_;
+    *content = sectors_[sector_number];
+    return true;
+  }
+  bool WriteSector(size_t sector_number, const std::string &content,
+                   IECStatus *status) override {
+    if (sector_number == fail_write_sector_number_) {
+      SetError(IECStatus::DRIVE_ERROR, "write failed", status);
+      return false;
+    }
+    sectors_[sector_number] = content;
+    return true;
+  }
+  bool ReadCommandChannel(std::string *response, IECStatus *status) override {
+    return true;
+  }
+
+  std::vector<std::string> sectors_;
+  size_t num_reads_ = 0;
+  // Writes to this sector fail.
+  size_t fail_write_sector_number_ = kNumSectors;
+};
+
+class DiscFilesTest : public ::testing::Test {
+public:
+  void SetUp() {
+    IECStatus status;
+    ASSERT_TRUE(drive_.FormatDiscQuick("TEST", &status));
+  }
+
+protected:
+  // Returns size bytes of data, different for each seed.
+  static std::string TestData(size_t size, int seed) {
+    std::string data;
+    for (size_t i = 0; i < size; ++i) {
+      data.append(1, char(i * 7 + seed));
+    }
+    return data;
+  }
+
+  MemoryDrive drive_;
+};
+
+TEST_F(DiscFilesTest, WriteAndReadFiles) {
+  IECStatus status;
+  DiscFiles files(&drive_);
+  ASSERT_TRUE(files.ReadDirectory(&status)) << status.message;
+  EXPECT_TRUE(files.entries().empty());
+  EXPECT_EQ(files.GetNumFreeBlocks(), 664);
+
+  // Three blocks, starting next to the directory with the drive's interleave.
+  ASSERT_TRUE(files.WriteFile("hello", DiscFiles::kTypePRG,
+                              TestData(600, 1), &status))
+      << status.message;
+  const DirectoryEntry *entry = files.FindFile("HELLO");
+  ASSERT_TRUE(entry != nullptr);
+  EXPECT_EQ(entry->track, 17);
+  EXPECT_EQ(entry->sector, 0);
+  EXPECT_EQ(entry->num_blocks, 3);
+  // Track 17 starts at sector number 336.
+  EXPECT_EQ(drive_.sectors_[336][0], 17);
+  EXPECT_EQ(drive_.sectors_[336][1], 10);
+  EXPECT_EQ(drive_.sectors_[346][0], 17);
+  EXPECT_EQ(drive_.sectors_[346][1], 20);
+  EXPECT_EQ(files.GetNumFreeBlocks(), 661);
+
+  // Fill more than one directory sector.
+  ASSERT_TRUE(files.WriteFile("empty", DiscFiles::kTypeSEQ, "", &status))
+      << status.message;
+  for (int i = 0; i < 8; ++i) {
+    ASSERT_TRUE(files.WriteFile("file" + std::to_string(i),
+                                DiscFiles::kTypePRG, TestData(254 * i, i),
+                                &status))
+        << status.message;
+  }
+  EXPECT_FALSE(files.WriteFile("hello", DiscFiles::kTypePRG, "", &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+  EXPECT_FALSE(files.WriteFile("a name too long to fit", DiscFiles::kTypePRG,
+                               "", &status));
+  EXPECT_EQ(status.status_code, IECStatus::INVALID_ARGUMENT);
+
+  // Everything is found on the disc, reading only the sectors involved.
+  DiscFiles reread(&drive_);
+  ASSERT_TRUE(reread.ReadDirectory(&status)) << status.message;
+  EXPECT_EQ(drive_.sectors_[kDirectorySectorNumber][0], 18);
+  EXPECT_EQ(drive_.sectors_[kDirectorySectorNumber][1], 4);
+  ASSERT_EQ(reread.entries().size(), 10);
+  EXPECT_EQ(reread.entries()[1].name, "EMPTY");
+  EXPECT_EQ(GetFileTypeName(reread.entries()[1].type), "SEQ");
+  EXPECT_EQ(reread.entries()[9].name, "FILE7");
+  EXPECT_EQ(reread.GetNumFreeBlocks(), files.GetNumFreeBlocks());
+
+  std::string content;
+  drive_.num_reads_ = 0;
+  ASSERT_TRUE(reread.ReadFile(*reread.FindFile("hello"), &content, &status))
+      << status.message;
+  EXPECT_EQ(content, TestData(600, 1));
+  EXPECT_EQ(drive_.num_reads_, 3);
+  ASSERT_TRUE(reread.ReadFile(*reread.FindFile("empty"), &content, &status))
+      << status.message;
+  EXPECT_EQ(content, "");
+  for (int i = 0; i < 8; ++i) {
+    const DirectoryEntry *file = reread.FindFile("file" + std::to_string(i));
+    ASSERT_TRUE(file != nullptr);
+    ASSERT_TRUE(reread.ReadFile(*file, &content, &status)) << status.message;
+    EXPECT_EQ(content, TestData(254 * i, i));
+  }
+}
+
+TEST_F(DiscFilesTest, RejectsFullDiscAndBrokenChains) {
+  IECStatus status;
+  DiscFiles files(&drive_);
+  ASSERT_TRUE(files.ReadDirectory(&status)) << status.message;
+  EXPECT_FALSE(files.WriteFile("big", DiscFiles::kTypePRG,
+                               TestData(254 * 665, 0), &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+  // Nothing was allocated.
+  EXPECT_EQ(files.GetNumFreeBlocks(), 664);
+  ASSERT_TRUE(files.WriteFile("big", DiscFiles::kTypePRG,
+                              TestData(254 * 664, 0), &status))
+      << status.message;
+  EXPECT_EQ(files.GetNumFreeBlocks(), 0);
+
+  // A chain looping back onto itself.
+  DirectoryEntry entry;
+  entry.track = 1;
+  entry.sector = 0;
+  drive_.sectors_[0][0] = 1;
+  drive_.sectors_[0][1] = 0;
+  std::string content;
+  EXPECT_FALSE(files.ReadFile(entry, &content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+
+  // A link to a track that doesn't exist is never followed.
+  drive_.sectors_[0][0] = 42;
+  drive_.num_reads_ = 0;
+  EXPECT_FALSE(files.ReadFile(entry, &content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+  EXPECT_EQ(drive_.num_reads_, 1);
+}
+
+TEST_F(DiscFilesTest, FailedWritesLeaveDirectoryAsItWas) {
+  IECStatus status;
+  DiscFiles files(&drive_);
+  ASSERT_TRUE(files.ReadDirectory(&status)) << status.message;
+  // Fill the first directory sector, the next file needs a new one.
+  for (int i = 0; i < 8; ++i) {
+    ASSERT_TRUE(files.WriteFile("file" + std::to_string(i),
+                                DiscFiles::kTypePRG, TestData(100, i),
+                                &status))
+        << status.message;
+  }
+
+  // The BAM can't be written after the new directory sector was.
+  drive_.fail_write_sector_number_ = kBAMSectorNumber;
+  EXPECT_FALSE(
+      files.WriteFile("ninth", DiscFiles::kTypePRG, TestData(100, 8), &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+  EXPECT_EQ(files.GetNumFreeBlocks(), 656);
+  EXPECT_TRUE(files.FindFile("ninth") == nullptr);
+
+  // Trying again links the new directory sector up like the first time.
+  drive_.fail_write_sector_number_ = kNumSectors;
+  ASSERT_TRUE(
+      files.WriteFile("ninth", DiscFiles::kTypePRG, TestData(100, 8), &status))
+      << status.message;
+  DiscFiles reread(&drive_);
+  ASSERT_TRUE(reread.ReadDirectory(&status)) << status.message;
+  ASSERT_EQ(reread.entries().size(), 9);
+  EXPECT_EQ(reread.entries()[8].name, "NINTH");
+  EXPECT_EQ(reread.GetNumFreeBlocks(), 655);
+}
@@ -0,0 +1,293 @@
+// Implementation of the disc pack format.
+
+#include "disc_pack.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "boost/format.hpp"
+
+namespace {
+const char kMagic[] = "DPAK";
+const uint32_t kVersion = 1;
+// Chunks are single sectors.
+const size_t kChunkSize = 256;
+
+// Header: Magic and five words.
+const size_t kHeaderSize = 24;
+const size_t kVersionOffset = 4;
+const size_t kNumImagesOffset = 8;
+const size_t kNumChunksOffset = 12;
+const size_t kChunksOffsetOffset = 16;
+const size_t kNamesOffsetOffset = 20;
+
+// Image table entry: Name offset, name length, number of sectors, first
+// manifest entry.
+const size_t kImageEntrySize = 16;
+const size_t kManifestEntrySize = 4;
+
+const size_t kWriteBatchSize = 64 * 1024;
+
+void AppendWord(uint32_t value, std::string *target) {
+  for (int i = 0; i < 4; ++i) {
+    target->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+} // namespace
+
+bool DiscPackWriter::AddImage(const std::string &name,
+                              const std::string &image, IECStatus *status) {
+  if (name.empty() || manifests_.count(name) > 0) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("AddImage: Empty or duplicate name '%s'") % name)
+                 .str(),
+             status);
+    return false;
+  }
+  if (image.size() % kChunkSize != 0) {
+    SetError(IECStatus::INVALID_ARGUMENT,
+             (boost::format("AddImage: Size of '%s' not a multiple of "
+                            "sector size") %
+              name)
+                 .str(),
+             status);
+    return false;
+  }
+  std::vector<uint32_t> &manifest = manifests_[name];
+  for (size_t offset = 0; offset < image.size(); offset += kChunkSize) {
+    std::string sector = image.substr(offset, kChunkSize);
+    auto it = chunk_index_.find(sector);
+    if (it == chunk_index_.end()) {
+      it = chunk_index_.emplace(sector, chunks_.size()).first;
+      chunks_.push_back(sector);
+    }
+    manifest.push_back(it->second);
+  }
+  num_sectors_ += manifest.size();
+  return true;
+}
+
+bool DiscPackWriter::Write(const std::string &path, IECStatus *status) const {
+  // Everything up to the chunks is small, build it in memory.
+  std::string index;
+  std::string names;
+  uint32_t manifest_start = 0;
+  for (const auto &image : manifests_) {
+    AppendWord(names.size(), &index);
+    AppendWord(image.first.size(), &index);
+    AppendWord(image.second.size(), &index);
+    AppendWord(manifest_start, &index);
+    names += image.first;
+    manifest_start += image.second.size();
+  }
+  for (const auto &image : manifests_) {
+    for (uint32_t chunk : image.second) {
+      AppendWord(chunk, &index);
+    }
+  }
+  size_t names_offset = kHeaderSize + index.size();
+  size_t chunks_offset = names_offset + names.size();
+  chunks_offset = (chunks_offset + kChunkSize - 1) / kChunkSize * kChunkSize;
+
+  std::string header(kMagic, 4);
+  AppendWord(kVersion, &header);
+  AppendWord(manifests_.size(), &header);
+  AppendWord(chunks_.size(), &header);
+  AppendWord(chunks_offset, &header);
+  AppendWord(names_offset, &header);
+  header += index;
+  header += names;
+  header.resize(chunks_offset, '\0');
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Write: open", status);
+    return false;
+  }
+  BufferedReadWriter writer(fd);
+  // Write the chunks in batches rather than one system call per sector.
+  std::string batch = header;
+  bool result = true;
+  for (size_t i = 0; result && i < chunks_.size(); ++i) {
+    batch += chunks_[i];
+    if (batch.size() >= kWriteBatchSize) {
+      result = writer.WriteString(batch, status);
+      batch.clear();
+    }
+  }
+  if (result && !batch.empty()) {
+    result = writer.WriteString(batch, status);
+  }
+  if (close(fd) != 0 && result) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Write: close", status);
+    result = false;
+  }
+  return result;
+}
+
+DiscPack::DiscPack() {}
+
+DiscPack::~DiscPack() {
+  if (data_ != nullptr) {
+    if (munmap(const_cast<char *>(data_), size_) != 0) {
+      std::cerr << "DiscPack: munmap() failed: " << strerror(errno)
+                << std::endl;
+    }
+    data_ = nullptr;
+  }
+}
+
+bool DiscPack::Open(const std::string &path, IECStatus *status) {
+  if (data_ != nullptr) {
+    SetError(IECStatus::INVALID_ARGUMENT, "Open: Pack is already open",
+             status);
+    return false;
+  }
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Open: open", status);
+    return false;
+  }
+  struct stat stat_buf;
+  if (fstat(fd, &stat_buf) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Open: fstat", status);
+    close(fd);
+    return false;
+  }
+  if (stat_buf.st_size < static_cast<off_t>(kHeaderSize)) {
+    SetError(IECStatus::DRIVE_ERROR, "Open: File too small for a pack",
+             status);
+    close(fd);
+    return false;
+  }
+  size_ = stat_buf.st_size;
+  void *data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after closing the file.
+  close(fd);
+  if (data == MAP_FAILED) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "Open: mmap", status);
+    return false;
+  }
+  data_ = static_cast<const char *>(data);
+
+  // Check everything we'll access later, so lookups need no checks.
+  std::string error;
+  num_images_ = ReadWord(kNumImagesOffset);
+  num_chunks_ = ReadWord(kNumChunksOffset);
+  chunks_offset_ = ReadWord(kChunksOffsetOffset);
+  uint64_t names_offset = ReadWord(kNamesOffsetOffset);
+  uint64_t manifest_offset =
+      kHeaderSize + static_cast<uint64_t>(num_images_) * kImageEntrySize;
+  if (memcmp(data_, kMagic, 4) != 0) {
+    error = "Not a disc pack";
+  } else if (ReadWord(kVersionOffset) != kVersion) {
+    error = (boost::format("Unsupported version %u") %
+             ReadWord(kVersionOffset))
+                .str();
+  } else if (chunks_offset_ +
+                 static_cast<uint64_t>(num_chunks_) * kChunkSize >
+             size_) {
+    error = "Chunks exceed file size";
+  } else if (manifest_offset > names_offset || names_offset > chunks_offset_) {
+    error = "Inconsistent offsets";
+  }
+  uint64_t next_manifest_entry = 0;
+  for (size_t image = 0; error.empty() && image < num_images_; ++image) {
+    size_t entry = ImageEntry(image);
+    uint64_t name_end = names_offset + static_cast<uint64_t>(ReadWord(entry)) +
+                        ReadWord(entry + 4);
+    uint64_t num_sectors = ReadWord(entry + 8);
+    uint64_t first_entry = ReadWord(entry + 12);
+    if (name_end > chunks_offset_ || first_entry != next_manifest_entry ||
+        manifest_offset + (first_entry + num_sectors) * kManifestEntrySize >
+            names_offset ||
+        (image > 0 && ImageName(image - 1) >= ImageName(image))) {
+      error = (boost::format("Bad image table entry %u") % image).str();
+      break;
+    }
+    next_manifest_entry += num_sectors;
+    for (size_t sector = 0; sector < num_sectors; ++sector) {
+      if (ReadWord(manifest_offset +
+                   (first_entry + sector) * kManifestEntrySize) >=
+          num_chunks_) {
+        error = (boost::format("Bad chunk index in image %u") % image).str();
+        break;
+      }
+    }
+  }
+  if (!error.empty()) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("Open: %s: %s") % path % error).str(), status);
+    munmap(const_cast<char *>(data_), size_);
+    data_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+std::vector<std::string> DiscPack::GetImageNames() const {
+  std::vector<std::string> names;
+  for (size_t image = 0; image < num_images_; ++image) {
+    names.push_back(ImageName(image));
+  }
+  return names;
+}
+
+bool DiscPack::FindImage(const std::string &name, size_t *image,
+                         IECStatus *status) const {
+  // The image table is sorted by name.
+  size_t low = 0, high = num_images_;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    int cmp = ImageName(middle).compare(name);
+    if (cmp == 0) {
+      *image = middle;
+      return true;
+    }
+    if (cmp < 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  SetError(IECStatus::DRIVE_ERROR,
+           (boost::format("FindImage: No image '%s' in pack") % name).str(),
+           status);
+  return false;
+}
+
+size_t DiscPack::GetNumSectors(size_t image) const {
+  return ReadWord(ImageEntry(image) + 8);
+}
+
+const char *DiscPack::GetSector(size_t image, size_t sector) const {
+  size_t manifest_entry = ReadWord(ImageEntry(image) + 12) + sector;
+  uint32_t chunk =
+      ReadWord(kHeaderSize + num_images_ * kImageEntrySize +
+               manifest_entry * kManifestEntrySize);
+  return data_ + chunks_offset_ + static_cast<size_t>(chunk) * kChunkSize;
+}
+
+uint32_t DiscPack::ReadWord(size_t offset) const {
+  const unsigned char *p =
+      reinterpret_cast<const unsigned char *>(data_ + offset);
+  return p[0] | (p[1] << 8) | (p[2] << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+size_t DiscPack::ImageEntry(size_t image) const {
+  return kHeaderSize + image * kImageEntrySize;
+}
+
+std::string DiscPack::ImageName(size_t image) const {
+  size_t entry = ImageEntry(image);
+  return std::string(data_ + ReadWord(kNamesOffsetOffset) + ReadWord(entry),
+                     ReadWord(entry + 4));
+}
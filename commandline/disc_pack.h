@@ -0,0 +1,97 @@
+// A disc pack holds any number of disc images in a single file, storing
+// each distinct sector only once. Collections of images tend to share most
+// of their sectors (empty ones, common loaders, re-releases), so a pack is
+// much smaller than the images it holds. The file is used memory mapped,
+// getting at an image only takes a lookup of its manifest.
+//
+// File layout, all numbers are 32 bit little endian:
+//   Header:      magic "DPAK", version, number of images, number of chunks,
+//                offset of the first chunk, offset of the names.
+//   Image table: For each image, sorted by name: Offset and length of its
+//                name, number of sectors and index of its first manifest
+//                entry.
+//   Manifests:   For each sector of each image, the index of the chunk
+//                holding its content.
+//   Names:       The image names, back to back.
+//   Chunks:      The distinct sectors, 256 bytes each, starting at a
+//                multiple of 256.
+
+#ifndef DISC_PACK_H
+#define DISC_PACK_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+// Builds a disc pack in memory and writes it to a file.
+class DiscPackWriter {
+public:
+  // Add the image (a sequence of 256 byte sectors) under name. Returns true
+  // if successful, sets status otherwise.
+  bool AddImage(const std::string &name, const std::string &image,
+                IECStatus *status);
+
+  // Write the pack to path. Returns true if successful, sets status
+  // otherwise.
+  bool Write(const std::string &path, IECStatus *status) const;
+
+  // Total number of sectors in all images added.
+  size_t num_sectors() const { return num_sectors_; }
+  // Number of distinct sectors, each stored once.
+  size_t num_chunks() const { return chunks_.size(); }
+
+private:
+  // Distinct sectors in the order they were first seen, and the index of
+  // each by content.
+  std::vector<std::string> chunks_;
+  std::unordered_map<std::string, uint32_t> chunk_index_;
+  // Chunk index for each sector, by image name.
+  std::map<std::string, std::vector<uint32_t>> manifests_;
+  size_t num_sectors_ = 0;
+};
+
+// Read only access to a disc pack file.
+class DiscPack {
+public:
+  DiscPack();
+  ~DiscPack();
+
+  // Map the pack file at path and check its structure. Returns true if
+  // successful, sets status otherwise.
+  bool Open(const std::string &path, IECStatus *status);
+  bool is_open() const { return data_ != nullptr; }
+
+  // Names of all images in the pack, sorted.
+  std::vector<std::string> GetImageNames() const;
+
+  // Look up the image called name and set *image to its index. Returns true
+  // if successful, sets status otherwise.
+  bool FindImage(const std::string &name, size_t *image,
+                 IECStatus *status) const;
+
+  // Number of sectors of the image with the given index.
+  size_t GetNumSectors(size_t image) const;
+
+  // The 256 bytes of the given sector of image. The sector must exist, the
+  // memory stays valid as long as the pack is open.
+  const char *GetSector(size_t image, size_t sector) const;
+
+private:
+  // Read the 32 bit number at offset.
+  uint32_t ReadWord(size_t offset) const;
+  // Offset of the entry for image in the image table.
+  size_t ImageEntry(size_t image) const;
+  std::string ImageName(size_t image) const;
+
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+  uint32_t num_images_ = 0;
+  uint32_t num_chunks_ = 0;
+  uint32_t chunks_offset_ = 0;
+};
+
+#endif // DISC_PACK_H
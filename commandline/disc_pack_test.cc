@@ -0,0 +1,104 @@
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "disc_pack.h"
+#include "image_drive_pack.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+const size_t kTestImageNumSectors = 683;
+
+class DiscPackTest : public ::testing::Test {
+public:
+  void SetUp() {
+    pack_path_ =
+        (boost::filesystem::temp_directory_path() / "pack_XXXXXX").string();
+    int fd = mkstemp(&pack_path_[0]);
+    EXPECT_TRUE(close(fd) == 0);
+  }
+
+  void TearDown() { EXPECT_TRUE(unlink(pack_path_.c_str()) == 0); }
+
+protected:
+  // Create an image in which all sectors are empty, apart from those at
+  // multiples of stride, which are filled with a pattern based on the
+  // sector number.
+  std::string MakeImage(size_t stride) {
+    std::string image(kTestImageNumSectors * 256, '\0');
+    for (size_t s = 0; s < kTestImageNumSectors; s += stride) {
+      for (size_t c = 0; c < 256; ++c) {
+        image[s * 256 + c] = static_cast<char>(s + c);
+      }
+    }
+    return image;
+  }
+
+  // Path to a temporary pack file.
+  std::string pack_path_;
+};
+
+TEST_F(DiscPackTest, PackAndReadTest) {
+  // Every sector of the second image is either empty or also in the first.
+  std::string image_a = MakeImage(2);
+  std::string image_b = MakeImage(4);
+
+  IECStatus status;
+  DiscPackWriter writer;
+  EXPECT_TRUE(writer.AddImage("b.d64", image_b, &status)) << status.message;
+  EXPECT_TRUE(writer.AddImage("a.d64", image_a, &status)) << status.message;
+  EXPECT_FALSE(writer.AddImage("a.d64", image_a, &status));
+  EXPECT_FALSE(writer.AddImage("c.d64", "partial sector", &status));
+  EXPECT_EQ(writer.num_sectors(), 2 * kTestImageNumSectors);
+  // The patterns repeat every 256 sectors, plus one empty sector.
+  EXPECT_EQ(writer.num_chunks(), 129);
+  EXPECT_TRUE(writer.Write(pack_path_, &status)) << status.message;
+
+  DiscPack pack;
+  EXPECT_TRUE(pack.Open(pack_path_, &status)) << status.message;
+  EXPECT_THAT(pack.GetImageNames(), ::testing::ElementsAre("a.d64", "b.d64"));
+  size_t image;
+  EXPECT_FALSE(pack.FindImage("c.d64", &image, &status));
+
+  for (const auto &name_content :
+       {std::make_pair("a.d64", image_a), std::make_pair("b.d64", image_b)}) {
+    ImageDrivePack drive(pack_path_, name_content.first);
+    size_t num_sectors = 0;
+    EXPECT_TRUE(drive.GetNumSectors(&num_sectors, &status)) << status.message;
+    EXPECT_EQ(num_sectors, kTestImageNumSectors);
+    std::string content;
+    for (size_t s = 0; s < num_sectors; ++s) {
+      EXPECT_TRUE(drive.ReadSector(s, &content, &status)) << status.message;
+      EXPECT_EQ(content, name_content.second.substr(s * 256, 256));
+    }
+    EXPECT_FALSE(drive.ReadSector(num_sectors, &content, &status));
+    EXPECT_FALSE(drive.WriteSector(0, content, &status));
+    EXPECT_EQ(status.status_code, IECStatus::UNIMPLEMENTED);
+  }
+
+  ImageDrivePack missing(pack_path_, "c.d64");
+  size_t num_sectors;
+  EXPECT_FALSE(missing.GetNumSectors(&num_sectors, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+}
+
+TEST_F(DiscPackTest, CorruptPackTest) {
+  IECStatus status;
+  DiscPackWriter writer;
+  EXPECT_TRUE(writer.AddImage("a.d64", MakeImage(1), &status));
+  EXPECT_TRUE(writer.Write(pack_path_, &status)) << status.message;
+
+  // Cut off the last chunk.
+  EXPECT_TRUE(truncate(pack_path_.c_str(),
+                       boost::filesystem::file_size(pack_path_) - 1) == 0);
+  DiscPack pack;
+  EXPECT_FALSE(pack.Open(pack_path_, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+
+  // Not a pack at all.
+  std::ofstream(pack_path_) << "This is not a disc pack, but long enough.";
+  EXPECT_FALSE(pack.Open(pack_path_, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
+}
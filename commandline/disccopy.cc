@@ -12,15 +12,50 @@
 #include "boost/program_options/options_description.hpp"
 #include "boost/program_options/parsers.hpp"
 #include "boost/program_options/variables_map.hpp"
+#include "cbm1541_drive.h"
 #include "drive_factory.h"
 #include "drive_interface.h"
 #include "iec_host_lib.h"
+#include "trace.h"
+#include "transport.h"
 #include "utils.h"
 
 namespace po = boost::program_options;
 
 using namespace std::chrono_literals;
 
+// Linear number of the BAM sector (track 18, sector 0).
+static const unsigned int kBAMSectorNumber = 357;
+// Offset and size of the disc name within the BAM.
+static const size_t kBAMDiscNameOffset = 0x90;
+static const size_t kBAMDiscNameSize = 16;
+// Offset of the disc ID within the BAM.
+static const size_t kBAMDiscIdOffset = 0xa2;
+// Number of tracks covered by the BAM.
+static const unsigned int kNumBAMTracks = 35;
+// Track holding BAM and directory.
+static const unsigned int kDirectoryTrack = 18;
+// Highest track number we'll ever encounter.
+static const unsigned int kMaxTracks = 41;
+
+// Writes the trace to a file when going out of scope, so failed copies are
+// traced as well.
+struct TraceFile {
+  ~TraceFile() {
+    if (tracer) {
+      IECStatus status;
+      if (tracer->Write(path, &status)) {
+        std::cout << "Trace written to " << path << std::endl;
+      } else {
+        std::cout << "Failed to write trace: " << status.message << std::endl;
+      }
+    }
+  }
+
+  std::string path;
+  std::unique_ptr<Tracer> tracer;
+};
+
 // Convert input to a string of BCD hex numbers.
 static std::string BytesToHex(const std::string &input) {
   std::string result;
@@ -32,6 +67,41 @@ static std::string BytesToHex(const std::string &input) {
   return result;
 }
 
+// Determine from the BAM of source which tracks hold any data. Tracks beyond
+// those covered by the BAM are considered used if source has them. Sets
+// *disc_name and *disc_id to the name (without padding) and ID found in the
+// BAM. Returns true if successful, sets status otherwise.
+static bool GetUsedTracks(DriveInterface *source, size_t num_sectors,
+                          std::vector<bool> *used_tracks,
+                          std::string *disc_name, std::string *disc_id,
+                          IECStatus *status) {
+  std::string bam;
+  if (!source->ReadSector(kBAMSectorNumber, &bam, status)) {
+    return false;
+  }
+  *disc_name = bam.substr(kBAMDiscNameOffset, kBAMDiscNameSize);
+  disc_name->erase(disc_name->find_last_not_of('\xa0') + 1);
+  *disc_id = bam.substr(kBAMDiscIdOffset, 2);
+
+  used_tracks->assign(kMaxTracks + 1, false);
+  for (unsigned int s = 0; s < num_sectors; ++s) {
+    unsigned int track, sector;
+    CBM1541Drive::GetTrackSector(s, &track, &sector);
+    if (track > kNumBAMTracks) {
+      (*used_tracks)[track] = true;
+    }
+  }
+  for (unsigned int track = 1; track <= kNumBAMTracks; ++track) {
+    unsigned char num_free = bam[4 * track];
+    if (num_free < CBM1541Drive::GetNumSectorsOnTrack(track)) {
+      (*used_tracks)[track] = true;
+    }
+  }
+  // The directory track is always needed.
+  (*used_tracks)[kDirectoryTrack] = true;
+  return true;
+}
+
 int main(int argc, char *argv[]) {
   std::cout << "IEC Bus disc copy utility." << std::endl
             << "Copyright (c) 2020 Andreas Eckleder" << std::endl
@@ -39,25 +109,36 @@ int main(int argc, char *argv[]) {
 
   std::string arduino_device;
   int serial_speed = 0;
+  std::string recording;
   bool verify = false;
   std::string source;
   std::string target;
-  bool format = false;
+  std::string format;
+  TraceFile trace;
 
   po::options_description desc("Options");
   desc.add_options()("help", "usage overview")(
       "serial",
       po::value<std::string>(&arduino_device)->default_value("/dev/ttyUSB0"),
-      "serial interface to use")(
+      "serial interface to use, or unix:<path> for a Unix domain socket or "
+      "replay:<path> to play back a recording")(
       "speed", po::value<int>(&serial_speed)->default_value(57600),
-      "baud rate")("verify", po::value<bool>(&verify)->default_value(false),
+      "baud rate")("record",
+                   po::value<std::string>(&recording)->default_value(""),
+                   "record the traffic with the Arduino to this file")(
+      "verify", po::value<bool>(&verify)->default_value(false),
                    "verify copy")(
       "source", po::value<std::string>(&source)->default_value(""),
       "device (e.g. 8, 9) or image to copy from")(
       "target", po::value<std::string>(&target)->default_value(""),
       "device (e.g. 8, 9) or image file to copy to")(
-      "format", po::value<bool>(&format)->default_value(false),
-      "format disc prior to copying");
+      "format", po::value<std::string>(&format)->default_value("false"),
+      "format disc prior to copying: true (all tracks), quick (BAM and "
+      "directory only, disc must be formatted already) or used (only tracks "
+      "used by the source). The latter two only copy tracks in use.")(
+      "trace", po::value<std::string>(&trace.path)->default_value(""),
+      "write a Chrome trace of the copy to this file, including the "
+      "Arduino's markers if built with TRACING");
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -80,8 +161,18 @@ int main(int argc, char *argv[]) {
   }
 
   IECStatus status;
+  std::unique_ptr<Transport> transport =
+      OpenTransport(arduino_device, serial_speed, &status);
+  if (transport && !recording.empty()) {
+    transport =
+        RecordingTransport::Create(std::move(transport), recording, &status);
+  }
+  if (!transport) {
+    std::cout << status.message << std::endl;
+    return 1;
+  }
   std::unique_ptr<IECBusConnection> connection(IECBusConnection::Create(
-      arduino_device, serial_speed,
+      std::move(transport),
       [](char level, const std::string &channel, const std::string &message) {
         std::cout << level << ":" << channel << ": " << message << std::endl;
       },
@@ -90,6 +181,10 @@ int main(int argc, char *argv[]) {
     std::cout << status.message << std::endl;
     return 1;
   }
+  if (!trace.path.empty()) {
+    trace.tracer = std::make_unique<Tracer>();
+    connection->SetTracer(trace.tracer.get());
+  }
 
   if (!connection->Reset(&status)) {
     std::cout << "Reset: " << status.message << std::endl;
@@ -128,32 +223,84 @@ int main(int argc, char *argv[]) {
     std::cout << "Initial target status: " << drive_status << std::endl;
   }
 
-  if (format) {
+  // Copy the entire disc.
+  size_t num_sectors = 0;
+  if (!source_drive->GetNumSectors(&num_sectors, &status)) {
+    std::cout << "Failed to retrieve number of sectors: " << status.message
+              << std::endl;
+    return 1;
+  }
+
+  // Tracks to copy, all of them unless we're told to format just some.
+  std::vector<bool> used_tracks(kMaxTracks + 1, true);
+  if (format == "true") {
     std::cout << "Formatting disc..." << std::endl;
     if (!target_drive->FormatDiscLowLevel(40, &status)) {
       std::cout << "FormatDiscLowLevel: " << status.message << std::endl;
       return 1;
     }
     std::cout << "Formatting complete." << std::endl;
+  } else if (format == "quick" || format == "used") {
+    std::string disc_name, disc_id;
+    if (!GetUsedTracks(source_drive.get(), num_sectors, &used_tracks,
+                       &disc_name, &disc_id, &status)) {
+      std::cout << "Failed to read source BAM: " << status.message
+                << std::endl;
+      return 1;
+    }
+    if (format == "quick") {
+      // The target keeps its own disc ID in the sector headers, the source's
+      // ends up in the BAM when copying the directory track.
+      std::cout << "Quick formatting disc..." << std::endl;
+      if (!target_drive->FormatDiscQuick(disc_name, &status)) {
+        std::cout << "FormatDiscQuick: " << status.message << std::endl;
+        return 1;
+      }
+    } else {
+      // Format consecutive runs of used tracks with the source's disc ID.
+      for (unsigned int first = 1; first <= kMaxTracks; ++first) {
+        if (!used_tracks[first])
+          continue;
+        unsigned int last = first;
+        while (last < kMaxTracks && used_tracks[last + 1])
+          ++last;
+        std::cout << "Formatting tracks " << first << " to " << last << "..."
+                  << std::endl;
+        if (!target_drive->FormatTracks(first, last, disc_id, &status)) {
+          std::cout << "FormatTracks: " << status.message << std::endl;
+          return 1;
+        }
+        first = last;
+      }
+    }
+    std::cout << "Formatting complete." << std::endl;
+  } else if (format != "false") {
+    std::cout << desc << std::endl
+              << "Invalid value for --format: " << format << std::endl;
+    return 2;
   }
 
-  // Copy the entire disc.
-  size_t num_sectors = 0;
-  if (!source_drive->GetNumSectors(&num_sectors, &status)) {
-    std::cout << "Failed to retrieve number of sectors: " << status.message
-              << std::endl;
-    return 1;
-  }
   for (unsigned int s = 0; s < num_sectors; ++s) {
+    unsigned int track, sector;
+    CBM1541Drive::GetTrackSector(s, &track, &sector);
+    if (!used_tracks[track])
+      continue;
+
     std::string current_sector;
-    if (!source_drive->ReadSector(s, &current_sector, &status)) {
-      std::cout << "ReadSector: " << status.message << std::endl;
-      return 1;
+    {
+      TraceSpan span(trace.tracer.get(), "ReadSector");
+      if (!source_drive->ReadSector(s, &current_sector, &status)) {
+        std::cout << "ReadSector: " << status.message << std::endl;
+        return 1;
+      }
     }
 
-    if (!target_drive->WriteSector(s, current_sector, &status)) {
-      std::cout << "WriteSector: " << status.message << std::endl;
-      return 1;
+    {
+      TraceSpan span(trace.tracer.get(), "WriteSector");
+      if (!target_drive->WriteSector(s, current_sector, &status)) {
+        std::cout << "WriteSector: " << status.message << std::endl;
+        return 1;
+      }
     }
 
     if (verify) {
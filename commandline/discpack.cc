@@ -0,0 +1,109 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "boost/filesystem.hpp"
+#include "boost/format.hpp"
+#include "boost/program_options/cmdline.hpp"
+#include "boost/program_options/options_description.hpp"
+#include "boost/program_options/parsers.hpp"
+#include "boost/program_options/positional_options.hpp"
+#include "boost/program_options/variables_map.hpp"
+#include "disc_pack.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+// Print the images in the pack at path along with their sizes.
+static int ListPack(const std::string &path) {
+  DiscPack pack;
+  IECStatus status;
+  if (!pack.Open(path, &status)) {
+    std::cout << status.message << std::endl;
+    return 1;
+  }
+  for (const std::string &name : pack.GetImageNames()) {
+    size_t image;
+    if (!pack.FindImage(name, &image, &status)) {
+      std::cout << status.message << std::endl;
+      return 1;
+    }
+    std::cout << boost::format("%-32s %4u sectors") % name %
+                     pack.GetNumSectors(image)
+              << std::endl;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::cout << "Disc image pack utility." << std::endl
+            << "Copyright (c) 2020 Andreas Eckleder" << std::endl
+            << std::endl;
+
+  std::string output;
+  std::string list;
+  std::vector<std::string> images;
+
+  po::options_description desc("Options");
+  desc.add_options()("help", "usage overview")(
+      "output", po::value<std::string>(&output)->default_value(""),
+      "pack file to create from the images given")(
+      "list", po::value<std::string>(&list)->default_value(""),
+      "pack file to list the images of")(
+      "image", po::value<std::vector<std::string>>(&images),
+      "disc image to add, named after its file name");
+  po::positional_options_description positional;
+  positional.add("image", -1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv)
+                .options(desc)
+                .positional(positional)
+                .run(),
+            vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  if (!list.empty()) {
+    return ListPack(list);
+  }
+
+  if (output.empty() || images.empty()) {
+    std::cout << desc << std::endl
+              << "Either --list or --output and at least one image are "
+                 "required."
+              << std::endl;
+    return 2;
+  }
+
+  DiscPackWriter writer;
+  IECStatus status;
+  for (const std::string &path : images) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    if (!file) {
+      std::cout << "Failed to read " << path << std::endl;
+      return 1;
+    }
+    std::string name = boost::filesystem::path(path).filename().string();
+    if (!writer.AddImage(name, content.str(), &status)) {
+      std::cout << status.message << std::endl;
+      return 1;
+    }
+  }
+  if (!writer.Write(output, &status)) {
+    std::cout << status.message << std::endl;
+    return 1;
+  }
+
+  std::cout << boost::format("Packed %u images, %u sectors stored as %u "
+                             "distinct sectors.") %
+                   images.size() % writer.num_sectors() % writer.num_chunks()
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,702 @@
+// A cycle counting model of a 1541, see drive_emulator.h.
+
+#include "drive_emulator.h"
+
+#include <cstring>
+#include <limits>
+
+namespace {
+
+enum Operation {
+  ILL, ADC, AND, ASL, BCC, BCS, BEQ, BIT, BMI, BNE, BPL, BRK, BVC, BVS, CLC,
+  CLD, CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP, JSR,
+  LDA, LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI, RTS, SBC,
+  SEC, SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA
+};
+
+enum AddressingMode { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IND, IZX,
+                      IZY, REL };
+
+struct OpcodeInfo {
+  uint8_t operation;
+  uint8_t mode;
+  uint8_t cycles;
+};
+
+// Instruction length per addressing mode, same order as AddressingMode.
+const uint8_t kModeLength[] = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2};
+
+// Base cycle count per opcode. Penalties for crossing pages and taking
+// branches are added while executing.
+const OpcodeInfo kOpcodes[256] = {
+    {BRK, IMP, 7}, {ORA, IZX, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 00
+    {ILL, IMP, 2}, {ORA, ZP, 3}, {ASL, ZP, 5}, {ILL, IMP, 2}, // 04
+    {PHP, IMP, 3}, {ORA, IMM, 2}, {ASL, ACC, 2}, {ILL, IMP, 2}, // 08
+    {ILL, IMP, 2}, {ORA, ABS, 4}, {ASL, ABS, 6}, {ILL, IMP, 2}, // 0C
+    {BPL, REL, 2}, {ORA, IZY, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 10
+    {ILL, IMP, 2}, {ORA, ZPX, 4}, {ASL, ZPX, 6}, {ILL, IMP, 2}, // 14
+    {CLC, IMP, 2}, {ORA, ABY, 4}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 18
+    {ILL, IMP, 2}, {ORA, ABX, 4}, {ASL, ABX, 7}, {ILL, IMP, 2}, // 1C
+    {JSR, ABS, 6}, {AND, IZX, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 20
+    {BIT, ZP, 3}, {AND, ZP, 3}, {ROL, ZP, 5}, {ILL, IMP, 2}, // 24
+    {PLP, IMP, 4}, {AND, IMM, 2}, {ROL, ACC, 2}, {ILL, IMP, 2}, // 28
+    {BIT, ABS, 4}, {AND, ABS, 4}, {ROL, ABS, 6}, {ILL, IMP, 2}, // 2C
+    {BMI, REL, 2}, {AND, IZY, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 30
+    {ILL, IMP, 2}, {AND, ZPX, 4}, {ROL, ZPX, 6}, {ILL, IMP, 2}, // 34
+    {SEC, IMP, 2}, {AND, ABY, 4}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 38
+    {ILL, IMP, 2}, {AND, ABX, 4}, {ROL, ABX, 7}, {ILL, IMP, 2}, // 3C
+    {RTI, IMP, 6}, {EOR, IZX, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 40
+    {ILL, IMP, 2}, {EOR, ZP, 3}, {LSR, ZP, 5}, {ILL, IMP, 2}, // 44
+    {PHA, IMP, 3}, {EOR, IMM, 2}, {LSR, ACC, 2}, {ILL, IMP, 2}, // 48
+    {JMP, ABS, 3}, {EOR, ABS, 4}, {LSR, ABS, 6}, {ILL, IMP, 2}, // 4C
+    {BVC, REL, 2}, {EOR, IZY, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 50
+    {ILL, IMP, 2}, {EOR, ZPX, 4}, {LSR, ZPX, 6}, {ILL, IMP, 2}, // 54
+    {CLI, IMP, 2}, {EOR, ABY, 4}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 58
+    {ILL, IMP, 2}, {EOR, ABX, 4}, {LSR, ABX, 7}, {ILL, IMP, 2}, // 5C
+    {RTS, IMP, 6}, {ADC, IZX, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 60
+    {ILL, IMP, 2}, {ADC, ZP, 3}, {ROR, ZP, 5}, {ILL, IMP, 2}, // 64
+    {PLA, IMP, 4}, {ADC, IMM, 2}, {ROR, ACC, 2}, {ILL, IMP, 2}, // 68
+    {JMP, IND, 5}, {ADC, ABS, 4}, {ROR, ABS, 6}, {ILL, IMP, 2}, // 6C
+    {BVS, REL, 2}, {ADC, IZY, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 70
+    {ILL, IMP, 2}, {ADC, ZPX, 4}, {ROR, ZPX, 6}, {ILL, IMP, 2}, // 74
+    {SEI, IMP, 2}, {ADC, ABY, 4}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 78
+    {ILL, IMP, 2}, {ADC, ABX, 4}, {ROR, ABX, 7}, {ILL, IMP, 2}, // 7C
+    {ILL, IMP, 2}, {STA, IZX, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 80
+    {STY, ZP, 3}, {STA, ZP, 3}, {STX, ZP, 3}, {ILL, IMP, 2}, // 84
+    {DEY, IMP, 2}, {ILL, IMP, 2}, {TXA, IMP, 2}, {ILL, IMP, 2}, // 88
+    {STY, ABS, 4}, {STA, ABS, 4}, {STX, ABS, 4}, {ILL, IMP, 2}, // 8C
+    {BCC, REL, 2}, {STA, IZY, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 90
+    {STY, ZPX, 4}, {STA, ZPX, 4}, {STX, ZPY, 4}, {ILL, IMP, 2}, // 94
+    {TYA, IMP, 2}, {STA, ABY, 5}, {TXS, IMP, 2}, {ILL, IMP, 2}, // 98
+    {ILL, IMP, 2}, {STA, ABX, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // 9C
+    {LDY, IMM, 2}, {LDA, IZX, 6}, {LDX, IMM, 2}, {ILL, IMP, 2}, // A0
+    {LDY, ZP, 3}, {LDA, ZP, 3}, {LDX, ZP, 3}, {ILL, IMP, 2}, // A4
+    {TAY, IMP, 2}, {LDA, IMM, 2}, {TAX, IMP, 2}, {ILL, IMP, 2}, // A8
+    {LDY, ABS, 4}, {LDA, ABS, 4}, {LDX, ABS, 4}, {ILL, IMP, 2}, // AC
+    {BCS, REL, 2}, {LDA, IZY, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // B0
+    {LDY, ZPX, 4}, {LDA, ZPX, 4}, {LDX, ZPY, 4}, {ILL, IMP, 2}, // B4
+    {CLV, IMP, 2}, {LDA, ABY, 4}, {TSX, IMP, 2}, {ILL, IMP, 2}, // B8
+    {LDY, ABX, 4}, {LDA, ABX, 4}, {LDX, ABY, 4}, {ILL, IMP, 2}, // BC
+    {CPY, IMM, 2}, {CMP, IZX, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // C0
+    {CPY, ZP, 3}, {CMP, ZP, 3}, {DEC, ZP, 5}, {ILL, IMP, 2}, // C4
+    {INY, IMP, 2}, {CMP, IMM, 2}, {DEX, IMP, 2}, {ILL, IMP, 2}, // C8
+    {CPY, ABS, 4}, {CMP, ABS, 4}, {DEC, ABS, 6}, {ILL, IMP, 2}, // CC
+    {BNE, REL, 2}, {CMP, IZY, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // D0
+    {ILL, IMP, 2}, {CMP, ZPX, 4}, {DEC, ZPX, 6}, {ILL, IMP, 2}, // D4
+    {CLD, IMP, 2}, {CMP, ABY, 4}, {ILL, IMP, 2}, {ILL, IMP, 2}, // D8
+    {ILL, IMP, 2}, {CMP, ABX, 4}, {DEC, ABX, 7}, {ILL, IMP, 2}, // DC
+    {CPX, IMM, 2}, {SBC, IZX, 6}, {ILL, IMP, 2}, {ILL, IMP, 2}, // E0
+    {CPX, ZP, 3}, {SBC, ZP, 3}, {INC, ZP, 5}, {ILL, IMP, 2}, // E4
+    {INX, IMP, 2}, {SBC, IMM, 2}, {NOP, IMP, 2}, {ILL, IMP, 2}, // E8
+    {CPX, ABS, 4}, {SBC, ABS, 4}, {INC, ABS, 6}, {ILL, IMP, 2}, // EC
+    {BEQ, REL, 2}, {SBC, IZY, 5}, {ILL, IMP, 2}, {ILL, IMP, 2}, // F0
+    {ILL, IMP, 2}, {SBC, ZPX, 4}, {INC, ZPX, 6}, {ILL, IMP, 2}, // F4
+    {SED, IMP, 2}, {SBC, ABY, 4}, {ILL, IMP, 2}, {ILL, IMP, 2}, // F8
+    {ILL, IMP, 2}, {SBC, ABX, 4}, {INC, ABX, 7}, {ILL, IMP, 2}, // FC
+};
+
+// Call() makes the routine return here, where nothing in a 1541 executes.
+const uint16_t kSentinelAddress = 0xffff;
+// The reset routine of the 1541 ROM leaves the stack pointer here.
+const uint8_t kInitialStackPointer = 0x45;
+
+const uint16_t kRomStart = 0xc000;
+const uint16_t kVIA1Start = 0x1800;
+const uint16_t kVIA2Start = 0x1c00;
+
+// Registers of the VIAs we model, relative to their start address.
+const uint16_t kVIAPortB = 0x0;
+const uint16_t kVIAPortA = 0x1;
+const uint16_t kVIADDRA = 0x3;
+const uint16_t kVIATimer1CounterLow = 0x4;
+const uint16_t kVIATimer1CounterHigh = 0x5;
+const uint16_t kVIATimer1LatchLow = 0x6;
+const uint16_t kVIATimer1LatchHigh = 0x7;
+const uint16_t kVIAAuxControl = 0xb;
+const uint16_t kVIAPeripheralControl = 0xc;
+const uint16_t kVIAInterruptFlags = 0xd;
+const uint16_t kVIAPortANoHandshake = 0xf;
+
+const uint8_t kVIAInterruptTimer1 = 0x40;
+const uint8_t kVIAAuxControlFreeRunning = 0x40;
+
+// Port B of the disc controller VIA: Inputs for SYNC (active low) and
+// write protect (low if protected).
+const uint8_t kPortBSync = 0x80;
+const uint8_t kPortBWriteProtect = 0x10;
+
+// The ROM sets up the disc controller VIA's peripheral control register
+// like this. CA2 high lets BYTE READY through to the CPU's overflow flag,
+// CB2 low switches the head to writing.
+const uint8_t kPCRReset = 0xee;
+const uint8_t kPCRByteReadyMask = 0x0e;
+const uint8_t kPCRModeMask = 0xe0;
+const uint8_t kPCRWriteMode = 0xc0;
+
+const uint8_t kSyncByte = 0xff;
+
+} // namespace
+
+DriveEmulator::DriveEmulator()
+    : a(0), x(0), y(0), sp(kInitialStackPointer), p(FLAG_U | FLAG_I), pc(0),
+      cycles(0), via2_port_b_(kPortBSync | kPortBWriteProtect),
+      via2_port_a_out_(0), via2_port_a_in_(0), via2_ddr_a_(0),
+      via2_pcr_(kPCRReset), via1_timer_latch_(0), via1_timer_counter_(0),
+      via1_timer_armed_(false), via1_acr_(0), via1_ifr_(0),
+      via1_timer_cycles_(0), track_position_(0), cycles_per_byte_(26),
+      rotating_(false),
+      next_byte_cycles_(std::numeric_limits<uint64_t>::max()),
+      last_byte_cycles_(0), byte_pending_(false),
+      bytes_not_acknowledged_(0), waiting_for_bytes_(false) {
+  memset(ram_, 0, sizeof(ram_));
+  ResetDiscStats();
+}
+
+void DriveEmulator::LoadRAM(uint16_t address, const unsigned char *data,
+                            size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    ram_[(address + i) % sizeof(ram_)] = data[i];
+  }
+}
+
+void DriveEmulator::LoadROM(const unsigned char *data, size_t size) {
+  rom_.assign(data, data + size);
+}
+
+void DriveEmulator::AddRomStub(uint16_t address, const RomStub &stub) {
+  rom_stubs_[address] = stub;
+}
+
+void DriveEmulator::AddWatchPoint(uint16_t address,
+                                  const WatchPoint &watch_point) {
+  watch_points_[address] = watch_point;
+}
+
+void DriveEmulator::AddExitPoint(uint16_t address) {
+  exit_points_.insert(address);
+}
+
+DriveEmulator::StopReason DriveEmulator::Call(uint16_t address,
+                                              uint64_t max_cycles) {
+  // Same stack layout as a JSR from the sentinel address.
+  const uint16_t return_address = kSentinelAddress - 1;
+  Push(return_address >> 8);
+  Push(return_address & 0xff);
+  pc = address;
+
+  const uint64_t cycle_limit = cycles + max_cycles;
+  while (cycles < cycle_limit) {
+    UpdatePeripherals(false);
+    if (pc == kSentinelAddress) {
+      return RETURNED;
+    }
+    if (exit_points_.count(pc)) {
+      return EXIT_POINT;
+    }
+    auto watch_point = watch_points_.find(pc);
+    if (watch_point != watch_points_.end()) {
+      watch_point->second(this);
+    }
+    if (pc >= kRomStart) {
+      auto it = rom_stubs_.find(pc);
+      if (it != rom_stubs_.end()) {
+        it->second(this);
+        // Return as the ROM routine would.
+        pc = Pull();
+        pc = (pc | (Pull() << 8)) + 1;
+        cycles += 6;
+        continue;
+      }
+      if (rom_.empty()) {
+        return MISSING_ROM_STUB;
+      }
+    }
+    StopReason reason;
+    if (!Step(&reason)) {
+      return reason;
+    }
+  }
+  return CYCLE_LIMIT;
+}
+
+void DriveEmulator::Idle(uint64_t idle_cycles) {
+  bytes_not_acknowledged_ = 0;
+  cycles += idle_cycles;
+  UpdatePeripherals(true);
+}
+
+void DriveEmulator::InsertTrack(const std::string &track,
+                                unsigned int cycles_per_byte, bool rotating) {
+  track_ = track;
+  cycles_per_byte_ = cycles_per_byte;
+  rotating_ = rotating;
+  SeekTrack(0);
+}
+
+void DriveEmulator::SeekTrack(size_t position) {
+  track_position_ = position;
+  next_byte_cycles_ = position < track_.size()
+                          ? cycles + cycles_per_byte_
+                          : std::numeric_limits<uint64_t>::max();
+}
+
+bool DriveEmulator::sync() const {
+  // The hardware needs ten one bits in a row, we ask for two SYNC bytes.
+  if (Writing() || track_position_ >= track_.size() ||
+      static_cast<uint8_t>(track_[track_position_]) != kSyncByte) {
+    return false;
+  }
+  size_t size = track_.size();
+  size_t previous = track_position_ > 0 ? track_position_ - 1 : size - 1;
+  size_t next = track_position_ + 1 < size ? track_position_ + 1 : 0;
+  if (!rotating_) {
+    previous = track_position_ > 0 ? previous : track_position_;
+    next = track_position_ + 1 < size ? next : track_position_;
+  }
+  return (previous != track_position_ &&
+          static_cast<uint8_t>(track_[previous]) == kSyncByte) ||
+         (next != track_position_ &&
+          static_cast<uint8_t>(track_[next]) == kSyncByte);
+}
+
+void DriveEmulator::ResetDiscStats() {
+  disc_stats_.bytes = 0;
+  disc_stats_.missed_bytes = 0;
+  disc_stats_.max_service_cycles = 0;
+  byte_pending_ = false;
+  bytes_not_acknowledged_ = 0;
+  waiting_for_bytes_ = false;
+}
+
+bool DriveEmulator::Writing() const {
+  return (via2_pcr_ & kPCRModeMask) == kPCRWriteMode;
+}
+
+void DriveEmulator::UpdatePeripherals(bool idle) {
+  // Timer 1 counts down once per cycle and flags each underflow. Free
+  // running, it restarts from the latch, one shot it only flags once.
+  if (via1_timer_armed_ || (via1_acr_ & kVIAAuxControlFreeRunning)) {
+    via1_timer_counter_ -= cycles - via1_timer_cycles_;
+    while (via1_timer_counter_ < 0) {
+      if (via1_timer_armed_) {
+        via1_ifr_ |= kVIAInterruptTimer1;
+      }
+      if (via1_acr_ & kVIAAuxControlFreeRunning) {
+        via1_timer_counter_ += via1_timer_latch_ + 2;
+      } else {
+        via1_timer_armed_ = false;
+        via1_timer_counter_ += 0x10000;
+      }
+    }
+  }
+  via1_timer_cycles_ = cycles;
+
+  while (next_byte_cycles_ <= cycles) {
+    // During SYNC, the disc controller doesn't signal any bytes.
+    bool byte_ready = !sync();
+    if (Writing()) {
+      if (via2_ddr_a_ != 0) {
+        track_[track_position_] = via2_port_a_out_;
+      }
+    } else {
+      via2_port_a_in_ = track_[track_position_];
+    }
+    if (byte_ready && (via2_pcr_ & kPCRByteReadyMask) == kPCRByteReadyMask) {
+      ++disc_stats_.bytes;
+      p |= FLAG_V;
+      last_byte_cycles_ = next_byte_cycles_;
+      byte_pending_ = !idle;
+      bytes_not_acknowledged_ = idle ? 0 : bytes_not_acknowledged_ + 1;
+    }
+    if (++track_position_ == track_.size()) {
+      if (!rotating_) {
+        next_byte_cycles_ = std::numeric_limits<uint64_t>::max();
+        break;
+      }
+      track_position_ = 0;
+    }
+    next_byte_cycles_ += cycles_per_byte_;
+  }
+}
+
+uint8_t DriveEmulator::ReadMemory(uint16_t address) {
+  if (address < kVIA1Start) {
+    return ram_[address % sizeof(ram_)];
+  }
+  if (address < kVIA2Start) {
+    switch (address & 0x0f) {
+    case kVIATimer1CounterLow:
+      via1_ifr_ &= ~kVIAInterruptTimer1;
+      return via1_timer_counter_ & 0xff;
+    case kVIATimer1CounterHigh:
+      return (via1_timer_counter_ >> 8) & 0xff;
+    case kVIATimer1LatchLow:
+      return via1_timer_latch_ & 0xff;
+    case kVIATimer1LatchHigh:
+      return via1_timer_latch_ >> 8;
+    case kVIAAuxControl:
+      return via1_acr_;
+    case kVIAInterruptFlags:
+      return via1_ifr_;
+    default:
+      return 0;
+    }
+  }
+  if (address < kRomStart) {
+    switch (address & 0x0f) {
+    case kVIAPortB:
+      return (via2_port_b_ & ~kPortBSync) | (sync() ? 0 : kPortBSync);
+    case kVIAPortA:
+    case kVIAPortANoHandshake:
+      return via2_port_a_in_;
+    case kVIADDRA:
+      return via2_ddr_a_;
+    case kVIAPeripheralControl:
+      return via2_pcr_;
+    default:
+      return 0;
+    }
+  }
+  if (rom_.empty()) {
+    return 0;
+  }
+  return rom_[(address - kRomStart) % rom_.size()];
+}
+
+void DriveEmulator::WriteMemory(uint16_t address, uint8_t value) {
+  if (address < kVIA1Start) {
+    ram_[address % sizeof(ram_)] = value;
+  } else if (address < kVIA2Start) {
+    switch (address & 0x0f) {
+    case kVIATimer1CounterLow:
+    case kVIATimer1LatchLow:
+      via1_timer_latch_ = (via1_timer_latch_ & 0xff00) | value;
+      break;
+    case kVIATimer1CounterHigh:
+      via1_timer_latch_ = (via1_timer_latch_ & 0x00ff) | (value << 8);
+      via1_timer_counter_ = via1_timer_latch_;
+      via1_timer_armed_ = true;
+      via1_ifr_ &= ~kVIAInterruptTimer1;
+      break;
+    case kVIATimer1LatchHigh:
+      via1_timer_latch_ = (via1_timer_latch_ & 0x00ff) | (value << 8);
+      break;
+    case kVIAAuxControl:
+      via1_acr_ = value;
+      break;
+    case kVIAInterruptFlags:
+      via1_ifr_ &= ~value;
+      break;
+    }
+  } else if (address < kRomStart) {
+    switch (address & 0x0f) {
+    case kVIAPortB:
+      // SYNC and write protect are inputs.
+      via2_port_b_ = (via2_port_b_ & (kPortBSync | kPortBWriteProtect)) |
+                     (value & ~(kPortBSync | kPortBWriteProtect));
+      break;
+    case kVIAPortA:
+    case kVIAPortANoHandshake:
+      via2_port_a_out_ = value;
+      break;
+    case kVIADDRA:
+      via2_ddr_a_ = value;
+      break;
+    case kVIAPeripheralControl:
+      via2_pcr_ = value;
+      break;
+    }
+  }
+}
+
+void DriveEmulator::Push(uint8_t value) {
+  WriteMemory(0x0100 | sp, value);
+  --sp;
+}
+
+uint8_t DriveEmulator::Pull() {
+  ++sp;
+  return ReadMemory(0x0100 | sp);
+}
+
+void DriveEmulator::SetNZ(uint8_t value) {
+  p = (p & ~(FLAG_N | FLAG_Z)) | (value & FLAG_N) | (value ? 0 : FLAG_Z);
+}
+
+void DriveEmulator::Compare(uint8_t reg, uint8_t value) {
+  SetNZ(reg - value);
+  if (reg >= value) {
+    p |= FLAG_C;
+  } else {
+    p &= ~FLAG_C;
+  }
+}
+
+void DriveEmulator::AddWithCarry(uint8_t value) {
+  unsigned int carry = p & FLAG_C;
+  unsigned int result = a + value + carry;
+  p &= ~(FLAG_C | FLAG_V);
+  if (~(a ^ value) & (a ^ result) & 0x80) {
+    p |= FLAG_V;
+  }
+  if (p & FLAG_D) {
+    // NMOS decimal mode, N, V and Z are taken from the binary result.
+    unsigned int lo = (a & 0x0f) + (value & 0x0f) + carry;
+    unsigned int hi = (a & 0xf0) + (value & 0xf0);
+    if (lo > 0x09) {
+      lo += 0x06;
+      hi += 0x10;
+    }
+    if (hi > 0x90) {
+      hi += 0x60;
+    }
+    SetNZ(result);
+    if (hi > 0xff) {
+      p |= FLAG_C;
+    }
+    a = (hi & 0xf0) | (lo & 0x0f);
+  } else {
+    if (result > 0xff) {
+      p |= FLAG_C;
+    }
+    a = result;
+    SetNZ(a);
+  }
+}
+
+void DriveEmulator::SubtractWithCarry(uint8_t value) {
+  if (!(p & FLAG_D)) {
+    AddWithCarry(~value);
+    return;
+  }
+  unsigned int borrow = (p & FLAG_C) ? 0 : 1;
+  int lo = (a & 0x0f) - (value & 0x0f) - borrow;
+  int hi = (a & 0xf0) - (value & 0xf0);
+  if (lo < 0) {
+    lo -= 0x06;
+    hi -= 0x10;
+  }
+  if (hi < 0) {
+    hi -= 0x60;
+  }
+  // Flags as in binary mode.
+  unsigned int result = a - value - borrow;
+  p &= ~(FLAG_C | FLAG_V);
+  if ((a ^ value) & (a ^ result) & 0x80) {
+    p |= FLAG_V;
+  }
+  if (result < 0x100) {
+    p |= FLAG_C;
+  }
+  SetNZ(result);
+  a = (hi & 0xf0) | (lo & 0x0f);
+}
+
+bool DriveEmulator::Step(StopReason *reason) {
+  uint8_t opcode = ReadMemory(pc);
+  const OpcodeInfo &info = kOpcodes[opcode];
+  // Drive code has no business executing BRK, the ROM would only report an
+  // error. Stop instead, as for undocumented opcodes.
+  if (info.operation == ILL || info.operation == BRK) {
+    *reason = ILLEGAL_OPCODE;
+    return false;
+  }
+  uint8_t length = kModeLength[info.mode];
+  uint16_t operand = 0;
+  if (length > 1) {
+    operand = ReadMemory(pc + 1);
+  }
+  if (length > 2) {
+    operand |= ReadMemory(pc + 2) << 8;
+  }
+  const uint64_t start_cycles = cycles;
+  pc += length;
+  cycles += info.cycles;
+
+  // Resolve the effective address.
+  uint16_t ea = 0;
+  bool page_crossed = false;
+  switch (info.mode) {
+  case ZP:
+  case ABS:
+    ea = operand;
+    break;
+  case ZPX:
+    ea = (operand + x) & 0xff;
+    break;
+  case ZPY:
+    ea = (operand + y) & 0xff;
+    break;
+  case ABX:
+    ea = operand + x;
+    page_crossed = (ea ^ operand) & 0xff00;
+    break;
+  case ABY:
+    ea = operand + y;
+    page_crossed = (ea ^ operand) & 0xff00;
+    break;
+  case IND:
+    // The NMOS 6502 doesn't carry into the high byte of the pointer.
+    ea = ReadMemory(operand) |
+         (ReadMemory((operand & 0xff00) | ((operand + 1) & 0xff)) << 8);
+    break;
+  case IZX: {
+    uint8_t zp = operand + x;
+    ea = ReadMemory(zp) | (ReadMemory(static_cast<uint8_t>(zp + 1)) << 8);
+    break;
+  }
+  case IZY: {
+    uint16_t base = ReadMemory(operand) |
+                    (ReadMemory(static_cast<uint8_t>(operand + 1)) << 8);
+    ea = base + y;
+    page_crossed = (ea ^ base) & 0xff00;
+    break;
+  }
+  case REL:
+    ea = pc + static_cast<int8_t>(operand);
+    break;
+  default:
+    break;
+  }
+
+  // Fetches the operand of instructions reading memory (or the immediate).
+  auto value = [&]() -> uint8_t {
+    if (info.mode == IMM) {
+      return operand;
+    }
+    if (page_crossed) {
+      ++cycles;
+    }
+    return ReadMemory(ea);
+  };
+  auto branch = [&](bool condition) {
+    if (condition) {
+      cycles += ((ea ^ pc) & 0xff00) ? 2 : 1;
+      pc = ea;
+    }
+  };
+
+  uint8_t v;
+  switch (info.operation) {
+  case ADC: AddWithCarry(value()); break;
+  case SBC: SubtractWithCarry(value()); break;
+  case AND: a &= value(); SetNZ(a); break;
+  case ORA: a |= value(); SetNZ(a); break;
+  case EOR: a ^= value(); SetNZ(a); break;
+  case LDA: a = value(); SetNZ(a); break;
+  case LDX: x = value(); SetNZ(x); break;
+  case LDY: y = value(); SetNZ(y); break;
+  case CMP: Compare(a, value()); break;
+  case CPX: Compare(x, value()); break;
+  case CPY: Compare(y, value()); break;
+  case BIT:
+    v = ReadMemory(ea);
+    p = (p & ~(FLAG_N | FLAG_V | FLAG_Z)) | (v & (FLAG_N | FLAG_V)) |
+        ((a & v) ? 0 : FLAG_Z);
+    break;
+
+  case STA: WriteMemory(ea, a); break;
+  case STX: WriteMemory(ea, x); break;
+  case STY: WriteMemory(ea, y); break;
+
+  case ASL:
+  case LSR:
+  case ROL:
+  case ROR: {
+    v = info.mode == ACC ? a : ReadMemory(ea);
+    uint8_t carry_in = p & FLAG_C;
+    p &= ~FLAG_C;
+    if (info.operation == ASL || info.operation == ROL) {
+      p |= v >> 7;
+      v = (v << 1) | (info.operation == ROL ? carry_in : 0);
+    } else {
+      p |= v & FLAG_C;
+      v = (v >> 1) | (info.operation == ROR ? carry_in << 7 : 0);
+    }
+    SetNZ(v);
+    if (info.mode == ACC) {
+      a = v;
+    } else {
+      WriteMemory(ea, v);
+    }
+    break;
+  }
+  case INC: v = ReadMemory(ea) + 1; SetNZ(v); WriteMemory(ea, v); break;
+  case DEC: v = ReadMemory(ea) - 1; SetNZ(v); WriteMemory(ea, v); break;
+  case INX: SetNZ(++x); break;
+  case INY: SetNZ(++y); break;
+  case DEX: SetNZ(--x); break;
+  case DEY: SetNZ(--y); break;
+
+  case TAX: x = a; SetNZ(x); break;
+  case TAY: y = a; SetNZ(y); break;
+  case TXA: a = x; SetNZ(a); break;
+  case TYA: a = y; SetNZ(a); break;
+  case TSX: x = sp; SetNZ(x); break;
+  case TXS: sp = x; break;
+
+  case PHA: Push(a); break;
+  case PHP: Push(p | FLAG_B | FLAG_U); break;
+  case PLA: a = Pull(); SetNZ(a); break;
+  case PLP: p = Pull() | FLAG_U; break;
+
+  case BCC: branch(!(p & FLAG_C)); break;
+  case BCS: branch(p & FLAG_C); break;
+  case BNE: branch(!(p & FLAG_Z)); break;
+  case BEQ: branch(p & FLAG_Z); break;
+  case BPL: branch(!(p & FLAG_N)); break;
+  case BMI: branch(p & FLAG_N); break;
+  case BVS: branch(p & FLAG_V); break;
+  case BVC:
+    waiting_for_bytes_ = true;
+    // Waiting for the next byte again means the last one was dealt with.
+    if (!(p & FLAG_V) && byte_pending_) {
+      uint64_t service_cycles = start_cycles - last_byte_cycles_;
+      if (service_cycles > disc_stats_.max_service_cycles) {
+        disc_stats_.max_service_cycles = service_cycles;
+      }
+      byte_pending_ = false;
+    }
+    branch(!(p & FLAG_V));
+    break;
+
+  case JMP: pc = ea; break;
+  case JSR:
+    --pc;
+    Push(pc >> 8);
+    Push(pc & 0xff);
+    pc = ea;
+    break;
+  case RTS:
+    pc = Pull();
+    pc = (pc | (Pull() << 8)) + 1;
+    break;
+  case RTI:
+    p = Pull() | FLAG_U;
+    pc = Pull();
+    pc |= Pull() << 8;
+    break;
+
+  case CLC: p &= ~FLAG_C; break;
+  case SEC: p |= FLAG_C; break;
+  case CLI: p &= ~FLAG_I; break;
+  case SEI: p |= FLAG_I; break;
+  case CLD: p &= ~FLAG_D; break;
+  case SED: p |= FLAG_D; break;
+  case CLV:
+    // Acknowledging more than one byte means the others were lost. Unless
+    // the code didn't wait for any since the last CLV, like the ROM after
+    // finding a SYNC: Then it skips whatever arrived on purpose.
+    if (!waiting_for_bytes_) {
+      byte_pending_ = false;
+    } else if (bytes_not_acknowledged_ > 1) {
+      disc_stats_.missed_bytes += bytes_not_acknowledged_ - 1;
+    }
+    bytes_not_acknowledged_ = 0;
+    waiting_for_bytes_ = false;
+    p &= ~FLAG_V;
+    break;
+  case NOP: break;
+  }
+  return true;
+}
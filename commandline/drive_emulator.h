@@ -0,0 +1,175 @@
+// A cycle counting model of the parts of a 1541 our drive code runs against:
+// The 6502, 2KB of RAM, the 16KB DOS ROM, the VIA timer and the disc
+// controller VIA with the head passing over a track. With the ROM loaded,
+// the ROM routines our code calls into run as on the drive. Stubs can still
+// replace single routines, for parts of the drive that aren't modelled (like
+// moving the head). This allows measuring whether the code in assembly/ keeps
+// up with the bytes coming from or going to the disc, without hardware.
+//
+// This doesn't reuse the 6502 core of the Qt host (cpu6502.cpp): That one
+// depends on Qt, caches decoded instructions instead of fetching opcodes
+// through the bus and accounts for time per instruction only. Here, BYTE READY
+// has to reach the overflow flag and the VIA timer has to count between any
+// two instructions, and every cycle of a byte loop matters.
+
+#ifndef DRIVE_EMULATOR_H
+#define DRIVE_EMULATOR_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class DriveEmulator {
+public:
+  // Why Call() returned.
+  enum StopReason {
+    RETURNED,         // The called routine returned with RTS.
+    EXIT_POINT,       // Execution reached an address added by AddExitPoint().
+    CYCLE_LIMIT,      // The cycle budget was used up.
+    MISSING_ROM_STUB, // Execution reached ROM, but neither is the ROM loaded
+                      // nor is there a stub for the address.
+    ILLEGAL_OPCODE    // An undocumented opcode (or BRK) was about to execute.
+  };
+
+  // Status register flags.
+  enum Flags {
+    FLAG_C = 0x01,
+    FLAG_Z = 0x02,
+    FLAG_I = 0x04,
+    FLAG_D = 0x08,
+    FLAG_B = 0x10,
+    FLAG_U = 0x20,
+    FLAG_V = 0x40, // Connected to BYTE READY from the disc controller.
+    FLAG_N = 0x80
+  };
+
+  // Stands in for a ROM routine. May inspect and modify registers and memory
+  // and spend time with Idle(). The emulator returns from the routine (RTS)
+  // once the stub is done.
+  typedef std::function<void(DriveEmulator *emulator)> RomStub;
+
+  // Called when execution reaches a watch point, before the instruction
+  // there executes. May inspect and modify registers and memory.
+  typedef std::function<void(DriveEmulator *emulator)> WatchPoint;
+
+  // Timing statistics for the bytes passing under the head.
+  struct DiscStats {
+    // Number of bytes that passed under the head.
+    uint64_t bytes;
+    // Bytes that arrived, but were followed by another one before the code
+    // acknowledged them with CLV.
+    uint64_t missed_bytes;
+    // The longest time, in cycles, between a byte arriving and the code
+    // waiting for the next one again (BVC with V clear). To keep up, this
+    // has to stay below the number of cycles per byte.
+    unsigned int max_service_cycles;
+  };
+
+  DriveEmulator();
+
+  // Copy size bytes of data to RAM, starting at address.
+  void LoadRAM(uint16_t address, const unsigned char *data, size_t size);
+  // Load the DOS ROM, the 16KB mapped to $c000-$ffff (other/dos1541).
+  void LoadROM(const unsigned char *data, size_t size);
+  // Access memory like the CPU does, including the VIA registers.
+  uint8_t ReadMemory(uint16_t address);
+  void WriteMemory(uint16_t address, uint8_t value);
+
+  // Run stub instead of the ROM routine at address.
+  void AddRomStub(uint16_t address, const RomStub &stub);
+  // Call watch_point whenever execution reaches address, in RAM or ROM.
+  void AddWatchPoint(uint16_t address, const WatchPoint &watch_point);
+  // Stop executing when reaching address, typically a ROM routine the code
+  // jumps to when it's done (like the end of the job loop).
+  void AddExitPoint(uint16_t address);
+
+  // Run the routine at address as if called with JSR, until it returns or
+  // stops otherwise, for at most max_cycles cycles.
+  StopReason Call(uint16_t address, uint64_t max_cycles);
+
+  // Let time pass without executing anything, for use by ROM stubs.
+  // Bytes passing under the head during that time are never missed.
+  void Idle(uint64_t cycles);
+
+  // Put a track under the head. It's rotating at cycles_per_byte (26 to 32
+  // cycles from the fastest zone to the slowest). If rotating is false,
+  // the head leaves the track after its last byte and no further bytes arrive.
+  void InsertTrack(const std::string &track, unsigned int cycles_per_byte,
+                   bool rotating);
+  // Move the head to position within the track. The byte at position arrives
+  // one full byte time from now.
+  void SeekTrack(size_t position);
+  // Current content of the track, including everything written to it.
+  const std::string &track() const { return track_; }
+  // Position of the next byte to arrive.
+  size_t track_position() const { return track_position_; }
+  // True while the head is over a SYNC mark.
+  bool sync() const;
+
+  // Statistics since the last ResetDiscStats().
+  const DiscStats &disc_stats() const { return disc_stats_; }
+  void ResetDiscStats();
+
+  // CPU registers, public so tests and stubs can set up and inspect them.
+  uint8_t a, x, y, sp, p;
+  uint16_t pc;
+  // Number of cycles since construction.
+  uint64_t cycles;
+
+private:
+  void Push(uint8_t value);
+  uint8_t Pull();
+  void SetNZ(uint8_t value);
+  void Compare(uint8_t reg, uint8_t value);
+  void AddWithCarry(uint8_t value);
+  void SubtractWithCarry(uint8_t value);
+  // Execute one instruction. Returns false (and why) if execution has to stop.
+  bool Step(StopReason *reason);
+  // Advance the disc and the VIA timer up to the current cycle count.
+  void UpdatePeripherals(bool idle);
+  // True if the disc controller is set up to write to the disc.
+  bool Writing() const;
+
+  uint8_t ram_[0x800];
+  // Empty until LoadROM().
+  std::vector<uint8_t> rom_;
+  std::map<uint16_t, RomStub> rom_stubs_;
+  std::map<uint16_t, WatchPoint> watch_points_;
+  std::set<uint16_t> exit_points_;
+
+  // Disc controller VIA.
+  uint8_t via2_port_b_;
+  uint8_t via2_port_a_out_;
+  uint8_t via2_port_a_in_;
+  uint8_t via2_ddr_a_;
+  uint8_t via2_pcr_;
+
+  // Timer 1 of the other VIA, free running or one shot.
+  uint16_t via1_timer_latch_;
+  int32_t via1_timer_counter_;
+  bool via1_timer_armed_;
+  uint8_t via1_acr_;
+  uint8_t via1_ifr_;
+  uint64_t via1_timer_cycles_;
+
+  std::string track_;
+  size_t track_position_;
+  unsigned int cycles_per_byte_;
+  bool rotating_;
+  // Cycle count at which the next byte arrives.
+  uint64_t next_byte_cycles_;
+  // Cycle count at which the last byte arrived, and whether the code is
+  // still busy with it.
+  uint64_t last_byte_cycles_;
+  bool byte_pending_;
+  // Bytes that arrived since the code last acknowledged one with CLV.
+  unsigned int bytes_not_acknowledged_;
+  // True if the code waited for a byte (BVC) since it last acknowledged one.
+  bool waiting_for_bytes_;
+  DiscStats disc_stats_;
+};
+
+#endif // DRIVE_EMULATOR_H
@@ -0,0 +1,396 @@
+#include "drive_emulator.h"
+
+#include "assembly/dos1541_h.h"
+#include "assembly/format_h.h"
+#include "assembly/gcr_decode_h.h"
+#include "assembly/rw_block_h.h"
+#include "gcr.h"
+#include "gtest/gtest.h"
+
+// ROM routines and locations used by the drive code, see
+// assembly/definitions.asm.
+static const uint16_t kDcEndOfJobLoop = 0xf99c;
+static const uint16_t kDcEndJobLoopWithStatus = 0xf969;
+static const uint16_t kDcSearchBlockHeader = 0xf510;
+static const uint16_t kDcSetHeadToRead = 0xfe00;
+static const uint16_t kReadConvertGCRToBinary = 0xf8e0;
+static const uint16_t kFormatCalculateChecksum = 0xf5e9;
+static const uint16_t kFormatConvertContentToGCR = 0xf78f;
+static const uint16_t kFormatConvertGCRToBinary = 0xf5f2;
+// The RTS of dc_search_block_header once it found the header, of
+// dc_wait_for_sync once it found a SYNC and of format_write_empty_track.
+static const uint16_t kDcSearchBlockHeaderFound = 0xf54d;
+static const uint16_t kDcWaitForSyncFound = 0xf56d;
+static const uint16_t kFormatWriteEmptyTrackDone = 0xfe2f;
+
+static const uint16_t kInputBuffer = 0x0200;
+static const uint16_t kAuxBuffer = 0x01bb;
+static const size_t kNumAuxBytes = 69;
+static const uint16_t kDriveCodeStart = 0x0500;
+static const uint16_t kGCRDecodeStart = 0x0300;
+
+// Cycles per byte in the fastest speed zone (tracks 1 to 17). Anything
+// keeping up with this keeps up everywhere.
+static const unsigned int kCyclesPerByteZone1 = 26;
+// Cycles per byte in the slowest speed zone (tracks 31 to 35).
+static const unsigned int kCyclesPerByteZone4 = 32;
+// Cycles per revolution at 300 rpm.
+static const unsigned int kCyclesPerRevolution = 200000;
+
+// Budgets for the longest time a byte loop takes to get back to waiting for
+// the next byte, in cycles. These are what the code achieves today, lower is
+// better. They have to stay below kCyclesPerByteZone1.
+static const unsigned int kReadServiceBudget = 21;
+static const unsigned int kWriteServiceBudget = 20;
+static const unsigned int kFormatWriteServiceBudget = 24;
+// Verifying compares each sector header like the ROM's header search does
+// (see kHeaderSearchServiceBudget) before its data block.
+static const unsigned int kVerifyServiceBudget = 23;
+// Formatting a track, including measuring it. Most of the time goes into
+// measuring: Each attempt to get the SYNC areas to half the track each
+// takes four revolutions.
+static const unsigned int kFormatTrackRevolutionsBudget = 27;
+
+// Budgets for the ROM routines the drive code relies on, in cycles, as
+// measured on the ROM in other/dos1541. Searching a header has to keep up
+// with the disc like our own byte loops. Converting between GCR and binary
+// and building checksums happens between sectors, and the time it takes
+// decides how many sectors pass under the head meanwhile.
+static const unsigned int kHeaderSearchServiceBudget = 23;
+static const unsigned int kReadConvertGCRToBinaryBudget = 22884;
+static const unsigned int kFormatConvertContentToGCRBudget = 22687;
+static const unsigned int kFormatConvertGCRToBinaryBudget = 27090;
+static const unsigned int kFormatCalculateChecksumBudget = 2569;
+// The table driven decoder in assembly/gcr_decode.asm, for comparison with
+// kReadConvertGCRToBinaryBudget.
+static const unsigned int kTableGCRDecodeBudget = 22854;
+
+class DriveEmulatorTest : public ::testing::Test {
+protected:
+  // Load the ROM and set up the state its reset routine and job loop leave
+  // behind when running a job for buffer 2 on track and sector of a disc
+  // with ID "AE".
+  void SetUpROM(unsigned int track, unsigned int sector) {
+    emulator_.LoadROM(dos1541_bin, sizeof(dos1541_bin));
+    emulator_.WriteMemory(0x12, 'A'); // disc_id_0
+    emulator_.WriteMemory(0x13, 'E'); // disc_id_1
+    emulator_.WriteMemory(0x0a, track);  // track_for_job_buffer_2
+    emulator_.WriteMemory(0x0b, sector); // sector_for_job_buffer_2
+    emulator_.WriteMemory(0x32, 0x0a);   // current_buffer_track_ptr
+    emulator_.WriteMemory(0x33, 0x00);
+    emulator_.WriteMemory(0x39, 0x08); // sector_header_signature_byte
+    emulator_.WriteMemory(0x3d, 0x00); // Drive number.
+    emulator_.WriteMemory(0x47, 0x07); // data_block_identifier
+  }
+
+  // A track of three sectors, each sector filled with its number.
+  static std::vector<std::string> TrackContent() {
+    std::vector<std::string> content;
+    for (int i = 0; i < 3; ++i) {
+      content.push_back(std::string(256, char(i)));
+    }
+    return content;
+  }
+
+  void WriteMemory(uint16_t address, const std::string &data) {
+    emulator_.LoadRAM(address,
+                      reinterpret_cast<const unsigned char *>(data.data()),
+                      data.size());
+  }
+
+  std::string ReadMemory(uint16_t address, size_t size) {
+    std::string result;
+    for (size_t i = 0; i < size; ++i) {
+      result.append(1, char(emulator_.ReadMemory(address + i)));
+    }
+    return result;
+  }
+
+  static uint8_t Checksum(const std::string &content) {
+    uint8_t checksum = 0;
+    for (char c : content) {
+      checksum ^= static_cast<uint8_t>(c);
+    }
+    return checksum;
+  }
+
+  static std::string SectorContent() {
+    std::string content;
+    for (int i = 0; i < 256; ++i) {
+      content.append(1, char(i * 7));
+    }
+    return content;
+  }
+
+  // Measure the timing of our own code only, from where the ROM found the
+  // sector (and the SYNC following its header, for reading) on.
+  void WatchSectorFound() {
+    auto reset_stats = [](DriveEmulator *e) { e->ResetDiscStats(); };
+    emulator_.AddWatchPoint(kDcSearchBlockHeaderFound, reset_stats);
+    emulator_.AddWatchPoint(kDcWaitForSyncFound, reset_stats);
+  }
+
+  // Run the format code for track 1 on a blank, rotating track until it has
+  // moved the head there.
+  void StartFormatting() {
+    SetUpROM(1, 0);
+    emulator_.LoadRAM(kDriveCodeStart, format_bin, sizeof(format_bin));
+    // M-E<lo><hi><first track><end track><disc id>.
+    WriteMemory(kInputBuffer + 5, "\x01\x02" "AE");
+    emulator_.WriteMemory(0x30, 0x00); // current_buffer_start_low
+    emulator_.WriteMemory(0x43, 21);   // current_track_sector_count
+    emulator_.WriteMemory(0x51, 0xff); // format_current_track: not formatting.
+    WriteMemory(0x0400, SectorContent());
+
+    const unsigned int kTrackSize = kCyclesPerRevolution / kCyclesPerByteZone1;
+    emulator_.InsertTrack(std::string(kTrackSize, 0x55), kCyclesPerByteZone1,
+                          true);
+    emulator_.AddExitPoint(kDcEndOfJobLoop);
+    emulator_.AddExitPoint(kDcEndJobLoopWithStatus);
+
+    // The first run sets up formatting and asks for the head to be moved.
+    ASSERT_EQ(emulator_.Call(kDriveCodeStart, 1000), DriveEmulator::EXIT_POINT);
+    EXPECT_EQ(emulator_.pc, kDcEndOfJobLoop);
+    EXPECT_EQ(emulator_.ReadMemory(0x51), 1);
+
+    // The head is on track 1 now: current_buffer_track_ptr points to the
+    // track of buffer 2.
+    emulator_.WriteMemory(0x32, 0x0a);
+    emulator_.WriteMemory(0x33, 0x00);
+    emulator_.WriteMemory(0x0a, 1);
+    emulator_.sp = 0x45;
+  }
+
+  DriveEmulator emulator_;
+};
+
+TEST_F(DriveEmulatorTest, CycleCountTest) {
+  // ldx #$05; loop: dex; bne loop; lda $0600,x; lda $06ff,x; rts
+  const unsigned char code[] = {0xa2, 0x05, 0xca, 0xd0, 0xfd, 0xbd,
+                                0x00, 0x06, 0xe8, 0xbd, 0xff, 0x06, 0x60};
+  emulator_.LoadRAM(0x0300, code, sizeof(code));
+  EXPECT_EQ(emulator_.Call(0x0300, 1000), DriveEmulator::RETURNED);
+  // 2 + 5 * (2 + 3) - 1 + 4 + 2 + (4 + 1 for crossing a page) + 6.
+  EXPECT_EQ(emulator_.cycles, 43u);
+
+  // Code running into ROM needs a stub.
+  const unsigned char call_rom[] = {0x20, 0x0a, 0xe6, 0x60};
+  emulator_.LoadRAM(0x0300, call_rom, sizeof(call_rom));
+  EXPECT_EQ(emulator_.Call(0x0300, 1000), DriveEmulator::MISSING_ROM_STUB);
+  emulator_.AddRomStub(0xe60a, [](DriveEmulator *e) { e->a = 0x42; });
+  emulator_.sp = 0x45;
+  EXPECT_EQ(emulator_.Call(0x0300, 1000), DriveEmulator::RETURNED);
+  EXPECT_EQ(emulator_.a, 0x42);
+}
+
+TEST_F(DriveEmulatorTest, ReadBlockTimingTest) {
+  SetUpROM(1, 1);
+  emulator_.LoadRAM(kDriveCodeStart, rw_block_bin, sizeof(rw_block_bin));
+  // M-E<lo><hi><track><sector><0 for reading>.
+  WriteMemory(kInputBuffer + 5, std::string("\x01\x01\x00", 3));
+
+  std::vector<std::string> content = TrackContent();
+  content[1] = SectorContent();
+  emulator_.InsertTrack(EncodeTrack(1, "AE", content), kCyclesPerByteZone1,
+                        true);
+  WatchSectorFound();
+  emulator_.AddExitPoint(kDcEndJobLoopWithStatus);
+
+  ASSERT_EQ(emulator_.Call(kDriveCodeStart, 2 * kCyclesPerRevolution),
+            DriveEmulator::EXIT_POINT);
+  EXPECT_EQ(emulator_.a, 0x01);
+  EXPECT_EQ(ReadMemory(0x0600, 256), SectorContent());
+
+  const DriveEmulator::DiscStats &stats = emulator_.disc_stats();
+  EXPECT_EQ(stats.missed_bytes, 0u);
+  EXPECT_LE(stats.max_service_cycles, kReadServiceBudget);
+}
+
+TEST_F(DriveEmulatorTest, WriteGCRBlockTimingTest) {
+  SetUpROM(1, 1);
+  emulator_.LoadRAM(kDriveCodeStart, rw_block_bin, sizeof(rw_block_bin));
+  // M-E<lo><hi><track><sector><2 for writing a GCR block>.
+  WriteMemory(kInputBuffer + 5, std::string("\x01\x01\x02", 3));
+  std::string block = EncodeDataBlock(SectorContent());
+  WriteMemory(kAuxBuffer, block.substr(0, kNumAuxBytes));
+  WriteMemory(0x0400, block.substr(kNumAuxBytes));
+
+  std::vector<std::string> content = TrackContent();
+  emulator_.InsertTrack(EncodeTrack(1, "AE", content), kCyclesPerByteZone1,
+                        true);
+  WatchSectorFound();
+  emulator_.AddExitPoint(kDcEndJobLoopWithStatus);
+
+  ASSERT_EQ(emulator_.Call(kDriveCodeStart, 2 * kCyclesPerRevolution),
+            DriveEmulator::EXIT_POINT);
+  EXPECT_EQ(emulator_.a, 0x01);
+
+  // The new block replaced the old one, without touching the others.
+  content[1] = SectorContent();
+  std::vector<GCRSector> sectors = DecodeTrack(emulator_.track());
+  ASSERT_EQ(sectors.size(), content.size());
+  for (const GCRSector &sector : sectors) {
+    ASSERT_LT(sector.header.sector, content.size());
+    EXPECT_TRUE(sector.content_ok);
+    EXPECT_EQ(sector.content, content[sector.header.sector]);
+  }
+
+  const DriveEmulator::DiscStats &stats = emulator_.disc_stats();
+  EXPECT_EQ(stats.missed_bytes, 0u);
+  EXPECT_LE(stats.max_service_cycles, kWriteServiceBudget);
+}
+
+TEST_F(DriveEmulatorTest, RomRoutinesTimingTest) {
+  SetUpROM(1, 1);
+  emulator_.InsertTrack(EncodeTrack(1, "AE", TrackContent()),
+                        kCyclesPerByteZone1, true);
+  ASSERT_EQ(emulator_.Call(kDcSearchBlockHeader, 2 * kCyclesPerRevolution),
+            DriveEmulator::RETURNED);
+  const DriveEmulator::DiscStats &stats = emulator_.disc_stats();
+  EXPECT_EQ(stats.missed_bytes, 0u);
+  EXPECT_LE(stats.max_service_cycles, kHeaderSearchServiceBudget);
+
+  // Decode a data block as read into buffer 3 and aux space.
+  std::string block = EncodeDataBlock(SectorContent());
+  WriteMemory(0x0600, block.substr(0, 256));
+  WriteMemory(kAuxBuffer - 1, block.substr(256));
+  emulator_.WriteMemory(0x30, 0x00); // current_buffer_start_low
+  emulator_.WriteMemory(0x31, 0x06); // current_buffer_start_high
+  uint64_t start_cycles = emulator_.cycles;
+  ASSERT_EQ(emulator_.Call(kReadConvertGCRToBinary, 100000),
+            DriveEmulator::RETURNED);
+  EXPECT_LE(emulator_.cycles - start_cycles, kReadConvertGCRToBinaryBudget);
+  EXPECT_EQ(ReadMemory(0x0600, 256), SectorContent());
+  EXPECT_EQ(emulator_.ReadMemory(0x38), kDataBlockSignature);
+
+  uint8_t checksum = Checksum(SectorContent());
+  start_cycles = emulator_.cycles;
+  ASSERT_EQ(emulator_.Call(kFormatCalculateChecksum, 100000),
+            DriveEmulator::RETURNED);
+  EXPECT_LE(emulator_.cycles - start_cycles, kFormatCalculateChecksumBudget);
+  EXPECT_EQ(emulator_.a, checksum);
+  EXPECT_EQ(emulator_.ReadMemory(0x3a), checksum);
+
+  // Encoding for writing, as rw_block does for content from the host, and
+  // back.
+  emulator_.WriteMemory(0x3a, checksum); // sector_data_checksum
+  start_cycles = emulator_.cycles;
+  ASSERT_EQ(emulator_.Call(kFormatConvertContentToGCR, 100000),
+            DriveEmulator::RETURNED);
+  EXPECT_LE(emulator_.cycles - start_cycles,
+            kFormatConvertContentToGCRBudget);
+  EXPECT_EQ(ReadMemory(kAuxBuffer, kNumAuxBytes),
+            block.substr(0, kNumAuxBytes));
+  EXPECT_EQ(ReadMemory(0x0600, 256),
+            block.substr(kNumAuxBytes, 256));
+
+  start_cycles = emulator_.cycles;
+  ASSERT_EQ(emulator_.Call(kFormatConvertGCRToBinary, 100000),
+            DriveEmulator::RETURNED);
+  EXPECT_LE(emulator_.cycles - start_cycles, kFormatConvertGCRToBinaryBudget);
+  EXPECT_EQ(ReadMemory(0x0600, 256), SectorContent());
+}
+
+// Why rw_block.asm leaves decoding to read_convert_gcr_to_binary: A table
+// driven decoder isn't faster, and takes longer for a group of five GCR bytes
+// than those take to pass under the head, even in the slowest zone. Decoding
+// on the fly would need bigger tables than fit next to the buffers the DOS
+// keeps allocated. If this fails, that may have changed.
+TEST_F(DriveEmulatorTest, TableGCRDecodeTimingTest) {
+  emulator_.LoadRAM(kGCRDecodeStart, gcr_decode_bin, sizeof(gcr_decode_bin));
+  std::string block = EncodeDataBlock(SectorContent());
+  WriteMemory(0x0600, block.substr(0, 256));
+  WriteMemory(kAuxBuffer - 1, block.substr(256));
+
+  uint64_t start_cycles = emulator_.cycles;
+  ASSERT_EQ(emulator_.Call(kGCRDecodeStart, 100000), DriveEmulator::RETURNED);
+  uint64_t decode_cycles = emulator_.cycles - start_cycles;
+  EXPECT_EQ(ReadMemory(0x0600, 256), SectorContent());
+  EXPECT_EQ(emulator_.ReadMemory(0x38), kDataBlockSignature);
+  EXPECT_EQ(emulator_.ReadMemory(0x3a), Checksum(SectorContent()));
+
+  EXPECT_LE(decode_cycles, kTableGCRDecodeBudget);
+  EXPECT_GT(decode_cycles, kReadConvertGCRToBinaryBudget * 9 / 10);
+  const size_t kNumGroups = kNumGCRDataBlockBytes / 5;
+  EXPECT_GT(decode_cycles / kNumGroups, 5 * kCyclesPerByteZone4);
+}
+
+TEST_F(DriveEmulatorTest, FormatTrackTimingTest) {
+  StartFormatting();
+
+  // Measure the byte loops writing the sectors and verifying them, not the
+  // ROM erasing the track in between.
+  DriveEmulator::DiscStats write_stats = {0, 0, 0};
+  bool writing_sectors = false;
+  emulator_.AddWatchPoint(kFormatWriteEmptyTrackDone,
+                          [&writing_sectors](DriveEmulator *e) {
+                            e->ResetDiscStats();
+                            writing_sectors = true;
+                          });
+  emulator_.AddWatchPoint(kDcSetHeadToRead,
+                          [&writing_sectors, &write_stats](DriveEmulator *e) {
+                            if (writing_sectors) {
+                              write_stats = e->disc_stats();
+                              writing_sectors = false;
+                            }
+                            e->ResetDiscStats();
+                          });
+
+  uint64_t start_cycles = emulator_.cycles;
+  ASSERT_EQ(emulator_.Call(kDriveCodeStart, 40 * kCyclesPerRevolution),
+            DriveEmulator::EXIT_POINT);
+  EXPECT_EQ(emulator_.pc, kDcEndJobLoopWithStatus);
+  EXPECT_EQ(emulator_.a, 0x01);
+  EXPECT_LE(emulator_.cycles - start_cycles,
+            kFormatTrackRevolutionsBudget * kCyclesPerRevolution);
+
+  // All sectors made it to the disc.
+  std::string block = EncodeDataBlock(SectorContent());
+  std::string track = emulator_.track() + emulator_.track();
+  const size_t kTrackSize = emulator_.track().size();
+  int num_blocks = 0;
+  for (size_t pos = track.find(block); pos < kTrackSize;
+       pos = track.find(block, pos + 1)) {
+    ++num_blocks;
+  }
+  EXPECT_EQ(num_blocks, 21);
+
+  EXPECT_EQ(write_stats.missed_bytes, 0u);
+  EXPECT_LE(write_stats.max_service_cycles, kFormatWriteServiceBudget);
+  const DriveEmulator::DiscStats &verify_stats = emulator_.disc_stats();
+  EXPECT_EQ(verify_stats.missed_bytes, 0u);
+  EXPECT_LE(verify_stats.max_service_cycles, kVerifyServiceBudget);
+}
+
+TEST_F(DriveEmulatorTest, FormatTrackVerifyFailsOnMissingHeader) {
+  StartFormatting();
+  // Break the header of sector 1 once all sectors are written. Its data block
+  // is fine, so only matching it to its header finds the problem.
+  bool writing_sectors = false;
+  emulator_.AddWatchPoint(kFormatWriteEmptyTrackDone,
+                          [&writing_sectors](DriveEmulator *e) {
+                            writing_sectors = true;
+                          });
+  emulator_.AddWatchPoint(
+      kDcSetHeadToRead, [this, &writing_sectors](DriveEmulator *e) {
+        if (!writing_sectors) {
+          return;
+        }
+        writing_sectors = false;
+        std::string track = e->track();
+        size_t header = track.find(ReadMemory(0x0300 + 10, 10));
+        ASSERT_NE(header, std::string::npos);
+        track[header + 3] ^= 0x01;
+        size_t position = e->track_position();
+        e->InsertTrack(track, kCyclesPerByteZone1, true);
+        e->SeekTrack(position);
+      });
+
+  // Verifying gives up after a limited number of retries and has the track
+  // formatted again.
+  ASSERT_EQ(emulator_.Call(kDriveCodeStart, 40 * kCyclesPerRevolution),
+            DriveEmulator::EXIT_POINT);
+  EXPECT_EQ(emulator_.pc, kDcEndOfJobLoop);
+  EXPECT_EQ(emulator_.a, 0x06); // errno_readerror_24
+  EXPECT_EQ(emulator_.ReadMemory(0x51), 1);
+}
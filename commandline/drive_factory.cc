@@ -6,6 +6,12 @@
 
 #include "cbm1541_drive.h"
 #include "image_drive_d64.h"
+#include "image_drive_pack.h"
+
+namespace {
+// Images in a disc pack are addressed as <pack>.dpk:<image name>.
+const char kPackSeparator[] = ".dpk:";
+} // namespace
 
 std::unique_ptr<DriveInterface> CreateDriveObject(const std::string &file_or_id,
                                                   IECBusConnection *bus_conn,
@@ -19,7 +25,14 @@ std::unique_ptr<DriveInterface> CreateDriveObject(const std::string &file_or_id,
 
     result = std::make_unique<CBM1541Drive>(bus_conn, device_number);
   } catch (const boost::bad_lexical_cast &) {
-    result = std::make_unique<ImageDriveD64>(file_or_id, read_only);
+    size_t separator = file_or_id.find(kPackSeparator);
+    if (separator != std::string::npos) {
+      size_t name_start = separator + sizeof(kPackSeparator) - 1;
+      result = std::make_unique<ImageDrivePack>(
+          file_or_id.substr(0, name_start - 1), file_or_id.substr(name_start));
+    } else {
+      result = std::make_unique<ImageDriveD64>(file_or_id, read_only);
+    }
   }
   return result;
 }
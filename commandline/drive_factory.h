@@ -10,6 +10,8 @@
 
 // Factory for creating a drive instance from the specified file_or_id.
 // file_or_id can be either a IEC bus id or a path to a disc image.
+// Images in a disc pack are specified as <pack>.dpk:<image name>, these
+// are always read-only.
 // If file_or_id specifies a IEC bus id, bus_conn must be a pointer to
 // and IECBusConnection instance used to talk to the drive.
 // if read_only is true, expect the drive to reject attempts to write to it.
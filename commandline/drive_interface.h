@@ -28,6 +28,21 @@ public:
   // standard is 35 tracks. Returns true if successful, sets status otherwise.
   virtual bool FormatDiscLowLevel(size_t num_sectors, IECStatus *status) = 0;
 
+  // Physically formats tracks first_track to last_track only, using disc_id
+  // (two characters) in the sector headers, and verifies each track right
+  // after formatting it. Other tracks are left alone, so disc_id should match
+  // the one they were formatted with. Returns true if successful, sets status
+  // otherwise.
+  virtual bool FormatTracks(unsigned int first_track, unsigned int last_track,
+                            const std::string &disc_id, IECStatus *status) = 0;
+
+  // Quick format for discs that are physically formatted already. Only writes
+  // an empty BAM and directory using disc_name, keeping the disc ID.
+  // disc_name must not contain ','. Returns true if successful, sets status
+  // otherwise.
+  virtual bool FormatDiscQuick(const std::string &disc_name,
+                               IECStatus *status) = 0;
+
   // Determine and set *num_sectors to the number of sectors available on the
   // current disc. Returns true if successful, sets status otherwise.
   virtual bool GetNumSectors(size_t *num_sectors, IECStatus *status) = 0;
@@ -0,0 +1,237 @@
+// Group code recording (GCR) as used by the 1541 to store data on disc.
+
+#include "gcr.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+// GCR code for each nibble. No code has more than two consecutive zero bits,
+// so the drive can recover its clock from the bit stream.
+static const unsigned char kGCRNibbleCodes[16] = {
+    0x0a, 0x0b, 0x12, 0x13, 0x0e, 0x0f, 0x16, 0x17,
+    0x09, 0x19, 0x1a, 0x1b, 0x0d, 0x1d, 0x1e, 0x15};
+
+// Nibble for each 5 bit code, the reverse of the table above.
+static const unsigned char kInvalidCode = 0xff;
+static const unsigned char kGCRNibbles[32] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x08, 0x00, 0x01, 0xff, 0x0c, 0x04, 0x05,
+    0xff, 0xff, 0x02, 0x03, 0xff, 0x0f, 0x06, 0x07,
+    0xff, 0x09, 0x0a, 0x0b, 0xff, 0x0d, 0x0e, 0xff};
+
+// Layout of the track written by EncodeTrack(), in bytes. Matches what the
+// 1541 writes when formatting, with a typical gap between sectors.
+static const size_t kNumSyncBytes = 5;
+static const size_t kNumHeaderGapBytes = 9;
+static const size_t kNumSectorGapBytes = 8;
+static const char kGapByte = 0x55;
+
+// Number of consecutive one bits the drive detects as SYNC.
+static const unsigned int kNumSyncBits = 10;
+
+void EncodeGCRGroup(const unsigned char *in, unsigned char *out) {
+  // Collect the 40 bits of the group, most significant nibble first.
+  uint64_t bits = 0;
+  for (int i = 0; i < 4; ++i) {
+    bits = (bits << 10) | (kGCRNibbleCodes[in[i] >> 4] << 5) |
+           kGCRNibbleCodes[in[i] & 0x0f];
+  }
+  for (int i = 4; i >= 0; --i) {
+    out[i] = bits & 0xff;
+    bits >>= 8;
+  }
+}
+
+void EncodeGCR(const std::string &data, std::string *gcr) {
+  assert(data.size() % 4 == 0);
+  unsigned char group[5];
+  for (size_t i = 0; i < data.size(); i += 4) {
+    EncodeGCRGroup(reinterpret_cast<const unsigned char *>(data.data() + i),
+                   group);
+    gcr->append(reinterpret_cast<const char *>(group), sizeof(group));
+  }
+}
+
+std::string EncodeDataBlock(const std::string &content) {
+  assert(content.size() == 256);
+  unsigned char checksum = 0;
+  for (char c : content) {
+    checksum ^= static_cast<unsigned char>(c);
+  }
+  std::string block(1, char(kDataBlockSignature));
+  block.append(content);
+  block.append(1, char(checksum));
+  block.append(2, char(0x00));
+
+  std::string gcr;
+  gcr.reserve(kNumGCRDataBlockBytes);
+  EncodeGCR(block, &gcr);
+  return gcr;
+}
+
+bool DecodeGCRGroup(const unsigned char *in, unsigned char *out) {
+  uint64_t bits = 0;
+  for (int i = 0; i < 5; ++i) {
+    bits = (bits << 8) | in[i];
+  }
+  for (int i = 3; i >= 0; --i) {
+    unsigned char low = kGCRNibbles[bits & 0x1f];
+    unsigned char high = kGCRNibbles[(bits >> 5) & 0x1f];
+    if (low == kInvalidCode || high == kInvalidCode) {
+      return false;
+    }
+    out[i] = (high << 4) | low;
+    bits >>= 10;
+  }
+  return true;
+}
+
+bool DecodeGCR(const std::string &gcr, std::string *data) {
+  assert(gcr.size() % 5 == 0);
+  unsigned char group[4];
+  for (size_t i = 0; i < gcr.size(); i += 5) {
+    if (!DecodeGCRGroup(reinterpret_cast<const unsigned char *>(gcr.data() + i),
+                        group)) {
+      return false;
+    }
+    data->append(reinterpret_cast<const char *>(group), sizeof(group));
+  }
+  return true;
+}
+
+bool DecodeDataBlock(const std::string &gcr, std::string *content) {
+  assert(gcr.size() == kNumGCRDataBlockBytes);
+  std::string block;
+  block.reserve(260);
+  if (!DecodeGCR(gcr, &block) ||
+      static_cast<unsigned char>(block[0]) != kDataBlockSignature) {
+    return false;
+  }
+  unsigned char checksum = 0;
+  for (size_t i = 1; i <= 256; ++i) {
+    checksum ^= static_cast<unsigned char>(block[i]);
+  }
+  if (checksum != static_cast<unsigned char>(block[257])) {
+    return false;
+  }
+  content->assign(block, 1, 256);
+  return true;
+}
+
+std::string EncodeHeader(const SectorHeader &header) {
+  assert(header.disc_id.size() == 2);
+  std::string data(1, char(kHeaderSignature));
+  data.append(1, char(header.sector ^ header.track ^ header.disc_id[1] ^
+                      header.disc_id[0]));
+  data.append(1, char(header.sector));
+  data.append(1, char(header.track));
+  data.append(1, header.disc_id[1]);
+  data.append(1, header.disc_id[0]);
+  data.append(2, char(0x0f));
+
+  std::string gcr;
+  gcr.reserve(kNumGCRHeaderBytes);
+  EncodeGCR(data, &gcr);
+  return gcr;
+}
+
+bool DecodeHeader(const std::string &gcr, SectorHeader *header) {
+  assert(gcr.size() == kNumGCRHeaderBytes);
+  std::string data;
+  if (!DecodeGCR(gcr, &data) ||
+      static_cast<unsigned char>(data[0]) != kHeaderSignature ||
+      (data[1] ^ data[2] ^ data[3] ^ data[4] ^ data[5]) != 0) {
+    return false;
+  }
+  header->sector = static_cast<unsigned char>(data[2]);
+  header->track = static_cast<unsigned char>(data[3]);
+  header->disc_id = {data[5], data[4]};
+  return true;
+}
+
+std::vector<size_t> FindSyncs(const std::string &track) {
+  std::vector<size_t> syncs;
+  // Start at a byte with a zero bit and visit it again at the end, so a SYNC
+  // running across the end of the track is found. A track without any zero
+  // bits has nothing to read after its SYNC.
+  size_t start = 0;
+  while (start < track.size() &&
+         static_cast<unsigned char>(track[start]) == 0xff) {
+    ++start;
+  }
+  if (start == track.size()) {
+    return syncs;
+  }
+  unsigned int ones = 0;
+  for (size_t i = 0; i <= track.size(); ++i) {
+    size_t pos = (start + i) % track.size();
+    unsigned char byte = track[pos];
+    if (byte == 0xff) {
+      ones += 8;
+      continue;
+    }
+    for (int bit = 7; bit >= 0; --bit) {
+      if (byte & (1 << bit)) {
+        ++ones;
+        continue;
+      }
+      if (ones >= kNumSyncBits && i > 0) {
+        syncs.push_back(pos * 8 + 7 - bit);
+      }
+      ones = 0;
+    }
+  }
+  // The one found when visiting the start again may belong at the front.
+  std::sort(syncs.begin(), syncs.end());
+  return syncs;
+}
+
+std::string ReadTrackBytes(const std::string &track, size_t bit_offset,
+                           size_t num_bytes) {
+  std::string result;
+  result.reserve(num_bytes);
+  size_t pos = bit_offset / 8;
+  unsigned int shift = bit_offset % 8;
+  for (size_t i = 0; i < num_bytes; ++i) {
+    unsigned int word = static_cast<unsigned char>(track[pos % track.size()])
+                        << 8;
+    word |= static_cast<unsigned char>(track[(pos + 1) % track.size()]);
+    result.append(1, char((word << shift) >> 8));
+    ++pos;
+  }
+  return result;
+}
+
+std::vector<GCRSector> DecodeTrack(const std::string &track) {
+  std::vector<GCRSector> sectors;
+  std::vector<size_t> syncs = FindSyncs(track);
+  for (size_t i = 0; i < syncs.size(); ++i) {
+    GCRSector sector;
+    if (!DecodeHeader(ReadTrackBytes(track, syncs[i], kNumGCRHeaderBytes),
+                      &sector.header)) {
+      continue;
+    }
+    // The data block follows after the next SYNC.
+    size_t next = (i + 1) % syncs.size();
+    sector.content_ok = DecodeDataBlock(
+        ReadTrackBytes(track, syncs[next], kNumGCRDataBlockBytes),
+        &sector.content);
+    sectors.push_back(sector);
+  }
+  return sectors;
+}
+
+std::string EncodeTrack(unsigned int track, const std::string &disc_id,
+                        const std::vector<std::string> &content) {
+  std::string result;
+  for (unsigned int sector = 0; sector < content.size(); ++sector) {
+    result.append(kNumSyncBytes, char(0xff));
+    result.append(EncodeHeader({track, sector, disc_id}));
+    result.append(kNumHeaderGapBytes, kGapByte);
+    result.append(kNumSyncBytes, char(0xff));
+    result.append(EncodeDataBlock(content[sector]));
+    result.append(kNumSectorGapBytes, kGapByte);
+  }
+  return result;
+}
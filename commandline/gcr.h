@@ -0,0 +1,96 @@
+// Group code recording (GCR) as used by the 1541 to store data on disc.
+// Encoding on the host allows sending data to the drive in the form it is
+// written, so the drive doesn't have to spend time converting it. Decoding
+// whole raw tracks allows converting raw disc images to sectors.
+
+#ifndef GCR_H
+#define GCR_H
+
+#include <string>
+#include <vector>
+
+// Number of GCR bytes of a complete data block: The signature byte, 256
+// bytes of content, the checksum and two padding bytes, 5 bytes per 4.
+const size_t kNumGCRDataBlockBytes = 325;
+
+// Signature byte preceding the content of a data block.
+const unsigned char kDataBlockSignature = 0x07;
+
+// Number of GCR bytes of a sector header: The signature byte, checksum,
+// sector, track, two disc ID bytes and two padding bytes.
+const size_t kNumGCRHeaderBytes = 10;
+
+// Signature byte of a sector header.
+const unsigned char kHeaderSignature = 0x08;
+
+// A sector header as found on disc.
+struct SectorHeader {
+  unsigned int track;
+  unsigned int sector;
+  // The two characters of the disc ID, in the order they're specified
+  // when formatting.
+  std::string disc_id;
+};
+
+// A sector found on a raw track.
+struct GCRSector {
+  SectorHeader header;
+  // The 256 bytes of content, if the data block following the header
+  // could be decoded.
+  std::string content;
+  bool content_ok;
+};
+
+// Encode the 4 bytes pointed to by in into the 5 GCR bytes pointed to by out.
+void EncodeGCRGroup(const unsigned char *in, unsigned char *out);
+
+// Encode data, whose size must be a multiple of 4, and append the result
+// to *gcr.
+void EncodeGCR(const std::string &data, std::string *gcr);
+
+// Build the GCR encoded data block for 256 bytes of content, including
+// signature and checksum. The result has kNumGCRDataBlockBytes bytes.
+std::string EncodeDataBlock(const std::string &content);
+
+// Decode the 5 GCR bytes pointed to by in into the 4 bytes pointed to by out.
+// Returns false if in holds an invalid code.
+bool DecodeGCRGroup(const unsigned char *in, unsigned char *out);
+
+// Decode gcr, whose size must be a multiple of 5, and append the result to
+// *data. Returns false if gcr holds an invalid code.
+bool DecodeGCR(const std::string &gcr, std::string *data);
+
+// Decode the kNumGCRDataBlockBytes bytes of a data block into the 256 bytes
+// of *content. Returns false if there are invalid codes, or signature or
+// checksum don't match.
+bool DecodeDataBlock(const std::string &gcr, std::string *content);
+
+// Build the GCR encoded sector header. The result has kNumGCRHeaderBytes.
+std::string EncodeHeader(const SectorHeader &header);
+
+// Decode the kNumGCRHeaderBytes bytes of a sector header. Returns false if
+// there are invalid codes, or signature or checksum don't match.
+bool DecodeHeader(const std::string &gcr, SectorHeader *header);
+
+// Find the SYNC marks (ten or more one bits) on a raw track. The track is
+// circular, it wraps around at its end. Returns the bit offset of the first
+// bit following each SYNC, in order. Offsets need not be multiples of 8, the
+// drive reads bytes starting right after a SYNC wherever that is.
+std::vector<size_t> FindSyncs(const std::string &track);
+
+// Read num_bytes bytes from the circular track, starting at bit_offset.
+std::string ReadTrackBytes(const std::string &track, size_t bit_offset,
+                           size_t num_bytes);
+
+// Decode all sectors on a raw track, one revolution as read from the drive
+// or a raw disc image. Each valid header yields a sector, in the order found.
+std::vector<GCRSector> DecodeTrack(const std::string &track);
+
+// Build a raw track the way the 1541 formats it, with a header and a data
+// block for each sector. content holds the 256 bytes of each sector. The
+// result is shorter than a revolution, pad it with 0x55 gap bytes to the
+// track's capacity as needed.
+std::string EncodeTrack(unsigned int track, const std::string &disc_id,
+                        const std::vector<std::string> &content);
+
+#endif // GCR_H
@@ -0,0 +1,120 @@
+#include "gcr.h"
+
+#include "gtest/gtest.h"
+
+class GCRTest : public ::testing::Test {};
+
+TEST_F(GCRTest, EncodeGCRGroupTest) {
+  const unsigned char zeros[4] = {0x00, 0x00, 0x00, 0x00};
+  unsigned char out[5];
+  EncodeGCRGroup(zeros, out);
+  EXPECT_EQ(std::string(reinterpret_cast<char *>(out), 5),
+            std::string("\x52\x94\xa5\x29\x4a", 5));
+
+  // The default data block start: signature, first content bytes $4b $01.
+  const unsigned char block_start[4] = {0x07, 0x4b, 0x01, 0x01};
+  EncodeGCRGroup(block_start, out);
+  EXPECT_EQ(std::string(reinterpret_cast<char *>(out), 5),
+            std::string("\x55\xdd\xb5\x2d\x4b", 5));
+}
+
+TEST_F(GCRTest, EncodeDataBlockTest) {
+  std::string content;
+  for (int i = 0; i < 256; ++i) {
+    content.append(1, char(i));
+  }
+  std::string gcr = EncodeDataBlock(content);
+  ASSERT_EQ(gcr.size(), kNumGCRDataBlockBytes);
+
+  // The last group holds the last content byte, the checksum (all bytes
+  // 0..255 XOR to zero) and two padding bytes.
+  std::string last_group;
+  EncodeGCR(std::string("\xff\x00\x00\x00", 4), &last_group);
+  EXPECT_EQ(gcr.substr(320), last_group);
+
+  std::string first_group;
+  EncodeGCR(std::string("\x07\x00\x01\x02", 4), &first_group);
+  EXPECT_EQ(gcr.substr(0, 5), first_group);
+}
+
+TEST_F(GCRTest, DecodeDataBlockTest) {
+  std::string content;
+  for (int i = 0; i < 256; ++i) {
+    content.append(1, char(i * 3));
+  }
+  std::string gcr = EncodeDataBlock(content);
+  std::string decoded;
+  ASSERT_TRUE(DecodeDataBlock(gcr, &decoded));
+  EXPECT_EQ(decoded, content);
+
+  // Valid codes, but the checksum doesn't match.
+  std::string block = std::string(1, char(kDataBlockSignature)) + content;
+  block.append(1, char(0x42));
+  block.append(2, char(0x00));
+  std::string bad_checksum;
+  EncodeGCR(block, &bad_checksum);
+  EXPECT_FALSE(DecodeDataBlock(bad_checksum, &decoded));
+
+  // An invalid code.
+  std::string corrupt = gcr;
+  corrupt[10] = 0x00;
+  EXPECT_FALSE(DecodeDataBlock(corrupt, &decoded));
+}
+
+TEST_F(GCRTest, HeaderTest) {
+  SectorHeader header = {18, 5, "AE"};
+  std::string gcr = EncodeHeader(header);
+  ASSERT_EQ(gcr.size(), kNumGCRHeaderBytes);
+  // Every header starts like this, as the signature is the same.
+  EXPECT_EQ(static_cast<unsigned char>(gcr[0]), 0x52);
+
+  SectorHeader decoded;
+  ASSERT_TRUE(DecodeHeader(gcr, &decoded));
+  EXPECT_EQ(decoded.track, 18u);
+  EXPECT_EQ(decoded.sector, 5u);
+  EXPECT_EQ(decoded.disc_id, "AE");
+
+  // Data blocks aren't mistaken for headers.
+  EXPECT_FALSE(
+      DecodeHeader(EncodeDataBlock(std::string(256, 0)).substr(0, 10),
+                   &decoded));
+}
+
+// Rotate the circular track by the given number of bits.
+static std::string RotateTrack(const std::string &track, size_t bits) {
+  return ReadTrackBytes(track, bits, track.size());
+}
+
+TEST_F(GCRTest, DecodeTrackTest) {
+  std::vector<std::string> content;
+  for (int s = 0; s < 21; ++s) {
+    content.push_back(std::string(256, char(s)));
+  }
+  std::string track = EncodeTrack(1, "XY", content);
+  track.append(7692 - track.size(), 0x55);
+
+  // Wherever the revolution starts, and whatever the bit alignment,
+  // all sectors are found.
+  for (size_t rotation : {0, 3, 8 * 100 + 5, 8 * 7000 + 7}) {
+    SCOPED_TRACE(rotation);
+    std::vector<GCRSector> sectors = DecodeTrack(RotateTrack(track, rotation));
+    ASSERT_EQ(sectors.size(), 21u);
+    for (const GCRSector &sector : sectors) {
+      EXPECT_EQ(sector.header.track, 1u);
+      EXPECT_EQ(sector.header.disc_id, "XY");
+      ASSERT_LT(sector.header.sector, 21u);
+      EXPECT_TRUE(sector.content_ok);
+      EXPECT_EQ(sector.content, content[sector.header.sector]);
+    }
+  }
+
+  // A sector with a broken data block is reported as such.
+  std::string broken = track;
+  size_t block_start = 5 + 10 + 9 + 5;
+  broken[block_start + 50] = 0x00;
+  std::vector<GCRSector> sectors = DecodeTrack(broken);
+  ASSERT_EQ(sectors.size(), 21u);
+  EXPECT_EQ(sectors[0].header.sector, 0u);
+  EXPECT_FALSE(sectors[0].content_ok);
+  EXPECT_TRUE(sectors[1].content_ok);
+}
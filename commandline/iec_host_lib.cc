@@ -1,15 +1,11 @@
+#include <algorithm>
 #include <csignal>
-#include <fcntl.h>
 #include <iostream>
 #include <memory>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <termios.h>
 #include <time.h>
-#include <unistd.h>
 
 #include "boost/format.hpp"
 #include "iec_host_lib.h"
@@ -33,6 +29,23 @@ static const int kMinProtocolVersion = 3;
 // Number of tries for successfully reading the connection string prefix.
 static const int kNumRetries = 5;
 
+// Default for the request timeout. Formatting a disc takes a while.
+static const auto kDefaultRequestTimeout = 120s;
+
+// How often waiting requests check for cancellation.
+static const auto kCancellationPollInterval = 50ms;
+
+// How long we wait for the Arduino to acknowledge a sync request, and how
+// often we ask. If the Arduino is in the middle of receiving a command, it
+// takes up to two of its serial timeouts (one second each) to give up on it.
+static const auto kSyncAttemptTimeout = 500ms;
+static const int kNumSyncAttempts = 6;
+
+// How long we keep dropping input before resetting the Arduino, and how long
+// we wait for it to come back with its connection string.
+static const auto kDrainDuration = 100ms;
+static const auto kHandshakeTimeout = 5s;
+
 // Config values. These are hardcoded for now and match the defaults of
 // the Arduino implementation. We request to be the host, so we specify
 // a device number of zero here (which is special cased on the Arduino).
@@ -55,6 +68,8 @@ static const std::string kCmdGetData =
     "g"; // Get data from a channel on a device.
 static const std::string kCmdPutData =
     "p"; // Put data onto a channel on a device.
+static const std::string kCmdSync =
+    "y"; // Sync request, acknowledged with "y<nonce>\r".
 
 static std::string GetPrintableString(const std::string &str) {
   std::string result;
@@ -77,83 +92,102 @@ static std::string GetPrintableString(const std::string &str) {
   return result;
 }
 
+// Check the protocol version in connection_string, which starts with
+// kConnectionStringPrefix, and set *reply to our configuration, asking the
+// Arduino to act as device_number. Returns true if successful, sets status
+// otherwise.
+static bool AcceptConnectionString(const std::string &connection_string,
+                                   int device_number, std::string *reply,
+                                   IECStatus *status) {
+  if (connection_string.compare(0, kConnectionStringPrefix.size(),
+                                kConnectionStringPrefix) != 0) {
+    SetError(IECStatus::CONNECTION_FAILURE,
+             std::string("Unknown protocol response: '") +
+                 GetPrintableString(connection_string) + "'",
+             status);
+    return false;
+  }
+  int protocol_version = 0;
+  if (sscanf(connection_string.substr(kConnectionStringPrefix.size()).c_str(),
+             "%i", &protocol_version) <= 0 ||
+      protocol_version < kMinProtocolVersion) {
+    SetError(IECStatus::CONNECTION_FAILURE,
+             std::string("Unsupported protocol: '") + connection_string + "'",
+             status);
+    return false;
+  }
+  time_t unix_time = time(nullptr);
+  struct tm local_time;
+  localtime_r(&unix_time, &local_time);
+
+  // Now talk back to the Arduino, communicating our configuration.
+  auto config_string =
+      boost::format("OK>%u|%u|%u|%u|%u|%u|%u-%u-%u.%u:%u:%u\r") %
+      device_number % kAtnPin % kClockPin % kDataPin % kResetPin % kSrqInPin %
+      (local_time.tm_year + 1900) % (local_time.tm_mon + 1) %
+      local_time.tm_mday % local_time.tm_hour % local_time.tm_min %
+      local_time.tm_sec;
+  *reply = config_string.str();
+  return true;
+}
+
 IECBusConnection::IECBusConnection(int arduino_fd, LogCallback log_callback)
-    : arduino_fd_(arduino_fd),
-      arduino_writer_(std::make_unique<BufferedReadWriter>(arduino_fd)),
-      log_callback_(log_callback) {
+    : IECBusConnection(std::make_unique<SerialTransport>(arduino_fd),
+                       log_callback) {}
+
+IECBusConnection::IECBusConnection(std::unique_ptr<Transport> transport,
+                                   LogCallback log_callback)
+    : transport_(std::move(transport)),
+      arduino_writer_(std::make_unique<BufferedReadWriter>(transport_.get())),
+      log_callback_(log_callback), request_timeout_(kDefaultRequestTimeout) {
   // Ignore broken pipes. They may just happen.
   signal(SIGPIPE, SIG_IGN);
-  assert(pipe(tthread_pipe_) == 0);
 }
 
 IECBusConnection::~IECBusConnection() {
-  // It doesn't really matter what we write here, but writing
-  // to tthread_pipe_ will tell the background thread to shutdown.
-  char tsym = 't';
-  assert(write(tthread_pipe_[1], &tsym, 1) == 1);
+  // Tell the background thread to shutdown.
+  terminate_requested_ = true;
+  transport_->Interrupt();
   if (response_thread_.joinable()) {
     // Step response processing.
     response_thread_.join();
   }
 
-  if (arduino_fd_ != -1) {
-    close(arduino_fd_);
-    arduino_fd_ = -1;
-  }
-  close(tthread_pipe_[0]);
-  close(tthread_pipe_[1]);
+  std::unique_lock<std::mutex> lock(mutex_);
+  IECStatus status;
+  SetError(IECStatus::CONNECTION_FAILURE, "Connection closed", &status);
+  broken_ = true;
+  // Don't send anything anymore.
+  syncing_ = true;
+  CompleteRequest(&lock, std::string(), status);
+  FailQueued(&lock, status);
 }
 
 bool IECBusConnection::Reset(IECStatus *status) {
-  auto f = RequestResult();
-  if (!arduino_writer_->WriteString(kCmdReset, status)) {
+  TraceSpan span(tracer_, "Reset");
+  if (!Request(kCmdReset, nullptr, status)) {
     return false;
   }
   // Sleep for a bit to give the drive time to reset.
   std::this_thread::sleep_for(2s);
-  auto r = f.get();
-  if (r.second.ok()) {
-    return true;
-  } else {
-    *status = r.second;
-    return false;
-  }
+  return true;
 }
 
 bool IECBusConnection::OpenChannel(char device_number, char channel,
                                    const std::string &cmd_string,
                                    IECStatus *status) {
-  auto f = RequestResult();
+  TraceSpan span(tracer_, "OpenChannel");
   std::string request_string = kCmdOpen + device_number + channel +
                                static_cast<char>(cmd_string.size()) +
                                cmd_string;
-  if (!arduino_writer_->WriteString(request_string, status)) {
-    return false;
-  }
-  auto r = f.get();
-  if (r.second.ok()) {
-    return true;
-  } else {
-    *status = r.second;
-    return false;
-  }
+  return Request(request_string, nullptr, status);
 }
 
 bool IECBusConnection::ReadFromChannel(char device_number, char channel,
                                        std::string *result, IECStatus *status) {
-  auto f = RequestResult();
+  TraceSpan span(tracer_, "ReadFromChannel");
   std::string request_string = kCmdGetData + device_number + channel;
-  if (!arduino_writer_->WriteString(request_string, status)) {
-    return false;
-  }
-  auto r = f.get();
-  if (r.second.ok()) {
-    *result = r.first;
-    return true;
-  } else {
-    *status = r.second;
-    return false;
-  }
+  return Request(request_string, result, status);
 }
 
 bool IECBusConnection::WriteToChannel(char device_number, char channel,
@@ -165,18 +199,13 @@ bool IECBusConnection::WriteToChannel(char device_number, char channel,
 
   size_t curr_pos = 0;
   while (curr_pos < data_string.size()) {
-    auto f = RequestResult();
+    TraceSpan span(tracer_, "WriteToChannel");
     size_t to_write =
         std::min(data_string.size() - curr_pos, kMaxSendPacketSize);
     std::string request_string = kCmdPutData + device_number + channel +
                                  static_cast<char>(to_write) +
                                  data_string.substr(curr_pos, to_write);
-    if (!arduino_writer_->WriteString(request_string, status)) {
-      return false;
-    }
-    auto r = f.get();
-    if (!r.second.ok()) {
-      *status = r.second;
+    if (!Request(request_string, nullptr, status)) {
       return false;
     }
     curr_pos += to_write;
@@ -186,117 +215,278 @@ bool IECBusConnection::WriteToChannel(char device_number, char channel,
 
 bool IECBusConnection::CloseChannel(char device_number, char channel,
                                     IECStatus *status) {
-  auto f = RequestResult();
+  TraceSpan span(tracer_, "CloseChannel");
   std::string request_string = kCmdClose + device_number + channel;
-  if (!arduino_writer_->WriteString(request_string, status)) {
-    return false;
+  return Request(request_string, nullptr, status);
+}
+
+void IECBusConnection::OpenChannelAsync(char device_number, char channel,
+                                        const std::string &cmd_string,
+                                        Callback done) {
+  Submit(kCmdOpen + device_number + channel +
+             static_cast<char>(cmd_string.size()) + cmd_string,
+         /*async=*/true, std::move(done));
+}
+
+void IECBusConnection::ReadFromChannelAsync(char device_number, char channel,
+                                            Callback done) {
+  Submit(kCmdGetData + device_number + channel, /*async=*/true,
+         std::move(done));
+}
+
+void IECBusConnection::WriteToChannelAsync(char device_number, char channel,
+                                           const std::string &data_string,
+                                           Callback done) {
+  // Empty string, we're done.
+  if (data_string.empty()) {
+    done(IECStatus(), std::string());
+    return;
   }
-  auto r = f.get();
-  if (r.second.ok()) {
-    return true;
-  } else {
-    *status = r.second;
-    return false;
+  WritePacketsAsync(device_number, channel, data_string, 0, std::move(done));
+}
+
+void IECBusConnection::CloseChannelAsync(char device_number, char channel,
+                                         Callback done) {
+  Submit(kCmdClose + device_number + channel, /*async=*/true,
+         std::move(done));
+}
+
+void IECBusConnection::WritePacketsAsync(char device_number, char channel,
+                                         const std::string &data_string,
+                                         size_t pos, Callback done) {
+  size_t to_write = std::min(data_string.size() - pos, kMaxSendPacketSize);
+  std::string request_string = kCmdPutData + device_number + channel +
+                               static_cast<char>(to_write) +
+                               data_string.substr(pos, to_write);
+  pos += to_write;
+  if (pos == data_string.size()) {
+    Submit(std::move(request_string), /*async=*/true, std::move(done));
+    return;
   }
+  Submit(std::move(request_string), /*async=*/true,
+         [this, device_number, channel, data_string, pos,
+          done](const IECStatus &status, const std::string &result) {
+           if (!status.ok()) {
+             done(status, result);
+             return;
+           }
+           WritePacketsAsync(device_number, channel, data_string, pos, done);
+         });
 }
 
 bool IECBusConnection::Initialize(IECStatus *status) {
-  std::string connection_string;
-  for (int i = 0; i < kNumRetries; ++i) {
-    if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength,
-                                               &connection_string, status)) {
-      return false;
-    }
-    if (connection_string.size() >= kConnectionStringPrefix.size() &&
-        connection_string.substr(0, kConnectionStringPrefix.size()) ==
-            kConnectionStringPrefix) {
-      break;
-    } else if (i >= (kNumRetries - 1)) {
-      SetError(IECStatus::CONNECTION_FAILURE,
-               std::string("Unknown protocol response: '") +
-                   GetPrintableString(connection_string) + "'",
-               status);
+  if (!ConnectArduino(arduino_writer_.get(), kDeviceNumber, log_callback_,
+                      status)) {
+    return false;
+  }
+
+  // Start our response thread.
+  response_thread_ = std::thread(&IECBusConnection::ProcessResponses, this);
+
+  return true;
+}
+
+bool IECBusConnection::Request(const std::string &request_string,
+                               std::string *response, IECStatus *status) {
+  auto deadline = std::chrono::steady_clock::now() + request_timeout_;
+  // Filled in on the response thread. Shared, as we may stop waiting.
+  struct Result {
+    bool done = false;
+    IECStatus status;
+    std::string response;
+  };
+  auto result = std::make_shared<Result>();
+  uint64_t id = Submit(
+      request_string, /*async=*/false,
+      [this, result](const IECStatus &status, const std::string &response) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        result->done = true;
+        result->status = status;
+        result->response = response;
+        state_changed_.notify_all();
+      });
+
+  // Wait for the request to be answered, checking for cancellation every now
+  // and then.
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!result->done) {
+    auto now = std::chrono::steady_clock::now();
+    bool cancelled = cancellation_ != nullptr && cancellation_->IsCancelled();
+    if (cancelled || now >= deadline) {
+      SetError(cancelled ? IECStatus::CANCELLED : IECStatus::TIMEOUT,
+               "Request", status);
+      auto queued = std::find_if(
+          queue_.begin(), queue_.end(),
+          [id](const QueuedRequest &request) { return request.id == id; });
+      if (queued != queue_.end()) {
+        // Not sent yet, we can just forget about it.
+        queue_.erase(queued);
+      } else if (request_pending_ && in_flight_.id == id) {
+        // Whatever the Arduino still sends for this request would be taken
+        // as the response to the next one, so get back in sync first.
+        syncing_ = true;
+        resync_requested_ = true;
+        transport_->Interrupt();
+      }
       return false;
-    } else {
-      log_callback_('W', "CLIENT",
-                    (boost::format("Malformed connection string '%s'") %
-                     connection_string)
-                        .str());
     }
+    state_changed_.wait_until(
+        lock, std::min(deadline, now + kCancellationPollInterval));
   }
-  int protocol_version = 0;
-  if (sscanf(connection_string.substr(kConnectionStringPrefix.size()).c_str(),
-             "%i", &protocol_version) <= 0 ||
-      protocol_version < kMinProtocolVersion) {
-    SetError(IECStatus::CONNECTION_FAILURE,
-             std::string("Unsupported protocol: '") + connection_string + "'",
-             status);
+  if (!result->status.ok()) {
+    *status = result->status;
     return false;
   }
-  time_t unix_time = time(nullptr);
-  struct tm local_time;
-  localtime_r(&unix_time, &local_time);
+  if (response != nullptr) {
+    *response = result->response;
+  }
+  return true;
+}
 
-  // Now talk back to the Arduino, communicating our configuration.
-  auto config_string =
-      boost::format("OK>%u|%u|%u|%u|%u|%u|%u-%u-%u.%u:%u:%u\r") %
-      kDeviceNumber % kAtnPin % kClockPin % kDataPin % kResetPin % kSrqInPin %
-      (local_time.tm_year + 1900) % (local_time.tm_mon + 1) %
-      local_time.tm_mday % local_time.tm_hour % local_time.tm_min %
-      local_time.tm_sec;
-  if (!arduino_writer_->WriteString(config_string.str(), status)) {
-    return false;
+uint64_t IECBusConnection::Submit(std::string request_string, bool async,
+                                  Callback done) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t id = next_id_++;
+  if (broken_) {
+    lock.unlock();
+    IECStatus status;
+    SetError(IECStatus::CONNECTION_FAILURE, "Lost the Arduino", &status);
+    done(status, std::string());
+    return id;
   }
+  queue_.push_back(
+      QueuedRequest{id, std::move(request_string), std::move(done), async});
+  SendNext(&lock);
+  return id;
+}
 
-  // Start our response thread.
-  response_thread_ = std::thread(&IECBusConnection::ProcessResponses, this);
+bool IECBusConnection::Write(const std::string &data, IECStatus *status) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  return arduino_writer_->WriteString(data, status);
+}
 
-  return true;
+void IECBusConnection::SendNext(std::unique_lock<std::mutex> *lock) {
+  while (!request_pending_ && !syncing_ && !queue_.empty()) {
+    in_flight_ = std::move(queue_.front());
+    queue_.pop_front();
+    request_pending_ = true;
+    in_flight_deadline_ = std::chrono::steady_clock::now() + request_timeout_;
+    if (in_flight_.async && waiting_forever_) {
+      // Have the response thread pick up the deadline.
+      waiting_forever_ = false;
+      transport_->Interrupt();
+    }
+    uint64_t id = in_flight_.id;
+    std::string request_string = std::move(in_flight_.request_string);
+    lock->unlock();
+    IECStatus status;
+    bool written = Write(request_string, &status);
+    lock->lock();
+    if (!written && request_pending_ && in_flight_.id == id) {
+      CompleteRequest(lock, std::string(), status);
+    }
+  }
 }
 
-std::future<std::pair<std::string, IECStatus>>
-IECBusConnection::RequestResult() {
-  response_promise_ = std::promise<std::pair<std::string, IECStatus>>();
-  return response_promise_.get_future();
+void IECBusConnection::CompleteRequest(std::unique_lock<std::mutex> *lock,
+                                       const std::string &response,
+                                       const IECStatus &status) {
+  if (!request_pending_) {
+    return;
+  }
+  request_pending_ = false;
+  Callback done = std::move(in_flight_.done);
+  // Get the Arduino busy with the next request before handling the result.
+  SendNext(lock);
+  lock->unlock();
+  done(status, response);
+  lock->lock();
 }
 
-void IECBusConnection::ProcessResponses() {
+void IECBusConnection::FailQueued(std::unique_lock<std::mutex> *lock,
+                                  const IECStatus &status) {
+  std::deque<QueuedRequest> failed;
+  failed.swap(queue_);
+  lock->unlock();
+  for (auto &request : failed) {
+    request.done(status, std::string());
+  }
+  lock->lock();
+}
 
-  fd_set rfds;
+void IECBusConnection::ProcessResponses() {
   // Remember the last response we received. We'll return it along
   // with the status once we have it.
   std::string last_response;
   while (true) {
     if (!arduino_writer_->HasBufferedData()) {
       // If we don't have any more buffered data, see if we can get more data
-      // from the file descriptor or if our thread should be cancelled.
-      FD_ZERO(&rfds);
-      FD_SET(arduino_fd_, &rfds);
-      FD_SET(tthread_pipe_[0], &rfds);
-
-      int select_result = select(std::max(arduino_fd_, tthread_pipe_[0]) + 1,
-                                 &rfds, nullptr, nullptr, nullptr);
-      assert(select_result > 0);
-      // Terminate the thread if we received the terminate signal. Don't bother
-      // to actually read from the pipe, we don't really care.
-      if (FD_ISSET(tthread_pipe_[0], &rfds))
-        return;
+      // from the transport or if our thread should be cancelled or
+      // resynchronise. Asynchronous requests have no one else waiting for
+      // them, we enforce their timeout.
+      Transport::TimePoint deadline = Transport::TimePoint::max();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (request_pending_ && in_flight_.async) {
+          deadline = in_flight_deadline_;
+        }
+        waiting_forever_ = deadline == Transport::TimePoint::max();
+      }
+      Transport::WaitResult wait_result = transport_->Wait(deadline);
+      if (wait_result == Transport::INTERRUPTED) {
+        if (terminate_requested_) {
+          return;
+        }
+        if (resync_requested_.exchange(false)) {
+          if (!Resync("Request timed out or was cancelled")) {
+            return;
+          }
+          last_response.clear();
+        }
+        continue;
+      }
+      if (wait_result == Transport::TIMED_OUT) {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          if (!request_pending_ || !in_flight_.async ||
+              std::chrono::steady_clock::now() < in_flight_deadline_) {
+            continue;
+          }
+          IECStatus status;
+          SetError(IECStatus::TIMEOUT, "Request", &status);
+          // Hold back the next request until we're back in sync.
+          syncing_ = true;
+          CompleteRequest(&lock, std::string(), status);
+        }
+        if (!Resync("Request timed out")) {
+          return;
+        }
+        last_response.clear();
+        continue;
+      }
     }
 
     std::string read_string;
     IECStatus status;
 
     if (!arduino_writer_->ReadUpTo(1, 1, &read_string, &status)) {
+      // There is no recovering from the transport failing.
       log_callback_('E', "CLIENT", status.message);
+      std::unique_lock<std::mutex> lock(mutex_);
+      broken_ = true;
+      CompleteRequest(&lock, std::string(), status);
+      FailQueued(&lock, status);
       return;
     }
+    // Set if we lost track of the Arduino's responses.
+    std::string out_of_sync;
     switch (read_string[0]) {
     case '!':
       // Debug channel configuration.
       if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
                                                  &status)) {
-        log_callback_('E', "CLIENT", status.message);
-        return;
+        out_of_sync = status.message;
+        break;
       }
       if (read_string.size() < 2) {
         log_callback_(
@@ -304,7 +494,7 @@ void IECBusConnection::ProcessResponses() {
             (boost::format("Malformed channel configuration string '%s'") %
              read_string)
                 .str());
-        return;
+        break;
       }
       debug_channel_map_[read_string[0]] = read_string.substr(1);
       break;
@@ -312,8 +502,8 @@ void IECBusConnection::ProcessResponses() {
       // Standard debug message.
       if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
                                                  &status)) {
-        log_callback_('E', "CLIENT", status.message);
-        return;
+        out_of_sync = status.message;
+        break;
       }
       if (read_string.size() < 3 ||
           debug_channel_map_.count(read_string[1]) == 0) {
@@ -322,7 +512,7 @@ void IECBusConnection::ProcessResponses() {
                       (boost::format("Malformed debug message '%s'") %
                        GetPrintableString(read_string))
                           .str());
-        return;
+        break;
       }
       log_callback_(read_string[0], debug_channel_map_[read_string[1]],
                     read_string.substr(2));
@@ -331,155 +521,293 @@ void IECBusConnection::ProcessResponses() {
       // Standard data response message.
       if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
                                                  &status)) {
-        log_callback_('E', "CLIENT", status.message);
-        return;
+        out_of_sync = status.message;
+        break;
       }
+      TraceSpan span(tracer_, "UnescapeString");
       std::string unescaped_response;
       if (!UnescapeString(read_string, &unescaped_response, &status)) {
-        log_callback_('E', "CLIENT", status.message);
-        return;
+        out_of_sync = status.message;
+        break;
       }
       last_response = unescaped_response;
     } break;
+    case 'T': {
+      // Trace marker, only sent if the Arduino was built with tracing.
+      if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
+                                                 &status)) {
+        out_of_sync = status.message;
+        break;
+      }
+      Tracer *tracer = tracer_;
+      if (tracer != nullptr &&
+          !tracer->AddArduinoMarker(read_string, Tracer::Clock::now(),
+                                    &status)) {
+        // Don't terminate execution, the marker isn't needed for anything
+        // else.
+        log_callback_('W', "CLIENT", status.message);
+      }
+    } break;
     case 's': {
       // Standard status response message.
       if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
                                                  &status)) {
-        log_callback_('E', "CLIENT", status.message);
-        return;
+        out_of_sync = status.message;
+        break;
       }
       IECStatus iecStatus;
       if (!read_string.empty()) {
         // We can use the status string directly, it isn't escaped.
         SetError(IECStatus::IEC_CONNECTION_FAILURE, read_string, &iecStatus);
       }
-      response_promise_.set_value(
-          std::pair<std::string, IECStatus>(last_response, iecStatus));
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        CompleteRequest(&lock, last_response, iecStatus);
+      }
       // Forget the last response so we won't return it again.
       last_response.clear();
     } break;
+    case 'y':
+      // A sync acknowledgement we stopped waiting for.
+      if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
+                                                 &status)) {
+        out_of_sync = status.message;
+      }
+      break;
+    case 'c': {
+      // The Arduino restarted and wants to connect again. Whatever it was
+      // doing for us is lost.
+      if (!arduino_writer_->ReadTerminatedString('\r', kMaxLength, &read_string,
+                                                 &status)) {
+        out_of_sync = status.message;
+        break;
+      }
+      // Requests may be sent concurrently, so reply through Write().
+      std::string reply;
+      if (!AcceptConnectionString("c" + read_string, kDeviceNumber, &reply,
+                                  &status) ||
+          !Write(reply, &status)) {
+        out_of_sync = status.message;
+        break;
+      }
+      log_callback_('W', "CLIENT", "Arduino restarted, connected again");
+      SetError(IECStatus::CONNECTION_FAILURE, "Arduino restarted", &status);
+      std::unique_lock<std::mutex> lock(mutex_);
+      CompleteRequest(&lock, std::string(), status);
+      last_response.clear();
+    } break;
     default:
-      // Ignore all other messages.
-      log_callback_('E', "CLIENT",
-                    (boost::format("Unknown response msg type %#x") %
+      out_of_sync = (boost::format("Unknown response msg type %#x") %
                      static_cast<int>(read_string[0]))
-                        .str());
-      return;
+                        .str();
+      break;
+    }
+    if (!out_of_sync.empty()) {
+      last_response.clear();
+      if (!Resync(out_of_sync)) {
+        return;
+      }
     }
   }
 }
 
-IECBusConnection *IECBusConnection::Create(int arduino_fd,
-                                           LogCallback log_callback,
-                                           IECStatus *status) {
-  if (arduino_fd == -1) {
-    return nullptr;
+bool IECBusConnection::Resync(const std::string &reason) {
+  log_callback_('W', "CLIENT", "Resynchronising: " + reason);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    syncing_ = true;
+    IECStatus status;
+    SetError(IECStatus::CONNECTION_FAILURE, "Out of sync: " + reason, &status);
+    CompleteRequest(&lock, std::string(), status);
   }
-  auto conn = std::make_unique<IECBusConnection>(arduino_fd, log_callback);
-  if (!conn->Initialize(status)) {
-    return nullptr;
+
+  bool terminate = false;
+  bool synced = false;
+  for (int i = 0; i < kNumSyncAttempts && !synced && !terminate; ++i) {
+    // Cycle through printable characters, anything but '\r' would do.
+    sync_nonce_ = sync_nonce_ >= 'z' ? '0' : sync_nonce_ + 1;
+    IECStatus status;
+    if (!Write(kCmdSync + sync_nonce_, &status)) {
+      log_callback_('E', "CLIENT", status.message);
+      break;
+    }
+    synced = DrainUntil(kCmdSync + sync_nonce_ + '\r',
+                        std::chrono::steady_clock::now() + kSyncAttemptTimeout,
+                        &terminate);
   }
-  return conn.release();
+  if (!synced && !terminate) {
+    synced = Rehandshake(&terminate);
+  }
+  if (terminate) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  syncing_ = false;
+  broken_ = !synced;
+  state_changed_.notify_all();
+  if (synced) {
+    log_callback_('I', "CLIENT", "Back in sync with the Arduino");
+    // Carry on with the requests made in the meantime.
+    SendNext(&lock);
+  } else {
+    log_callback_('E', "CLIENT", "Couldn't get back in sync with the Arduino");
+    IECStatus status;
+    SetError(IECStatus::CONNECTION_FAILURE, "Lost the Arduino", &status);
+    FailQueued(&lock, status);
+  }
+  return synced;
 }
 
-static bool ConfigureSerial(int fd, int speed, IECStatus *status) {
-  struct termios tty;
-  if (tcgetattr(fd, &tty) == -1) {
-    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "tcgetattr", status);
-    return false;
+bool IECBusConnection::DrainUntil(
+    const std::string &expected,
+    std::chrono::steady_clock::time_point deadline, bool *terminate) {
+  std::string window;
+  while (WaitForInput(deadline, terminate)) {
+    std::string read_string;
+    IECStatus status;
+    if (!arduino_writer_->ReadUpTo(1, 1, &read_string, &status)) {
+      return false;
+    }
+    window += read_string;
+    if (window.size() > expected.size()) {
+      window.erase(0, 1);
+    }
+    if (!expected.empty() && window == expected) {
+      return true;
+    }
   }
-  speed_t speed_constant = B0;
-#define SPEED_MAP(s)                                                           \
-  case s:                                                                      \
-    speed_constant = B##s;                                                     \
-    break
-  switch (speed) {
-    SPEED_MAP(0);
-    SPEED_MAP(50);
-    SPEED_MAP(75);
-    SPEED_MAP(110);
-    SPEED_MAP(134);
-    SPEED_MAP(150);
-    SPEED_MAP(200);
-    SPEED_MAP(300);
-    SPEED_MAP(600);
-    SPEED_MAP(1200);
-    SPEED_MAP(2400);
-    SPEED_MAP(4800);
-    SPEED_MAP(9600);
-    SPEED_MAP(19200);
-    SPEED_MAP(38400);
-    SPEED_MAP(57600);
-    SPEED_MAP(115200);
-    SPEED_MAP(230400);
-  default:
-    SetError(IECStatus::CONNECTION_FAILURE,
-             (boost::format("Unknown speed setting: #%u baud") % speed).str(),
-             status);
+  return false;
+}
+
+bool IECBusConnection::WaitForInput(
+    std::chrono::steady_clock::time_point deadline, bool *terminate) {
+  while (!arduino_writer_->HasBufferedData()) {
+    switch (transport_->Wait(deadline)) {
+    case Transport::READABLE:
+      return true;
+    case Transport::TIMED_OUT:
+      return false;
+    case Transport::INTERRUPTED:
+      if (terminate_requested_) {
+        *terminate = true;
+        return false;
+      }
+      resync_requested_ = false;
+      break;
+    }
+  }
+  return true;
+}
+
+bool IECBusConnection::Rehandshake(bool *terminate) {
+  log_callback_('W', "CLIENT", "No sync acknowledgement, resetting Arduino");
+  // Drop anything still arriving from before the reset.
+  DrainUntil(std::string(), std::chrono::steady_clock::now() + kDrainDuration,
+             terminate);
+  if (*terminate) {
     return false;
   }
-#undef SPEED_MAP
-  if (cfsetospeed(&tty, speed_constant) == -1) {
-    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "cfsetospeed", status);
+  IECStatus status;
+  if (!transport_->ResetPeer(&status)) {
+    log_callback_('E', "CLIENT", status.message);
     return false;
   }
-  if (cfsetispeed(&tty, speed_constant) == -1) {
-    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "cfsetispeed", status);
+  if (!WaitForInput(std::chrono::steady_clock::now() + kHandshakeTimeout,
+                    terminate)) {
     return false;
   }
-
-  tty.c_cflag |= (CLOCAL | CREAD); /* ignore modem controls */
-  tty.c_cflag &= ~CSIZE;
-  tty.c_cflag |= CS8;      /* 8-bit characters */
-  tty.c_cflag &= ~PARENB;  /* no parity bit */
-  tty.c_cflag &= ~CSTOPB;  /* only need 1 stop bit */
-  tty.c_cflag &= ~CRTSCTS; /* no hardware flowcontrol */
-
-  /* setup for non-canonical mode */
-  tty.c_iflag &=
-      ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
-  tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
-
-  tty.c_oflag &= ~OPOST;
-
-  /* fetch bytes as they become available */
-  tty.c_cc[VMIN] = 1;
-  tty.c_cc[VTIME] = 1;
-
-  if (tcsetattr(fd, TCSANOW, &tty) == -1) {
-    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "tcsetattr", status);
+  if (!ConnectArduino(arduino_writer_.get(), kDeviceNumber, log_callback_,
+                      &status)) {
+    log_callback_('E', "CLIENT", status.message);
     return false;
   }
   return true;
 }
 
-IECBusConnection *IECBusConnection::Create(const std::string &device_file,
-                                           int speed, LogCallback log_callback,
+IECBusConnection *IECBusConnection::Create(int arduino_fd,
+                                           LogCallback log_callback,
                                            IECStatus *status) {
-  int fd = open(device_file.c_str(), O_RDWR | O_NONBLOCK);
-  if (fd == -1) {
-    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE,
-                      "open(\"" + device_file + "\")", status);
+  if (arduino_fd == -1) {
     return nullptr;
   }
+  return Create(std::make_unique<SerialTransport>(arduino_fd), log_callback,
+                status);
+}
 
-  // Configure serial port to 1200 baud to make the Arduino reset.
-  if (!ConfigureSerial(fd, 1200, status)) {
+IECBusConnection *IECBusConnection::Create(std::unique_ptr<Transport> transport,
+                                           LogCallback log_callback,
+                                           IECStatus *status) {
+  auto conn =
+      std::make_unique<IECBusConnection>(std::move(transport), log_callback);
+  if (!conn->Initialize(status)) {
     return nullptr;
   }
+  return conn.release();
+}
 
-  // Wait for the Arduino to reset, then flush everything that was sent or
-  // received.
-  usleep(1000 * 1000);
+// Run steps from next onwards, see RunAsyncSteps().
+static void RunAsyncStepsFrom(std::shared_ptr<std::vector<IECAsyncStep>> steps,
+                              size_t next, IECBusConnection::Callback done) {
+  (*steps)[next]([steps, next, done](const IECStatus &status,
+                                     const std::string &result) {
+    if (!status.ok() || next + 1 == steps->size()) {
+      done(status, result);
+      return;
+    }
+    RunAsyncStepsFrom(steps, next + 1, done);
+  });
+}
 
-  // Now configure to the desired speed.
-  if (!ConfigureSerial(fd, speed, status)) {
-    return nullptr;
+void RunAsyncSteps(std::vector<IECAsyncStep> steps,
+                   IECBusConnection::Callback done) {
+  if (steps.empty()) {
+    done(IECStatus(), std::string());
+    return;
   }
-  if (tcflush(fd, TCIFLUSH) == -1) {
-    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "tcflush", status);
-    return nullptr;
+  RunAsyncStepsFrom(
+      std::make_shared<std::vector<IECAsyncStep>>(std::move(steps)), 0,
+      std::move(done));
+}
+
+bool ConnectArduino(BufferedReadWriter *arduino, int device_number,
+                    const IECBusConnection::LogCallback &log_callback,
+                    IECStatus *status) {
+  std::string connection_string;
+  for (int i = 0; i < kNumRetries; ++i) {
+    if (!arduino->ReadTerminatedString('\r', kMaxLength, &connection_string,
+                                       status)) {
+      return false;
+    }
+    if (connection_string.size() >= kConnectionStringPrefix.size() &&
+        connection_string.substr(0, kConnectionStringPrefix.size()) ==
+            kConnectionStringPrefix) {
+      break;
+    } else if (i >= (kNumRetries - 1)) {
+      SetError(IECStatus::CONNECTION_FAILURE,
+               std::string("Unknown protocol response: '") +
+                   GetPrintableString(connection_string) + "'",
+               status);
+      return false;
+    } else {
+      log_callback('W', "CLIENT",
+                   (boost::format("Malformed connection string '%s'") %
+                    connection_string)
+                       .str());
+    }
   }
+  std::string reply;
+  return AcceptConnectionString(connection_string, device_number, &reply,
+                                status) &&
+         arduino->WriteString(reply, status);
+}
 
-  return Create(fd, log_callback, status);
+IECBusConnection *IECBusConnection::Create(const std::string &device_file,
+                                           int speed, LogCallback log_callback,
+                                           IECStatus *status) {
+  auto transport = SerialTransport::Open(device_file, speed, status);
+  if (!transport) {
+    return nullptr;
+  }
+  return Create(std::move(transport), log_callback, status);
 }
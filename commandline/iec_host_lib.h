@@ -5,21 +5,50 @@
 #ifndef IEC_HOST_LIB_H
 #define IEC_HOST_LIB_H
 
-#include <future>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include "trace.h"
+#include "transport.h"
 #include "utils.h"
 
+// Lets requests be cancelled from another thread, see
+// IECBusConnection::SetCancellation().
+class IECCancellation {
+public:
+  void Cancel() { cancelled_ = true; }
+  // Allow requests again after a cancellation.
+  void Reset() { cancelled_ = false; }
+  bool IsCancelled() const { return cancelled_; }
+
+private:
+  std::atomic<bool> cancelled_{false};
+};
+
 class IECBusConnection {
 public:
   typedef std::function<void(char level, const std::string &channel,
                              const std::string &message)>
       LogCallback;
 
+  // Called with the outcome of an asynchronous request, and the data read if
+  // it was a read. Called on the response thread, so it must not block, in
+  // particular not on blocking requests to the same connection. It may make
+  // further asynchronous requests though.
+  typedef std::function<void(const IECStatus &status,
+                             const std::string &result)>
+      Callback;
+
   // Instantiate an IECBusConnection object. The arduino_fd parameter is
   // used to specify a file descriptor that will be used for bidirectional
   // communication with an arduino connected to the IEC bus and speaking the
@@ -28,6 +57,11 @@ public:
   // Use Create() methods below instead of instantiating directly!
   IECBusConnection(int arduino_fd, LogCallback log_callback);
 
+  // Instantiate an IECBusConnection object talking to the Arduino through
+  // transport, see above.
+  IECBusConnection(std::unique_ptr<Transport> transport,
+                   LogCallback log_callback);
+
   // Reset the IEC bus by pulling the reset line to low. Returns true on
   // success. In case of an error, status will be set to an appropriate error
   // status.
@@ -60,6 +94,23 @@ public:
   virtual bool CloseChannel(char device_number, char channel,
                             IECStatus *status);
 
+  // Asynchronous versions of the requests above. They return right away and
+  // call done once the request is complete. All requests, blocking or not,
+  // are sent in the order they were made, each as soon as the Arduino
+  // answered the previous one. Any number of operations, e.g. on different
+  // drives, can thus be in progress without a thread of their own. A request
+  // fails with TIMEOUT if it isn't answered within the request timeout of
+  // being sent. Cancellation only applies to blocking requests.
+  virtual void OpenChannelAsync(char device_number, char channel,
+                                const std::string &data_string, Callback done);
+  virtual void ReadFromChannelAsync(char device_number, char channel,
+                                    Callback done);
+  virtual void WriteToChannelAsync(char device_number, char channel,
+                                   const std::string &data_string,
+                                   Callback done);
+  virtual void CloseChannelAsync(char device_number, char channel,
+                                 Callback done);
+
   // Create IECBusConnection instance using the specified device_file and serial
   // port speed. If log_callback is specified, the function will be called for
   // every log message received from the Arduino. Returns nullptr in case of a
@@ -77,25 +128,115 @@ public:
   static IECBusConnection *Create(int arduino_fd, LogCallback log_callback,
                                   IECStatus *status);
 
-  // Free resources such as any owned file descriptors.
+  // Create IECBusConnection instance talking to the Arduino through
+  // transport, e.g. one returned by OpenTransport(). See above for the other
+  // parameters.
+  static IECBusConnection *Create(std::unique_ptr<Transport> transport,
+                                  LogCallback log_callback, IECStatus *status);
+
+  // Free resources such as any owned file descriptors. Requests still
+  // pending fail with CONNECTION_FAILURE.
   virtual ~IECBusConnection();
 
+  // Every request fails with status TIMEOUT if it isn't done within timeout
+  // of being issued. The default is generous enough for formatting a disc.
+  void SetRequestTimeout(std::chrono::milliseconds timeout) {
+    request_timeout_ = timeout;
+  }
+
+  // Requests fail with status CANCELLED as soon as cancellation is requested,
+  // instead of waiting for the Arduino. Ownership is not transferred, pass
+  // nullptr to stop checking.
+  void SetCancellation(const IECCancellation *cancellation) {
+    cancellation_ = cancellation;
+  }
+
+  // Record spans for all requests, and the trace markers the Arduino sends,
+  // in tracer. Ownership is not transferred, pass nullptr to stop tracing.
+  // May be called at any time, the response thread picks up the change.
+  void SetTracer(Tracer *tracer) { tracer_ = tracer; }
+
   // Initialize the bus connection. To be called immediately after construction.
   // Returns true if successful. In case of error, returns false and sets
   // status.
   bool Initialize(IECStatus *status);
 
 private:
-  // RequestResult registers a promise with the background thread and returns
-  // a future on it.
-  std::future<std::pair<std::string, IECStatus>> RequestResult();
+  // A request waiting to be sent, or waiting for its status response.
+  struct QueuedRequest {
+    uint64_t id;
+    std::string request_string;
+    Callback done;
+    // Set if the response thread enforces the request timeout, rather than
+    // a caller waiting for the request.
+    bool async;
+  };
+
+  // Send request_string and wait for the Arduino's status response, within
+  // the request timeout. Sets *response to the data received with it, if
+  // response isn't null. Returns true if successful, sets status otherwise.
+  // Timeouts and cancellations resynchronise the connection.
+  bool Request(const std::string &request_string, std::string *response,
+               IECStatus *status);
+
+  // Queue request_string, to be sent once the requests before it are done.
+  // Calls done once it is complete, right away if the connection is broken.
+  // Returns the id of the request.
+  uint64_t Submit(std::string request_string, bool async, Callback done);
+
+  // Write data_string from pos onwards in packets, one after another.
+  void WritePacketsAsync(char device_number, char channel,
+                         const std::string &data_string, size_t pos,
+                         Callback done);
+
+  // Write to the Arduino, from any thread.
+  bool Write(const std::string &data, IECStatus *status);
+
+  // Send queued requests until one is in flight, unless resynchronising.
+  // Must be called with mutex_ held through lock, which is released while
+  // writing.
+  void SendNext(std::unique_lock<std::mutex> *lock);
+
+  // Complete the request in flight, if any, and send the next one. Must be
+  // called with mutex_ held through lock, which is released while calling
+  // back.
+  void CompleteRequest(std::unique_lock<std::mutex> *lock,
+                       const std::string &response, const IECStatus &status);
+
+  // Fail all queued requests with status. Must be called with mutex_ held
+  // through lock, which is released while calling back.
+  void FailQueued(std::unique_lock<std::mutex> *lock, const IECStatus &status);
 
   // Run on the response background thread. Reads from arduino_writer_,
   // calls log_callback_ for log messages and dispatches responses.
   void ProcessResponses();
 
-  // File descriptor used for communication.
-  int arduino_fd_;
+  // Run on the response thread after losing track of the Arduino's
+  // responses. Fails the pending request, drains everything received until
+  // the Arduino acknowledges a sync request and falls back to resetting the
+  // Arduino and repeating the handshake. Returns false if the thread should
+  // terminate.
+  bool Resync(const std::string &reason);
+
+  // Discard input until expected was received or deadline passed, or just
+  // until deadline if expected is empty. Returns true if found. Sets
+  // *terminate if the thread should terminate.
+  bool DrainUntil(const std::string &expected,
+                  std::chrono::steady_clock::time_point deadline,
+                  bool *terminate);
+
+  // Wait until input is available or deadline passed, returns true if there
+  // is input. Sets *terminate if the thread should terminate. Requests to
+  // resynchronise are dropped, we're at it already.
+  bool WaitForInput(std::chrono::steady_clock::time_point deadline,
+                    bool *terminate);
+
+  // Reset the Arduino, e.g. through the serial port's DTR line, and repeat
+  // the handshake. Returns true if successful.
+  bool Rehandshake(bool *terminate);
+
+  // Transport used for communication.
+  std::unique_ptr<Transport> transport_;
 
   // A buffered reader / writer used for communication.
   std::unique_ptr<BufferedReadWriter> arduino_writer_;
@@ -106,16 +247,64 @@ private:
   // Thread processing responses from the Arduino, including log messages.
   std::thread response_thread_;
 
-  // The current response promise. Will be updated for every incoming request.
-  std::promise<std::pair<std::string, IECStatus>> response_promise_;
+  // Guards the request state below, which is shared with the response
+  // thread. state_changed_ is notified whenever it changes.
+  std::mutex mutex_;
+  std::condition_variable state_changed_;
+  // Requests not sent yet.
+  std::deque<QueuedRequest> queue_;
+  // Whether a request was sent and waits for its status response, which
+  // request that is and when it times out.
+  bool request_pending_ = false;
+  QueuedRequest in_flight_;
+  std::chrono::steady_clock::time_point in_flight_deadline_;
+  uint64_t next_id_ = 0;
+  // Set while the response thread waits without a deadline. It needs to be
+  // interrupted to enforce the timeout of an asynchronous request.
+  bool waiting_forever_ = false;
+  // Set while resynchronising, new requests wait for it to finish.
+  bool syncing_ = false;
+  // Set if resynchronising failed, requests fail right away.
+  bool broken_ = false;
+
+  // Serializes writes of requests and of the response thread.
+  std::mutex write_mutex_;
+
+  // Identifies the current sync request, so stale acknowledgements are
+  // ignored.
+  char sync_nonce_ = '0';
+
+  std::chrono::milliseconds request_timeout_;
+  const IECCancellation *cancellation_ = nullptr;
+
+  // Where requests and trace markers are recorded, if anywhere. Read by the
+  // response thread.
+  std::atomic<Tracer *> tracer_{nullptr};
 
   // Configured and used by the response thread to provide user identifiable
   // debug log channel names.
   std::map<char, std::string> debug_channel_map_;
 
-  // A pipe created in the constructor and used to signal to the background
-  // thread that it should terminate execution.
-  int tthread_pipe_[2];
+  // Tell the background thread to terminate execution, or to resynchronise,
+  // along with interrupting the transport.
+  std::atomic<bool> terminate_requested_{false};
+  std::atomic<bool> resync_requested_{false};
 };
 
+// A step of an asynchronous operation, calling done once finished.
+typedef std::function<void(IECBusConnection::Callback done)> IECAsyncStep;
+
+// Run steps one after another, stopping at the first one failing. Calls done
+// with the outcome of the last step run.
+void RunAsyncSteps(std::vector<IECAsyncStep> steps,
+                   IECBusConnection::Callback done);
+
+// Wait for the connection string of the Arduino on arduino and reply with our
+// configuration, asking it to act as device_number (zero for host mode).
+// Malformed connection strings are passed to log_callback. Returns true if
+// successful, sets status otherwise.
+bool ConnectArduino(BufferedReadWriter *arduino, int device_number,
+                    const IECBusConnection::LogCallback &log_callback,
+                    IECStatus *status);
+
 #endif // IEC_HOST_LIB_H
@@ -1,13 +1,17 @@
+#include <chrono>
 #include <csignal>
 #include <functional>
+#include <future>
 #include <mutex>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 
 #include "boost/format.hpp"
 #include "iec_host_lib.h"
+#include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 static std::string Escape(const std::string &unescaped) {
@@ -90,6 +94,13 @@ protected:
           return;
         r = r + params;
         break;
+      case 'y':
+        // Sync requests are always acknowledged right away.
+        if (!writer.ReadUpTo(1, 1, &params, &status))
+          return;
+        EXPECT_TRUE(writer.WriteString("y" + params + "\r", &status))
+            << status.message;
+        continue;
       default:
         EXPECT_TRUE(false) << "Unknown command: " << Escape(r) << std::endl;
       }
@@ -180,3 +191,127 @@ TEST_F(IECBusConnectionTest, BasicProtocolTest) {
                                       &status));
   EXPECT_TRUE(bus_conn.CloseChannel(8, 15, &status));
 }
+
+TEST_F(IECBusConnectionTest, TimesOutAndResyncs) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        std::cout << level << ":" << channel << ":" << message << std::endl;
+      });
+  // The Arduino never answers closing channel 2.
+  AddRequestResponse((boost::format("c%c%c") % char(8) % char(2)).str(), "");
+  AddRequestResponse((boost::format("g%c%c") % char(8) % char(15)).str(),
+                     "r00, OK,00,00\\r\rs\r");
+
+  IECStatus status;
+  ASSERT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  bus_conn.SetRequestTimeout(std::chrono::milliseconds(100));
+  EXPECT_FALSE(bus_conn.CloseChannel(8, 2, &status));
+  EXPECT_EQ(status.status_code, IECStatus::TIMEOUT);
+
+  status.Clear();
+  std::string response;
+  EXPECT_TRUE(bus_conn.ReadFromChannel(8, 15, &response, &status))
+      << status.message;
+  EXPECT_EQ(response, "00, OK,00,00\r");
+}
+
+TEST_F(IECBusConnectionTest, RecoversFromMalformedResponses) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        std::cout << level << ":" << channel << ":" << message << std::endl;
+      });
+  AddRequestResponse((boost::format("g%c%c") % char(8) % char(2)).str(),
+                     "xgarbage\rs\r");
+  AddRequestResponse((boost::format("g%c%c") % char(8) % char(15)).str(),
+                     "r00, OK,00,00\\r\rs\r");
+
+  IECStatus status;
+  ASSERT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  std::string response;
+  EXPECT_FALSE(bus_conn.ReadFromChannel(8, 2, &response, &status));
+  EXPECT_EQ(status.status_code, IECStatus::CONNECTION_FAILURE);
+
+  // The garbage, and the status response following it, are skipped.
+  status.Clear();
+  EXPECT_TRUE(bus_conn.ReadFromChannel(8, 15, &response, &status))
+      << status.message;
+  EXPECT_EQ(response, "00, OK,00,00\r");
+}
+
+TEST_F(IECBusConnectionTest, CancelsRequests) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        std::cout << level << ":" << channel << ":" << message << std::endl;
+      });
+  AddRequestResponse((boost::format("c%c%c") % char(8) % char(2)).str(), "");
+  AddRequestResponse((boost::format("c%c%c") % char(8) % char(15)).str(),
+                     "s\r");
+
+  IECStatus status;
+  ASSERT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  IECCancellation cancellation;
+  bus_conn.SetCancellation(&cancellation);
+  std::thread canceller([&cancellation]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    cancellation.Cancel();
+  });
+  EXPECT_FALSE(bus_conn.CloseChannel(8, 2, &status));
+  EXPECT_EQ(status.status_code, IECStatus::CANCELLED);
+  canceller.join();
+
+  cancellation.Reset();
+  status.Clear();
+  EXPECT_TRUE(bus_conn.CloseChannel(8, 15, &status)) << status.message;
+}
+
+TEST_F(IECBusConnectionTest, AsyncRequests) {
+  IECBusConnection bus_conn(
+      pipefd_[0],
+      [](char level, const std::string &channel, const std::string &message) {
+        std::cout << level << ":" << channel << ":" << message << std::endl;
+      });
+  for (char device = 8; device < 11; ++device) {
+    AddRequestResponse((boost::format("g%c%c") % device % char(15)).str(),
+                       (boost::format("r%u\rs\r") % int(device)).str());
+    AddRequestResponse((boost::format("c%c%c") % device % char(2)).str(),
+                       device == 10 ? "snot open\r" : "s\r");
+  }
+
+  IECStatus status;
+  ASSERT_TRUE(bus_conn.Initialize(&status)) << status.message;
+  // Each device's status is read, then a channel closed, without any thread
+  // waiting for it.
+  std::mutex mutex;
+  std::vector<std::string> results;
+  std::promise<void> all_done;
+  for (char device = 8; device < 11; ++device) {
+    std::vector<IECAsyncStep> steps;
+    steps.push_back([&, device](IECBusConnection::Callback done) {
+      bus_conn.ReadFromChannelAsync(device, 15, done);
+    });
+    steps.push_back([&, device](IECBusConnection::Callback done) {
+      bus_conn.CloseChannelAsync(device, 2, done);
+    });
+    RunAsyncSteps(steps, [&, device](const IECStatus &status,
+                                     const std::string &result) {
+      std::lock_guard<std::mutex> lock(mutex);
+      results.push_back(std::to_string(device) + ":" +
+                        (status.ok() ? "OK" : status.message));
+      if (results.size() == 3) {
+        all_done.set_value();
+      }
+    });
+  }
+  // Blocking requests line up with the asynchronous ones.
+  std::string response;
+  EXPECT_TRUE(bus_conn.ReadFromChannel(8, 15, &response, &status))
+      << status.message;
+  EXPECT_EQ(response, "8");
+  all_done.get_future().wait();
+  EXPECT_THAT(results, ::testing::UnorderedElementsAre(
+                           "8:OK", "9:OK",
+                           "10:not open: IEC connection failure"));
+}
@@ -0,0 +1,255 @@
+#include "iec_sniffer.h"
+
+#include <algorithm>
+
+#include "boost/format.hpp"
+
+namespace {
+// Record kinds and flags, see uno2iec/sniffer.h.
+const unsigned char kRecordFlag = 0x80;
+const unsigned char kKindMask = 0x70;
+const unsigned char kKindByte = 0x00;
+const unsigned char kKindATNAsserted = 0x10;
+const unsigned char kKindATNReleased = 0x20;
+const unsigned char kKindTime = 0x30;
+const unsigned char kKindStart = 0x40;
+const unsigned char kFlagEOI = 0x01;
+const unsigned char kFlagATN = 0x02;
+const unsigned char kFlagError = 0x04;
+const size_t kRecordSize = 4;
+
+// Log messages longer than this mean we're out of sync.
+const size_t kMaxLogLength = 512;
+
+// Bytes sent under ATN.
+const unsigned char kATNCodeMask = 0xe0;
+const unsigned char kATNCodeListen = 0x20;
+const unsigned char kATNCodeTalk = 0x40;
+const unsigned char kATNCodeData = 0x60;
+const unsigned char kATNCodeClose = 0xe0;
+const unsigned char kATNCodeUnlisten = 0x3f;
+const unsigned char kATNCodeUntalk = 0x5f;
+
+// Number of data bytes shown in a report.
+const size_t kMaxDataShown = 16;
+
+std::string CommandName(unsigned char command) {
+  const char *name =
+      (command & kATNCodeMask) == kATNCodeListen ? "LISTEN" : "TALK";
+  return (boost::format("%s %u") % name % (command & 0x1f)).str();
+}
+
+std::string SecondaryName(unsigned char secondary) {
+  const char *name = "OPEN";
+  if ((secondary & 0xf0) == kATNCodeData) {
+    name = "DATA";
+  } else if ((secondary & 0xf0) == kATNCodeClose) {
+    name = "CLOSE";
+  }
+  return (boost::format("%s %u") % name % (secondary & 0x0f)).str();
+}
+
+double Milliseconds(uint64_t us) { return us / 1000.0; }
+} // namespace
+
+SniffDecoder::SniffDecoder(LogCallback log_callback)
+    : log_callback_(log_callback) {}
+
+bool SniffDecoder::Decode(const std::string &input,
+                          std::vector<SniffEvent> *events, IECStatus *status) {
+  pending_ += input;
+  size_t pos = 0;
+  while (pos < pending_.size()) {
+    unsigned char flags = pending_[pos];
+    if (flags & kRecordFlag) {
+      if (pending_.size() - pos < kRecordSize) {
+        break;
+      }
+      unsigned char data = pending_[pos + 1];
+      uint64_t delta = static_cast<unsigned char>(pending_[pos + 2]) |
+                       (static_cast<unsigned char>(pending_[pos + 3]) << 8);
+      pos += kRecordSize;
+      unsigned char kind = flags & kKindMask;
+      if (kind == kKindStart) {
+        if (data == 0) {
+          SetError(IECStatus::CONNECTION_FAILURE,
+                   "Decode: Start record with zero tick length", status);
+          return false;
+        }
+        tick_us_ = data;
+        ticks_ = 0;
+        continue;
+      }
+      if (!started()) {
+        SetError(IECStatus::CONNECTION_FAILURE,
+                 "Decode: Record received before start record", status);
+        return false;
+      }
+      if (kind == kKindTime) {
+        ticks_ += delta << 16;
+        continue;
+      }
+      ticks_ += delta;
+      SniffEvent event = {SniffEvent::BYTE, ticks_ * tick_us_, data,
+                          (flags & kFlagEOI) != 0, (flags & kFlagATN) != 0,
+                          (flags & kFlagError) != 0};
+      if (kind == kKindATNAsserted) {
+        event.kind = SniffEvent::ATN_ASSERTED;
+      } else if (kind == kKindATNReleased) {
+        event.kind = SniffEvent::ATN_RELEASED;
+      } else if (kind != kKindByte) {
+        SetError(IECStatus::CONNECTION_FAILURE,
+                 (boost::format("Decode: Unknown record kind %#x") %
+                  static_cast<int>(kind))
+                     .str(),
+                 status);
+        return false;
+      }
+      events->push_back(event);
+    } else if (flags == 'D' || flags == '!') {
+      size_t end = pending_.find('\r', pos);
+      if (end == std::string::npos) {
+        if (pending_.size() - pos > kMaxLogLength) {
+          SetError(IECStatus::CONNECTION_FAILURE,
+                   "Decode: Unterminated log message", status);
+          return false;
+        }
+        break;
+      }
+      std::string message = pending_.substr(pos + 1, end - pos - 1);
+      pos = end + 1;
+      if (flags == '!' && message.size() >= 2) {
+        channels_[message[0]] = message.substr(1);
+      } else if (flags == 'D' && message.size() >= 2) {
+        log_callback_(message[0], channels_[message[1]], message.substr(2));
+      } else {
+        SetError(IECStatus::CONNECTION_FAILURE,
+                 "Decode: Malformed log message", status);
+        return false;
+      }
+    } else {
+      SetError(IECStatus::CONNECTION_FAILURE,
+               (boost::format("Decode: Unexpected byte %#x") %
+                static_cast<int>(flags))
+                   .str(),
+               status);
+      return false;
+    }
+  }
+  pending_.erase(0, pos);
+  return true;
+}
+
+bool SniffTransactionBuilder::Add(const SniffEvent &event,
+                                  SniffTransaction *completed) {
+  if (event.kind == SniffEvent::ATN_ASSERTED) {
+    atn_asserted_us_ = event.time_us;
+    return false;
+  }
+  if (event.kind != SniffEvent::BYTE) {
+    return false;
+  }
+  if (event.error) {
+    if (in_progress_) {
+      ++current_.errors;
+    }
+    return false;
+  }
+  bool result = false;
+  if (event.atn) {
+    unsigned char code = event.data;
+    if (code == kATNCodeUnlisten || code == kATNCodeUntalk) {
+      if (in_progress_) {
+        current_.end_us = event.time_us;
+      }
+      return Flush(completed);
+    }
+    if ((code & kATNCodeMask) == kATNCodeListen ||
+        (code & kATNCodeMask) == kATNCodeTalk) {
+      result = Start(atn_asserted_us_, completed);
+      current_.command = code;
+    } else {
+      if (!in_progress_) {
+        result = Start(atn_asserted_us_, completed);
+      }
+      current_.has_secondary = true;
+      current_.secondary = code;
+    }
+  } else {
+    if (!in_progress_) {
+      result = Start(event.time_us, completed);
+    }
+    current_.data.push_back(event.data);
+    current_.data_times_us.push_back(event.time_us);
+    current_.eoi = current_.eoi || event.eoi;
+  }
+  current_.end_us = event.time_us;
+  return result;
+}
+
+bool SniffTransactionBuilder::Flush(SniffTransaction *completed) {
+  if (!in_progress_) {
+    return false;
+  }
+  *completed = current_;
+  in_progress_ = false;
+  return true;
+}
+
+bool SniffTransactionBuilder::Start(uint64_t start_us,
+                                    SniffTransaction *completed) {
+  bool result = Flush(completed);
+  current_ = SniffTransaction();
+  current_.start_us = start_us;
+  in_progress_ = true;
+  return result;
+}
+
+std::string FormatTransaction(const SniffTransaction &transaction) {
+  std::string result =
+      (boost::format("%12.6f ") % (transaction.start_us / 1000000.0)).str();
+  result += transaction.command != 0 ? CommandName(transaction.command)
+                                     : std::string("(no command)");
+  if (transaction.has_secondary) {
+    result += " " + SecondaryName(transaction.secondary);
+  }
+  result += (boost::format(": %u bytes%s, %.2f ms") % transaction.data.size() %
+             (transaction.eoi ? " EOI" : "") %
+             Milliseconds(transaction.end_us - transaction.start_us))
+                .str();
+  const auto &times = transaction.data_times_us;
+  if (!times.empty()) {
+    result += (boost::format(", command %.2f ms") %
+               Milliseconds(times.front() - transaction.start_us))
+                  .str();
+  }
+  if (times.size() > 1) {
+    uint64_t min_gap = UINT64_MAX, max_gap = 0;
+    for (size_t i = 1; i < times.size(); ++i) {
+      min_gap = std::min(min_gap, times[i] - times[i - 1]);
+      max_gap = std::max(max_gap, times[i] - times[i - 1]);
+    }
+    uint64_t total = times.back() - times.front();
+    result +=
+        (boost::format(", byte gap min/avg/max %.2f/%.2f/%.2f ms, %.0f "
+                       "bytes/s") %
+         Milliseconds(min_gap) % (Milliseconds(total) / (times.size() - 1)) %
+         Milliseconds(max_gap) %
+         (total > 0 ? (times.size() - 1) * 1000000.0 / total : 0.0))
+            .str();
+  }
+  if (transaction.errors > 0) {
+    result += (boost::format(", %u aborted") % transaction.errors).str();
+  }
+  if (!transaction.data.empty()) {
+    std::string shown;
+    for (size_t i = 0;
+         i < std::min(transaction.data.size(), kMaxDataShown); ++i) {
+      char c = transaction.data[i];
+      shown += (c >= 32 && c < 127) ? c : '.';
+    }
+    result += " \"" + shown +
+              (transaction.data.size() > kMaxDataShown ? "\"..." : "\"");
+  }
+  return result;
+}
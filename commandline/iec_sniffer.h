@@ -0,0 +1,112 @@
+// Decoding of the capture an Arduino streams while passively watching the IEC
+// bus (see uno2iec/sniffer.h for the record format), and grouping of the
+// captured bytes into bus transactions for timing reports.
+
+#ifndef IEC_SNIFFER_H
+#define IEC_SNIFFER_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+// Device number that makes the Arduino sniff rather than take part in
+// communication. It can't be addressed on the bus.
+const int kSnifferDeviceNumber = 31;
+
+// Something that happened on the bus.
+struct SniffEvent {
+  enum Kind { BYTE, ATN_ASSERTED, ATN_RELEASED };
+  Kind kind;
+  // Time since sniffing started.
+  uint64_t time_us;
+  // For BYTE events: The byte and how it was sent. If error is set, the
+  // transfer was aborted and data holds only the bits received.
+  unsigned char data;
+  bool eoi;
+  bool atn;
+  bool error;
+};
+
+// Turns the byte stream received from the Arduino into events. Log messages
+// may be interleaved with the records.
+class SniffDecoder {
+public:
+  typedef std::function<void(char level, const std::string &channel,
+                             const std::string &message)>
+      LogCallback;
+
+  // log_callback is invoked for every log message found.
+  explicit SniffDecoder(LogCallback log_callback);
+
+  // Decode input, which may end in the middle of a record or log message,
+  // and append the events found to *events. Returns true if successful, sets
+  // status if the input doesn't follow the protocol.
+  bool Decode(const std::string &input, std::vector<SniffEvent> *events,
+              IECStatus *status);
+
+  // True once the Arduino reported sniffing started.
+  bool started() const { return tick_us_ != 0; }
+
+private:
+  LogCallback log_callback_;
+  // Input not decoded yet because it's incomplete.
+  std::string pending_;
+  // Log channel names by abbreviation.
+  std::map<char, std::string> channels_;
+  // Timer ticks since sniffing started, and the length of a tick.
+  uint64_t ticks_ = 0;
+  unsigned int tick_us_ = 0;
+};
+
+// A command sent under ATN and the data that followed it, e.g. LISTEN 8,
+// OPEN 2 and a file name.
+struct SniffTransaction {
+  // The LISTEN or TALK byte, zero if the capture started in the middle of
+  // the transaction.
+  unsigned char command = 0;
+  // The secondary address byte (DATA, OPEN or CLOSE and channel), if any.
+  bool has_secondary = false;
+  unsigned char secondary = 0;
+  // When ATN was asserted for the command, and when the last byte of the
+  // transaction was sent.
+  uint64_t start_us = 0;
+  uint64_t end_us = 0;
+  // The data bytes and the time of each.
+  std::string data;
+  std::vector<uint64_t> data_times_us;
+  bool eoi = false;
+  // Number of transfers aborted.
+  int errors = 0;
+};
+
+// Groups events into transactions.
+class SniffTransactionBuilder {
+public:
+  // Add the next event. Returns true and sets *completed if this completes a
+  // transaction.
+  bool Add(const SniffEvent &event, SniffTransaction *completed);
+
+  // Complete the transaction in progress at the end of a capture. Returns
+  // false if there isn't one.
+  bool Flush(SniffTransaction *completed);
+
+private:
+  // Start a new transaction at time start_us, returning the one in progress
+  // in *completed, if any.
+  bool Start(uint64_t start_us, SniffTransaction *completed);
+
+  bool in_progress_ = false;
+  SniffTransaction current_;
+  uint64_t atn_asserted_us_ = 0;
+};
+
+// A one line timing report for transaction: When it started, what it was,
+// how long the ATN command and the whole transaction took, and the time
+// between data bytes.
+std::string FormatTransaction(const SniffTransaction &transaction);
+
+#endif // IEC_SNIFFER_H
@@ -0,0 +1,148 @@
+#include <string>
+#include <vector>
+
+#include "iec_sniffer.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::HasSubstr;
+
+class SniffDecoderTest : public ::testing::Test {
+protected:
+  SniffDecoderTest()
+      : decoder_([this](char level, const std::string &channel,
+                        const std::string &message) {
+          logged_.push_back(std::string(1, level) + channel + ":" + message);
+        }) {}
+
+  // A record as sent by the Arduino.
+  static std::string Record(unsigned char flags, unsigned char data,
+                            unsigned int delta) {
+    std::string result;
+    result.push_back(static_cast<char>(0x80 | flags));
+    result.push_back(static_cast<char>(data));
+    result.push_back(static_cast<char>(delta & 0xff));
+    result.push_back(static_cast<char>(delta >> 8));
+    return result;
+  }
+
+  // The start record, with 4 us ticks.
+  static std::string Start() { return Record(0x40, 4, 0); }
+
+  // Feed input to the decoder and then to a transaction builder, collecting
+  // all transactions completed.
+  void Capture(const std::string &input) {
+    IECStatus status;
+    std::vector<SniffEvent> events;
+    ASSERT_TRUE(decoder_.Decode(input, &events, &status)) << status.message;
+    for (const auto &event : events) {
+      SniffTransaction transaction;
+      if (builder_.Add(event, &transaction)) {
+        transactions_.push_back(transaction);
+      }
+    }
+  }
+
+  SniffDecoder decoder_;
+  SniffTransactionBuilder builder_;
+  std::vector<std::string> logged_;
+  std::vector<SniffTransaction> transactions_;
+};
+
+TEST_F(SniffDecoderTest, DecodesRecordsAndLogMessages) {
+  std::string input = "!MMAIN\r" + Start() + "DIMHello\r" +
+                      Record(0x10, 0, 100) + Record(0x02, 0x28, 250) +
+                      Record(0x20, 0, 10) + Record(0x05, 0x03, 1);
+  std::vector<SniffEvent> events;
+  IECStatus status;
+  ASSERT_TRUE(decoder_.Decode(input, &events, &status)) << status.message;
+  EXPECT_TRUE(decoder_.started());
+  EXPECT_EQ(logged_, std::vector<std::string>({"IMAIN:Hello"}));
+
+  ASSERT_EQ(events.size(), 4);
+  EXPECT_EQ(events[0].kind, SniffEvent::ATN_ASSERTED);
+  EXPECT_EQ(events[0].time_us, 400);
+  EXPECT_EQ(events[1].kind, SniffEvent::BYTE);
+  EXPECT_EQ(events[1].data, 0x28);
+  EXPECT_TRUE(events[1].atn);
+  EXPECT_FALSE(events[1].eoi);
+  EXPECT_EQ(events[1].time_us, 1400);
+  EXPECT_EQ(events[2].kind, SniffEvent::ATN_RELEASED);
+  EXPECT_EQ(events[2].time_us, 1440);
+  EXPECT_TRUE(events[3].eoi);
+  EXPECT_TRUE(events[3].error);
+  EXPECT_FALSE(events[3].atn);
+}
+
+TEST_F(SniffDecoderTest, HandlesSplitInputAndLongGaps) {
+  // Two time records of 65536 ticks each, followed by a byte 16 ticks later.
+  std::string input =
+      Start() + "DWMSplit\r" + Record(0x30, 0, 2) + Record(0x00, 'A', 16);
+  std::vector<SniffEvent> events;
+  IECStatus status;
+  for (char c : input) {
+    ASSERT_TRUE(decoder_.Decode(std::string(1, c), &events, &status))
+        << status.message;
+  }
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0].data, 'A');
+  EXPECT_EQ(events[0].time_us, (2 * 65536 + 16) * 4);
+  EXPECT_EQ(logged_.size(), 1);
+}
+
+TEST_F(SniffDecoderTest, RejectsMalformedInput) {
+  std::vector<SniffEvent> events;
+  IECStatus status;
+  EXPECT_FALSE(decoder_.Decode(Record(0x00, 0, 0), &events, &status));
+  EXPECT_THAT(status.message, HasSubstr("before start"));
+
+  SniffDecoder other([](char, const std::string &, const std::string &) {});
+  status.Clear();
+  EXPECT_FALSE(other.Decode(Start() + "x", &events, &status));
+  EXPECT_THAT(status.message, HasSubstr("Unexpected byte"));
+}
+
+TEST_F(SniffDecoderTest, GroupsTransactions) {
+  // LISTEN 8, OPEN 2, "AB" with EOI, UNLISTEN. Then TALK 8, DATA 2, two bytes
+  // and UNTALK.
+  Capture(Start() + Record(0x10, 0, 250) + Record(0x02, 0x28, 250) +
+          Record(0x02, 0xf2, 250) + Record(0x20, 0, 25) +
+          Record(0x00, 'A', 250) + Record(0x01, 'B', 500) +
+          Record(0x10, 0, 25) + Record(0x02, 0x3f, 250) +
+          Record(0x20, 0, 25));
+  Capture(Record(0x10, 0, 2500) + Record(0x02, 0x48, 250) +
+          Record(0x02, 0x62, 250) + Record(0x20, 0, 25) +
+          Record(0x00, 0x01, 250) + Record(0x01, 0x08, 250) +
+          Record(0x10, 0, 25) + Record(0x02, 0x5f, 250));
+  ASSERT_EQ(transactions_.size(), 2);
+
+  const SniffTransaction &open = transactions_[0];
+  EXPECT_EQ(open.command, 0x28);
+  EXPECT_TRUE(open.has_secondary);
+  EXPECT_EQ(open.secondary, 0xf2);
+  EXPECT_EQ(open.data, "AB");
+  EXPECT_TRUE(open.eoi);
+  EXPECT_EQ(open.start_us, 1000);
+  EXPECT_EQ(open.end_us, 7200);
+  EXPECT_EQ(open.data_times_us, std::vector<uint64_t>({4100, 6100}));
+  std::string report = FormatTransaction(open);
+  EXPECT_THAT(report, HasSubstr("LISTEN 8 OPEN 2: 2 bytes EOI, 6.20 ms"));
+  EXPECT_THAT(report, HasSubstr("byte gap min/avg/max 2.00/2.00/2.00 ms"));
+  EXPECT_THAT(report, HasSubstr("\"AB\""));
+
+  const SniffTransaction &read = transactions_[1];
+  EXPECT_EQ(read.command, 0x48);
+  EXPECT_EQ(read.secondary, 0x62);
+  EXPECT_EQ(read.data, std::string("\x01\x08"));
+  EXPECT_THAT(FormatTransaction(read), HasSubstr("TALK 8 DATA 2: 2 bytes"));
+
+  // Data without a command, as when the capture starts mid-transfer, ends up
+  // in a transaction of its own.
+  Capture(Record(0x00, 'X', 100));
+  SniffTransaction rest;
+  ASSERT_TRUE(builder_.Flush(&rest));
+  EXPECT_EQ(rest.command, 0);
+  EXPECT_THAT(FormatTransaction(rest), HasSubstr("(no command): 1 bytes"));
+  EXPECT_FALSE(builder_.Flush(&rest));
+}
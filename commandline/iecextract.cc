@@ -0,0 +1,291 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/crc.hpp"
+#include "boost/filesystem.hpp"
+#include "boost/format.hpp"
+#include "boost/program_options/cmdline.hpp"
+#include "boost/program_options/options_description.hpp"
+#include "boost/program_options/parsers.hpp"
+#include "boost/program_options/variables_map.hpp"
+#include "disc_files.h"
+#include "disc_pack.h"
+#include "image_drive_d64.h"
+#include "utils.h"
+#include "work_pool.h"
+
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+// Processes all images below a directory on a pool of workers. Every
+// directory and every image is a task of its own.
+class Extractor {
+public:
+  // Files are extracted below output_dir unless it's empty, images added to
+  // pack unless it's nullptr.
+  Extractor(WorkStealingPool *pool, const fs::path &input_dir,
+            const fs::path &output_dir, DiscPackWriter *pack)
+      : pool_(pool), input_dir_(input_dir), output_dir_(output_dir),
+        pack_(pack) {}
+
+  // Queue the images in directory and its subdirectories for processing.
+  void AddDirectory(const fs::path &directory) {
+    pool_->Submit([this, directory]() {
+      boost::system::error_code error;
+      for (fs::directory_iterator it(directory, error), end;
+           !error && it != end; it.increment(error)) {
+        const fs::path &path = it->path();
+        boost::system::error_code status_error;
+        if (fs::is_directory(path, status_error)) {
+          AddDirectory(path);
+        } else if (IsImage(path)) {
+          pool_->Submit([this, path]() { ProcessImage(path); });
+        }
+      }
+      if (error) {
+        AddResult(directory, {Line(Relative(directory), nullptr, 0,
+                                   "error: " + error.message())},
+                  0, 1);
+      }
+    });
+  }
+
+  // Write the manifest, one line per file, sorted by image and in directory
+  // order within each image. Returns true if successful.
+  bool WriteManifest(std::ostream *manifest) const {
+    *manifest << "image\tfile\ttype\tblocks\tbytes\tcrc32\tstatus\n";
+    for (const auto &image : results_) {
+      for (const auto &line : image.second) {
+        *manifest << line << "\n";
+      }
+    }
+    return static_cast<bool>(*manifest);
+  }
+
+  size_t num_images() const { return results_.size(); }
+  size_t num_files() const { return num_files_; }
+  size_t num_errors() const { return num_errors_; }
+
+private:
+  static bool IsImage(const fs::path &path) {
+    std::string extension = path.extension().string();
+    for (auto &c : extension) {
+      c = tolower(static_cast<unsigned char>(c));
+    }
+    return extension == ".d64";
+  }
+
+  std::string Relative(const fs::path &path) const {
+    return path.lexically_relative(input_dir_).generic_string();
+  }
+
+  // Returns a manifest line for the file described by entry (if any) of
+  // image.
+  static std::string Line(const std::string &image,
+                          const DirectoryEntry *entry, size_t size,
+                          const std::string &status, uint32_t crc = 0) {
+    if (entry == nullptr) {
+      return (boost::format("%s\t\t\t\t\t\t%s") % image % status).str();
+    }
+    std::string name = entry->name;
+    for (auto &c : name) {
+      if (c < ' ' || c > '~') {
+        c = '?';
+      }
+    }
+    return (boost::format("%s\t%s\t%s\t%u\t%u\t%08x\t%s") % image % name %
+            GetFileTypeName(entry->type) % entry->num_blocks % size % crc %
+            status)
+        .str();
+  }
+
+  // Returns the host file name for entry, with a number added in front of the
+  // extension if it is used already. Adds the name returned to used.
+  static std::string GetUniqueHostFileName(const DirectoryEntry &entry,
+                                           std::set<std::string> *used) {
+    std::string name = GetHostFileName(entry);
+    fs::path path(name);
+    for (int i = 2; used->count(name) != 0; ++i) {
+      name = (boost::format("%s~%d%s") % path.stem().string() % i %
+              path.extension().string())
+                 .str();
+    }
+    used->insert(name);
+    return name;
+  }
+
+  void ProcessImage(const fs::path &path) {
+    std::string image = Relative(path);
+    std::vector<std::string> lines;
+    size_t num_errors = 0;
+    ImageDriveD64 drive(path.string(), /*read_only=*/true);
+    IECStatus status;
+    if (pack_ != nullptr && !AddToPack(image, &drive, &status)) {
+      lines.push_back(Line(image, nullptr, 0, "error: " + status.message));
+      ++num_errors;
+    }
+
+    DiscFiles files(&drive);
+    if (!files.ReadDirectory(&status)) {
+      lines.push_back(Line(image, nullptr, 0, "error: " + status.message));
+      AddResult(path, lines, 0, num_errors + 1);
+      return;
+    }
+    fs::path target = output_dir_ / fs::path(image).replace_extension();
+    if (!output_dir_.empty()) {
+      boost::system::error_code error;
+      fs::create_directories(target, error);
+      if (error) {
+        lines.push_back(Line(image, nullptr, 0, "error: " + error.message()));
+        AddResult(path, lines, 0, num_errors + 1);
+        return;
+      }
+    }
+    // Host names of the files written so far, distinct entries can map to the
+    // same one.
+    std::set<std::string> host_names;
+    for (const auto &entry : files.entries()) {
+      std::string content;
+      if (!files.ReadFile(entry, &content, &status)) {
+        lines.push_back(Line(image, &entry, 0, "error: " + status.message));
+        ++num_errors;
+        continue;
+      }
+      boost::crc_32_type crc;
+      crc.process_bytes(content.data(), content.size());
+      std::string result = "ok";
+      if (!output_dir_.empty()) {
+        std::string host_name = GetUniqueHostFileName(entry, &host_names);
+        if (host_name != GetHostFileName(entry)) {
+          result += ", written as " + host_name;
+        }
+        std::ofstream output((target / host_name).string(), std::ios::binary);
+        output.write(content.data(), content.size());
+        if (!output) {
+          result = "error: failed to write " + host_name;
+          ++num_errors;
+        }
+      }
+      lines.push_back(
+          Line(image, &entry, content.size(), result, crc.checksum()));
+    }
+    AddResult(path, lines, files.entries().size(), num_errors);
+  }
+
+  // Add the image in drive to the pack under name. Returns true if
+  // successful, sets status otherwise.
+  bool AddToPack(const std::string &name, DriveInterface *drive,
+                 IECStatus *status) {
+    size_t num_sectors = 0;
+    if (!drive->GetNumSectors(&num_sectors, status)) {
+      return false;
+    }
+    std::string image, sector;
+    image.reserve(num_sectors * DriveInterface::kNumBytesPerSector);
+    for (size_t s = 0; s < num_sectors; ++s) {
+      if (!drive->ReadSector(s, &sector, status)) {
+        return false;
+      }
+      image += sector;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pack_->AddImage(name, image, status);
+  }
+
+  void AddResult(const fs::path &path, std::vector<std::string> lines,
+                 size_t num_files, size_t num_errors) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_files_ += num_files;
+    num_errors_ += num_errors;
+    results_[Relative(path)] = std::move(lines);
+  }
+
+  WorkStealingPool *pool_;
+  const fs::path input_dir_;
+  const fs::path output_dir_;
+  DiscPackWriter *pack_;
+
+  // Guards the pack and the results.
+  std::mutex mutex_;
+  // Manifest lines by image.
+  std::map<std::string, std::vector<std::string>> results_;
+  size_t num_files_ = 0;
+  size_t num_errors_ = 0;
+};
+
+int main(int argc, char *argv[]) {
+  std::cout << "Disc image archive extraction utility." << std::endl
+            << "Copyright (c) 2020 Andreas Eckleder" << std::endl
+            << std::endl;
+
+  std::string input;
+  std::string output;
+  std::string pack;
+  std::string manifest;
+  size_t num_threads = 0;
+
+  po::options_description desc("Options");
+  desc.add_options()("help", "usage overview")(
+      "input", po::value<std::string>(&input)->default_value(""),
+      "directory to search for .d64 images, including subdirectories")(
+      "output", po::value<std::string>(&output)->default_value(""),
+      "directory to extract the files of each image to, in a directory "
+      "named after the image")(
+      "pack", po::value<std::string>(&pack)->default_value(""),
+      "disc pack to convert the images to")(
+      "manifest", po::value<std::string>(&manifest)->default_value(""),
+      "file to list every file found in, with its size, CRC and whether it "
+      "could be read")(
+      "threads", po::value<size_t>(&num_threads)->default_value(0),
+      "number of worker threads, 0 for one per core");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+  if (input.empty()) {
+    std::cout << desc << std::endl
+              << "Required argument --input must be non-empty." << std::endl;
+    return 2;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  DiscPackWriter pack_writer;
+  WorkStealingPool pool(num_threads);
+  Extractor extractor(&pool, input, output,
+                      pack.empty() ? nullptr : &pack_writer);
+  extractor.AddDirectory(input);
+  pool.Wait();
+
+  IECStatus status;
+  if (!pack.empty() && !pack_writer.Write(pack, &status)) {
+    std::cout << status.message << std::endl;
+    return 1;
+  }
+  if (!manifest.empty()) {
+    std::ofstream file(manifest);
+    if (!extractor.WriteManifest(&file)) {
+      std::cout << "Failed to write " << manifest << std::endl;
+      return 1;
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << boost::format("%u images, %u files, %u errors in %.1fs on %u "
+                             "threads.") %
+                   extractor.num_images() % extractor.num_files() %
+                   extractor.num_errors() % elapsed.count() %
+                   pool.num_threads()
+            << std::endl;
+  return extractor.num_errors() == 0 ? 0 : 1;
+}
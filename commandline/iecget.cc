@@ -0,0 +1,150 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/format.hpp"
+#include "boost/program_options/cmdline.hpp"
+#include "boost/program_options/options_description.hpp"
+#include "boost/program_options/parsers.hpp"
+#include "boost/program_options/positional_options.hpp"
+#include "boost/program_options/variables_map.hpp"
+#include "disc_files.h"
+#include "drive_factory.h"
+#include "drive_interface.h"
+#include "iec_host_lib.h"
+#include "transport.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+// Returns true if drive names a device on the bus rather than an image.
+static bool IsDeviceNumber(const std::string &drive) {
+  return !drive.empty() &&
+         drive.find_first_not_of("0123456789") == std::string::npos;
+}
+
+int main(int argc, char *argv[]) {
+  std::cout << "IEC Bus file extraction utility." << std::endl
+            << "Copyright (c) 2020 Andreas Eckleder" << std::endl
+            << std::endl;
+
+  std::string arduino_device;
+  int serial_speed = 0;
+  std::string recording;
+  std::string drive_spec;
+  std::string output_dir;
+  std::vector<std::string> names;
+
+  po::options_description desc("Options");
+  desc.add_options()("help", "usage overview")(
+      "serial",
+      po::value<std::string>(&arduino_device)->default_value("/dev/ttyUSB0"),
+      "serial interface to use, or unix:<path> for a Unix domain socket or "
+      "replay:<path> to play back a recording")(
+      "speed", po::value<int>(&serial_speed)->default_value(57600),
+      "baud rate")("record",
+                   po::value<std::string>(&recording)->default_value(""),
+                   "record the traffic with the Arduino to this file")(
+      "drive", po::value<std::string>(&drive_spec)->default_value("8"),
+      "device (e.g. 8, 9) or image to read from")(
+      "output", po::value<std::string>(&output_dir)->default_value("."),
+      "directory to store the files in")(
+      "file", po::value<std::vector<std::string>>(&names),
+      "name of a file to extract, lists the directory if none is given");
+  po::positional_options_description positional;
+  positional.add("file", -1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv)
+                .options(desc)
+                .positional(positional)
+                .run(),
+            vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  IECStatus status;
+  std::unique_ptr<IECBusConnection> connection;
+  if (IsDeviceNumber(drive_spec)) {
+    std::unique_ptr<Transport> transport =
+        OpenTransport(arduino_device, serial_speed, &status);
+    if (transport && !recording.empty()) {
+      transport =
+          RecordingTransport::Create(std::move(transport), recording, &status);
+    }
+    if (!transport) {
+      std::cout << status.message << std::endl;
+      return 1;
+    }
+    connection.reset(IECBusConnection::Create(
+        std::move(transport),
+        [](char level, const std::string &channel,
+           const std::string &message) {
+          std::cout << level << ":" << channel << ": " << message
+                    << std::endl;
+        },
+        &status));
+    if (!connection || !connection->Reset(&status)) {
+      std::cout << status.message << std::endl;
+      return 1;
+    }
+  }
+
+  std::unique_ptr<DriveInterface> drive = CreateDriveObject(
+      drive_spec, connection.get(), /*read_only=*/true, &status);
+  if (!drive) {
+    std::cout << "Failed to access specified drive: " << status.message
+              << std::endl;
+    return 1;
+  }
+
+  DiscFiles files(drive.get());
+  if (!files.ReadDirectory(&status)) {
+    std::cout << "Failed to read directory: " << status.message << std::endl;
+    return 1;
+  }
+  if (names.empty()) {
+    for (const auto &entry : files.entries()) {
+      std::cout << boost::format("%-5u \"%s\" %s") % entry.num_blocks %
+                       entry.name % GetFileTypeName(entry.type)
+                << std::endl;
+    }
+    std::cout << files.GetNumFreeBlocks() << " blocks free." << std::endl;
+    return 0;
+  }
+
+  for (const auto &name : names) {
+    const DirectoryEntry *entry = files.FindFile(name);
+    if (entry == nullptr) {
+      std::cout << "File not found: " << name << std::endl;
+      return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::string content;
+    if (!files.ReadFile(*entry, &content, &status)) {
+      std::cout << "Failed to read " << name << ": " << status.message
+                << std::endl;
+      return 1;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::string path = output_dir + "/" + GetHostFileName(*entry);
+    std::ofstream output(path, std::ios::binary);
+    output.write(content.data(), content.size());
+    if (!output) {
+      std::cout << "Failed to write " << path << std::endl;
+      return 1;
+    }
+    std::cout << boost::format("%s: %u bytes in %.1fs") % path %
+                     content.size() % elapsed.count()
+              << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "boost/format.hpp"
+#include "boost/program_options/cmdline.hpp"
+#include "boost/program_options/options_description.hpp"
+#include "boost/program_options/parsers.hpp"
+#include "boost/program_options/positional_options.hpp"
+#include "boost/program_options/variables_map.hpp"
+#include "disc_files.h"
+#include "drive_factory.h"
+#include "drive_interface.h"
+#include "iec_host_lib.h"
+#include "transport.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+int main(int argc, char *argv[]) {
+  std::cout << "IEC Bus file transfer utility." << std::endl
+            << "Copyright (c) 2020 Andreas Eckleder" << std::endl
+            << std::endl;
+
+  std::string arduino_device;
+  int serial_speed = 0;
+  std::string recording;
+  std::string drive_spec;
+  std::string type;
+  std::vector<std::string> paths;
+
+  po::options_description desc("Options");
+  desc.add_options()("help", "usage overview")(
+      "serial",
+      po::value<std::string>(&arduino_device)->default_value("/dev/ttyUSB0"),
+      "serial interface to use, or unix:<path> for a Unix domain socket or "
+      "replay:<path> to play back a recording")(
+      "speed", po::value<int>(&serial_speed)->default_value(57600),
+      "baud rate")("record",
+                   po::value<std::string>(&recording)->default_value(""),
+                   "record the traffic with the Arduino to this file")(
+      "drive", po::value<std::string>(&drive_spec)->default_value("8"),
+      "device (e.g. 8, 9) to write to")(
+      "type", po::value<std::string>(&type)->default_value("prg"),
+      "type of the files written: prg or seq")(
+      "file", po::value<std::vector<std::string>>(&paths),
+      "file to write, named on disc after the file name without extension");
+  po::positional_options_description positional;
+  positional.add("file", -1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv)
+                .options(desc)
+                .positional(positional)
+                .run(),
+            vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+  if (paths.empty()) {
+    std::cout << desc << std::endl
+              << "At least one file to write is required." << std::endl;
+    return 2;
+  }
+  unsigned char file_type = DiscFiles::kTypePRG;
+  if (type == "seq") {
+    file_type = DiscFiles::kTypeSEQ;
+  } else if (type != "prg") {
+    std::cout << desc << std::endl
+              << "Invalid value for --type: " << type << std::endl;
+    return 2;
+  }
+
+  IECStatus status;
+  std::unique_ptr<Transport> transport =
+      OpenTransport(arduino_device, serial_speed, &status);
+  if (transport && !recording.empty()) {
+    transport =
+        RecordingTransport::Create(std::move(transport), recording, &status);
+  }
+  if (!transport) {
+    std::cout << status.message << std::endl;
+    return 1;
+  }
+  std::unique_ptr<IECBusConnection> connection(IECBusConnection::Create(
+      std::move(transport),
+      [](char level, const std::string &channel, const std::string &message) {
+        std::cout << level << ":" << channel << ": " << message << std::endl;
+      },
+      &status));
+  if (!connection || !connection->Reset(&status)) {
+    std::cout << status.message << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<DriveInterface> drive = CreateDriveObject(
+      drive_spec, connection.get(), /*read_only=*/false, &status);
+  if (!drive) {
+    std::cout << "Failed to access specified drive: " << status.message
+              << std::endl;
+    return 1;
+  }
+
+  DiscFiles files(drive.get());
+  if (!files.ReadDirectory(&status)) {
+    std::cout << "Failed to read directory: " << status.message << std::endl;
+    return 1;
+  }
+  for (const auto &path : paths) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+      std::cout << "Failed to open " << path << std::endl;
+      return 1;
+    }
+    std::string content((std::istreambuf_iterator<char>(input)),
+                        std::istreambuf_iterator<char>());
+    std::string name = boost::filesystem::path(path).stem().string();
+    auto start = std::chrono::steady_clock::now();
+    if (!files.WriteFile(name, file_type, content, &status)) {
+      std::cout << "Failed to write " << name << ": " << status.message
+                << std::endl;
+      return 1;
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << boost::format("%s: %u bytes in %.1fs, %u blocks free") %
+                     name % content.size() % elapsed.count() %
+                     files.GetNumFreeBlocks()
+              << std::endl;
+  }
+
+  std::string drive_status;
+  if (!drive->ReadCommandChannel(&drive_status, &status)) {
+    std::cout << "Failed to read drive status: " << status.message
+              << std::endl;
+    return 1;
+  }
+  std::cout << "Drive status: " << drive_status << std::endl;
+  return 0;
+}
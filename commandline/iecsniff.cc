@@ -0,0 +1,156 @@
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <memory>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "boost/format.hpp"
+#include "boost/program_options/cmdline.hpp"
+#include "boost/program_options/options_description.hpp"
+#include "boost/program_options/parsers.hpp"
+#include "boost/program_options/variables_map.hpp"
+#include "iec_host_lib.h"
+#include "iec_sniffer.h"
+#include "utils.h"
+
+namespace po = boost::program_options;
+
+// How often we check whether we should stop while the bus is quiet.
+static const int kPollTimeoutMs = 100;
+
+// Amount of data read from the Arduino at once.
+static const size_t kMaxRead = 512;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void RequestStop(int) { stop_requested = 1; }
+
+// Print a single event as received, for --events.
+static void PrintEvent(const SniffEvent &event) {
+  std::string what;
+  switch (event.kind) {
+  case SniffEvent::ATN_ASSERTED:
+    what = "ATN asserted";
+    break;
+  case SniffEvent::ATN_RELEASED:
+    what = "ATN released";
+    break;
+  case SniffEvent::BYTE:
+    what = (boost::format("%02x%s%s%s") % static_cast<int>(event.data) %
+            (event.atn ? " ATN" : "") % (event.eoi ? " EOI" : "") %
+            (event.error ? " ABORTED" : ""))
+               .str();
+    break;
+  }
+  std::cout << boost::format("%12.6f   %s") % (event.time_us / 1000000.0) %
+                   what
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  std::cout << "IEC Bus sniffer." << std::endl
+            << "Copyright (c) 2020 Andreas Eckleder" << std::endl
+            << std::endl;
+
+  std::string arduino_device;
+  int serial_speed = 0;
+  int duration = 0;
+  bool print_events = false;
+
+  po::options_description desc("Options");
+  desc.add_options()("help", "usage overview")(
+      "serial",
+      po::value<std::string>(&arduino_device)->default_value("/dev/ttyUSB0"),
+      "serial interface to use")(
+      "speed", po::value<int>(&serial_speed)->default_value(57600),
+      "baud rate")("duration", po::value<int>(&duration)->default_value(0),
+                   "seconds to capture, 0 to capture until interrupted")(
+      "events", po::value<bool>(&print_events)->default_value(false),
+      "print every byte and ATN edge, not just transactions");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  auto log_callback = [](char level, const std::string &channel,
+                         const std::string &message) {
+    std::cout << level << ":" << channel << ": " << message << std::endl;
+  };
+
+  IECStatus status;
+  int fd = OpenArduinoSerial(arduino_device, serial_speed, &status);
+  if (fd == -1) {
+    std::cout << status.message << std::endl;
+    return 1;
+  }
+  BufferedReadWriter arduino(fd);
+  if (!ConnectArduino(&arduino, kSnifferDeviceNumber, log_callback,
+                      &status)) {
+    std::cout << status.message << std::endl;
+    close(fd);
+    return 1;
+  }
+
+  signal(SIGINT, RequestStop);
+  std::cout << "Sniffing, press Ctrl-C to stop." << std::endl;
+
+  SniffDecoder decoder(log_callback);
+  SniffTransactionBuilder builder;
+  SniffTransaction transaction;
+  std::vector<SniffEvent> events;
+  size_t num_transactions = 0, num_bytes = 0, num_aborted = 0;
+  auto start = std::chrono::steady_clock::now();
+  int result = 0;
+  while (!stop_requested &&
+         (duration <= 0 || std::chrono::steady_clock::now() - start <
+                               std::chrono::seconds(duration))) {
+    if (!arduino.HasBufferedData()) {
+      struct pollfd pfd = {fd, POLLIN, 0};
+      if (poll(&pfd, 1, kPollTimeoutMs) <= 0) {
+        continue;
+      }
+    }
+    std::string input;
+    events.clear();
+    if (!arduino.ReadUpTo(0, kMaxRead, &input, &status) ||
+        !decoder.Decode(input, &events, &status)) {
+      std::cout << status.message << std::endl;
+      result = 1;
+      break;
+    }
+    for (const auto &event : events) {
+      if (print_events) {
+        PrintEvent(event);
+      }
+      if (event.kind == SniffEvent::BYTE) {
+        ++(event.error ? num_aborted : num_bytes);
+      }
+      if (builder.Add(event, &transaction)) {
+        std::cout << FormatTransaction(transaction) << std::endl;
+        ++num_transactions;
+      }
+    }
+  }
+  if (builder.Flush(&transaction)) {
+    std::cout << FormatTransaction(transaction) << std::endl;
+    ++num_transactions;
+  }
+  if (!decoder.started()) {
+    std::cout << "The Arduino never started sniffing, does its firmware "
+                 "support it?"
+              << std::endl;
+    result = 1;
+  }
+  std::cout << boost::format("%u transactions, %u bytes, %u aborted.") %
+                   num_transactions % num_bytes % num_aborted
+            << std::endl;
+  close(fd);
+  return result;
+}
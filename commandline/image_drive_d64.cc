@@ -7,6 +7,7 @@
 #include <fcntl.h>
 #include <iostream>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -26,6 +27,13 @@ ImageDriveD64::~ImageDriveD64() {
     }
     image_fd_ = -1;
   }
+  if (image_data_ != nullptr) {
+    if (munmap(const_cast<char *>(image_data_), image_size_) != 0) {
+      std::cerr << "ImageDriveD64: munmap() failed: " << strerror(errno)
+                << std::endl;
+    }
+    image_data_ = nullptr;
+  }
 }
 
 bool ImageDriveD64::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
@@ -34,9 +42,27 @@ bool ImageDriveD64::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
   return false;
 }
 
+bool ImageDriveD64::FormatTracks(unsigned int first_track,
+                                 unsigned int last_track,
+                                 const std::string &disc_id,
+                                 IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "ImageDriveD64::FormatTracks", status);
+  return false;
+}
+
+bool ImageDriveD64::FormatDiscQuick(const std::string &disc_name,
+                                    IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "ImageDriveD64::FormatDiscQuick", status);
+  return false;
+}
+
 bool ImageDriveD64::GetNumSectors(size_t *num_sectors, IECStatus *status) {
   if (!OpenDiscImage(status))
     return false;
+  if (image_data_ != nullptr) {
+    *num_sectors = image_size_ / kNumBytesPerSector;
+    return true;
+  }
   assert(image_fd_ != -1);
 
   struct stat stat_buf;
@@ -59,6 +85,19 @@ bool ImageDriveD64::ReadSector(size_t sector_number, std::string *content,
                                IECStatus *status) {
   if (!OpenDiscImage(status))
     return false;
+  if (image_data_ != nullptr) {
+    if ((sector_number + 1) * kNumBytesPerSector > image_size_) {
+      SetError(IECStatus::DRIVE_ERROR,
+               (boost::format("ReadSector: sector %u beyond end of image") %
+                sector_number)
+                   .str(),
+               status);
+      return false;
+    }
+    content->assign(image_data_ + sector_number * kNumBytesPerSector,
+                    kNumBytesPerSector);
+    return true;
+  }
   assert(image_fd_ != -1);
   if (!SeekToSector(sector_number, status))
     return false;
@@ -101,7 +140,7 @@ bool ImageDriveD64::SeekToSector(size_t sector_number, IECStatus *status) {
 }
 
 bool ImageDriveD64::OpenDiscImage(IECStatus *status) {
-  if (image_fd_ != -1) {
+  if (image_fd_ != -1 || image_data_ != nullptr) {
     return true;
   }
 
@@ -111,5 +150,29 @@ bool ImageDriveD64::OpenDiscImage(IECStatus *status) {
     SetErrorFromErrno(IECStatus::DRIVE_ERROR, "OpenDiscImage", status);
     return false;
   }
+  if (!read_only_) {
+    return true;
+  }
+
+  struct stat stat_buf;
+  if (fstat(image_fd_, &stat_buf) != 0) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "OpenDiscImage: fstat", status);
+    return false;
+  }
+  if (stat_buf.st_size == 0) {
+    // Nothing to map, the file descriptor reports the empty image.
+    return true;
+  }
+  void *data =
+      mmap(nullptr, stat_buf.st_size, PROT_READ, MAP_SHARED, image_fd_, 0);
+  if (data == MAP_FAILED) {
+    SetErrorFromErrno(IECStatus::DRIVE_ERROR, "OpenDiscImage: mmap", status);
+    return false;
+  }
+  // The mapping stays valid after closing the file.
+  close(image_fd_);
+  image_fd_ = -1;
+  image_data_ = static_cast<const char *>(data);
+  image_size_ = stat_buf.st_size;
   return true;
 }
@@ -11,12 +11,17 @@ class ImageDriveD64 : public DriveInterface {
 public:
   // Instantiate a image drive object based on image_path. If read_only
   // is true, the image file is expected to exist and will be opened
-  // in readonly mode. Attempts to write to the image will fail.
+  // in readonly mode. Attempts to write to the image will fail. Read-only
+  // images are memory mapped, reading a sector doesn't take a system call.
   ImageDriveD64(const std::string &image_path, bool read_only);
 
   ~ImageDriveD64();
 
   bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  bool FormatTracks(unsigned int first_track, unsigned int last_track,
+                    const std::string &disc_id, IECStatus *status) override;
+  bool FormatDiscQuick(const std::string &disc_name,
+                       IECStatus *status) override;
   bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
   bool ReadSector(size_t sector_number, std::string *content,
                   IECStatus *status) override;
@@ -41,6 +46,11 @@ private:
   // If the image is opened, contains the file descriptor used to
   // access it.
   int image_fd_ = -1;
+
+  // The mapped image and its size, if opened read-only. The file descriptor
+  // is closed once the image is mapped.
+  const char *image_data_ = nullptr;
+  size_t image_size_ = 0;
 };
 
 #endif // IMAGE_DRIVE_D64_H
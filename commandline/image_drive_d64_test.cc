@@ -67,4 +67,9 @@ TEST_F(ImageDriveD64Test, ReadSectorTest) {
     FillTestBuffer(reinterpret_cast<unsigned char *>(&golden[0]), s);
     EXPECT_EQ(golden, content);
   }
+
+  // Reading beyond the end of the image fails.
+  std::string content;
+  EXPECT_FALSE(drive.ReadSector(num_sectors, &content, &status));
+  EXPECT_EQ(status.status_code, IECStatus::DRIVE_ERROR);
 }
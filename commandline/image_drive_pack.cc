@@ -0,0 +1,83 @@
+// DriveInterface implementation on images stored in a disc pack.
+
+#include "image_drive_pack.h"
+
+#include "boost/format.hpp"
+
+ImageDrivePack::ImageDrivePack(const std::string &pack_path,
+                               const std::string &image_name)
+    : pack_path_(pack_path), image_name_(image_name) {}
+
+bool ImageDrivePack::FormatDiscLowLevel(size_t num_tracks, IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "ImageDrivePack::FormatDiscLowLevel",
+           status);
+  return false;
+}
+
+bool ImageDrivePack::FormatTracks(unsigned int first_track,
+                                  unsigned int last_track,
+                                  const std::string &disc_id,
+                                  IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "ImageDrivePack::FormatTracks", status);
+  return false;
+}
+
+bool ImageDrivePack::FormatDiscQuick(const std::string &disc_name,
+                                     IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "ImageDrivePack::FormatDiscQuick",
+           status);
+  return false;
+}
+
+bool ImageDrivePack::GetNumSectors(size_t *num_sectors, IECStatus *status) {
+  if (!OpenImage(status))
+    return false;
+  *num_sectors = pack_.GetNumSectors(image_);
+  return true;
+}
+
+bool ImageDrivePack::ReadSector(size_t sector_number, std::string *content,
+                                IECStatus *status) {
+  if (!OpenImage(status))
+    return false;
+  if (sector_number >= pack_.GetNumSectors(image_)) {
+    SetError(IECStatus::DRIVE_ERROR,
+             (boost::format("ReadSector: Sector %u out of range") %
+              sector_number)
+                 .str(),
+             status);
+    return false;
+  }
+  content->assign(pack_.GetSector(image_, sector_number),
+                  kNumBytesPerSector);
+  return true;
+}
+
+bool ImageDrivePack::WriteSector(size_t sector_number,
+                                 const std::string &content,
+                                 IECStatus *status) {
+  SetError(IECStatus::UNIMPLEMENTED, "ImageDrivePack::WriteSector", status);
+  return false;
+}
+
+bool ImageDrivePack::ReadCommandChannel(std::string *response,
+                                        IECStatus *status) {
+  bool result = OpenImage(status);
+  if (result) {
+    *response =
+        "Accessing image '" + image_name_ + "' in pack '" + pack_path_ + "'";
+  }
+  return result;
+}
+
+bool ImageDrivePack::OpenImage(IECStatus *status) {
+  if (open_) {
+    return true;
+  }
+  if ((!pack_.is_open() && !pack_.Open(pack_path_, status)) ||
+      !pack_.FindImage(image_name_, &image_, status)) {
+    return false;
+  }
+  open_ = true;
+  return true;
+}
@@ -0,0 +1,44 @@
+// DriveInterface implementation on images stored in a disc pack.
+
+#ifndef IMAGE_DRIVE_PACK_H
+#define IMAGE_DRIVE_PACK_H
+
+#include <string>
+
+#include "disc_pack.h"
+#include "drive_interface.h"
+
+class ImageDrivePack : public DriveInterface {
+public:
+  // Instantiate a drive object for the image called image_name in the pack
+  // at pack_path. Packs are read-only, attempts to write will fail.
+  ImageDrivePack(const std::string &pack_path, const std::string &image_name);
+
+  bool FormatDiscLowLevel(size_t num_tracks, IECStatus *status) override;
+  bool FormatTracks(unsigned int first_track, unsigned int last_track,
+                    const std::string &disc_id, IECStatus *status) override;
+  bool FormatDiscQuick(const std::string &disc_name,
+                       IECStatus *status) override;
+  bool GetNumSectors(size_t *num_sectors, IECStatus *status) override;
+  bool ReadSector(size_t sector_number, std::string *content,
+                  IECStatus *status) override;
+  bool WriteSector(size_t sector_number, const std::string &content,
+                   IECStatus *status) override;
+  bool ReadCommandChannel(std::string *response, IECStatus *status) override;
+
+private:
+  // Open the pack and look up the image if that didn't happen yet. In case
+  // of an error, returns false and sets status.
+  bool OpenImage(IECStatus *status);
+
+  std::string pack_path_;
+  std::string image_name_;
+
+  DiscPack pack_;
+  // True once the pack is open and image_ is valid.
+  bool open_ = false;
+  // Index of our image within the pack.
+  size_t image_ = 0;
+};
+
+#endif // IMAGE_DRIVE_PACK_H
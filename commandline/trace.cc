@@ -0,0 +1,139 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "boost/format.hpp"
+
+namespace {
+// Process IDs the host and the Arduino show up as.
+const int kHostPid = 1;
+const int kArduinoPid = 2;
+
+// Length of the timestamp in a marker, after the phase.
+const size_t kMarkerTimeLength = 8;
+
+std::string JsonString(const std::string &value) {
+  std::string result = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 32) {
+      result += (boost::format("\\u%04x") % static_cast<int>(c)).str();
+    } else {
+      result += c;
+    }
+  }
+  return result + "\"";
+}
+} // namespace
+
+Tracer::Tracer() : start_(Clock::now()) {}
+
+void Tracer::AddSpan(const std::string &name, Clock::time_point begin,
+                     Clock::time_point end) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto thread = threads_.emplace(std::this_thread::get_id(), threads_.size());
+  host_spans_.push_back({name, thread.first->second + 1, Microseconds(begin),
+                         Microseconds(end) - Microseconds(begin)});
+}
+
+bool Tracer::AddArduinoMarker(const std::string &marker,
+                              Clock::time_point received, IECStatus *status) {
+  if (marker.size() <= 1 + kMarkerTimeLength ||
+      (marker[0] != 'B' && marker[0] != 'E') ||
+      marker.find_first_not_of("0123456789abcdef", 1) <=
+          kMarkerTimeLength) {
+    SetError(IECStatus::CONNECTION_FAILURE,
+             "Malformed trace marker '" + marker + "'", status);
+    return false;
+  }
+  uint32_t arduino_us = static_cast<uint32_t>(
+      std::stoul(marker.substr(1, kMarkerTimeLength), nullptr, 16));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!arduino_markers_.empty() && arduino_us < last_arduino_us_) {
+    ++arduino_wraps_;
+  }
+  last_arduino_us_ = arduino_us;
+  int64_t extended_us = (arduino_wraps_ << 32) + arduino_us;
+  int64_t offset_us = Microseconds(received) - extended_us;
+  if (!has_offset_ || offset_us < offset_us_) {
+    offset_us_ = offset_us;
+    has_offset_ = true;
+  }
+  arduino_markers_.push_back(
+      {marker.substr(1 + kMarkerTimeLength), marker[0], extended_us});
+  return true;
+}
+
+std::string Tracer::ToJson() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::string> events;
+  for (const auto &process :
+       {std::make_pair(kHostPid, "host"),
+        std::make_pair(kArduinoPid, "arduino")}) {
+    events.push_back((boost::format("{\"name\":\"process_name\",\"ph\":"
+                                    "\"M\",\"pid\":%d,\"args\":{\"name\":"
+                                    "\"%s\"}}") %
+                      process.first % process.second)
+                         .str());
+  }
+  for (const auto &span : host_spans_) {
+    events.push_back((boost::format("{\"name\":%s,\"cat\":\"host\",\"ph\":"
+                                    "\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%d,"
+                                    "\"dur\":%d}") %
+                      JsonString(span.name) % kHostPid % span.thread %
+                      span.begin_us % span.duration_us)
+                         .str());
+  }
+  for (const auto &marker : arduino_markers_) {
+    events.push_back((boost::format("{\"name\":%s,\"cat\":\"arduino\",\"ph\":"
+                                    "\"%c\",\"pid\":%d,\"tid\":1,\"ts\":%d}") %
+                      JsonString(marker.name) % marker.phase % kArduinoPid %
+                      (marker.arduino_us + offset_us_))
+                         .str());
+  }
+  std::string result = "{\"traceEvents\":[\n";
+  for (size_t i = 0; i < events.size(); ++i) {
+    result += events[i] + (i + 1 < events.size() ? ",\n" : "\n");
+  }
+  return result + "],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+bool Tracer::Write(const std::string &path, IECStatus *status) const {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "Write: open", status);
+    return false;
+  }
+  BufferedReadWriter writer(fd);
+  bool result = writer.WriteString(ToJson(), status);
+  if (close(fd) != 0 && result) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "Write: close", status);
+    result = false;
+  }
+  return result;
+}
+
+int64_t Tracer::Microseconds(Clock::time_point time) const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(time - start_)
+      .count();
+}
+
+TraceSpan::TraceSpan(Tracer *tracer, const char *name)
+    : tracer_(tracer), name_(name) {
+  if (tracer_ != nullptr) {
+    begin_ = Tracer::Clock::now();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (tracer_ != nullptr) {
+    tracer_->AddSpan(name_, begin_, Tracer::Clock::now());
+  }
+}
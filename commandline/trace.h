@@ -0,0 +1,86 @@
+// Tracing of where the time goes in a transfer: Spans recorded on the host
+// are merged with the begin / end markers an Arduino built with TRACING sends
+// (see uno2iec/log.h), and written in Chrome's trace event format, to be
+// viewed in chrome://tracing or Perfetto.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+
+// Collects spans from any number of threads.
+class Tracer {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  Tracer();
+
+  // Record a span of the calling thread.
+  void AddSpan(const std::string &name, Clock::time_point begin,
+               Clock::time_point end);
+
+  // Record a marker sent by the Arduino, without the leading 'T' and the
+  // terminating '\r', which was received at the given time. Returns true if
+  // successful, sets status if the marker is malformed.
+  bool AddArduinoMarker(const std::string &marker, Clock::time_point received,
+                        IECStatus *status);
+
+  // The trace as JSON.
+  std::string ToJson() const;
+
+  // Write the trace to path. Returns true if successful, sets status
+  // otherwise.
+  bool Write(const std::string &path, IECStatus *status) const;
+
+private:
+  struct HostSpan {
+    std::string name;
+    int thread;
+    int64_t begin_us;
+    int64_t duration_us;
+  };
+  struct ArduinoMarker {
+    std::string name;
+    char phase;
+    // micros() of the Arduino, extended beyond 32 bits.
+    int64_t arduino_us;
+  };
+
+  int64_t Microseconds(Clock::time_point time) const;
+
+  mutable std::mutex mutex_;
+  Clock::time_point start_;
+  std::map<std::thread::id, int> threads_;
+  std::vector<HostSpan> host_spans_;
+  std::vector<ArduinoMarker> arduino_markers_;
+  // For extending the Arduino's clock when it wraps around.
+  uint32_t last_arduino_us_ = 0;
+  int64_t arduino_wraps_ = 0;
+  // Our time minus the Arduino's. Markers take a while to reach us, so the
+  // smallest difference seen is the best estimate.
+  bool has_offset_ = false;
+  int64_t offset_us_ = 0;
+};
+
+// Records a span from construction to destruction. Does nothing if tracer is
+// null.
+class TraceSpan {
+public:
+  TraceSpan(Tracer *tracer, const char *name);
+  ~TraceSpan();
+
+private:
+  Tracer *tracer_;
+  const char *name_;
+  Tracer::Clock::time_point begin_;
+};
+
+#endif // TRACE_H
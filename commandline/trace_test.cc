@@ -0,0 +1,73 @@
+#include <chrono>
+#include <string>
+
+#include "trace.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+// The timestamp of the first event with the given phase in json.
+static long Timestamp(const std::string &json, const std::string &phase) {
+  size_t event = json.find("\"ph\":\"" + phase + "\"");
+  EXPECT_NE(event, std::string::npos);
+  return std::stol(json.substr(json.find("\"ts\":", event) + 5));
+}
+
+TEST(TracerTest, RecordsHostSpans) {
+  Tracer tracer;
+  {
+    TraceSpan span(&tracer, "ReadSector");
+  }
+  TraceSpan no_tracer(nullptr, "Ignored");
+  std::string json = tracer.ToJson();
+  EXPECT_THAT(json, HasSubstr("\"name\":\"ReadSector\",\"cat\":\"host\","
+                              "\"ph\":\"X\",\"pid\":1,\"tid\":1"));
+  EXPECT_THAT(json, Not(HasSubstr("Ignored")));
+}
+
+TEST(TracerTest, AlignsArduinoClock) {
+  Tracer tracer;
+  IECStatus status;
+  auto now = Tracer::Clock::now();
+  // The first marker took longer to arrive than the second one, so the second
+  // one determines the offset: Our time 3000 us later than the Arduino's.
+  ASSERT_TRUE(tracer.AddArduinoMarker("B000003e8iec send",
+                                      now + std::chrono::microseconds(5000),
+                                      &status))
+      << status.message;
+  ASSERT_TRUE(tracer.AddArduinoMarker("E000007d0iec send",
+                                      now + std::chrono::microseconds(5000),
+                                      &status))
+      << status.message;
+  std::string json = tracer.ToJson();
+  EXPECT_THAT(json, HasSubstr("\"name\":\"iec send\",\"cat\":\"arduino\","
+                              "\"ph\":\"B\",\"pid\":2,\"tid\":1,\"ts\":"));
+  // The offset is relative to the tracer's start, just before now.
+  long end_ts = Timestamp(json, "E");
+  EXPECT_EQ(end_ts - Timestamp(json, "B"), 1000);
+  EXPECT_GE(end_ts, 5000);
+  EXPECT_LT(end_ts, 6000);
+}
+
+TEST(TracerTest, ExtendsWrappingArduinoClock) {
+  Tracer tracer;
+  IECStatus status;
+  auto now = Tracer::Clock::now();
+  ASSERT_TRUE(tracer.AddArduinoMarker("Bfffffc18get", now, &status));
+  ASSERT_TRUE(tracer.AddArduinoMarker("E000003e8get", now, &status));
+  std::string json = tracer.ToJson();
+  EXPECT_EQ(Timestamp(json, "E") - Timestamp(json, "B"), 2000);
+}
+
+TEST(TracerTest, RejectsMalformedMarkers) {
+  Tracer tracer;
+  IECStatus status;
+  auto now = Tracer::Clock::now();
+  EXPECT_FALSE(tracer.AddArduinoMarker("X00000000name", now, &status));
+  EXPECT_FALSE(tracer.AddArduinoMarker("B0000zz00name", now, &status));
+  EXPECT_FALSE(tracer.AddArduinoMarker("B00000000", now, &status));
+  EXPECT_THAT(status.message, HasSubstr("Malformed trace marker"));
+}
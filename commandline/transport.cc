@@ -0,0 +1,548 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+
+#include "boost/format.hpp"
+#include "transport.h"
+
+using namespace std::chrono_literals;
+
+// How long DTR is held low to reset the Arduino.
+static const auto kResetPulseDuration = 100ms;
+
+// The connection string the firmware greets the host with.
+static const std::string kConnectionString = "connect_arduino:3\r";
+
+// Start of the configuration the host answers the connection string with.
+static const std::string kConfigPrefix = "OK>";
+
+// Recordings are small, but their records can be large.
+static const size_t kMaxRecordLengthDigits = 10;
+
+static const std::string kUnixSocketPrefix = "unix:";
+static const std::string kReplayPrefix = "replay:";
+
+static bool ConfigureSerial(int fd, int speed, IECStatus *status) {
+  struct termios tty;
+  if (tcgetattr(fd, &tty) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "tcgetattr", status);
+    return false;
+  }
+  speed_t speed_constant = B0;
+#define SPEED_MAP(s)                                                           \
+  case s:                                                                      \
+    speed_constant = B##s;                                                     \
+    break
+  switch (speed) {
+    SPEED_MAP(0);
+    SPEED_MAP(50);
+    SPEED_MAP(75);
+    SPEED_MAP(110);
+    SPEED_MAP(134);
+    SPEED_MAP(150);
+    SPEED_MAP(200);
+    SPEED_MAP(300);
+    SPEED_MAP(600);
+    SPEED_MAP(1200);
+    SPEED_MAP(2400);
+    SPEED_MAP(4800);
+    SPEED_MAP(9600);
+    SPEED_MAP(19200);
+    SPEED_MAP(38400);
+    SPEED_MAP(57600);
+    SPEED_MAP(115200);
+    SPEED_MAP(230400);
+  default:
+    SetError(IECStatus::CONNECTION_FAILURE,
+             (boost::format("Unknown speed setting: #%u baud") % speed).str(),
+             status);
+    return false;
+  }
+#undef SPEED_MAP
+  if (cfsetospeed(&tty, speed_constant) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "cfsetospeed", status);
+    return false;
+  }
+  if (cfsetispeed(&tty, speed_constant) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "cfsetispeed", status);
+    return false;
+  }
+
+  tty.c_cflag |= (CLOCAL | CREAD); /* ignore modem controls */
+  tty.c_cflag &= ~CSIZE;
+  tty.c_cflag |= CS8;      /* 8-bit characters */
+  tty.c_cflag &= ~PARENB;  /* no parity bit */
+  tty.c_cflag &= ~CSTOPB;  /* only need 1 stop bit */
+  tty.c_cflag &= ~CRTSCTS; /* no hardware flowcontrol */
+
+  /* setup for non-canonical mode */
+  tty.c_iflag &=
+      ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+  tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+
+  tty.c_oflag &= ~OPOST;
+
+  /* fetch bytes as they become available */
+  tty.c_cc[VMIN] = 1;
+  tty.c_cc[VTIME] = 1;
+
+  if (tcsetattr(fd, TCSANOW, &tty) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "tcsetattr", status);
+    return false;
+  }
+  return true;
+}
+
+int OpenArduinoSerial(const std::string &device_file, int speed,
+                      IECStatus *status) {
+  int fd = open(device_file.c_str(), O_RDWR | O_NONBLOCK);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE,
+                      "open(\"" + device_file + "\")", status);
+    return -1;
+  }
+
+  // Configure serial port to 1200 baud to make the Arduino reset.
+  if (!ConfigureSerial(fd, 1200, status)) {
+    close(fd);
+    return -1;
+  }
+
+  // Wait for the Arduino to reset, then flush everything that was sent or
+  // received.
+  usleep(1000 * 1000);
+
+  // Now configure to the desired speed.
+  if (!ConfigureSerial(fd, speed, status)) {
+    close(fd);
+    return -1;
+  }
+  if (tcflush(fd, TCIFLUSH) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "tcflush", status);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+std::unique_ptr<SerialTransport>
+SerialTransport::Open(const std::string &device_file, int speed,
+                      IECStatus *status) {
+  int fd = OpenArduinoSerial(device_file, speed, status);
+  if (fd == -1) {
+    return nullptr;
+  }
+  return std::make_unique<SerialTransport>(fd);
+}
+
+bool SerialTransport::ResetPeer(IECStatus *status) {
+  int dtr = TIOCM_DTR;
+  if (ioctl(fd(), TIOCMBIC, &dtr) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "ResetPeer", status);
+    return false;
+  }
+  std::this_thread::sleep_for(kResetPulseDuration);
+  if (ioctl(fd(), TIOCMBIS, &dtr) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "ResetPeer", status);
+    return false;
+  }
+  // Whatever the Arduino sent before restarting is of no interest.
+  tcflush(fd(), TCIFLUSH);
+  return true;
+}
+
+std::unique_ptr<UnixSocketTransport>
+UnixSocketTransport::Connect(const std::string &path, IECStatus *status) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    SetError(IECStatus::INVALID_ARGUMENT, "Socket path too long: " + path,
+             status);
+    return nullptr;
+  }
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "socket", status);
+    return nullptr;
+  }
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+              sizeof(address)) == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE,
+                      "connect(\"" + path + "\")", status);
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<UnixSocketTransport>(new UnixSocketTransport(fd));
+}
+
+std::unique_ptr<RecordingTransport>
+RecordingTransport::Create(std::unique_ptr<Transport> transport,
+                           const std::string &path, IECStatus *status) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE,
+                      "open(\"" + path + "\")", status);
+    return nullptr;
+  }
+  return std::unique_ptr<RecordingTransport>(
+      new RecordingTransport(std::move(transport), fd));
+}
+
+RecordingTransport::RecordingTransport(std::unique_ptr<Transport> transport,
+                                       int fd)
+    : transport_(std::move(transport)), fd_(fd) {}
+
+RecordingTransport::~RecordingTransport() { close(fd_); }
+
+bool RecordingTransport::Read(char *buffer, size_t max_length,
+                              size_t *num_read, IECStatus *status) {
+  if (!transport_->Read(buffer, max_length, num_read, status)) {
+    return false;
+  }
+  Record('R', buffer, *num_read);
+  return true;
+}
+
+bool RecordingTransport::Write(const char *data, size_t length,
+                               IECStatus *status) {
+  // Record first, the answer may be recorded before Write() returns.
+  Record('W', data, length);
+  return transport_->Write(data, length, status);
+}
+
+Transport::WaitResult RecordingTransport::Wait(TimePoint deadline) {
+  return transport_->Wait(deadline);
+}
+
+void RecordingTransport::Interrupt() { transport_->Interrupt(); }
+
+bool RecordingTransport::ResetPeer(IECStatus *status) {
+  return transport_->ResetPeer(status);
+}
+
+void RecordingTransport::Record(char direction, const char *data,
+                                size_t length) {
+  std::string record = (boost::format("%c%u:") % direction % length).str();
+  record.append(data, length);
+  record += '\n';
+  std::lock_guard<std::mutex> lock(mutex_);
+  BufferedReadWriter writer(fd_);
+  IECStatus status;
+  writer.WriteString(record, &status);
+}
+
+ReplayTransport::ReplayTransport(Records records)
+    : records_(std::move(records)) {}
+
+std::unique_ptr<ReplayTransport> ReplayTransport::Load(const std::string &path,
+                                                       IECStatus *status) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    SetErrorFromErrno(IECStatus::CONNECTION_FAILURE,
+                      "open(\"" + path + "\")", status);
+    return nullptr;
+  }
+  BufferedReadWriter reader(fd);
+  Records records;
+  std::string direction, length, data, terminator;
+  bool result = true;
+  while (result) {
+    IECStatus read_status;
+    if (!reader.ReadUpTo(1, 1, &direction, &read_status)) {
+      // The end of the last record is the end of the recording.
+      if (read_status.status_code != IECStatus::END_OF_FILE) {
+        *status = read_status;
+        result = false;
+      }
+      break;
+    }
+    char *length_end = nullptr;
+    result = (direction == "R" || direction == "W") &&
+             reader.ReadTerminatedString(':', kMaxRecordLengthDigits + 1,
+                                         &length, status);
+    size_t data_length = result ? strtoul(length.c_str(), &length_end, 10) : 0;
+    result = result && !length.empty() && *length_end == '\0' &&
+             reader.ReadUpTo(data_length, data_length, &data, status) &&
+             reader.ReadUpTo(1, 1, &terminator, status) && terminator == "\n";
+    if (result) {
+      records.emplace_back(direction[0], data);
+    } else if (status->ok()) {
+      SetError(IECStatus::INVALID_ARGUMENT,
+               (boost::format("Malformed record %u in %s") % records.size() %
+                path)
+                   .str(),
+               status);
+    }
+  }
+  close(fd);
+  if (!result) {
+    return nullptr;
+  }
+  return std::make_unique<ReplayTransport>(std::move(records));
+}
+
+bool ReplayTransport::Read(char *buffer, size_t max_length, size_t *num_read,
+                           IECStatus *status) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return Readable(); });
+  if (record_ == records_.size()) {
+    SetError(IECStatus::END_OF_FILE, "End of recording", status);
+    return false;
+  }
+  const std::string &data = records_[record_].second;
+  *num_read = std::min(max_length, data.size() - offset_);
+  memcpy(buffer, data.data() + offset_, *num_read);
+  offset_ += *num_read;
+  return true;
+}
+
+bool ReplayTransport::Write(const char *data, size_t length,
+                            IECStatus *status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < length;) {
+    while (record_ < records_.size() &&
+           offset_ == records_[record_].second.size()) {
+      ++record_;
+      offset_ = 0;
+    }
+    if (record_ == records_.size() || records_[record_].first != 'W') {
+      SetError(IECStatus::CONNECTION_FAILURE,
+               (boost::format("Record %u doesn't expect writing") % record_)
+                   .str(),
+               status);
+      return false;
+    }
+    const std::string &expected = records_[record_].second;
+    if (expected.compare(0, kConfigPrefix.size(), kConfigPrefix) == 0) {
+      // Our configuration carries the time of day, only its end matters.
+      const char *end =
+          static_cast<const char *>(memchr(data + i, '\r', length - i));
+      if (end != nullptr) {
+        offset_ = expected.size();
+      }
+      i = end != nullptr ? end - data + 1 : length;
+      continue;
+    }
+    size_t to_compare = std::min(length - i, expected.size() - offset_);
+    if (expected.compare(offset_, to_compare, data + i, to_compare) != 0) {
+      SetError(IECStatus::CONNECTION_FAILURE,
+               (boost::format("Record %u expects different data") % record_)
+                   .str(),
+               status);
+      return false;
+    }
+    offset_ += to_compare;
+    i += to_compare;
+  }
+  changed_.notify_all();
+  return true;
+}
+
+Transport::WaitResult ReplayTransport::Wait(TimePoint deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto done = [this]() { return interrupted_ || Readable(); };
+  if (deadline == TimePoint::max()) {
+    changed_.wait(lock, done);
+  } else if (!changed_.wait_until(lock, deadline, done)) {
+    return TIMED_OUT;
+  }
+  if (interrupted_) {
+    interrupted_ = false;
+    return INTERRUPTED;
+  }
+  return READABLE;
+}
+
+void ReplayTransport::Interrupt() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  interrupted_ = true;
+  changed_.notify_all();
+}
+
+bool ReplayTransport::Readable() {
+  while (record_ < records_.size() &&
+         offset_ == records_[record_].second.size()) {
+    ++record_;
+    offset_ = 0;
+  }
+  return record_ == records_.size() || records_[record_].first == 'R';
+}
+
+LoopbackTransport::LoopbackTransport(Peer *peer) : peer_(peer) {
+  std::lock_guard<std::mutex> lock(peer_mutex_);
+  peer_->Reset(this);
+}
+
+void LoopbackTransport::Send(const std::string &data) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  input_ += data;
+  changed_.notify_all();
+}
+
+bool LoopbackTransport::Read(char *buffer, size_t max_length,
+                             size_t *num_read, IECStatus *status) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [this]() { return input_pos_ < input_.size(); });
+  *num_read = std::min(max_length, input_.size() - input_pos_);
+  memcpy(buffer, input_.data() + input_pos_, *num_read);
+  input_pos_ += *num_read;
+  if (input_pos_ == input_.size()) {
+    // Start over rather than moving data around.
+    input_.clear();
+    input_pos_ = 0;
+  }
+  return true;
+}
+
+bool LoopbackTransport::Write(const char *data, size_t length,
+                              IECStatus *status) {
+  std::lock_guard<std::mutex> lock(peer_mutex_);
+  peer_->Receive(data, length, this);
+  return true;
+}
+
+Transport::WaitResult LoopbackTransport::Wait(TimePoint deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto done = [this]() {
+    return interrupted_ || input_pos_ < input_.size();
+  };
+  if (deadline == TimePoint::max()) {
+    changed_.wait(lock, done);
+  } else if (!changed_.wait_until(lock, deadline, done)) {
+    return TIMED_OUT;
+  }
+  if (interrupted_) {
+    interrupted_ = false;
+    return INTERRUPTED;
+  }
+  return READABLE;
+}
+
+void LoopbackTransport::Interrupt() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  interrupted_ = true;
+  changed_.notify_all();
+}
+
+bool LoopbackTransport::ResetPeer(IECStatus *status) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    input_.clear();
+    input_pos_ = 0;
+  }
+  std::lock_guard<std::mutex> lock(peer_mutex_);
+  peer_->Reset(this);
+  return true;
+}
+
+EmulatedArduino::EmulatedArduino(Handler handler)
+    : handler_(std::move(handler)) {}
+
+void EmulatedArduino::Reset(LoopbackTransport *transport) {
+  configured_ = false;
+  pending_.clear();
+  transport->Send(kConnectionString);
+}
+
+void EmulatedArduino::Receive(const char *data, size_t length,
+                              LoopbackTransport *transport) {
+  pending_.append(data, length);
+  while (!configured_) {
+    size_t end = pending_.find('\r');
+    if (end == std::string::npos) {
+      return;
+    }
+    // Anything but a configuration is ignored, as by the firmware.
+    configured_ = pending_.compare(0, 3, "OK>") == 0;
+    pending_.erase(0, end + 1);
+  }
+  size_t size;
+  while ((size = RequestSize()) != 0 && size <= pending_.size()) {
+    std::string request = pending_.substr(0, size);
+    pending_.erase(0, size);
+    std::string answer;
+    switch (request[0]) {
+    case 'y':
+      answer = request + '\r';
+      break;
+    case 'r':
+    case 'o':
+    case 'c':
+    case 'g':
+    case 'p': {
+      std::string data;
+      std::string error = handler_(request, &data);
+      if (!data.empty()) {
+        answer = "r";
+        for (char c : data) {
+          if (c == '\r') {
+            answer += "\\r";
+          } else if (c == '\\') {
+            answer += "\\\\";
+          } else {
+            answer += c;
+          }
+        }
+        answer += '\r';
+      }
+      answer += "s" + error + "\r";
+    } break;
+    default:
+      answer = "sUnknown command\r";
+      break;
+    }
+    transport->Send(answer);
+  }
+}
+
+size_t EmulatedArduino::RequestSize() const {
+  if (pending_.empty()) {
+    return 0;
+  }
+  switch (pending_[0]) {
+  case 'r':
+    return 1;
+  case 'y':
+    return 2;
+  case 'c':
+  case 'g':
+    return 3;
+  case 'o':
+  case 'p': {
+    if (pending_.size() < 4) {
+      return 0;
+    }
+    size_t length = static_cast<unsigned char>(pending_[3]);
+    // Writes of 256 bytes are sent with a length of zero.
+    if (pending_[0] == 'p' && length == 0) {
+      length = 256;
+    }
+    return 4 + length;
+  }
+  default:
+    return 1;
+  }
+}
+
+std::unique_ptr<Transport> OpenTransport(const std::string &spec, int speed,
+                                         IECStatus *status) {
+  if (spec.compare(0, kUnixSocketPrefix.size(), kUnixSocketPrefix) == 0) {
+    return UnixSocketTransport::Connect(spec.substr(kUnixSocketPrefix.size()),
+                                        status);
+  }
+  if (spec.compare(0, kReplayPrefix.size(), kReplayPrefix) == 0) {
+    return ReplayTransport::Load(spec.substr(kReplayPrefix.size()), status);
+  }
+  return SerialTransport::Open(spec, speed, status);
+}
@@ -0,0 +1,213 @@
+// Transports connecting the IEC host library to an Arduino: its serial port,
+// a Unix domain socket, a recorded session or an Arduino emulated within the
+// same process. The Transport interface itself and FdTransport are part of
+// utils.h.
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+// The serial port the Arduino is connected to.
+class SerialTransport : public FdTransport {
+public:
+  // Use fd, a serial port configured already, taking ownership.
+  explicit SerialTransport(int fd) : FdTransport(fd, true) {}
+
+  // Open device_file at the given speed, resetting the Arduino. Returns
+  // nullptr in case of a problem and sets status.
+  static std::unique_ptr<SerialTransport>
+  Open(const std::string &device_file, int speed, IECStatus *status);
+
+  // Restarts the Arduino by pulsing the DTR line.
+  bool ResetPeer(IECStatus *status) override;
+};
+
+// A Unix domain stream socket, e.g. one that socat forwards to a serial port
+// on another machine, or one an emulator listens at.
+class UnixSocketTransport : public FdTransport {
+public:
+  // Connect to the socket at path. Returns nullptr in case of a problem and
+  // sets status.
+  static std::unique_ptr<UnixSocketTransport> Connect(const std::string &path,
+                                                      IECStatus *status);
+
+private:
+  explicit UnixSocketTransport(int fd) : FdTransport(fd, true) {}
+};
+
+// Passes everything through to another transport, recording it in a file
+// that ReplayTransport can play back.
+//
+// The file consists of records of the form <direction><length>:<data>\n,
+// where direction is 'R' for data read from the Arduino and 'W' for data
+// written to it, and length is the decimal number of bytes of data.
+class RecordingTransport : public Transport {
+public:
+  // Record the traffic on transport to path. Returns nullptr in case of a
+  // problem and sets status.
+  static std::unique_ptr<RecordingTransport>
+  Create(std::unique_ptr<Transport> transport, const std::string &path,
+         IECStatus *status);
+
+  ~RecordingTransport() override;
+
+  bool Read(char *buffer, size_t max_length, size_t *num_read,
+            IECStatus *status) override;
+  bool Write(const char *data, size_t length, IECStatus *status) override;
+  WaitResult Wait(TimePoint deadline) override;
+  void Interrupt() override;
+  bool ResetPeer(IECStatus *status) override;
+
+private:
+  RecordingTransport(std::unique_ptr<Transport> transport, int fd);
+
+  // Append a record to the file. Failures are ignored, the recording is
+  // secondary to talking to the Arduino.
+  void Record(char direction, const char *data, size_t length);
+
+  std::unique_ptr<Transport> transport_;
+  std::mutex mutex_;
+  int fd_;
+};
+
+// Plays back a recording made by RecordingTransport, standing in for the
+// Arduino. Data read from the Arduino is only delivered once everything
+// written before it was written again, byte by byte, which makes replays
+// deterministic regardless of how the data was split up into reads and
+// writes. The configuration the host sends when connecting is the exception,
+// it contains the time of day and only needs to be sent in one piece.
+class ReplayTransport : public Transport {
+public:
+  // Direction ('R' or 'W') and data of each record.
+  typedef std::vector<std::pair<char, std::string>> Records;
+
+  explicit ReplayTransport(Records records);
+
+  // Load the recording at path. Returns nullptr in case of a problem and sets
+  // status.
+  static std::unique_ptr<ReplayTransport> Load(const std::string &path,
+                                               IECStatus *status);
+
+  // Reading fails with END_OF_FILE once the recording is over. Writing
+  // anything the recording doesn't expect fails with CONNECTION_FAILURE.
+  bool Read(char *buffer, size_t max_length, size_t *num_read,
+            IECStatus *status) override;
+  bool Write(const char *data, size_t length, IECStatus *status) override;
+  WaitResult Wait(TimePoint deadline) override;
+  void Interrupt() override;
+
+private:
+  // Skip records consumed completely. Returns true if data can be read, or
+  // the recording is over. Must be called with mutex_ held.
+  bool Readable();
+
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  Records records_;
+  // The current record and the position within it.
+  size_t record_ = 0;
+  size_t offset_ = 0;
+  bool interrupted_ = false;
+};
+
+// Connects the host directly to a peer in the same process, such as an
+// EmulatedArduino, without any system calls. Data written by the host is
+// passed to the peer right away, on the writing thread.
+class LoopbackTransport : public Transport {
+public:
+  // The other end of a LoopbackTransport.
+  class Peer {
+  public:
+    virtual ~Peer() {}
+
+    // Called when the transport is created, and when the host resets the
+    // peer. This is where the peer greets the host, if it does.
+    virtual void Reset(LoopbackTransport *transport) = 0;
+
+    // Called with data written by the host. Calls are serialized. Answers are
+    // sent through transport->Send().
+    virtual void Receive(const char *data, size_t length,
+                         LoopbackTransport *transport) = 0;
+  };
+
+  // Ownership of peer is not transferred, it must outlive the transport.
+  explicit LoopbackTransport(Peer *peer);
+
+  // Queue data for the host to read. Can be called from any thread.
+  void Send(const std::string &data);
+
+  bool Read(char *buffer, size_t max_length, size_t *num_read,
+            IECStatus *status) override;
+  bool Write(const char *data, size_t length, IECStatus *status) override;
+  WaitResult Wait(TimePoint deadline) override;
+  void Interrupt() override;
+  // Drops data not read yet and resets the peer.
+  bool ResetPeer(IECStatus *status) override;
+
+private:
+  Peer *peer_;
+  // Serializes calls into peer_.
+  std::mutex peer_mutex_;
+
+  // Guards the state below, changed_ is notified whenever it changes.
+  std::mutex mutex_;
+  std::condition_variable changed_;
+  // Data sent by the peer, of which the host read up to input_pos_.
+  std::string input_;
+  size_t input_pos_ = 0;
+  bool interrupted_ = false;
+};
+
+// An Arduino in host mode, as seen through a LoopbackTransport. Parses
+// requests the way the firmware does and leaves serving them to a handler,
+// e.g. one backed by a disc image.
+class EmulatedArduino : public LoopbackTransport::Peer {
+public:
+  // Serve request, the command character followed by its parameters as sent
+  // by the host, e.g. "g\x08\x0f" to read from device 8, channel 15. Sets
+  // *data to the data read, if any. Returns an error message, or an empty
+  // string if successful.
+  typedef std::function<std::string(const std::string &request,
+                                    std::string *data)>
+      Handler;
+
+  explicit EmulatedArduino(Handler handler);
+
+  void Reset(LoopbackTransport *transport) override;
+  void Receive(const char *data, size_t length,
+               LoopbackTransport *transport) override;
+
+private:
+  // Returns the size of the request at the start of pending_, or zero if
+  // more data is needed to tell.
+  size_t RequestSize() const;
+
+  Handler handler_;
+  // Set once the host sent its configuration.
+  bool configured_ = false;
+  // Data received but not processed yet.
+  std::string pending_;
+};
+
+// Open the transport described by spec: "unix:<path>" for a Unix domain
+// socket, "replay:<path>" for a recording, anything else is taken to be a
+// serial device opened at the given speed. Returns nullptr in case of a
+// problem and sets status.
+std::unique_ptr<Transport> OpenTransport(const std::string &spec, int speed,
+                                         IECStatus *status);
+
+// Open the serial port device_file at the given speed, resetting the Arduino
+// connected to it. Returns the file descriptor, or -1 after setting status.
+int OpenArduinoSerial(const std::string &device_file, int speed,
+                      IECStatus *status);
+
+#endif // TRANSPORT_H
@@ -0,0 +1,147 @@
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "iec_host_lib.h"
+#include "transport.h"
+
+#include "gtest/gtest.h"
+
+class TransportTest : public ::testing::Test {
+public:
+  void SetUp() {
+    recording_path_ =
+        (boost::filesystem::temp_directory_path() / "recording_XXXXXX")
+            .string();
+    int fd = mkstemp(&recording_path_[0]);
+    EXPECT_TRUE(close(fd) == 0);
+  }
+
+  void TearDown() { EXPECT_TRUE(unlink(recording_path_.c_str()) == 0); }
+
+protected:
+  // A drive 8 with a command channel, and a data channel 2 that reads back
+  // whatever was written to it.
+  std::string Serve(const std::string &request, std::string *data) {
+    std::string channel = request.substr(0, 3);
+    switch (request[0]) {
+    case 'o':
+    case 'c':
+      return request[1] == 8 ? "" : "Device not present";
+    case 'g':
+      *data = channel[2] == 15 ? "00, OK,00,00\r" : written_;
+      return "";
+    case 'p':
+      written_ += request.substr(4);
+      return "";
+    default:
+      return "Unsupported";
+    }
+  }
+
+  // Run requests through bus, checking the results.
+  void RunRequests(IECBusConnection *bus) {
+    // More than fits into one packet, and in need of escaping.
+    const std::string kData = std::string(256, 'x') + "\\\r\\\r";
+    IECStatus status;
+    ASSERT_TRUE(bus->OpenChannel(8, 2, "FILE,S,W", &status)) << status.message;
+    EXPECT_TRUE(bus->WriteToChannel(8, 2, kData, &status)) << status.message;
+    std::string result;
+    EXPECT_TRUE(bus->ReadFromChannel(8, 2, &result, &status))
+        << status.message;
+    EXPECT_EQ(result, kData);
+    EXPECT_TRUE(bus->ReadFromChannel(8, 15, &result, &status))
+        << status.message;
+    EXPECT_EQ(result, "00, OK,00,00\r");
+    EXPECT_TRUE(bus->CloseChannel(8, 2, &status)) << status.message;
+    EXPECT_FALSE(bus->CloseChannel(9, 2, &status));
+    EXPECT_EQ(status.status_code, IECStatus::IEC_CONNECTION_FAILURE);
+  }
+
+  // Replays end with the response thread failing to read any further.
+  static void Log(char level, const std::string &channel,
+                  const std::string &message) {
+    std::cout << level << ":" << channel << ": " << message << std::endl;
+  }
+
+  std::string written_;
+  // Path to a temporary recording.
+  std::string recording_path_;
+};
+
+TEST_F(TransportTest, LoopbackToEmulatedArduino) {
+  EmulatedArduino arduino([this](const std::string &request,
+                                 std::string *data) {
+    return Serve(request, data);
+  });
+  IECStatus status;
+  std::unique_ptr<IECBusConnection> bus(IECBusConnection::Create(
+      std::make_unique<LoopbackTransport>(&arduino), Log, &status));
+  ASSERT_TRUE(bus != nullptr) << status.message;
+  RunRequests(bus.get());
+}
+
+TEST_F(TransportTest, RecordAndReplay) {
+  EmulatedArduino arduino([this](const std::string &request,
+                                 std::string *data) {
+    return Serve(request, data);
+  });
+  IECStatus status;
+  auto recording = RecordingTransport::Create(
+      std::make_unique<LoopbackTransport>(&arduino), recording_path_,
+      &status);
+  ASSERT_TRUE(recording != nullptr) << status.message;
+  std::unique_ptr<IECBusConnection> bus(
+      IECBusConnection::Create(std::move(recording), Log, &status));
+  ASSERT_TRUE(bus != nullptr) << status.message;
+  RunRequests(bus.get());
+  bus.reset();
+
+  // The same requests get the same answers, without the Arduino.
+  written_.clear();
+  auto replay = ReplayTransport::Load(recording_path_, &status);
+  ASSERT_TRUE(replay != nullptr) << status.message;
+  bus.reset(IECBusConnection::Create(std::move(replay), Log, &status));
+  ASSERT_TRUE(bus != nullptr) << status.message;
+  RunRequests(bus.get());
+  EXPECT_TRUE(written_.empty());
+}
+
+TEST_F(TransportTest, ReplayRejectsUnexpectedWrites) {
+  ReplayTransport replay({{'W', "abc"}, {'R', "de"}});
+  IECStatus status;
+  char buffer[4];
+  size_t num_read = 0;
+  EXPECT_EQ(replay.Wait(std::chrono::steady_clock::now()),
+            Transport::TIMED_OUT);
+  EXPECT_TRUE(replay.Write("ab", 2, &status)) << status.message;
+  EXPECT_TRUE(replay.Write("c", 1, &status)) << status.message;
+  EXPECT_EQ(replay.Wait(Transport::TimePoint::max()), Transport::READABLE);
+  EXPECT_FALSE(replay.Write("x", 1, &status));
+  EXPECT_EQ(status.status_code, IECStatus::CONNECTION_FAILURE);
+  ASSERT_TRUE(replay.Read(buffer, sizeof(buffer), &num_read, &status));
+  EXPECT_EQ(std::string(buffer, num_read), "de");
+  EXPECT_FALSE(replay.Read(buffer, sizeof(buffer), &num_read, &status));
+  EXPECT_EQ(status.status_code, IECStatus::END_OF_FILE);
+}
+
+TEST_F(TransportTest, FdTransportWaits) {
+  int pipefd[2];
+  ASSERT_EQ(pipe(pipefd), 0);
+  FdTransport transport(pipefd[0], /*take_ownership=*/true);
+  EXPECT_EQ(transport.Wait(std::chrono::steady_clock::now() +
+                           std::chrono::milliseconds(10)),
+            Transport::TIMED_OUT);
+  // Interrupts are kept until somebody waits.
+  transport.Interrupt();
+  transport.Interrupt();
+  EXPECT_EQ(transport.Wait(Transport::TimePoint::max()),
+            Transport::INTERRUPTED);
+  ASSERT_EQ(write(pipefd[1], "x", 1), 1);
+  EXPECT_EQ(transport.Wait(Transport::TimePoint::max()), Transport::READABLE);
+  close(pipefd[1]);
+}
@@ -3,6 +3,8 @@
 #include <algorithm>
 #include <cassert>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <sys/select.h>
 #include <unistd.h>
@@ -34,6 +36,12 @@ void SetError(IECStatus::IECStatusCode status_code, const std::string &context,
   case IECStatus::END_OF_FILE:
     status->message = "End of file error";
     break;
+  case IECStatus::TIMEOUT:
+    status->message = "Timeout";
+    break;
+  case IECStatus::CANCELLED:
+    status->message = "Cancelled";
+    break;
   }
   if (!context.empty()) {
     status->message = context + ": " + status->message;
@@ -48,7 +56,120 @@ void SetErrorFromErrno(IECStatus::IECStatusCode status_code,
           .str();
 }
 
-BufferedReadWriter::BufferedReadWriter(int fd) : fd_(fd) {
+FdTransport::FdTransport(int fd, bool take_ownership)
+    : fd_(fd), owned_(take_ownership) {
+  assert(pipe(interrupt_pipe_) == 0);
+  // Interrupts don't need to pile up, and are drained without blocking.
+  fcntl(interrupt_pipe_[0], F_SETFL, O_NONBLOCK);
+  fcntl(interrupt_pipe_[1], F_SETFL, O_NONBLOCK);
+}
+
+FdTransport::~FdTransport() {
+  if (owned_ && fd_ != -1) {
+    close(fd_);
+  }
+  close(interrupt_pipe_[0]);
+  close(interrupt_pipe_[1]);
+}
+
+bool FdTransport::Read(char *buffer, size_t max_length, size_t *num_read,
+                       IECStatus *status) {
+  while (true) {
+    ssize_t res = read(fd_, buffer, max_length);
+    if (res > 0) {
+      *num_read = res;
+      return true;
+    }
+    if (res == 0) {
+      SetErrorFromErrno(IECStatus::END_OF_FILE, "read", status);
+      return false;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // Non-blocking file descriptor, wait for data instead of spinning.
+      if (!Poll(POLLIN, status)) {
+        return false;
+      }
+    } else if (errno != EINTR) {
+      SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "read", status);
+      return false;
+    }
+  }
+}
+
+bool FdTransport::Write(const char *data, size_t length, IECStatus *status) {
+  size_t pos = 0;
+  while (pos < length) {
+    ssize_t res = write(fd_, data + pos, length - pos);
+    if (res >= 0) {
+      pos += res;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (!Poll(POLLOUT, status)) {
+        return false;
+      }
+    } else if (errno != EINTR) {
+      SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "write", status);
+      return false;
+    }
+  }
+  return true;
+}
+
+Transport::WaitResult FdTransport::Wait(TimePoint deadline) {
+  while (true) {
+    int timeout_ms = -1;
+    if (deadline != TimePoint::max()) {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      // Round up, so we don't return before the deadline.
+      timeout_ms = std::max<int>(0, remaining.count() + 1);
+    }
+    struct pollfd fds[2] = {{fd_, POLLIN, 0}, {interrupt_pipe_[0], POLLIN, 0}};
+    int res = poll(fds, 2, timeout_ms);
+    if (res == -1 && errno != EINTR) {
+      // Let the caller find out about the error when reading.
+      return READABLE;
+    }
+    if (res > 0 && fds[1].revents != 0) {
+      char symbols[16];
+      // Consume all interrupts, one is as good as many.
+      while (read(interrupt_pipe_[0], symbols, sizeof(symbols)) > 0) {
+      }
+      return INTERRUPTED;
+    }
+    if (res > 0) {
+      return READABLE;
+    }
+    if (res == 0 && std::chrono::steady_clock::now() >= deadline) {
+      return TIMED_OUT;
+    }
+  }
+}
+
+void FdTransport::Interrupt() {
+  char symbol = 'i';
+  // Fails only if the pipe is full of interrupts already.
+  (void)write(interrupt_pipe_[1], &symbol, 1);
+}
+
+bool FdTransport::Poll(short events, IECStatus *status) {
+  struct pollfd fds = {fd_, events, 0};
+  while (poll(&fds, 1, -1) == -1) {
+    if (errno != EINTR) {
+      SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "poll", status);
+      return false;
+    }
+  }
+  return true;
+}
+
+BufferedReadWriter::BufferedReadWriter(int fd)
+    : fd_transport_(std::make_unique<FdTransport>(fd, false)),
+      transport_(fd_transport_.get()) {
+  memset(buffer_, 0, sizeof(buffer_));
+}
+
+BufferedReadWriter::BufferedReadWriter(Transport *transport)
+    : transport_(transport) {
   memset(buffer_, 0, sizeof(buffer_));
 }
 
@@ -123,27 +244,13 @@ bool BufferedReadWriter::ReadTerminatedString(char term_symbol,
     // Still in the game. Let's read additional data that may have become
     // available.
     size_t read_max = kBufferSize - data_end_;
-    ssize_t res = -1;
-    while (res <= 0) {
-      ssize_t res = read(fd_, &buffer_[data_end_], read_max);
-      if (res == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-        SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "read", status);
-        return false;
-      }
-      if (res == 0) {
-        // End of file.
-        SetErrorFromErrno(IECStatus::END_OF_FILE, "read", status);
-        return false;
-      }
-      if (res > 0) {
-        // We obtained some new data. Update data_end_ and try to find the
-        // terminator within the newly read data (outer loop).
-        data_end_ += res;
-        break;
-      }
-      // We didn't read any extra data.
-      // TODO(aeckleder): Block until more data becomes available.
+    size_t num_read = 0;
+    if (!transport_->Read(&buffer_[data_end_], read_max, &num_read, status)) {
+      return false;
     }
+    // We obtained some new data. Update data_end_ and try to find the
+    // terminator within the newly read data.
+    data_end_ += num_read;
   }
 }
 
@@ -174,29 +281,16 @@ bool BufferedReadWriter::ReadUpTo(size_t min_length, size_t max_length,
   // read more than we return in result.
   assert(data_end_ - data_start_ == 0);
 
-  ssize_t res = -1;
-  while (result->size() < min_length && res <= 0) {
+  while (result->size() < min_length) {
     size_t read_max =
         std::min(static_cast<size_t>(kBufferSize), max_length - result->size());
-    ssize_t res = read(fd_, buffer_, read_max);
-    if (res == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-      SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "read", status);
-      return false;
-    }
-    if (res == 0) {
-      // End of file.
-      SetErrorFromErrno(IECStatus::END_OF_FILE, "read", status);
+    size_t num_read = 0;
+    if (!transport_->Read(buffer_, read_max, &num_read, status)) {
       return false;
     }
-    if (res > 0) {
-      // Append new data to the string and do another iteration through the
-      // loop without waiting for additional data. We might exit the loop as
-      // a result, in case we have read at least min_length bytes.
-      result->append(buffer_, res);
-      continue;
-    }
-    // We didn't read any extra data.
-    // TODO(aeckleder): Block until more data becomes available.
+    // Append new data to the string and go on until we have read at least
+    // min_length bytes.
+    result->append(buffer_, num_read);
   }
   return true;
 }
@@ -206,18 +300,7 @@ bool BufferedReadWriter::WriteString(const std::string &content,
   if (content.empty()) {
     return true;
   }
-  size_t pos = 0;
-  while (pos < content.size()) {
-    ssize_t result = write(fd_, &content.c_str()[pos], content.size() - pos);
-    if (result == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
-      SetErrorFromErrno(IECStatus::CONNECTION_FAILURE, "write", status);
-      return false;
-    }
-    if (result >= 0) {
-      pos += result;
-    }
-  }
-  return true;
+  return transport_->Write(content.data(), content.size(), status);
 }
 
 bool UnescapeString(const std::string &source, std::string *target,
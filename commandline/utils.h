@@ -4,6 +4,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <chrono>
+#include <memory>
 #include <string>
 #include <unistd.h>
 
@@ -33,6 +35,8 @@ struct IECStatus {
     IEC_CONNECTION_FAILURE = 0x04,
     DRIVE_ERROR = 0x05,
     END_OF_FILE = 0x06,
+    TIMEOUT = 0x07,
+    CANCELLED = 0x08,
   };
   IECStatusCode status_code;
   std::string message; // A status message describing the status.
@@ -54,6 +58,72 @@ void SetErrorFromErrno(IECStatus::IECStatusCode status_code,
 bool UnescapeString(const std::string &source, std::string *target,
                     IECStatus *status);
 
+// A bidirectional byte stream to an Arduino, or to anything else speaking its
+// protocol. Reads and writes may happen on different threads. See
+// transport.h for the implementations beyond FdTransport.
+class Transport {
+public:
+  enum WaitResult {
+    READABLE,    // Read() won't block.
+    INTERRUPTED, // Interrupt() was called.
+    TIMED_OUT,   // The deadline passed.
+  };
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  virtual ~Transport() {}
+
+  // Read at least one and up to max_length bytes into buffer, blocking until
+  // they are available. Sets *num_read and returns true if successful, sets
+  // status otherwise (to END_OF_FILE if there won't be any more data).
+  virtual bool Read(char *buffer, size_t max_length, size_t *num_read,
+                    IECStatus *status) = 0;
+
+  // Write length bytes from data. Returns true if successful, sets status
+  // otherwise.
+  virtual bool Write(const char *data, size_t length, IECStatus *status) = 0;
+
+  // Block until data can be read, deadline passed or Interrupt() was called.
+  // An interrupt arriving while nobody waits is reported by the next call.
+  // Pass TimePoint::max() to wait without a deadline.
+  virtual WaitResult Wait(TimePoint deadline) = 0;
+
+  // Make Wait() return INTERRUPTED. Can be called from any thread.
+  virtual void Interrupt() = 0;
+
+  // Reset whatever is on the other end, e.g. restart the Arduino. Returns
+  // true if successful, sets status otherwise.
+  virtual bool ResetPeer(IECStatus *status) {
+    SetError(IECStatus::UNIMPLEMENTED, "ResetPeer", status);
+    return false;
+  }
+};
+
+// A Transport on a file descriptor, which may be non-blocking.
+class FdTransport : public Transport {
+public:
+  // The file descriptor is closed on destruction if take_ownership is set.
+  FdTransport(int fd, bool take_ownership);
+  ~FdTransport() override;
+
+  bool Read(char *buffer, size_t max_length, size_t *num_read,
+            IECStatus *status) override;
+  bool Write(const char *data, size_t length, IECStatus *status) override;
+  WaitResult Wait(TimePoint deadline) override;
+  void Interrupt() override;
+
+  int fd() const { return fd_; }
+
+private:
+  // Block until fd_ is ready for events (as for poll()). Returns false and
+  // sets status on errors.
+  bool Poll(short events, IECStatus *status);
+
+  int fd_;
+  bool owned_;
+  // Written to by Interrupt() to wake up Wait().
+  int interrupt_pipe_[2];
+};
+
 // BufferedReadWriter can be used to read both terminated and fixed
 // character amounts from a file handle. It buffers reads internally,
 // writes are executed immediately. Note that file handle ownership is not
@@ -64,6 +134,10 @@ public:
   // Construct a BufferedReadWriter from a file descriptor.
   BufferedReadWriter(int fd);
 
+  // Construct a BufferedReadWriter on transport. Ownership is not
+  // transferred.
+  BufferedReadWriter(Transport *transport);
+
   // Reads up to max_length characters until term_symbol is found and set result
   // to the read string (not including term_symbol). Returns true if successful,
   // sets status otherwise. Note that the maximum value for max_length is
@@ -112,8 +186,10 @@ private:
   // the first half in case the first half is fully used.
   static const int kBufferSize = 2 * kMaxReadAhead - 1;
 
-  // File descriptor to read from.
-  int fd_;
+  // Set if constructed from a file descriptor.
+  std::unique_ptr<FdTransport> fd_transport_;
+  // Transport to read from and write to.
+  Transport *transport_;
   // The buffer we use to cache read results.
   char buffer_[kBufferSize];
 
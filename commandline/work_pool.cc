@@ -0,0 +1,107 @@
+#include "work_pool.h"
+
+#include <algorithm>
+
+namespace {
+// The pool and queue of the worker running on this thread, if any.
+thread_local WorkStealingPool *current_pool = nullptr;
+thread_local size_t current_queue = 0;
+} // namespace
+
+WorkStealingPool::WorkStealingPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    queues_.push_back(std::make_unique<Queue>());
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this, i]() { Work(i); });
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  queued_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::Submit(Task task) {
+  size_t index;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Counted before the task is queued, so it's never taken uncounted.
+    // Workers finding it missing for a moment just look again.
+    ++num_queued_;
+    ++num_pending_;
+    if (current_pool == this) {
+      index = current_queue;
+    } else {
+      index = next_queue_;
+      next_queue_ = (next_queue_ + 1) % queues_.size();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+    queues_[index]->tasks.push_back(std::move(task));
+  }
+  queued_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return num_pending_ == 0; });
+}
+
+void WorkStealingPool::Work(size_t index) {
+  current_pool = this;
+  current_queue = index;
+  while (true) {
+    Task task;
+    if (TakeTask(index, &task)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --num_queued_;
+      }
+      task();
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_pending_ == 0) {
+        idle_.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    queued_.wait(lock, [this]() { return stopping_ || num_queued_ > 0; });
+    if (stopping_ && num_queued_ == 0) {
+      return;
+    }
+  }
+}
+
+bool WorkStealingPool::TakeTask(size_t index, Task *task) {
+  {
+    Queue &own = *queues_[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    Queue &other = *queues_[(index + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(other.mutex);
+    if (!other.tasks.empty()) {
+      *task = std::move(other.tasks.front());
+      other.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,67 @@
+// A pool of worker threads for running many independent tasks, such as
+// processing each image of an archive. Every worker has a queue of its own.
+// Tasks submitted by a task go to the queue of the worker running it, and are
+// taken from its back, so related work stays on one core. Workers running out
+// of work steal the oldest task from the front of another worker's queue.
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+  typedef std::function<void()> Task;
+
+  // Start num_threads workers, or one per core if num_threads is zero.
+  explicit WorkStealingPool(size_t num_threads = 0);
+
+  // Waits for all tasks to complete before stopping the workers.
+  ~WorkStealingPool();
+
+  // Queue task to run on one of the workers. Can be called from any thread,
+  // including from within tasks.
+  void Submit(Task task);
+
+  // Block until all tasks submitted, including those submitted by tasks,
+  // ran. Must not be called from within a task.
+  void Wait();
+
+  size_t num_threads() const { return threads_.size(); }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Run tasks on worker index until the pool is stopped.
+  void Work(size_t index);
+
+  // Take the newest task from queue index, or the oldest one of any other
+  // queue. Returns false if all of them are empty.
+  bool TakeTask(size_t index, Task *task);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+
+  // Guards the counters below. Workers wait on queued_ for tasks, Wait()
+  // waits on idle_ for all of them to finish.
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable idle_;
+  // Tasks in any queue, and tasks not finished yet (queued or running).
+  size_t num_queued_ = 0;
+  size_t num_pending_ = 0;
+  bool stopping_ = false;
+  // Queue to put the next task submitted from outside the pool into.
+  size_t next_queue_ = 0;
+};
+
+#endif // WORK_POOL_H
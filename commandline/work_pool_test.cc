@@ -0,0 +1,51 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "work_pool.h"
+
+#include "gtest/gtest.h"
+
+TEST(WorkStealingPoolTest, RunsNestedTasks) {
+  std::atomic<int> num_run{0};
+  WorkStealingPool pool(4);
+  EXPECT_EQ(pool.num_threads(), 4);
+  for (int i = 0; i < 100; ++i) {
+    pool.Submit([&pool, &num_run]() {
+      for (int j = 0; j < 10; ++j) {
+        pool.Submit([&num_run]() { ++num_run; });
+      }
+      ++num_run;
+    });
+  }
+  pool.Wait();
+  EXPECT_EQ(num_run, 1100);
+
+  // The pool can be reused after waiting.
+  pool.Submit([&num_run]() { ++num_run; });
+  pool.Wait();
+  EXPECT_EQ(num_run, 1101);
+}
+
+TEST(WorkStealingPoolTest, StealsTasksQueuedByOneWorker) {
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  {
+    WorkStealingPool pool(4);
+    // All tasks end up in the queue of the worker running this one, the
+    // others have to steal them.
+    pool.Submit([&]() {
+      for (int i = 0; i < 40; ++i) {
+        pool.Submit([&]() {
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          std::lock_guard<std::mutex> lock(mutex);
+          threads.insert(std::this_thread::get_id());
+        });
+      }
+    });
+    // The destructor waits for everything to run.
+  }
+  EXPECT_GT(threads.size(), 1);
+}
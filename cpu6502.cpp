@@ -0,0 +1,451 @@
+#include "cpu6502.hpp"
+
+namespace {
+
+enum Operation {
+	OP_ILL,
+	OP_ADC, OP_AND, OP_ASL, OP_BCC, OP_BCS, OP_BEQ, OP_BIT, OP_BMI, OP_BNE, OP_BPL, OP_BRK, OP_BVC, OP_BVS, OP_CLC,
+	OP_CLD, OP_CLI, OP_CLV, OP_CMP, OP_CPX, OP_CPY, OP_DEC, OP_DEX, OP_DEY, OP_EOR, OP_INC, OP_INX, OP_INY, OP_JMP,
+	OP_JSR, OP_LDA, OP_LDX, OP_LDY, OP_LSR, OP_NOP, OP_ORA, OP_PHA, OP_PHP, OP_PLA, OP_PLP, OP_ROL, OP_ROR, OP_RTI,
+	OP_RTS, OP_SBC, OP_SEC, OP_SED, OP_SEI, OP_STA, OP_STX, OP_STY, OP_TAX, OP_TAY, OP_TSX, OP_TXA, OP_TXS, OP_TYA
+};
+
+enum AddressingMode {
+	M_IMP, M_ACC, M_IMM, M_ZP, M_ZPX, M_ZPY, M_ABS, M_ABX, M_ABY, M_IND, M_IZX, M_IZY, M_REL
+};
+
+struct OpcodeInfo
+{
+	uchar operation;
+	uchar mode;
+	uchar cycles;
+};
+
+// Instruction length per addressing mode, same order as the AddressingMode enum.
+const uchar s_modeLength[] = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2 };
+
+// Base cycle count per opcode, page crossing and taken branch penalties are added while executing.
+const OpcodeInfo s_opcodes[256] = {
+	{ OP_BRK, M_IMP, 7 }, { OP_ORA, M_IZX, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 00
+	{ OP_ILL, M_IMP, 2 }, { OP_ORA, M_ZP, 3 }, { OP_ASL, M_ZP, 5 }, { OP_ILL, M_IMP, 2 }, // 04
+	{ OP_PHP, M_IMP, 3 }, { OP_ORA, M_IMM, 2 }, { OP_ASL, M_ACC, 2 }, { OP_ILL, M_IMP, 2 }, // 08
+	{ OP_ILL, M_IMP, 2 }, { OP_ORA, M_ABS, 4 }, { OP_ASL, M_ABS, 6 }, { OP_ILL, M_IMP, 2 }, // 0C
+	{ OP_BPL, M_REL, 2 }, { OP_ORA, M_IZY, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 10
+	{ OP_ILL, M_IMP, 2 }, { OP_ORA, M_ZPX, 4 }, { OP_ASL, M_ZPX, 6 }, { OP_ILL, M_IMP, 2 }, // 14
+	{ OP_CLC, M_IMP, 2 }, { OP_ORA, M_ABY, 4 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 18
+	{ OP_ILL, M_IMP, 2 }, { OP_ORA, M_ABX, 4 }, { OP_ASL, M_ABX, 7 }, { OP_ILL, M_IMP, 2 }, // 1C
+	{ OP_JSR, M_ABS, 6 }, { OP_AND, M_IZX, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 20
+	{ OP_BIT, M_ZP, 3 }, { OP_AND, M_ZP, 3 }, { OP_ROL, M_ZP, 5 }, { OP_ILL, M_IMP, 2 }, // 24
+	{ OP_PLP, M_IMP, 4 }, { OP_AND, M_IMM, 2 }, { OP_ROL, M_ACC, 2 }, { OP_ILL, M_IMP, 2 }, // 28
+	{ OP_BIT, M_ABS, 4 }, { OP_AND, M_ABS, 4 }, { OP_ROL, M_ABS, 6 }, { OP_ILL, M_IMP, 2 }, // 2C
+	{ OP_BMI, M_REL, 2 }, { OP_AND, M_IZY, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 30
+	{ OP_ILL, M_IMP, 2 }, { OP_AND, M_ZPX, 4 }, { OP_ROL, M_ZPX, 6 }, { OP_ILL, M_IMP, 2 }, // 34
+	{ OP_SEC, M_IMP, 2 }, { OP_AND, M_ABY, 4 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 38
+	{ OP_ILL, M_IMP, 2 }, { OP_AND, M_ABX, 4 }, { OP_ROL, M_ABX, 7 }, { OP_ILL, M_IMP, 2 }, // 3C
+	{ OP_RTI, M_IMP, 6 }, { OP_EOR, M_IZX, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 40
+	{ OP_ILL, M_IMP, 2 }, { OP_EOR, M_ZP, 3 }, { OP_LSR, M_ZP, 5 }, { OP_ILL, M_IMP, 2 }, // 44
+	{ OP_PHA, M_IMP, 3 }, { OP_EOR, M_IMM, 2 }, { OP_LSR, M_ACC, 2 }, { OP_ILL, M_IMP, 2 }, // 48
+	{ OP_JMP, M_ABS, 3 }, { OP_EOR, M_ABS, 4 }, { OP_LSR, M_ABS, 6 }, { OP_ILL, M_IMP, 2 }, // 4C
+	{ OP_BVC, M_REL, 2 }, { OP_EOR, M_IZY, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 50
+	{ OP_ILL, M_IMP, 2 }, { OP_EOR, M_ZPX, 4 }, { OP_LSR, M_ZPX, 6 }, { OP_ILL, M_IMP, 2 }, // 54
+	{ OP_CLI, M_IMP, 2 }, { OP_EOR, M_ABY, 4 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 58
+	{ OP_ILL, M_IMP, 2 }, { OP_EOR, M_ABX, 4 }, { OP_LSR, M_ABX, 7 }, { OP_ILL, M_IMP, 2 }, // 5C
+	{ OP_RTS, M_IMP, 6 }, { OP_ADC, M_IZX, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 60
+	{ OP_ILL, M_IMP, 2 }, { OP_ADC, M_ZP, 3 }, { OP_ROR, M_ZP, 5 }, { OP_ILL, M_IMP, 2 }, // 64
+	{ OP_PLA, M_IMP, 4 }, { OP_ADC, M_IMM, 2 }, { OP_ROR, M_ACC, 2 }, { OP_ILL, M_IMP, 2 }, // 68
+	{ OP_JMP, M_IND, 5 }, { OP_ADC, M_ABS, 4 }, { OP_ROR, M_ABS, 6 }, { OP_ILL, M_IMP, 2 }, // 6C
+	{ OP_BVS, M_REL, 2 }, { OP_ADC, M_IZY, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 70
+	{ OP_ILL, M_IMP, 2 }, { OP_ADC, M_ZPX, 4 }, { OP_ROR, M_ZPX, 6 }, { OP_ILL, M_IMP, 2 }, // 74
+	{ OP_SEI, M_IMP, 2 }, { OP_ADC, M_ABY, 4 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 78
+	{ OP_ILL, M_IMP, 2 }, { OP_ADC, M_ABX, 4 }, { OP_ROR, M_ABX, 7 }, { OP_ILL, M_IMP, 2 }, // 7C
+	{ OP_ILL, M_IMP, 2 }, { OP_STA, M_IZX, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 80
+	{ OP_STY, M_ZP, 3 }, { OP_STA, M_ZP, 3 }, { OP_STX, M_ZP, 3 }, { OP_ILL, M_IMP, 2 }, // 84
+	{ OP_DEY, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, { OP_TXA, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 88
+	{ OP_STY, M_ABS, 4 }, { OP_STA, M_ABS, 4 }, { OP_STX, M_ABS, 4 }, { OP_ILL, M_IMP, 2 }, // 8C
+	{ OP_BCC, M_REL, 2 }, { OP_STA, M_IZY, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 90
+	{ OP_STY, M_ZPX, 4 }, { OP_STA, M_ZPX, 4 }, { OP_STX, M_ZPY, 4 }, { OP_ILL, M_IMP, 2 }, // 94
+	{ OP_TYA, M_IMP, 2 }, { OP_STA, M_ABY, 5 }, { OP_TXS, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 98
+	{ OP_ILL, M_IMP, 2 }, { OP_STA, M_ABX, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // 9C
+	{ OP_LDY, M_IMM, 2 }, { OP_LDA, M_IZX, 6 }, { OP_LDX, M_IMM, 2 }, { OP_ILL, M_IMP, 2 }, // A0
+	{ OP_LDY, M_ZP, 3 }, { OP_LDA, M_ZP, 3 }, { OP_LDX, M_ZP, 3 }, { OP_ILL, M_IMP, 2 }, // A4
+	{ OP_TAY, M_IMP, 2 }, { OP_LDA, M_IMM, 2 }, { OP_TAX, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // A8
+	{ OP_LDY, M_ABS, 4 }, { OP_LDA, M_ABS, 4 }, { OP_LDX, M_ABS, 4 }, { OP_ILL, M_IMP, 2 }, // AC
+	{ OP_BCS, M_REL, 2 }, { OP_LDA, M_IZY, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // B0
+	{ OP_LDY, M_ZPX, 4 }, { OP_LDA, M_ZPX, 4 }, { OP_LDX, M_ZPY, 4 }, { OP_ILL, M_IMP, 2 }, // B4
+	{ OP_CLV, M_IMP, 2 }, { OP_LDA, M_ABY, 4 }, { OP_TSX, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // B8
+	{ OP_LDY, M_ABX, 4 }, { OP_LDA, M_ABX, 4 }, { OP_LDX, M_ABY, 4 }, { OP_ILL, M_IMP, 2 }, // BC
+	{ OP_CPY, M_IMM, 2 }, { OP_CMP, M_IZX, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // C0
+	{ OP_CPY, M_ZP, 3 }, { OP_CMP, M_ZP, 3 }, { OP_DEC, M_ZP, 5 }, { OP_ILL, M_IMP, 2 }, // C4
+	{ OP_INY, M_IMP, 2 }, { OP_CMP, M_IMM, 2 }, { OP_DEX, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // C8
+	{ OP_CPY, M_ABS, 4 }, { OP_CMP, M_ABS, 4 }, { OP_DEC, M_ABS, 6 }, { OP_ILL, M_IMP, 2 }, // CC
+	{ OP_BNE, M_REL, 2 }, { OP_CMP, M_IZY, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // D0
+	{ OP_ILL, M_IMP, 2 }, { OP_CMP, M_ZPX, 4 }, { OP_DEC, M_ZPX, 6 }, { OP_ILL, M_IMP, 2 }, // D4
+	{ OP_CLD, M_IMP, 2 }, { OP_CMP, M_ABY, 4 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // D8
+	{ OP_ILL, M_IMP, 2 }, { OP_CMP, M_ABX, 4 }, { OP_DEC, M_ABX, 7 }, { OP_ILL, M_IMP, 2 }, // DC
+	{ OP_CPX, M_IMM, 2 }, { OP_SBC, M_IZX, 6 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // E0
+	{ OP_CPX, M_ZP, 3 }, { OP_SBC, M_ZP, 3 }, { OP_INC, M_ZP, 5 }, { OP_ILL, M_IMP, 2 }, // E4
+	{ OP_INX, M_IMP, 2 }, { OP_SBC, M_IMM, 2 }, { OP_NOP, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // E8
+	{ OP_CPX, M_ABS, 4 }, { OP_SBC, M_ABS, 4 }, { OP_INC, M_ABS, 6 }, { OP_ILL, M_IMP, 2 }, // EC
+	{ OP_BEQ, M_REL, 2 }, { OP_SBC, M_IZY, 5 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // F0
+	{ OP_ILL, M_IMP, 2 }, { OP_SBC, M_ZPX, 4 }, { OP_INC, M_ZPX, 6 }, { OP_ILL, M_IMP, 2 }, // F4
+	{ OP_SED, M_IMP, 2 }, { OP_SBC, M_ABY, 4 }, { OP_ILL, M_IMP, 2 }, { OP_ILL, M_IMP, 2 }, // F8
+	{ OP_ILL, M_IMP, 2 }, { OP_SBC, M_ABX, 4 }, { OP_INC, M_ABX, 7 }, { OP_ILL, M_IMP, 2 } // FC
+};
+
+// The routine started by call() returns here. Nothing in a 1541 ever executes at $FFFF (it's the IRQ vector).
+const ushort SENTINEL_ADDRESS = 0xFFFF;
+
+// The reset routine of the 1541 ROM leaves the stack pointer here.
+const uchar INITIAL_STACK_POINTER = 0x45;
+
+} // anonymous
+
+
+CPU6502::CPU6502(IBus& bus)
+	: decodeHits(0)
+	, decodeMisses(0)
+	, m_bus(bus)
+	, m_decodeCache(0x10000)
+	, m_traps(0x10000)
+{
+	reset();
+} // ctor
+
+
+void CPU6502::reset()
+{
+	a = x = y = 0;
+	sp = INITIAL_STACK_POINTER;
+	p = FLAG_U bitor FLAG_I;
+	pc = 0;
+	cycles = 0;
+	m_decodeCache.fill(Decoded());
+} // reset
+
+
+void CPU6502::invalidate(ushort address, ushort length)
+{
+	// An instruction starting up to two bytes before the range may have its operand in it.
+	int start = qMax(0, address - 2);
+	int end = qMin(0x10000, address + length);
+	for(int i = start; i < end; ++i)
+		m_decodeCache[i].valid = false;
+} // invalidate
+
+
+void CPU6502::setTrap(ushort address, bool enabled)
+{
+	m_traps.setBit(address, enabled);
+} // setTrap
+
+
+CPU6502::StopReason CPU6502::call(ushort address, quint64 maxCycles)
+{
+	// Same stack layout as a JSR from the sentinel address, so an RTS from the routine lands on the sentinel.
+	const ushort returnAddress = SENTINEL_ADDRESS - 1;
+	push(returnAddress >> 8);
+	push(returnAddress bitand 0xFF);
+	pc = address;
+
+	const quint64 cycleLimit = cycles + maxCycles;
+	while(cycles < cycleLimit) {
+		if(SENTINEL_ADDRESS == pc)
+			return STOP_RETURNED;
+		if(m_traps.testBit(pc))
+			return STOP_TRAP;
+		StopReason reason;
+		if(not step(reason))
+			return reason;
+	}
+	return STOP_CYCLE_LIMIT;
+} // call
+
+
+const CPU6502::Decoded& CPU6502::fetch()
+{
+	Decoded& d = m_decodeCache[pc];
+	if(d.valid)
+		++decodeHits;
+	else {
+		++decodeMisses;
+		d.opcode = read(pc);
+		d.length = s_modeLength[s_opcodes[d.opcode].mode];
+		d.operand = 0;
+		if(d.length > 1)
+			d.operand = read(pc + 1);
+		if(d.length > 2)
+			d.operand or_eq read(pc + 2) << 8;
+		d.valid = true;
+	}
+	return d;
+} // fetch
+
+
+void CPU6502::write(ushort address, uchar value)
+{
+	m_bus.write(address, value);
+	invalidate(address, 1);
+} // write
+
+
+void CPU6502::push(uchar value)
+{
+	write(0x0100 bitor sp, value);
+	--sp;
+} // push
+
+
+uchar CPU6502::pull()
+{
+	++sp;
+	return read(0x0100 bitor sp);
+} // pull
+
+
+void CPU6502::setNZ(uchar value)
+{
+	p = (p bitand ~(FLAG_N bitor FLAG_Z)) bitor (value bitand FLAG_N) bitor (value ? 0 : FLAG_Z);
+} // setNZ
+
+
+void CPU6502::compare(uchar reg, uchar value)
+{
+	setNZ(reg - value);
+	if(reg >= value)
+		p or_eq FLAG_C;
+	else
+		p and_eq ~FLAG_C;
+} // compare
+
+
+void CPU6502::adc(uchar value)
+{
+	uint carry = p bitand FLAG_C;
+	uint result = a + value + carry;
+	p and_eq ~(FLAG_C bitor FLAG_V);
+	if(~(a ^ value) bitand (a ^ result) bitand 0x80)
+		p or_eq FLAG_V;
+	if(p bitand FLAG_D) {
+		// NMOS decimal mode, N/V/Z are taken from the binary result as on the real chip.
+		uint lo = (a bitand 0x0F) + (value bitand 0x0F) + carry;
+		uint hi = (a bitand 0xF0) + (value bitand 0xF0);
+		if(lo > 0x09) {
+			lo += 0x06;
+			hi += 0x10;
+		}
+		if(hi > 0x90)
+			hi += 0x60;
+		setNZ(result);
+		if(hi > 0xFF)
+			p or_eq FLAG_C;
+		a = (hi bitand 0xF0) bitor (lo bitand 0x0F);
+	}
+	else {
+		if(result > 0xFF)
+			p or_eq FLAG_C;
+		a = result;
+		setNZ(a);
+	}
+} // adc
+
+
+void CPU6502::sbc(uchar value)
+{
+	if(p bitand FLAG_D) {
+		uint borrow = (p bitand FLAG_C) ? 0 : 1;
+		int lo = (a bitand 0x0F) - (value bitand 0x0F) - borrow;
+		int hi = (a bitand 0xF0) - (value bitand 0xF0);
+		if(lo < 0) {
+			lo -= 0x06;
+			hi -= 0x10;
+		}
+		if(hi < 0)
+			hi -= 0x60;
+		// Flags as in binary mode.
+		uint result = a - value - borrow;
+		p and_eq ~(FLAG_C bitor FLAG_V);
+		if((a ^ value) bitand (a ^ result) bitand 0x80)
+			p or_eq FLAG_V;
+		if(result < 0x100)
+			p or_eq FLAG_C;
+		setNZ(result);
+		a = (hi bitand 0xF0) bitor (lo bitand 0x0F);
+	}
+	else
+		adc(~value);
+} // sbc
+
+
+bool CPU6502::step(StopReason& reason)
+{
+	const Decoded& d = fetch();
+	const OpcodeInfo& info = s_opcodes[d.opcode];
+	if(OP_ILL == info.operation) {
+		reason = STOP_ILLEGAL_OPCODE;
+		return false;
+	}
+
+	pc += d.length;
+	cycles += info.cycles;
+
+	// Resolve the effective address.
+	ushort ea = 0;
+	bool pageCrossed = false;
+	switch(info.mode) {
+		case M_ZP:
+			ea = d.operand;
+			break;
+		case M_ZPX:
+			ea = (d.operand + x) bitand 0xFF;
+			break;
+		case M_ZPY:
+			ea = (d.operand + y) bitand 0xFF;
+			break;
+		case M_ABS:
+			ea = d.operand;
+			break;
+		case M_ABX:
+			ea = d.operand + x;
+			pageCrossed = (ea ^ d.operand) bitand 0xFF00;
+			break;
+		case M_ABY:
+			ea = d.operand + y;
+			pageCrossed = (ea ^ d.operand) bitand 0xFF00;
+			break;
+		case M_IND:
+			// The NMOS 6502 doesn't carry into the high byte of the pointer.
+			ea = read(d.operand) bitor (read((d.operand bitand 0xFF00) bitor ((d.operand + 1) bitand 0xFF)) << 8);
+			break;
+		case M_IZX:
+		{
+			uchar zp = d.operand + x;
+			ea = read(zp) bitor (read((uchar)(zp + 1)) << 8);
+			break;
+		}
+		case M_IZY:
+		{
+			ushort base = read(d.operand) bitor (read((uchar)(d.operand + 1)) << 8);
+			ea = base + y;
+			pageCrossed = (ea ^ base) bitand 0xFF00;
+			break;
+		}
+		case M_REL:
+			ea = pc + (signed char)d.operand;
+			break;
+		default:
+			break;
+	}
+
+	// Fetches the operand value for instructions that read memory (or the immediate value).
+#define OPERAND() (M_IMM == info.mode ? (uchar)d.operand : (cycles += pageCrossed ? 1 : 0, read(ea)))
+#define BRANCH(cond) if(cond) { cycles += ((ea ^ pc) bitand 0xFF00) ? 2 : 1; pc = ea; } break
+
+	uchar value;
+	switch(info.operation) {
+		case OP_ADC: adc(OPERAND()); break;
+		case OP_SBC: sbc(OPERAND()); break;
+		case OP_AND: a and_eq OPERAND(); setNZ(a); break;
+		case OP_ORA: a or_eq OPERAND(); setNZ(a); break;
+		case OP_EOR: a ^= OPERAND(); setNZ(a); break;
+		case OP_LDA: a = OPERAND(); setNZ(a); break;
+		case OP_LDX: x = OPERAND(); setNZ(x); break;
+		case OP_LDY: y = OPERAND(); setNZ(y); break;
+		case OP_CMP: compare(a, OPERAND()); break;
+		case OP_CPX: compare(x, OPERAND()); break;
+		case OP_CPY: compare(y, OPERAND()); break;
+		case OP_BIT:
+			value = read(ea);
+			p = (p bitand ~(FLAG_N bitor FLAG_V bitor FLAG_Z)) bitor (value bitand (FLAG_N bitor FLAG_V))
+					bitor ((a bitand value) ? 0 : FLAG_Z);
+			break;
+
+		case OP_STA: write(ea, a); break;
+		case OP_STX: write(ea, x); break;
+		case OP_STY: write(ea, y); break;
+
+		case OP_ASL:
+		case OP_LSR:
+		case OP_ROL:
+		case OP_ROR:
+		{
+			value = M_ACC == info.mode ? a : read(ea);
+			uchar carryIn = p bitand FLAG_C;
+			p and_eq ~FLAG_C;
+			if(OP_ASL == info.operation or OP_ROL == info.operation) {
+				p or_eq value >> 7;
+				value = (value << 1) bitor (OP_ROL == info.operation ? carryIn : 0);
+			}
+			else {
+				p or_eq value bitand FLAG_C;
+				value = (value >> 1) bitor (OP_ROR == info.operation ? carryIn << 7 : 0);
+			}
+			setNZ(value);
+			if(M_ACC == info.mode)
+				a = value;
+			else
+				write(ea, value);
+			break;
+		}
+		case OP_INC: value = read(ea) + 1; setNZ(value); write(ea, value); break;
+		case OP_DEC: value = read(ea) - 1; setNZ(value); write(ea, value); break;
+		case OP_INX: setNZ(++x); break;
+		case OP_INY: setNZ(++y); break;
+		case OP_DEX: setNZ(--x); break;
+		case OP_DEY: setNZ(--y); break;
+
+		case OP_TAX: x = a; setNZ(x); break;
+		case OP_TAY: y = a; setNZ(y); break;
+		case OP_TXA: a = x; setNZ(a); break;
+		case OP_TYA: a = y; setNZ(a); break;
+		case OP_TSX: x = sp; setNZ(x); break;
+		case OP_TXS: sp = x; break;
+
+		case OP_PHA: push(a); break;
+		case OP_PHP: push(p bitor FLAG_B bitor FLAG_U); break;
+		case OP_PLA: a = pull(); setNZ(a); break;
+		case OP_PLP: p = pull() bitor FLAG_U; break;
+
+		case OP_BCC: BRANCH(not (p bitand FLAG_C));
+		case OP_BCS: BRANCH(p bitand FLAG_C);
+		case OP_BNE: BRANCH(not (p bitand FLAG_Z));
+		case OP_BEQ: BRANCH(p bitand FLAG_Z);
+		case OP_BPL: BRANCH(not (p bitand FLAG_N));
+		case OP_BMI: BRANCH(p bitand FLAG_N);
+		case OP_BVC: BRANCH(not (p bitand FLAG_V));
+		case OP_BVS: BRANCH(p bitand FLAG_V);
+
+		case OP_JMP: pc = ea; break;
+		case OP_JSR:
+			--pc;
+			push(pc >> 8);
+			push(pc bitand 0xFF);
+			pc = ea;
+			break;
+		case OP_RTS:
+			pc = pull();
+			pc = (pc bitor (pull() << 8)) + 1;
+			break;
+		case OP_RTI:
+			p = pull() bitor FLAG_U;
+			pc = pull();
+			pc or_eq pull() << 8;
+			break;
+		case OP_BRK:
+			// Drive code doesn't use BRK on purpose, the ROM would only report an error. Stop instead.
+			reason = STOP_BRK;
+			return false;
+
+		case OP_CLC: p and_eq ~FLAG_C; break;
+		case OP_SEC: p or_eq FLAG_C; break;
+		case OP_CLI: p and_eq ~FLAG_I; break;
+		case OP_SEI: p or_eq FLAG_I; break;
+		case OP_CLD: p and_eq ~FLAG_D; break;
+		case OP_SED: p or_eq FLAG_D; break;
+		case OP_CLV: p and_eq ~FLAG_V; break;
+		case OP_NOP: break;
+	}
+#undef OPERAND
+#undef BRANCH
+
+	return true;
+} // step
@@ -0,0 +1,89 @@
+#ifndef CPU6502_HPP
+#define CPU6502_HPP
+
+#include <QVector>
+#include <QBitArray>
+
+// A plain NMOS 6502 core (documented opcodes only), good enough to run drive code uploaded with M-W.
+// Instructions are decoded once per address and kept in a decode cache. The cache is invalidated for
+// every address the core itself writes to, anyone else changing memory must call invalidate().
+class CPU6502
+{
+public:
+	// Memory bus the core runs against. All address decoding (RAM, I/O, ROM, mirrors) is done by the bus.
+	struct IBus
+	{
+		virtual uchar read(ushort address) = 0;
+		virtual void write(ushort address, uchar value) = 0;
+	};
+
+	enum StopReason {
+		STOP_RETURNED,				// The called routine returned with RTS.
+		STOP_TRAP,						// Execution reached a trap address, see setTrap().
+		STOP_CYCLE_LIMIT,			// The cycle budget was used up, typically an endless loop waiting for the bus.
+		STOP_BRK,							// A BRK was executed.
+		STOP_ILLEGAL_OPCODE		// An undocumented opcode was about to be executed.
+	};
+
+	// Status register flags.
+	enum Flags {
+		FLAG_C = 0x01,
+		FLAG_Z = 0x02,
+		FLAG_I = 0x04,
+		FLAG_D = 0x08,
+		FLAG_B = 0x10,
+		FLAG_U = 0x20,
+		FLAG_V = 0x40,
+		FLAG_N = 0x80
+	};
+
+	CPU6502(IBus& bus);
+
+	// Set registers to a defined state, the stack pointer as left by the 1541 ROM reset routine.
+	void reset();
+	// Run the subroutine at address as if called with JSR, until it returns, hits a trap, or the cycle budget
+	// is spent. May be called recursively from within a bus access (e.g. to run a job in a buffer).
+	StopReason call(ushort address, quint64 maxCycles);
+	// Drop decoded instructions overlapping the given memory range.
+	void invalidate(ushort address, ushort length);
+	// Stop execution whenever the program counter reaches the address (before the instruction is executed).
+	void setTrap(ushort address, bool enabled = true);
+
+	// Registers are public, the owner may need to set up or inspect them around call().
+	uchar a, x, y, sp, p;
+	ushort pc;
+	// Total number of cycles executed since reset.
+	quint64 cycles;
+	// Instructions fetched from / added to the decode cache since construction.
+	quint64 decodeHits, decodeMisses;
+
+private:
+	struct Decoded
+	{
+		uchar opcode;
+		uchar length;
+		ushort operand;
+		bool valid;
+	};
+
+	const Decoded& fetch();
+	// Execute one instruction, returns false (and why) if execution has to stop.
+	bool step(StopReason& reason);
+	uchar read(ushort address)
+	{
+		return m_bus.read(address);
+	}
+	void write(ushort address, uchar value);
+	void push(uchar value);
+	uchar pull();
+	void setNZ(uchar value);
+	void compare(uchar reg, uchar value);
+	void adc(uchar value);
+	void sbc(uchar value);
+
+	IBus& m_bus;
+	QVector<Decoded> m_decodeCache;
+	QBitArray m_traps;
+};
+
+#endif // CPU6502_HPP
@@ -23,6 +23,12 @@ namespace {
 
 #define D64_IMAGE_SIZE 174848
 
+#define D64_BAM_TRACKS 35
+#define D64_DIR_ENTRY_SIZE 32
+#define D64_DIR_OFS_NAME 5
+#define D64_FILE_INTERLEAVE 10
+#define D64_DIR_INTERLEAVE 3
+
 typedef struct {
 		uchar disk_name[16]; // disk name padded with A0
 		uchar disk_id[5];    // disk id and dos type
@@ -42,12 +48,58 @@ const QString strFileTypes[] = { "DEL", "SEQ", "PRG", "USR", "REL", "???" };
 const QString strBlocksFree("BLOCKS FREE.");
 const QString strD64Error("ERROR: D64");
 
+// BAM entry of a track: Number of free sectors, followed by a bitmap with a set bit for each free sector.
+bool isBlockFree(const QByteArray& bam, uchar track, uchar sector)
+{
+	return uchar(bam.at(4 * track + 1 + sector / 8)) bitand (1 << (sector % 8));
+} // isBlockFree
+
+
+void setBlockFree(QByteArray& bam, uchar track, uchar sector, bool free)
+{
+	if(free == isBlockFree(bam, track, sector))
+		return;
+	int ix = 4 * track + 1 + sector / 8;
+	bam[ix] = char(uchar(bam.at(ix)) xor (1 << (sector % 8)));
+	bam[4 * track] = char(uchar(bam.at(4 * track)) + (free ? 1 : -1));
+} // setBlockFree
+
+
+// Allocate a free block on track, the first one at least interleave sectors after previous (if any). Returns false if
+// the track is full.
+bool allocateBlock(QByteArray& bam, uchar track, int previous, int interleave, uchar& sector)
+{
+	uchar numSectors = sectorsPerTrack[track - 1];
+	uchar start = previous < 0 ? 0 : (previous + interleave) % numSectors;
+	for(uchar i = 0; i < numSectors; ++i) {
+		sector = (start + i) % numSectors;
+		if(isBlockFree(bam, track, sector)) {
+			setBlockFree(bam, track, sector, false);
+			return true;
+		}
+	}
+	return false;
+} // allocateBlock
+
+
+// Index of a block in a bitmap of all blocks of the tracks covered by the BAM, -1 if track / sector are out of range.
+int blockIndex(uchar track, uchar sector)
+{
+	if(track < 1 or track > D64_BAM_TRACKS or sector >= sectorsPerTrack[track - 1])
+		return -1;
+	int index = sector;
+	for(uchar i = 0; i < track - 1; ++i)
+		index += sectorsPerTrack[i];
+	return index;
+} // blockIndex
+
 } // anonymous
 
 
 D64::D64(const QString& fileName)
-		: FileDriverBase(), m_hostFile(fileName), m_currentTrack(0), m_currentSector(0), m_currentOffset(0),
-				m_currentLinkTrack(0), m_currentLinkSector(0)
+		: FileDriverBase(), m_currentTrack(0), m_currentSector(0), m_currentOffset(0),
+				m_currentLinkTrack(0), m_currentLinkSector(0), m_writing(false), m_writeReplace(false),
+				m_closeError(CBM::ErrOK)
 {
 		if(not fileName.isEmpty())
 				mountHostImage(fileName);
@@ -63,11 +115,18 @@ D64::~D64()
 bool D64::mountHostImage(const QString& fileName)
 {
 		unmountHostImage();
-		m_hostFile.setFileName(fileName);
-		if(m_hostFile.open(QIODevice::ReadOnly)) {
+		QFile hostFile(fileName);
+		if(hostFile.open(QIODevice::ReadOnly)) {
 				// Check if file is a valid disk image by the simple criteria that
 				// file size is at least 174.848
-				if(hostSize() >= D64_IMAGE_SIZE) {
+				if(hostFile.size() >= D64_IMAGE_SIZE) {
+						// The image is small, keep it in memory with the modified sectors of its overlay on top.
+						m_image = hostFile.readAll();
+						if(not m_overlayDir.isEmpty() and m_overlay.open(fileName, m_overlayDir))
+								m_overlay.apply(m_image);
+						m_hostImage.setBuffer(&m_image);
+						m_hostImage.open(QIODevice::ReadOnly);
+						m_hostFileName = fileName;
 						m_status = IMAGE_OK;
 						m_lastName = QString("Image: ") + fileName;
 						return true;
@@ -82,8 +141,12 @@ bool D64::mountHostImage(const QString& fileName)
 
 void D64::unmountHostImage()
 {
-		if(not m_hostFile.fileName().isEmpty() and m_hostFile.isOpen())
-				m_hostFile.close();
+		if(m_hostImage.isOpen())
+				m_hostImage.close();
+		m_overlay.close();
+		m_image.clear();
+		m_hostFileName.clear();
+		m_writing = false;
 		m_status = NOT_READY;
 } // unmountHostImage
 
@@ -186,12 +249,196 @@ char D64::getc(void)
 
 bool D64::close(void)
 {
+		m_closeError = CBM::ErrOK;
+		if(m_writing) {
+				m_writing = false;
+				// The image stays mounted, the error is picked up through closeError().
+				m_closeError = saveFile();
+				if(CBM::ErrOK not_eq m_closeError)
+						Log("D64", error, QString("Saving %1 failed.").arg(m_lastName));
+		}
 		m_status and_eq IMAGE_OK;  // Clear all flags except disk ok
 
 		return true;
 } // fclose
 
 
+CBM::IOErrorMessage D64::closeError() const
+{
+	return m_closeError;
+} // closeError
+
+
+CBM::IOErrorMessage D64::fopenWrite(const QString& fileName, bool replaceMode)
+{
+	if(not (m_status bitand IMAGE_OK))
+		return CBM::ErrDriveNotReady;
+	if(not m_overlay.isOpen())
+		return CBM::ErrWriteProtectOn;
+	if(fileName.length() > int(sizeof(m_currDirEntry.m_name)) or fileName.contains('*') or fileName.contains('?'))
+		return CBM::ErrInvalidFilename;
+
+	uchar track, sector;
+	int entryOffset;
+	bool exists;
+	findDirSlot(fileName, track, sector, entryOffset, exists);
+	if(exists and not replaceMode)
+		return CBM::ErrFileExists;
+
+	m_writing = true;
+	m_writeReplace = replaceMode;
+	m_writeData.clear();
+	m_lastName = fileName;
+	m_status = IMAGE_OK bitor FILE_OPEN;
+	return CBM::ErrOK;
+} // fopenWrite
+
+
+bool D64::putc(char c)
+{
+	if(not m_writing)
+		return false;
+	m_writeData.append(c);
+	return true;
+} // putc
+
+
+bool D64::findDirSlot(const QString& name, uchar& track, uchar& sector, int& entryOffset, bool& exists)
+{
+	QByteArray padded(name.toLatin1());
+	padded.append(QByteArray(sizeof(m_currDirEntry.m_name) - padded.size(), char(0xA0)));
+
+	bool haveFree = false;
+	exists = false;
+	uchar dirTrack = D64_FIRSTDIR_TRACK, dirSector = D64_FIRSTDIR_SECTOR;
+	QByteArray block;
+	// Bound the walk, a corrupt image may have a circular directory chain.
+	for(int i = 0; i < sectorsPerTrack[D64_FIRSTDIR_TRACK - 1] and 0 not_eq dirTrack; ++i) {
+		if(not readSector(dirTrack, dirSector, block))
+			break;
+		for(int offset = 0; offset < D64_BLOCK_SIZE; offset += D64_DIR_ENTRY_SIZE) {
+			if(0 == block.at(offset + DIR_OFS_FILE_TYPE)) {
+				if(not haveFree) {
+					haveFree = true;
+					track = dirTrack;
+					sector = dirSector;
+					entryOffset = offset;
+				}
+			}
+			else if(block.mid(offset + D64_DIR_OFS_NAME, padded.size()) == padded) {
+				exists = true;
+				track = dirTrack;
+				sector = dirSector;
+				entryOffset = offset;
+				return true;
+			}
+		}
+		dirTrack = block.at(0);
+		dirSector = block.at(1);
+	}
+	return haveFree;
+} // findDirSlot
+
+
+CBM::IOErrorMessage D64::saveFile()
+{
+	QByteArray bam, dirBlock, block;
+	if(not readSector(D64_BAM_TRACK, D64_BAM_SECTOR, bam))
+		return CBM::ErrWriteVerify;
+
+	uchar dirTrack, dirSector;
+	int entryOffset;
+	bool exists;
+	bool haveSlot = findDirSlot(m_lastName, dirTrack, dirSector, entryOffset, exists);
+	if(exists and not m_writeReplace)
+		return CBM::ErrFileExists;
+
+	// All changes are made to the BAM in memory first, nothing is written unless everything fits.
+	uchar lastDirTrack = 0, lastDirSector = 0;
+	QByteArray lastDirBlock;
+	if(exists) {
+		// Release the blocks of the file being replaced, they may be reused right away.
+		readSector(dirTrack, dirSector, dirBlock);
+		uchar t = dirBlock.at(entryOffset + DIR_OFS_TRACK), s = dirBlock.at(entryOffset + DIR_OFS_SECTOR);
+		for(int i = 0; i < D64_IMAGE_SIZE / D64_BLOCK_SIZE and 0 not_eq t and readSector(t, s, block); ++i) {
+			if(t <= D64_BAM_TRACKS)
+				setBlockFree(bam, t, s, true);
+			t = block.at(0);
+			s = block.at(1);
+		}
+	}
+	else if(haveSlot)
+		readSector(dirTrack, dirSector, dirBlock);
+	else {
+		// Directory full, append a block to the directory chain.
+		lastDirTrack = D64_FIRSTDIR_TRACK;
+		lastDirSector = D64_FIRSTDIR_SECTOR;
+		for(int i = 0; readSector(lastDirTrack, lastDirSector, lastDirBlock) and 0 not_eq lastDirBlock.at(0); ++i) {
+			if(i >= sectorsPerTrack[D64_FIRSTDIR_TRACK - 1])
+				return CBM::ErrDiskFullOrDirectoryFull;
+			lastDirTrack = lastDirBlock.at(0);
+			lastDirSector = lastDirBlock.at(1);
+		}
+		dirTrack = D64_FIRSTDIR_TRACK;
+		if(not allocateBlock(bam, dirTrack, lastDirSector, D64_DIR_INTERLEAVE, dirSector)) {
+			Log("D64", error, "Directory full.");
+			return CBM::ErrDiskFullOrDirectoryFull;
+		}
+		lastDirBlock[0] = char(dirTrack);
+		lastDirBlock[1] = char(dirSector);
+		dirBlock = QByteArray(D64_BLOCK_SIZE, 0);
+		dirBlock[1] = char(0xFF);
+		entryOffset = 0;
+	}
+
+	// Allocate blocks for the data, starting next to the directory track and moving outwards like the 1541 does.
+	int numBlocks = qMax(1, (m_writeData.size() + D64_BLOCK_DATA - 1) / D64_BLOCK_DATA);
+	QList<QPair<uchar, uchar> > blocks;
+	int previous = -1;
+	for(int distance = 1; distance < D64_BAM_TRACKS and blocks.size() < numBlocks; ++distance) {
+		foreach(int t, QList<int>() << D64_BAM_TRACK - distance << D64_BAM_TRACK + distance) {
+			uchar s;
+			while(t >= 1 and t <= D64_BAM_TRACKS and blocks.size() < numBlocks and allocateBlock(bam, t, previous, D64_FILE_INTERLEAVE, s)) {
+				blocks.append(qMakePair(uchar(t), s));
+				previous = s;
+			}
+			previous = -1;
+		}
+	}
+	if(blocks.size() < numBlocks) {
+		Log("D64", error, QString("Disk full, %1 needs %2 blocks.").arg(m_lastName).arg(numBlocks));
+		return CBM::ErrDiskFullOrDirectoryFull;
+	}
+
+	for(int i = 0; i < numBlocks; ++i) {
+		block = m_writeData.mid(i * D64_BLOCK_DATA, D64_BLOCK_DATA);
+		int used = block.size();
+		block.append(QByteArray(D64_BLOCK_DATA - used, 0));
+		// Link to the next block, the last one has the index of its last byte in use instead.
+		if(i + 1 < numBlocks)
+			block.prepend(char(blocks[i + 1].second)).prepend(char(blocks[i + 1].first));
+		else
+			block.prepend(char(used + 1)).prepend(char(0));
+		if(not writeSector(blocks[i].first, blocks[i].second, block))
+			return CBM::ErrWriteVerify;
+	}
+
+	QByteArray entry(1, char(FILE_CLOSED bitor PRG));
+	entry.append(char(blocks.first().first)).append(char(blocks.first().second));
+	entry.append(m_lastName.toLatin1()).append(QByteArray(sizeof(m_currDirEntry.m_name) - m_lastName.length(), char(0xA0)));
+	entry.append(QByteArray(DIR_OFS_SIZE_LOW - DIR_OFS_FILE_NAME - int(sizeof(m_currDirEntry.m_name)), 0));
+	entry.append(char(numBlocks bitand 0xFF)).append(char(numBlocks >> 8));
+	dirBlock.replace(entryOffset + DIR_OFS_FILE_TYPE, entry.size(), entry);
+	if(not writeSector(dirTrack, dirSector, dirBlock))
+		return CBM::ErrWriteVerify;
+	// Only link a new directory block into the chain once it's there.
+	if(0 not_eq lastDirTrack and not writeSector(lastDirTrack, lastDirSector, lastDirBlock))
+		return CBM::ErrWriteVerify;
+
+	return writeSector(D64_BAM_TRACK, D64_BAM_SECTOR, bam) ? CBM::ErrOK : CBM::ErrWriteVerify;
+} // saveFile
+
+
 bool D64::seekFirstDir(void)
 {
 		if(m_status bitand IMAGE_OK) {
@@ -266,7 +513,7 @@ bool D64::getDirEntryByName(D64::DirEntry &dir, const QString &name)
 uchar D64::hostReadByte(uint length)
 {
 		char theByte;
-		qint64 numRead(m_hostFile.read(&theByte, length));
+		qint64 numRead(m_hostImage.read(&theByte, length));
 		if(numRead < length) // shouldn't happen?
 				m_status = FILE_EOF;
 
@@ -277,9 +524,9 @@ uchar D64::hostReadByte(uint length)
 bool D64::hostSeek(qint32 pos, bool relative)
 {
 		if(relative)
-				pos += m_hostFile.pos();
+				pos += m_hostImage.pos();
 
-		return m_hostFile.seek(pos);
+		return m_hostImage.seek(pos);
 } // hostSeek
 
 
@@ -377,7 +624,7 @@ ushort D64::openedFileSize() const
 } // // openedFileSize
 
 
-bool D64::sendListing(ISendLine& cb)
+bool D64::sendListing(ISendLine& cb, const DirFilter& filter)
 {
 		if(not (m_status bitand IMAGE_OK)) {
 				// We are not happy with the d64 file
@@ -428,6 +675,10 @@ bool D64::sendListing(ISendLine& cb)
 						if(fileType > NumD64FileTypes)
 								fileType = NumD64FileTypes; // Limit to Unknown type (???) when out of range.
 
+						// Skip entries not selected by the pattern / type of the listing.
+						if(not filter.matchesType(strFileTypes[fileType]) or not filter.matchesName(name.left(i)))
+								continue;
+
 						// Prepare buffer
 						line = QString("   \"%1 %2%3%4").arg(name) // %s  %s%c%c
 										.arg(strFileTypes[fileType])
@@ -454,8 +705,8 @@ bool D64::sendMediaInfo(ISendLine &cb)
 {
 		// TODO: Improve this with information about the file system type AND, usage and free data.
 		Log("D64", info, "sendMediaInfo.");
-		cb.send(0, QString("D64 FS -> %1").arg(m_hostFile.fileName().toUpper()));
-		cb.send(1, QString("FILE SIZE: %1").arg(QString::number(m_hostFile.size())));
+		cb.send(0, QString("D64 FS -> %1").arg(m_hostFileName.toUpper()));
+		cb.send(1, QString("FILE SIZE: %1").arg(QString::number(m_image.size())));
 		seekFirstDir();
 		ushort entryCnt = 0;
 		DirEntry dir;
@@ -483,6 +734,181 @@ CBM::IOErrorMessage D64::newDisk(const QString& name, const QString& id)
 } // newDisk
 
 
+CBM::IOErrorMessage D64::validateDisk()
+{
+	if(not (m_status bitand IMAGE_OK))
+		return CBM::ErrDriveNotReady;
+	if(not m_overlay.isOpen())
+		return CBM::ErrWriteProtectOn;
+
+	QByteArray bam, block;
+	if(not readSector(D64_BAM_TRACK, D64_BAM_SECTOR, bam))
+		return CBM::ErrDriveNotReady;
+
+	// The allocation is rebuilt from scratch in memory, the image isn't touched unless the whole disk checks out.
+	QBitArray used(blockIndex(D64_BAM_TRACKS, sectorsPerTrack[D64_BAM_TRACKS - 1] - 1) + 1);
+	used.setBit(blockIndex(D64_BAM_TRACK, D64_BAM_SECTOR));
+	QList<QPair<uchar, uchar> > dirSectors;
+	QList<QByteArray> dirBlocks;
+	QList<bool> dirModified;
+	int numFiles = 0, numScratched = 0;
+	uchar dirTrack = D64_FIRSTDIR_TRACK, dirSector = D64_FIRSTDIR_SECTOR;
+	while(0 not_eq dirTrack) {
+		int index = blockIndex(dirTrack, dirSector);
+		if(index < 0 or used.testBit(index) or not readSector(dirTrack, dirSector, block)) {
+			Log("D64", error, QString("Validate: Bad directory link to %1/%2.").arg(dirTrack).arg(dirSector));
+			return CBM::ErrDirectoryError;
+		}
+		used.setBit(index);
+		bool modified = false;
+		for(int offset = 0; offset < D64_BLOCK_SIZE; offset += D64_DIR_ENTRY_SIZE) {
+			uchar type = block.at(offset + DIR_OFS_FILE_TYPE);
+			if(0 == type)
+				continue;
+			QString name(QString::fromLatin1(block.mid(offset + DIR_OFS_FILE_NAME, sizeof(m_currDirEntry.m_name))));
+			name = name.left(name.indexOf(QChar(0xA0)));
+			if(not (type bitand FILE_CLOSED)) {
+				// Never closed (a save that didn't complete), scratch it like the 1541 does.
+				Log("D64", warning, QString("Validate: Scratching unclosed file %1.").arg(name));
+				block[offset + DIR_OFS_FILE_TYPE] = 0;
+				modified = true;
+				++numScratched;
+				continue;
+			}
+			CBM::IOErrorMessage result = allocateChain(block.at(offset + DIR_OFS_TRACK), block.at(offset + DIR_OFS_SECTOR), used, name);
+			if(CBM::ErrOK == result and REL == (type bitand FILE_TYPE_MASK))
+				result = allocateChain(block.at(offset + DIR_OFS_SIDE_TRACK), block.at(offset + DIR_OFS_SIDE_SECTOR), used, name);
+			if(CBM::ErrOK not_eq result)
+				return result;
+			++numFiles;
+		}
+		dirSectors.append(qMakePair(dirTrack, dirSector));
+		dirBlocks.append(block);
+		dirModified.append(modified);
+		dirTrack = block.at(0);
+		dirSector = block.at(1);
+	}
+
+	for(int i = 0; i < dirBlocks.size(); ++i) {
+		if(dirModified.at(i) and not writeSector(dirSectors.at(i).first, dirSectors.at(i).second, dirBlocks.at(i)))
+			return CBM::ErrWriteVerify;
+	}
+
+	// Only the track entries of the BAM are replaced, disk name and id stay as they are.
+	ushort numFree = 0;
+	for(uchar track = 1; track <= D64_BAM_TRACKS; ++track) {
+		uchar numTrackFree = 0;
+		for(int ix = 4 * track + 1; ix < 4 * track + 4; ++ix)
+			bam[ix] = 0;
+		for(uchar sector = 0; sector < sectorsPerTrack[track - 1]; ++sector) {
+			if(not used.testBit(blockIndex(track, sector))) {
+				int ix = 4 * track + 1 + sector / 8;
+				bam[ix] = char(uchar(bam.at(ix)) bitor (1 << (sector % 8)));
+				++numTrackFree;
+			}
+		}
+		bam[4 * track] = char(numTrackFree);
+		if(D64_BAM_TRACK not_eq track)
+			numFree += numTrackFree;
+	}
+	if(not writeSector(D64_BAM_TRACK, D64_BAM_SECTOR, bam))
+		return CBM::ErrWriteVerify;
+
+	Log("D64", success, QString("Validated %1 files, %2 scratched, %3 blocks free.").arg(numFiles).arg(numScratched).arg(numFree));
+	return CBM::ErrOK;
+} // validateDisk
+
+
+CBM::IOErrorMessage D64::allocateChain(uchar track, uchar sector, QBitArray& used, const QString& name)
+{
+	QByteArray block;
+	while(0 not_eq track) {
+		int index = blockIndex(track, sector);
+		if(index < 0 or not readSector(track, sector, block)) {
+			Log("D64", error, QString("Validate: %1 links to illegal block %2/%3.").arg(name).arg(track).arg(sector));
+			return CBM::ErrIllegalTrackOrSector;
+		}
+		// Also ends a circular chain, as the block was marked on the way round.
+		if(used.testBit(index)) {
+			Log("D64", error, QString("Validate: %1 is cross linked at %2/%3.").arg(name).arg(track).arg(sector));
+			return CBM::ErrDirectoryError;
+		}
+		used.setBit(index);
+		track = block.at(0);
+		sector = block.at(1);
+	}
+	return CBM::ErrOK;
+} // allocateChain
+
+
+qint32 D64::sectorOffset(uchar track, uchar sector) const
+{
+	if(track < 1 or track > sizeof(sectorsPerTrack) or sector >= sectorsPerTrack[track - 1])
+		return -1;
+
+	qint32 absSector = sector;
+	for(uchar i = 0; i < track - 1; ++i)
+		absSector += sectorsPerTrack[i];
+
+	qint32 offset = absSector * D64_BLOCK_SIZE;
+	return offset + D64_BLOCK_SIZE <= hostSize() ? offset : -1;
+} // sectorOffset
+
+
+bool D64::readSector(uchar track, uchar sector, QByteArray& data)
+{
+	qint32 offset = sectorOffset(track, sector);
+	if(not (m_status bitand IMAGE_OK) or offset < 0)
+		return false;
+
+	data = m_image.mid(offset, D64_BLOCK_SIZE);
+	return true;
+} // readSector
+
+
+bool D64::writeSector(uchar track, uchar sector, const QByteArray& data)
+{
+	qint32 offset = sectorOffset(track, sector);
+	if(not (m_status bitand IMAGE_OK) or offset < 0 or D64_BLOCK_SIZE not_eq data.size())
+		return false;
+
+	// Overlay first, the image in memory must not get ahead of what will be there on the next mount.
+	if(not m_overlay.write(offset, data))
+		return false;
+	m_image.replace(offset, D64_BLOCK_SIZE, data);
+	return true;
+} // writeSector
+
+
+void D64::setOverlayDirectory(const QString& dir)
+{
+	// Takes effect with the next mount.
+	m_overlayDir = dir;
+} // setOverlayDirectory
+
+
+int D64::numOverlaySectors() const
+{
+	return m_overlay.numSectors();
+} // numOverlaySectors
+
+
+bool D64::mergeOverlay()
+{
+	// The image in memory already has the modifications.
+	return m_overlay.merge();
+} // mergeOverlay
+
+
+bool D64::discardOverlay()
+{
+	if(not m_overlay.discard())
+		return false;
+	// Back to what is in the image file.
+	return mountHostImage(QString(m_hostFileName));
+} // discardOverlay
+
+
 QString D64::DirEntry::name() const
 {
 		return QString::fromLocal8Bit((const char*)(m_name));
@@ -1,7 +1,11 @@
 #ifndef D64DRIVER_H
 #define D64DRIVER_H
 
+#include <QBitArray>
+#include <QBuffer>
+
 #include "filedriverbase.hpp"
+#include "sectoroverlay.hpp"
 
 
 class D64 : public FileDriverBase
@@ -63,8 +67,12 @@ public:
 	char getc(void);
 	// Returns true if last character was retrieved:
 	bool isEOF(void) const;
+	// Open a file for writing (SAVE). The content is collected and written to the image when the file is closed.
+	CBM::IOErrorMessage fopenWrite(const QString& fileName, bool replaceMode = false);
+	bool putc(char c);
 	// Close current file
 	bool close(void);
+	CBM::IOErrorMessage closeError() const;
 	// Blocks free information
 	ushort blocksFree(void);
 
@@ -73,7 +81,7 @@ public:
 		return true;
 	}
 	// Send realistic $ file basic listing, line by line
-	bool sendListing(ISendLine& cb);
+	bool sendListing(ISendLine& cb, const DirFilter& filter = DirFilter());
 	// Whether this file system supports media info or not (true == supports it).
 	bool supportsMediaInfo() const
 	{
@@ -100,6 +108,8 @@ public:
 #define DIR_OFS_TRACK           3
 #define DIR_OFS_SECTOR          4
 #define DIR_OFS_FILE_NAME       5
+#define DIR_OFS_SIDE_TRACK      0x15
+#define DIR_OFS_SIDE_SECTOR     0x16
 #define DIR_OFS_SIZE_LOW        0x1e
 #define DIR_OFS_SIZE_HI         0x1f
 	};
@@ -140,6 +150,16 @@ public:
 #endif
 	// special commands.
 	CBM::IOErrorMessage newDisk(const QString& name, const QString& id);
+	CBM::IOErrorMessage validateDisk();
+
+	// Raw sector access. The image file itself is opened read only, writes go to its overlay.
+	bool readSector(uchar track, uchar sector, QByteArray& data);
+	bool writeSector(uchar track, uchar sector, const QByteArray& data);
+
+	void setOverlayDirectory(const QString& dir);
+	int numOverlaySectors() const;
+	bool mergeOverlay();
+	bool discardOverlay();
 
 private:
 
@@ -147,18 +167,33 @@ private:
 	bool hostSeek(qint32 pos, bool relative = false);
 	qint32 hostSize() const
 	{
-		return static_cast<qint32>(m_hostFile.size());
+		return static_cast<qint32>(m_image.size());
 	}
 
 	ushort xxxsectorsPerTrack(uchar track);
 	void seekBlock(uchar track, uchar sector);
+	// Byte offset of the sector in the image, or -1 if track / sector are out of range.
+	qint32 sectorOffset(uchar track, uchar sector) const;
 	bool seekFirstDir(void);
 	bool getDirEntry(DirEntry& dir);
 	bool getDirEntryByName(DirEntry& dir, const QString& name);
 	void seekToDiskName(void);
-
-	// The real host file system D64 file:
-	QFile m_hostFile;
+	// Find the directory entry of the file called name, or else a free one. Returns false if there is neither.
+	bool findDirSlot(const QString& name, uchar& track, uchar& sector, int& entryOffset, bool& exists);
+	// Write the file collected since fopenWrite to the image. Returns CBM::ErrOK if successful.
+	CBM::IOErrorMessage saveFile();
+	// Mark the blocks of the chain starting at track / sector as used. Fails on a link out of range or to a block that
+	// is already in use (cross-linked or circular chain).
+	CBM::IOErrorMessage allocateChain(uchar track, uchar sector, QBitArray& used, const QString& name);
+
+	// Path of the host file system D64 file:
+	QString m_hostFileName;
+	// Its content, with the sectors modified in the overlay on top, and a device for reading it like a file.
+	QByteArray m_image;
+	QBuffer m_hostImage;
+	// Where modifications go. Not open if there is no overlay directory.
+	SectorOverlay m_overlay;
+	QString m_overlayDir;
 
 	// D64 driver state variables:
 	// The current d64 file position described as track/sector/offset
@@ -171,6 +206,13 @@ private:
 	uchar m_currentLinkSector;
 	DirEntry m_currDirEntry;
 	QString m_lastName;
+
+	// State of a file being saved.
+	bool m_writing;
+	bool m_writeReplace;
+	QByteArray m_writeData;
+	// Outcome of saving the file on the last close.
+	CBM::IOErrorMessage m_closeError;
 };
 
 #endif
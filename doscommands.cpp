@@ -21,7 +21,9 @@ RenameFile renameFileCmd;
 CopyFiles copyFilesCmd;
 SetPosition setPositionCmd;
 BlockRead blockReadCmd;
+UserBlockRead userBlockReadCmd;
 BlockWrite blockWriteCmd;
+UserBlockWrite userBlockWriteCmd;
 MemoryRead memoryReadCmd;
 MemoryWrite memoryWriteCmd;
 BufferPointer bufferPointerCmd;
@@ -29,11 +31,36 @@ BlockAllocate blockAllocateCmd;
 BlockFree blockFreeCmd;
 BlockExecute blockExecuteCmd;
 MemoryExecute memoryExecuteCmd;
+UserExecute user3ExecuteCmd(3);
+UserExecute user4ExecuteCmd(4);
+UserExecute user5ExecuteCmd(5);
+UserExecute user6ExecuteCmd(6);
+UserExecute user7ExecuteCmd(7);
+UserExecute user8ExecuteCmd(8);
 VC20ModeOnOff vc20ModeOnOffCmd;
 DeviceAddress deviceAddressCmd;
+SwapList swapListCmd;
 ChangeDirectory chDirCmd;
 MakeDirectory makeDirCmd;
 RemoveDirectory rmDirCmd;
+
+// The numeric parameters of the block commands, which the real DOS accepts separated by space, comma or cursor right.
+// Returns false unless there are count of them, each one byte.
+bool parseBlockParams(const QByteArray& params, int count, QList<uchar>& numbers)
+{
+	const QStringList parts(QString(params).split(QRegExp("[ ,:\\x1d]"), QString::SkipEmptyParts));
+	if(count not_eq parts.count())
+		return false;
+	numbers.clear();
+	foreach(const QString& part, parts) {
+		bool ok;
+		uint number = part.toUInt(&ok);
+		if(not ok or number > 0xFF)
+			return false;
+		numbers.append(number);
+	}
+	return true;
+} // parseBlockParams
 }
 
 
@@ -48,8 +75,11 @@ CBM::IOErrorMessage InitDrive::process(const QByteArray& params, Interface& ifac
 CBM::IOErrorMessage ValidateDisk::process(const QByteArray& params, Interface& iface)
 {
 	Q_UNUSED(params);
-	Q_UNUSED(iface);
-	return CBM::ErrNotImplemented;
+	if(NULL == iface.currentFileDriver())
+		return CBM::ErrDriveNotReady;
+	if(iface.isDiskWriteProtected())
+		return CBM::ErrWriteProtectOn;
+	return iface.currentFileDriver()->validateDisk();
 } // ValidateDisk
 
 
@@ -185,20 +215,49 @@ CBM::IOErrorMessage SetPosition::process(const QByteArray& params, Interface& if
 
 CBM::IOErrorMessage BlockRead::process(const QByteArray& params, Interface& iface)
 {
-	Q_UNUSED(params);
-	Q_UNUSED(iface);
-	return CBM::ErrNotImplemented;
+	// Parameters: channel, drive, track, sector.
+	QList<uchar> numbers;
+	if(not parseBlockParams(params, 4, numbers))
+		return CBM::ErrSyntaxError;
+	Log(FACDOS, info, QString("B-R %1 %2,%3").arg(numbers[0]).arg(numbers[2]).arg(numbers[3]));
+
+	return iface.readBlock(numbers[0], numbers[2], numbers[3], false);
 } // BlockRead
 
 
+CBM::IOErrorMessage UserBlockRead::process(const QByteArray& params, Interface& iface)
+{
+	QList<uchar> numbers;
+	if(not parseBlockParams(params, 4, numbers))
+		return CBM::ErrSyntaxError;
+	Log(FACDOS, info, QString("U1 %1 %2,%3").arg(numbers[0]).arg(numbers[2]).arg(numbers[3]));
+
+	return iface.readBlock(numbers[0], numbers[2], numbers[3], true);
+} // UserBlockRead
+
+
 CBM::IOErrorMessage BlockWrite::process(const QByteArray& params, Interface& iface)
 {
-	Q_UNUSED(params);
-	Q_UNUSED(iface);
-	return CBM::ErrNotImplemented;
+	QList<uchar> numbers;
+	if(not parseBlockParams(params, 4, numbers))
+		return CBM::ErrSyntaxError;
+	Log(FACDOS, info, QString("B-W %1 %2,%3").arg(numbers[0]).arg(numbers[2]).arg(numbers[3]));
+
+	return iface.writeBlock(numbers[0], numbers[2], numbers[3], false);
 } // BlockWrite
 
 
+CBM::IOErrorMessage UserBlockWrite::process(const QByteArray& params, Interface& iface)
+{
+	QList<uchar> numbers;
+	if(not parseBlockParams(params, 4, numbers))
+		return CBM::ErrSyntaxError;
+	Log(FACDOS, info, QString("U2 %1 %2,%3").arg(numbers[0]).arg(numbers[2]).arg(numbers[3]));
+
+	return iface.writeBlock(numbers[0], numbers[2], numbers[3], true);
+} // UserBlockWrite
+
+
 CBM::IOErrorMessage MemoryRead::process(const QByteArray& params, Interface& iface)
 {
 	Q_UNUSED(params);
@@ -232,9 +291,12 @@ CBM::IOErrorMessage MemoryWrite::process(const QByteArray& params, Interface& if
 
 CBM::IOErrorMessage BufferPointer::process(const QByteArray& params, Interface& iface)
 {
-	Q_UNUSED(params);
-	Q_UNUSED(iface);
-	return CBM::ErrNotImplemented;
+	// Parameters: channel, position.
+	QList<uchar> numbers;
+	if(not parseBlockParams(params, 2, numbers))
+		return CBM::ErrSyntaxError;
+
+	return iface.setBufferPointer(numbers[0], numbers[1]);
 } // BufferPointer
 
 
@@ -256,20 +318,37 @@ CBM::IOErrorMessage BlockFree::process(const QByteArray& params, Interface& ifac
 
 CBM::IOErrorMessage BlockExecute::process(const QByteArray& params, Interface& iface)
 {
-	Q_UNUSED(params);
-	Q_UNUSED(iface);
-	return CBM::ErrNotImplemented;
+	// Parameters: channel, drive, track, sector.
+	QList<uchar> numbers;
+	if(not parseBlockParams(params, 4, numbers))
+		return CBM::ErrSyntaxError;
+	Log(FACDOS, info, QString("B-E %1,%2").arg(numbers[2]).arg(numbers[3]));
+
+	return iface.executeDriveBlock(numbers[0], numbers[2], numbers[3]);
 } // BlockExecute
 
 
 CBM::IOErrorMessage MemoryExecute::process(const QByteArray& params, Interface& iface)
 {
-	Q_UNUSED(params);
-	Q_UNUSED(iface);
-	return CBM::ErrNotImplemented;
+	if(params.length() < 2)
+		return CBM::ErrSyntaxError;
+	ushort address = ((ushort)(uchar)params.at(1)) << 8 bitor ((uchar)params.at(0));
+	Log(FACDOS, info, QString("M-E 0x%1").arg(QString::number(address, 16)));
+
+	return iface.executeDriveMemory(address);
 } // MemoryExecute
 
 
+CBM::IOErrorMessage UserExecute::process(const QByteArray& params, Interface& iface)
+{
+	Q_UNUSED(params);
+	ushort address = 0x0500 + 3 * (m_number - 3);
+	Log(FACDOS, info, QString("U%1 0x%2").arg(m_number).arg(QString::number(address, 16)));
+
+	return iface.executeDriveMemory(address);
+} // UserExecute
+
+
 CBM::IOErrorMessage VC20ModeOnOff::process(const QByteArray& params, Interface& iface)
 {
 	Q_UNUSED(params);
@@ -292,6 +371,27 @@ CBM::IOErrorMessage DeviceAddress::process(const QByteArray& params, Interface&
 } // DeviceAddress
 
 
+CBM::IOErrorMessage SwapList::process(const QByteArray& params, Interface& iface)
+{
+	const QString param(params);
+	bool ok = true;
+	if(param.startsWith(':'))
+		ok = iface.mountSwapList(param.mid(1));
+	else if(param.isEmpty() or "+" == param)
+		ok = iface.swapToNextDisk();
+	else if("-" == param)
+		ok = iface.swapToPreviousDisk();
+	else if(param.startsWith('#')) {
+		int disk = param.mid(1).trimmed().toInt(&ok);
+		ok = ok and disk >= 1 and disk <= iface.swapListSize() and iface.swapDisk(disk - 1);
+	}
+	else
+		return CBM::ErrSyntaxError;
+
+	return ok ? CBM::ErrOK : CBM::ErrDriveNotReady;
+} // SwapList
+
+
 // This is totally f'ed up right now. Fix so that it works as sd2iec.
 // http://sd2iec.de/cgi-bin/gitweb.cgi?p=sd2iec.git;a=blob_plain;f=README
 CBM::IOErrorMessage ChangeDirectory::process(const QByteArray &params, Interface &iface)
@@ -171,21 +171,27 @@ DECLARE_DOSCMD_IMPL(CopyFiles, "COPY|C|C0", ':');
 // Syntax: "P"+CHR$(Channel)+CHR$(RecLow)+CHR$(RecHi)+CHR$(Pos)
 DECLARE_DOSCMD_IMPL(SetPosition, "POSITION|P", QChar());
 
-// BLOCK-READ - Read a Disk Block into the internal floppy RAM
-// Abbreviation: U1 (superseded by USER1, U1)
+// BLOCK-READ - Read a Disk Block into the buffer of a direct access channel (opened with "#")
+// Abbreviation: B-R (superseded by USER1, U1)
+// Syntax: "B-R:"+STR$(Channel)+STR$(Drive)+STR$(Track)+STR$(Sector)
+// The parameters are separated by space, comma or cursor right, the colon is optional.
+DECLARE_DOSCMD_IMPL(BlockRead, "BLOCK-READ|B-R", QChar());
+
 // USER1 works like BLOCK-READ with the exception that U1 considers the link to the next block to be part of the data.
 // Thus a block read with U1 will be 256 (rather than max. 254) bytes long.
-// Syntax: "B-R:"+STR$(Channel)+STR$(Drive)+STR$(Track)+STR$(Sector)
-DECLARE_DOSCMD_IMPL(BlockRead, "B-R|U1", ':');
+// Syntax: "U1:"+STR$(Channel)+STR$(Drive)+STR$(Track)+STR$(Sector)
+DECLARE_DOSCMD_IMPL(UserBlockRead, "U1|UA", QChar());
 
 
+// BLOCK-WRITE - Write a Disk Block from the buffer of a direct access channel
+// Abbreviation: B-W (superseded by USER2, U2)
+// Syntax: "B-W:"+STR$(Channel)+STR$(Drive)+STR$(Track)+STR$(Sector)
+DECLARE_DOSCMD_IMPL(BlockWrite, "BLOCK-WRITE|B-W", QChar());
 
-// BLOCK-WRITE - Write a Disk Block from the internal floppy RAM
-// Abbreviation: U1 (superseded by USER1, U1)
 // USER2 works like BLOCK-WRITE with the exception that U2 considers the link to the next block to be part of the data.
 // Thus a block written with U2 has to be 256 (rather than max. 254) bytes long.
-// Syntax: "B-W:"+STR$(Channel)+STR$(Drive)+STR$(Track)+STR$(Sector)
-DECLARE_DOSCMD_IMPL(BlockWrite, "B-W|U2", ':');
+// Syntax: "U2:"+STR$(Channel)+STR$(Drive)+STR$(Track)+STR$(Sector)
+DECLARE_DOSCMD_IMPL(UserBlockWrite, "U2|UB", QChar());
 
 
 // MEMORY-READ - Read Data from the floppy RAM
@@ -203,7 +209,7 @@ DECLARE_DOSCMD_IMPL(MemoryWrite, "M-W", QChar());
 // BUFFER-POINTER - Set the pointer for a buffered block
 // Abbreviation: B-P
 // Syntax: "B-P:"+STR$(Channel)+STR$(Pos)
-DECLARE_DOSCMD_IMPL(BufferPointer, "BUFFER-POINTER|B-P", ':');
+DECLARE_DOSCMD_IMPL(BufferPointer, "BUFFER-POINTER|B-P", QChar());
 
 // BLOCK-ALLOCATE - Mark a disk block as used
 // Abbreviation: B-A
@@ -217,19 +223,36 @@ DECLARE_DOSCMD_IMPL(BlockFree, "BLOCK-FREE|B-F", ':');
 
 // BLOCK-EXECUTE - Read a Disk Block into the internal floppy and execute it. Abbreviation: B-E
 // Syntax: "B-E:"+STR$(Channel)+STR$(Drive)+STR$(Track)+STR$(Sector)
-// Note: Block Execute obviously requires the complete emulation of the MOS 6502 CPU in the 1541.
-// This is the place to check if a turbo loader should be enabled.
+// The block is run on the emulated 1541 (see Drive1541).
 DECLARE_DOSCMD_IMPL(BlockExecute, "BLOCK-EXECUTE|B-E", ':');
 
 
 // MEMORY-EXECUTE - Run a User Program on the Floppy
 // Abbreviation: M-E (You must use the abbreviation, the full form is not legal).
-// Abbreviation: U3..U8
-// For U3..U8: Program execution starts at $0500 + 3*(x-3) (i.e. $0500 for U3, $0503 for U4...)
 // Syntax: "M-E"+CHR$(LowAddress)+CHR$(HighAddress)
-// Note: Memory Execute obviously requires the complete emulation of the MOS 6502 CPU in the 1541.
-// This is the place to check if a turbo loader should be enabled.
-DECLARE_DOSCMD_IMPL(MemoryExecute, "M-E|USER3|U3|USER4|U4|USER5|U5|USER6|U6|USER7|U7", QChar());
+// The code is run on the emulated 1541 (see Drive1541).
+DECLARE_DOSCMD_IMPL(MemoryExecute, "M-E", QChar());
+
+// USER3..USER8 - Jump into the $0500 buffer
+// Abbreviation: U3..U8 (or UC..UH)
+// Program execution starts at $0500 + 3*(x-3) (i.e. $0500 for U3, $0503 for U4...), the jump table of the buffer.
+// One instance per number, since the command itself tells where to jump.
+class UserExecute : public Command
+{
+public:
+	UserExecute(uchar number) : m_number(number)
+	{
+		attach(this);
+	}
+	const QString full()
+	{
+		return QString("USER%1|U%1|U%2").arg(m_number).arg(QChar('A' + m_number - 1));
+	}
+	CBM::IOErrorMessage process(const QByteArray& params, Interface& iface);
+
+private:
+	uchar m_number;
+};
 
 
 // USERI - Switch the C1541 between C64 to VC20 mode
@@ -248,6 +271,13 @@ DECLARE_DOSCMD_IMPL(VC20ModeOnOff, "USERI|UI", QChar());
 DECLARE_DOSCMD_IMPL(DeviceAddress, "U0>", QChar());
 
 
+// XS - Disk swap lists. sd2iec selects the list with XS and swaps disks with its buttons, we have no buttons so XS
+// swaps as well.
+// Syntax: "XS:<list>" mounts the swap list (.lst or .m3u), "XS" or "XS+" swaps to the next disk, "XS-" to the previous
+// one and "XS#"+STR$(Disk) to the given disk (1 based).
+DECLARE_DOSCMD_IMPL(SwapList, "XS", QChar());
+
+
 // CD is also used to mount/unmount image files. Just change into them
 // as if they were a directory and use CD:_ (left arrow on the C64) to leave.
 // Please note that image files are detected by file extension and file size
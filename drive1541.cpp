@@ -0,0 +1,187 @@
+#include "drive1541.hpp"
+#include "logger.hpp"
+
+using namespace Logging;
+
+namespace {
+const QString FAC_1541("1541EMU");
+
+// Job queue: one job code per slot at $00-$05, track and sector for each slot at $06-$11. Only slots 0-4 have a
+// buffer, at $0300-$07FF. The one of slot 5 would be at $0800, past the end of the RAM.
+const ushort JOB_QUEUE = 0x0000;
+const ushort JOB_TRACK_SECTOR = 0x0006;
+const uchar NUM_JOB_SLOTS = 6;
+const ushort FIRST_BUFFER = CBM1541_BUFFER_OFFSET;
+
+// Job codes (only the high nibble counts, the low bits are the drive number).
+const uchar JOB_READ = 0x80;
+const uchar JOB_WRITE = 0x90;
+const uchar JOB_VERIFY = 0xA0;
+const uchar JOB_SEEK = 0xB0;
+const uchar JOB_BUMP = 0xC0;
+const uchar JOB_JUMP = 0xD0;
+const uchar JOB_EXECUTE = 0xE0;
+
+// Job result codes as left in the queue by the controller.
+const uchar JOB_OK = 0x01;
+const uchar JOB_HEADER_NOT_FOUND = 0x02;	// 20, READ ERROR
+const uchar JOB_VERIFY_ERROR = 0x07;			// 25, WRITE ERROR
+const uchar JOB_WRITE_PROTECT = 0x08;			// 26, WRITE PROTECT ON
+const uchar JOB_NO_DISK = 0x0F;						// 74, DRIVE NOT READY
+const uchar JOB_NO_BUFFER = JOB_NO_DISK;		// Slot 5, nothing the drive could work with.
+
+// Buffer code of an execute job ends by jumping here with the result code in A.
+const ushort ROM_JOB_RETURN = 0xF969;
+
+// About two seconds of real drive time. Code still running by then waits for something we don't emulate (IEC bus
+// handshake, disk controller) and is stopped.
+const quint64 MAX_EXECUTE_CYCLES = 2000000;
+const quint64 MAX_JOB_CYCLES = 1000000;
+
+const QString s_stopReasons[] = { "returned", "trap", "cycle limit", "BRK", "illegal opcode" };
+
+} // anonymous
+
+
+Drive1541::Drive1541(QByteArray& ram, const QByteArray& rom, QByteArray& via1, QByteArray& via2)
+	: m_ram(ram)
+	, m_rom(rom)
+	, m_via1(via1)
+	, m_via2(via2)
+	, m_cpu(*this)
+	, m_pImage(NULL)
+	, m_inJob(false)
+{
+	m_cpu.setTrap(ROM_JOB_RETURN);
+} // ctor
+
+
+void Drive1541::reset()
+{
+	m_cpu.reset();
+	m_pImage = NULL;
+	m_inJob = false;
+} // reset
+
+
+CBM::IOErrorMessage Drive1541::execute(ushort address, FileDriverBase* pImage)
+{
+	m_pImage = pImage;
+	const uchar sp = m_cpu.sp;
+	const quint64 startCycles = m_cpu.cycles;
+	CPU6502::StopReason reason = m_cpu.call(address, MAX_EXECUTE_CYCLES);
+	// Leave the stack as it was, whatever the code did to it.
+	m_cpu.sp = sp;
+	m_pImage = NULL;
+
+	const QString msg(QString("Drive code at $%1 stopped at $%2 (%3) after %4 cycles.")
+		.arg(QString::number(address, 16), QString::number(m_cpu.pc, 16), s_stopReasons[reason])
+		.arg(m_cpu.cycles - startCycles));
+	switch(reason) {
+		case CPU6502::STOP_RETURNED:
+		case CPU6502::STOP_TRAP:
+			Log(FAC_1541, info, msg);
+			return CBM::ErrOK;
+		case CPU6502::STOP_CYCLE_LIMIT:
+			Log(FAC_1541, warning, msg);
+			return CBM::ErrOK;
+		default:
+			Log(FAC_1541, error, msg);
+			return CBM::ErrNotImplemented;
+	}
+} // execute
+
+
+uchar Drive1541::read(ushort address)
+{
+	if(address < CBM1541_VIA1_OFFSET)
+		return m_ram.at(address bitand (CBM1541_RAM_SIZE - 1));
+	if(address < CBM1541_VIA2_OFFSET)
+		return m_via1.at(address bitand (CBM1541_VIA1_SIZE - 1));
+	if(address < CBM1541_VIA2_OFFSET + 0x400)
+		return m_via2.at(address bitand (CBM1541_VIA2_SIZE - 1));
+	if(address >= CBM1541_ROM_OFFSET and address - CBM1541_ROM_OFFSET < m_rom.size())
+		return m_rom.at(address - CBM1541_ROM_OFFSET);
+	// Open bus, the high byte of the address is what's usually left on it.
+	return address >> 8;
+} // read
+
+
+void Drive1541::write(ushort address, uchar value)
+{
+	if(address < CBM1541_VIA1_OFFSET) {
+		address and_eq CBM1541_RAM_SIZE - 1;
+		if(address < JOB_QUEUE + NUM_JOB_SLOTS and (value bitand 0x80) and not m_inJob)
+			value = runJob(address - JOB_QUEUE, value);
+		m_ram[address] = value;
+	}
+	else if(address < CBM1541_VIA2_OFFSET)
+		m_via1[address bitand (CBM1541_VIA1_SIZE - 1)] = value;
+	else if(address < CBM1541_VIA2_OFFSET + 0x400)
+		m_via2[address bitand (CBM1541_VIA2_SIZE - 1)] = value;
+	// ROM and unmapped areas ignore writes.
+} // write
+
+
+uchar Drive1541::runJob(uchar buffer, uchar job)
+{
+	if(buffer >= CBM1541_NUM_BUFFERS) {
+		Log(FAC_1541, warning, QString("Job $%1 in slot %2, which has no buffer.").arg(QString::number(job, 16)).arg(buffer));
+		return JOB_NO_BUFFER;
+	}
+	const uchar track = m_ram.at(JOB_TRACK_SECTOR + buffer * 2);
+	const uchar sector = m_ram.at(JOB_TRACK_SECTOR + buffer * 2 + 1);
+	const ushort bufferAddress = FIRST_BUFFER + buffer * 0x100;
+	job and_eq 0xF0;
+
+	if(JOB_JUMP == job or JOB_EXECUTE == job) {
+		// Run the buffer as a subroutine, but with the registers of the code that queued the job left intact.
+		const uchar a = m_cpu.a, x = m_cpu.x, y = m_cpu.y, p = m_cpu.p, sp = m_cpu.sp;
+		const ushort pc = m_cpu.pc;
+		m_inJob = true;
+		CPU6502::StopReason reason = m_cpu.call(bufferAddress, MAX_JOB_CYCLES);
+		m_inJob = false;
+		uchar result = CPU6502::STOP_TRAP == reason ? m_cpu.a : JOB_OK;
+		if(CPU6502::STOP_TRAP not_eq reason and CPU6502::STOP_RETURNED not_eq reason) {
+			Log(FAC_1541, warning, QString("Job in buffer %1 stopped (%2).").arg(buffer).arg(s_stopReasons[reason]));
+			result = JOB_HEADER_NOT_FOUND;
+		}
+		m_cpu.a = a;
+		m_cpu.x = x;
+		m_cpu.y = y;
+		m_cpu.p = p;
+		m_cpu.sp = sp;
+		m_cpu.pc = pc;
+		return result;
+	}
+
+	if(NULL == m_pImage or not (m_pImage->status() bitand FileDriverBase::IMAGE_OK))
+		return JOB_NO_DISK;
+
+	QByteArray data;
+	switch(job) {
+		case JOB_READ:
+			if(not m_pImage->readSector(track, sector, data))
+				return JOB_HEADER_NOT_FOUND;
+			for(int i = 0; i < data.size(); ++i)
+				m_ram[bufferAddress + i] = data.at(i);
+			m_cpu.invalidate(bufferAddress, data.size());
+			return JOB_OK;
+
+		case JOB_WRITE:
+			if(not m_pImage->writeSector(track, sector, m_ram.mid(bufferAddress, 0x100)))
+				return JOB_WRITE_PROTECT;
+			return JOB_OK;
+
+		case JOB_VERIFY:
+			if(not m_pImage->readSector(track, sector, data))
+				return JOB_HEADER_NOT_FOUND;
+			return data == m_ram.mid(bufferAddress, 0x100) ? JOB_OK : JOB_VERIFY_ERROR;
+
+		case JOB_SEEK:
+		case JOB_BUMP:
+		default:
+			// No head to move.
+			return JOB_OK;
+	}
+} // runJob
@@ -0,0 +1,50 @@
+#ifndef DRIVE1541_HPP
+#define DRIVE1541_HPP
+
+#include <QByteArray>
+
+#include "cpu6502.hpp"
+#include "filedriverbase.hpp"
+
+// Runs drive code (M-E, B-E) on an emulated 1541: the 6502 core against the drive memory map held by the Interface.
+// There is no disk controller emulation. Instead, jobs put in the job queue at $00-$05 are carried out right away
+// against the mounted image when the job code is written, so the usual "store job, wait for result" pattern
+// returns immediately and drive code runs much faster than on the real drive.
+class Drive1541 : public CPU6502::IBus
+{
+public:
+	Drive1541(QByteArray& ram, const QByteArray& rom, QByteArray& via1, QByteArray& via2);
+
+	void reset();
+	// Run the code at address as a subroutine, with jobs working on the given file system (may be NULL).
+	CBM::IOErrorMessage execute(ushort address, FileDriverBase* pImage);
+	// Must be called when drive RAM is changed from outside (M-W).
+	void invalidate(ushort address, ushort length)
+	{
+		m_cpu.invalidate(address, length);
+	}
+	const CPU6502& cpu() const
+	{
+		return m_cpu;
+	}
+
+	// CPU6502::IBus implementation.
+	uchar read(ushort address);
+	void write(ushort address, uchar value);
+
+private:
+	// Carry out the job for queue slot 0..5 and return the job result code as the controller would. Slot 5 has no
+	// buffer, its jobs fail right away.
+	uchar runJob(uchar buffer, uchar job);
+
+	QByteArray& m_ram;
+	const QByteArray& m_rom;
+	QByteArray& m_via1;
+	QByteArray& m_via2;
+	CPU6502 m_cpu;
+	FileDriverBase* m_pImage;
+	// Set while running buffer code for an execute job, jobs queued from there are not run recursively.
+	bool m_inJob;
+};
+
+#endif // DRIVE1541_HPP
@@ -0,0 +1,85 @@
+#include "drivecodetracker.hpp"
+
+
+DriveCodeTracker::DriveCodeTracker()
+{
+} // ctor
+
+
+void DriveCodeTracker::reset()
+{
+	m_uploads.clear();
+} // reset
+
+
+void DriveCodeTracker::recordUpload(ushort address, ushort length)
+{
+	if(0 == length)
+		return;
+	uint start = address;
+	uint end = address + length;
+
+	// Merge with all ranges that overlap or touch the new one, loaders are usually uploaded in 32 byte chunks.
+	QList<QPair<ushort, ushort> >::iterator it = m_uploads.begin();
+	while(it not_eq m_uploads.end()) {
+		if(it->second < start or it->first > end)
+			++it;
+		else {
+			start = qMin(start, (uint)it->first);
+			end = qMax(end, (uint)it->second);
+			it = m_uploads.erase(it);
+		}
+	}
+	// keep list sorted by start address.
+	it = m_uploads.begin();
+	while(it not_eq m_uploads.end() and it->first < start)
+		++it;
+	m_uploads.insert(it, qMakePair((ushort)start, (ushort)qMin(end, 0xFFFFu)));
+} // recordUpload
+
+
+bool DriveCodeTracker::uploadedBlock(ushort execAddress, const QByteArray& driveRAM,
+	ushort& blockStart, ushort& blockLength, quint32& crc) const
+{
+	blockStart = blockLength = 0;
+	crc = 0;
+	QPair<ushort, ushort> range;
+	bool found = false;
+	foreach(range, m_uploads) {
+		if(execAddress >= range.first and execAddress < range.second) {
+			found = true;
+			break;
+		}
+	}
+	if(not found or range.first >= driveRAM.size())
+		return false;
+
+	blockStart = range.first;
+	blockLength = qMin((int)range.second, driveRAM.size()) - range.first;
+	crc = crc32(driveRAM.constData() + blockStart, blockLength);
+	return true;
+} // uploadedBlock
+
+
+// Plain CRC-32 (IEEE 802.3, reflected), same as zip and the crc32 command line tool. That way the logged
+// checksum can be compared with a dump of the uploaded drive code.
+quint32 DriveCodeTracker::crc32(const char* data, int length)
+{
+	static quint32 table[256];
+	static bool tableBuilt = false;
+	if(not tableBuilt) {
+		for(quint32 i = 0; i < 256; ++i) {
+			quint32 c = i;
+			for(int k = 0; k < 8; ++k)
+				c = (c bitand 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		tableBuilt = true;
+	}
+
+	quint32 crc = 0xFFFFFFFF;
+	for(int i = 0; i < length; ++i)
+		crc = table[(crc ^ (uchar)data[i]) bitand 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+} // crc32
+
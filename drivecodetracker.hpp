@@ -0,0 +1,32 @@
+#ifndef DRIVECODETRACKER_HPP
+#define DRIVECODETRACKER_HPP
+
+#include <QList>
+#include <QByteArray>
+#include <QPair>
+
+// Keeps track of the drive code the CBM uploads with M-W. When it is started with M-E (or U3..U8) the contiguous
+// uploaded block around the execution address is fingerprinted with a CRC-32 for the log. Nothing is recognised by
+// it, the code itself is run on the emulated drive (see Drive1541).
+class DriveCodeTracker
+{
+public:
+	DriveCodeTracker();
+
+	// Forget all uploaded ranges, called on drive reset.
+	void reset();
+	// Record that the given drive RAM range was written with M-W.
+	void recordUpload(ushort address, ushort length);
+	// Find the uploaded block containing the execution address and compute its crc. Returns false if the address
+	// isn't in uploaded code (a ROM routine or a buffer we know nothing about).
+	bool uploadedBlock(ushort execAddress, const QByteArray& driveRAM, ushort& blockStart, ushort& blockLength,
+		quint32& crc) const;
+
+	static quint32 crc32(const char* data, int length);
+
+private:
+	// Uploaded ranges as [start, end) pairs, kept sorted and merged.
+	QList<QPair<ushort, ushort> > m_uploads;
+};
+
+#endif // DRIVECODETRACKER_HPP
@@ -1,5 +1,68 @@
 #include "filedriverbase.hpp"
 
+DirFilter::DirFilter()
+{
+} // ctor
+
+
+DirFilter::DirFilter(const QString& dirName)
+{
+	int colon = dirName.indexOf(':');
+	if(colon < 0)
+		return;
+	foreach(QString pattern, dirName.mid(colon + 1).split(',')) {
+		int equals = pattern.indexOf('=');
+		if(equals >= 0) {
+			if(equals + 1 < pattern.length())
+				m_type = pattern.at(equals + 1).toUpper();
+			pattern.truncate(equals);
+		}
+		if(not pattern.isEmpty())
+			m_patterns.append(pattern);
+	}
+} // ctor
+
+
+bool DirFilter::isEmpty() const
+{
+	return m_patterns.isEmpty() and m_type.isNull();
+} // isEmpty
+
+
+bool DirFilter::matchesName(const QString& name) const
+{
+	if(m_patterns.isEmpty())
+		return true;
+	foreach(const QString& pattern, m_patterns) {
+		int i;
+		for(i = 0; i < pattern.length(); ++i) {
+			if('*' == pattern.at(i) or i >= name.length() or ('?' not_eq pattern.at(i) and pattern.at(i) not_eq name.at(i)))
+				break;
+		}
+		if((i < pattern.length() and '*' == pattern.at(i)) or (i == pattern.length() and i == name.length()))
+			return true;
+	}
+	return false;
+} // matchesName
+
+
+bool DirFilter::matchesType(const QString& type) const
+{
+	return m_type.isNull() or (not type.isEmpty() and type.at(0).toUpper() == m_type);
+} // matchesType
+
+
+QStringList DirFilter::nameFilters() const
+{
+	QStringList filters;
+	foreach(const QString& pattern, m_patterns) {
+		int star = pattern.indexOf('*');
+		filters.append(star < 0 ? pattern : pattern.left(star + 1));
+	}
+	return filters;
+} // nameFilters
+
+
 FileDriverBase::FileDriverBase()
 	: m_status(NOT_READY)
 {
@@ -27,7 +90,7 @@ bool FileDriverBase::supportsListing() const
 } // supportsListing
 
 
-bool FileDriverBase::sendListing(ISendLine& /*cb*/)
+bool FileDriverBase::sendListing(ISendLine& /*cb*/, const DirFilter& /*filter*/)
 {
 	return false;
 } // sendListing
@@ -98,6 +161,12 @@ bool FileDriverBase::putc(char c)
 } // putc
 
 
+CBM::IOErrorMessage FileDriverBase::closeError() const
+{
+	return CBM::ErrOK;
+} // closeError
+
+
 FileDriverBase::FSStatus FileDriverBase::status(void) const
 {
 	return static_cast<FSStatus>(m_status);
@@ -120,8 +189,56 @@ CBM::IOErrorMessage FileDriverBase::newDisk(const QString& name, const QString&
 } // newDisk
 
 
+CBM::IOErrorMessage FileDriverBase::validateDisk()
+{
+	return CBM::ErrNotImplemented;
+} // validateDisk
+
+
 bool FileDriverBase::deleteFile(const QString& fileName)
 {
 	Q_UNUSED(fileName);
 	return false;
 } // deleteFile
+
+
+bool FileDriverBase::readSector(uchar track, uchar sector, QByteArray& data)
+{
+	Q_UNUSED(track);
+	Q_UNUSED(sector);
+	Q_UNUSED(data);
+	return false;
+} // readSector
+
+
+bool FileDriverBase::writeSector(uchar track, uchar sector, const QByteArray& data)
+{
+	Q_UNUSED(track);
+	Q_UNUSED(sector);
+	Q_UNUSED(data);
+	return false;
+} // writeSector
+
+
+void FileDriverBase::setOverlayDirectory(const QString& dir)
+{
+	Q_UNUSED(dir);
+} // setOverlayDirectory
+
+
+int FileDriverBase::numOverlaySectors() const
+{
+	return 0;
+} // numOverlaySectors
+
+
+bool FileDriverBase::mergeOverlay()
+{
+	return false;
+} // mergeOverlay
+
+
+bool FileDriverBase::discardOverlay()
+{
+	return false;
+} // discardOverlay
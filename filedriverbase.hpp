@@ -16,6 +16,26 @@ public:
 	virtual void send(short lineNo, const QString& text) = 0;
 };
 
+// Selection of a directory listing, as in LOAD"$:A*,B??=P",8. Names are matched like the CBM DOS does: ? matches any
+// character and * the rest of the name. The type letter is compared to the first letter of the listed type (P for PRG).
+class DirFilter
+{
+public:
+	DirFilter();
+	// Parse the name the listing was opened with: $, $0 or $:PATTERN[,PATTERN...][=TYPE].
+	explicit DirFilter(const QString& dirName);
+
+	bool isEmpty() const;
+	bool matchesName(const QString& name) const;
+	bool matchesType(const QString& type) const;
+	// The patterns as QDir name filters, with anything after a * dropped. Empty if there are no patterns.
+	QStringList nameFilters() const;
+
+private:
+	QStringList m_patterns;
+	QChar m_type;
+};
+
 /// Base class for all virtual file systems supported.
 class FileDriverBase
 {
@@ -49,7 +69,8 @@ public:
 	// returns true if the file system supports directory listing (t64 for instance doesn't).
 	virtual bool supportsListing() const;
 	// Send realistic $ file basic listing, line by line (returning false means there was some error, but that there is a listing anyway).
-	virtual bool sendListing(ISendLine& cb);
+	// Only the entries passing filter are listed, the header and footer lines are always sent.
+	virtual bool sendListing(ISendLine& cb, const DirFilter& filter = DirFilter());
 	// Whether this file system supports media info or not (true == supports it).
 	virtual bool supportsMediaInfo() const;
 	// Send information about file system (whether it is OK, sizes etc.).
@@ -83,6 +104,8 @@ public:
 	// closes the open file. Should always be supported in order to make implementation make any sense.
 	// If returning false here it indicates the filesystem is ready and should move back to native file system.
 	virtual bool close() = 0;
+	// Error of the last close() that couldn't write what was saved, CBM::ErrOK if there was none. Base returns ErrOK.
+	virtual CBM::IOErrorMessage closeError() const;
 
 	// Current status of operation.
 	virtual FSStatus status() const;
@@ -94,6 +117,22 @@ public:
 	// Initialize (format) a disk with the given name and id (id can be empty). The extension can be used to further
 	// determine the actual image type.
 	virtual CBM::IOErrorMessage newDisk(const QString& name, const QString& id);
+	// Validate (collect) the disk: Rebuild the block allocation from the files in the directory and scratch files
+	// that were never closed. Base returns not implemented.
+	virtual CBM::IOErrorMessage validateDisk();
+
+	// Raw sector access for file systems with a track / sector layout (disk images). Tracks are 1 based, data is
+	// always 256 bytes. Base returns false, meaning no such thing as sectors.
+	virtual bool readSector(uchar track, uchar sector, QByteArray& data);
+	virtual bool writeSector(uchar track, uchar sector, const QByteArray& data);
+
+	// Sector images are never written to directly, modifications go to a copy-on-write overlay kept in the given
+	// directory (see SectorOverlay), an empty directory means mounted images are read only. The overlay of the mounted
+	// image can be merged into the image file or discarded. Base has no overlay support and returns false / 0.
+	virtual void setOverlayDirectory(const QString& dir);
+	virtual int numOverlaySectors() const;
+	virtual bool mergeOverlay();
+	virtual bool discardOverlay();
 
 protected:
 	// Status of the driver:
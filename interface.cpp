@@ -1,6 +1,10 @@
 #include <QStringList>
 #include <QDir>
 #include <QDebug>
+#include <QStandardPaths>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QElapsedTimer>
 
 #include "interface.hpp"
 #include "d64driver.hpp"
@@ -64,11 +68,17 @@ const QString s_errorEnding = ",00,00";
 
 
 Interface::Interface()
-	: m_currFileDriver(0)
+	: m_swapIndex(0)
+	, m_currFileDriver(0)
 	, m_queuedError(CBM::ErrOK)
 	,	m_openState(O_NOTHING)
 	, m_currReadLength(MAX_BYTES_PER_REQUEST)
+	, m_numDirLines(0)
+	, m_nextDirLine(0)
 	, m_pListener(0)
+	, m_pTracer(0)
+	, m_pMetrics(0)
+	, m_drive(m_driveRAM, m_driveROM, m_via1MEM, m_via2MEM)
 {
 	// Build the list of implemented / supported file systems.
 	m_fsList.append(&m_native);
@@ -86,12 +96,15 @@ Interface::Interface()
 		m_driveROM = romFile.readAll();
 		romFile.close();
 	}
+	setOverlayDirectory(QDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation)).filePath("overlays"));
 	reset();
 } // ctor
 
 
 Interface::~Interface()
-{} // dtor
+{
+	clearSwapList();
+} // dtor
 
 
 void Interface::setImageFilters(const QString& filters, bool showDirs)
@@ -100,17 +113,131 @@ void Interface::setImageFilters(const QString& filters, bool showDirs)
 } // setImageFilters
 
 
+void Interface::setOverlayDirectory(const QString& dir)
+{
+	m_overlayDir = dir;
+	foreach(FileDriverBase* fs, m_fsList)
+		fs->setOverlayDirectory(dir);
+	foreach(FileDriverBase* disk, m_swapDisks)
+		disk->setOverlayDirectory(dir);
+} // setOverlayDirectory
+
+
+int Interface::numImageOverlaySectors() const
+{
+	return 0 == m_currFileDriver ? 0 : m_currFileDriver->numOverlaySectors();
+} // numImageOverlaySectors
+
+
+bool Interface::mergeImageOverlay()
+{
+	bool success = 0 not_eq m_currFileDriver and m_currFileDriver->mergeOverlay();
+	Log(FAC_IFACE, success ? info : error, success ? "Merged changes into the mounted image." : "Merging changes into the mounted image failed.");
+	return success;
+} // mergeImageOverlay
+
+
+bool Interface::discardImageOverlay()
+{
+	bool success = 0 not_eq m_currFileDriver and m_currFileDriver->discardOverlay();
+	Log(FAC_IFACE, success ? info : error, success ? "Discarded changes to the mounted image." : "Discarding changes to the mounted image failed.");
+	return success;
+} // discardImageOverlay
+
+
+bool Interface::isSwapList(const QString& fileName)
+{
+	return fileName.endsWith(".lst", Qt::CaseInsensitive) or fileName.endsWith(".m3u", Qt::CaseInsensitive);
+} // isSwapList
+
+
+bool Interface::mountSwapList(const QString& listPath)
+{
+	QFile listFile(listPath);
+	if(not listFile.open(QIODevice::ReadOnly bitor QIODevice::Text)) {
+		Log(FAC_IFACE, error, QString("Can't open swap list: %1").arg(listPath));
+		return false;
+	}
+	clearSwapList();
+	const QDir listDir(QFileInfo(listPath).absolutePath());
+	QTextStream stream(&listFile);
+	while(not stream.atEnd()) {
+		const QString line(stream.readLine().trimmed());
+		// Skip empty lines and m3u comments / directives.
+		if(line.isEmpty() or line.startsWith('#'))
+			continue;
+		const QString imagePath(listDir.filePath(line));
+		D64* disk = new D64;
+		disk->setOverlayDirectory(m_overlayDir);
+		if(not m_d64.supportsType(imagePath) or not disk->mountHostImage(imagePath)) {
+			Log(FAC_IFACE, warning, QString("Swap list entry is not a usable D64 image, skipped: %1").arg(line));
+			delete disk;
+			continue;
+		}
+		m_swapDisks.append(disk);
+		m_swapPaths.append(imagePath);
+	}
+	if(m_swapDisks.isEmpty()) {
+		Log(FAC_IFACE, error, QString("No images in swap list: %1").arg(listPath));
+		return false;
+	}
+	Log(FAC_IFACE, success, QString("Swap list %1 loaded with %2 disks.").arg(listPath).arg(m_swapDisks.size()));
+	return swapDisk(0);
+} // mountSwapList
+
+
+void Interface::clearSwapList()
+{
+	if(m_swapDisks.contains(m_currFileDriver))
+		m_currFileDriver = &m_native;
+	qDeleteAll(m_swapDisks);
+	m_swapDisks.clear();
+	m_swapPaths.clear();
+	m_swapIndex = 0;
+} // clearSwapList
+
+
+bool Interface::swapDisk(int index)
+{
+	if(m_swapDisks.isEmpty())
+		return false;
+	m_swapIndex = (index % m_swapDisks.size() + m_swapDisks.size()) % m_swapDisks.size();
+	FileDriverBase* disk = m_swapDisks.at(m_swapIndex);
+	const QString& imagePath(m_swapPaths.at(m_swapIndex));
+	// A local image selection unmounts the current driver, bring the disk back if that happened.
+	if(not (disk->status() bitand FileDriverBase::IMAGE_OK) and not disk->mountHostImage(imagePath))
+		return false;
+	if(m_currFileDriver not_eq &m_native and not m_swapDisks.contains(m_currFileDriver))
+		m_currFileDriver->unmountHostImage();
+	m_currFileDriver = disk;
+	m_openState = O_DIR;
+	if(0 not_eq m_pListener)
+		m_pListener->imageMounted(imagePath, disk);
+	Log(FAC_IFACE, success, QString("Swapped to disk %1 of %2: %3").arg(m_swapIndex + 1).arg(m_swapDisks.size()).arg(imagePath));
+	return true;
+} // swapDisk
+
+
 CBM::IOErrorMessage Interface::reset(bool informUnmount)
 {
 	// restore RAM and via areas.
 	m_driveRAM.fill(0, CBM1541_RAM_SIZE);
 	m_via1MEM.fill(0, CBM1541_VIA1_SIZE);
 	m_via2MEM.fill(0, CBM1541_VIA2_SIZE);
+	m_driveCodeTracker.reset();
+	for(int channel = 0; channel < CBM::CMD_CHANNEL; ++channel)
+		m_channelBuffer[channel] = -1;
+	m_bufferChannel = 0;
+	m_drive.reset();
 	if(informUnmount and 0 not_eq m_pListener)
 		m_pListener->imageUnmounted();
-	m_currFileDriver = &m_native;
+	// A drive initialize keeps the swap list and the disk of it that is in the drive, only an explicit reset from the
+	// user drops it.
+	if(informUnmount)
+		clearSwapList();
+	m_currFileDriver = m_swapDisks.isEmpty() ? static_cast<FileDriverBase*>(&m_native) : m_swapDisks.at(m_swapIndex);
 	m_openState = m_currFileDriver->supportsMediaInfo() ? O_INFO : O_NOTHING;
-	m_dirListing.empty();
+	m_numDirLines = m_nextDirLine = 0;
 	m_lastCmdString.clear();
 	foreach(FileDriverBase* fs, m_fsList)
 		fs->unmountHostImage(); // TODO: Better with a reset or init method on all file systems.
@@ -208,6 +335,8 @@ void Interface::writeDriveMemory(ushort address, const QByteArray& bytes)
 	if(/*address >= CBM1541_RAM_OFFSET and */address < CBM1541_RAM_OFFSET + m_driveRAM.size()) {
 		replaceBytes(m_driveRAM, address, bytes.size(), source);
 		m_driveRAM.resize(CBM1541_RAM_SIZE);
+		m_driveCodeTracker.recordUpload(address, qMin(bytes.size(), CBM1541_RAM_SIZE - address));
+		m_drive.invalidate(address, bytes.size());
 	}
 	else if((address >= CBM1541_VIA1_OFFSET and address <= CBM1541_VIA1_OFFSET + m_via1MEM.size())
 					or (address < CBM1541_VIA1_OFFSET and address + bytes.length() > CBM1541_VIA1_OFFSET)) {
@@ -237,6 +366,130 @@ void Interface::writeDriveMemory(ushort address, const QByteArray& bytes)
 } // writeDriveMemory
 
 
+CBM::IOErrorMessage Interface::executeDriveMemory(ushort address)
+{
+	ushort blockStart, blockLength;
+	quint32 crc;
+	// Fingerprint the uploaded code in the log, e.g. to tell fastloaders apart.
+	if(m_driveCodeTracker.uploadedBlock(address, m_driveRAM, blockStart, blockLength, crc))
+		Log(FAC_IFACE, info, QString("Drive code executed at $%1, block $%2;%3;%4")
+			.arg(QString::number(address, 16), QString::number(blockStart, 16),
+				QString::number(blockLength, 16), QString::number(crc, 16)));
+	CBM::IOErrorMessage result = m_drive.execute(address, m_currFileDriver);
+	if(0 not_eq m_pMetrics) {
+		m_pMetrics->set(Metrics::DECODE_CACHE_HITS, m_drive.cpu().decodeHits);
+		m_pMetrics->set(Metrics::DECODE_CACHE_MISSES, m_drive.cpu().decodeMisses);
+	}
+	return result;
+} // executeDriveMemory
+
+
+CBM::IOErrorMessage Interface::executeDriveBlock(uchar channel, uchar track, uchar sector)
+{
+	QByteArray block;
+	if(0 == m_currFileDriver or not m_currFileDriver->readSector(track, sector, block))
+		return CBM::ErrIllegalTrackOrSector;
+	// Without a buffer for the channel, $0500 is the usual choice.
+	ushort address = bufferAddress(channel);
+	if(0 == address)
+		address = 0x0500;
+	writeDriveMemory(address, block);
+	return executeDriveMemory(address);
+} // executeDriveBlock
+
+
+CBM::IOErrorMessage Interface::openBufferChannel(uchar channel, const QByteArray& name)
+{
+	// Opening the channel again gives up its buffer.
+	m_channelBuffer[channel] = -1;
+	m_bufferChannel = 0;
+	bool used[CBM1541_NUM_BUFFERS] = { false };
+	for(int other = 0; other < CBM::CMD_CHANNEL; ++other)
+		if(m_channelBuffer[other] >= 0)
+			used[m_channelBuffer[other]] = true;
+
+	int buffer = -1;
+	if(name.trimmed().isEmpty()) {
+		// Like the 1541, hand out buffers from the top down, but keep the one at $0700 the DOS has the BAM in.
+		for(int candidate = CBM1541_NUM_BUFFERS - 2; candidate >= 0 and buffer < 0; --candidate)
+			if(not used[candidate])
+				buffer = candidate;
+	}
+	else {
+		bool ok;
+		buffer = QString(name).trimmed().toInt(&ok);
+		if(not ok or buffer < 0 or buffer >= CBM1541_NUM_BUFFERS)
+			return CBM::ErrSyntaxError;
+		if(used[buffer])
+			buffer = -1;
+	}
+	if(buffer < 0)
+		return CBM::ErrNoChannelAvailable;
+
+	m_channelBuffer[channel] = buffer;
+	m_bufferChannel = channel;
+	m_bufferPointer[buffer] = 0;
+	m_bufferEnd[buffer] = CBM1541_BUFFER_SIZE;
+	Log(FAC_IFACE, info, QString("Channel %1 got buffer %2 at $%3.").arg(channel).arg(buffer)
+		.arg(QString::number(bufferAddress(channel), 16)));
+	return CBM::ErrOK;
+} // openBufferChannel
+
+
+ushort Interface::bufferAddress(uchar channel) const
+{
+	if(channel >= CBM::CMD_CHANNEL or m_channelBuffer[channel] < 0)
+		return 0;
+	return CBM1541_BUFFER_OFFSET + m_channelBuffer[channel] * CBM1541_BUFFER_SIZE;
+} // bufferAddress
+
+
+CBM::IOErrorMessage Interface::readBlock(uchar channel, uchar track, uchar sector, bool wholeBlock)
+{
+	const ushort address = bufferAddress(channel);
+	if(0 == address)
+		return CBM::ErrNoChannelAvailable;
+	QByteArray block;
+	if(0 == m_currFileDriver or not m_currFileDriver->readSector(track, sector, block))
+		return CBM::ErrIllegalTrackOrSector;
+	writeDriveMemory(address, block);
+
+	// B-R: The first byte is the number of data bytes following it (zero for all of them).
+	const int buffer = m_channelBuffer[channel];
+	const uchar numBytes = block.at(0);
+	m_bufferPointer[buffer] = wholeBlock ? 0 : 1;
+	m_bufferEnd[buffer] = wholeBlock or 0 == numBytes ? CBM1541_BUFFER_SIZE : numBytes + 1;
+	return CBM::ErrOK;
+} // readBlock
+
+
+CBM::IOErrorMessage Interface::writeBlock(uchar channel, uchar track, uchar sector, bool wholeBlock)
+{
+	const ushort address = bufferAddress(channel);
+	if(0 == address)
+		return CBM::ErrNoChannelAvailable;
+	if(isDiskWriteProtected())
+		return CBM::ErrWriteProtectOn;
+
+	// B-W: The first byte is set to the number of data bytes, the ones before the buffer pointer. Like the ROM ($CD73)
+	// it's at least 1, a pointer still at the start of the buffer doesn't give 0 or 255.
+	if(not wholeBlock)
+		writeDriveMemory(address, QByteArray(1, char(qMax(1, m_bufferPointer[m_channelBuffer[channel]] - 1))));
+	if(0 == m_currFileDriver or not m_currFileDriver->writeSector(track, sector, m_driveRAM.mid(address, CBM1541_BUFFER_SIZE)))
+		return CBM::ErrIllegalTrackOrSector;
+	return CBM::ErrOK;
+} // writeBlock
+
+
+CBM::IOErrorMessage Interface::setBufferPointer(uchar channel, uchar position)
+{
+	if(0 == bufferAddress(channel))
+		return CBM::ErrNoChannelAvailable;
+	m_bufferPointer[m_channelBuffer[channel]] = position;
+	return CBM::ErrOK;
+} // setBufferPointer
+
+
 // Parse LOAD command, open either special/file/directory/d64/t64/...
 // The specials are:
 // single arrow / double slash: up one folder/image, rest of string may reference file or folder relative that.
@@ -250,6 +503,7 @@ CBM::IOErrorMessage Interface::openFile(const QString& cmdString)
 
 	// assume fall back result
 	m_openState = O_NOTHING;
+	m_dirFilter = DirFilter();
 
 	cmd.replace("/:", "/");
 	// remove leading ':' as they have no meaning (but do so in sd2iec for separation).
@@ -281,8 +535,10 @@ CBM::IOErrorMessage Interface::openFile(const QString& cmdString)
 		// whatever file system we have active, check if it supports media info.
 		m_openState = m_currFileDriver->supportsMediaInfo() ? O_INFO : O_NOTHING;
 	}
-	else if(not cmd.isEmpty() and cmd.at(0) == QChar(CBM_DOLLAR_SIGN)) // Send directory listing of the current directory, of whatever file system is the actual one.
+	else if(not cmd.isEmpty() and cmd.at(0) == QChar(CBM_DOLLAR_SIGN)) { // Send directory listing of the current directory, of whatever file system is the actual one.
 		m_openState = O_DIR;
+		m_dirFilter = DirFilter(cmd);
+	}
 	else {
 		// open file depending on interface state
 		if(m_currFileDriver == &m_native) {
@@ -295,6 +551,12 @@ CBM::IOErrorMessage Interface::openFile(const QString& cmdString)
 //				if(0 not_eq m_pListener)
 //					m_pListener->imageMounted(cmd, m_currFileDriver);
 			}
+			else if(not cmd.isEmpty() and isSwapList(cmd) and QFile::exists(cmd)) {
+				if(not mountSwapList(cmd)) {
+					m_openState = O_FILE_ERR;
+					retCode = CBM::ErrDriveNotReady;
+				}
+			}
 			else if(not cmd.isEmpty() and m_native.mountHostImage(cmd)) {
 				// File opened, investigate filetype
 				// if extension matches ending characters in any file systems extension list, then we set that filesystem into use.
@@ -356,17 +618,18 @@ CBM::IOErrorMessage Interface::openFile(const QString& cmdString)
 } // openFile
 
 
-void Interface::sendOpenResponse(char code) const
+void Interface::sendOpenResponse(char code)
 {
 	// Response: ><code><CR>
 	// send back response / result code to uno.
-	write(QByteArray().append('>').append(code).append('\r'));
+	write(FrameBuilder(m_frame).append('>').append(code).append('\r').frame());
 } // sendOpenResponse
 
 
 void Interface::processOpenCommand(uchar channel, const QByteArray& cmd, bool localImageSelectionMode)
 {
 	// Request: <channel>|<command string>
+	TraceSpan span(m_pTracer, "open");
 	Log(FAC_IFACE, info, QString("processOpenCommand, cmd: %1").arg(QString(cmd)));
 
 	// Are we addressing the command channel?
@@ -374,6 +637,9 @@ void Interface::processOpenCommand(uchar channel, const QByteArray& cmd, bool lo
 		case CBM::CMD_CHANNEL:
 			// command channel command, or request for status if empty.
 			if(cmd.isEmpty() or (cmd.length() == 1 and cmd.at(0) == '\r')) {
+				// A copy in the background that has failed meanwhile reports its error here.
+				if(CBM::ErrOK == m_queuedError)
+					m_queuedError = m_native.takeCopyError();
 				// Response: ><code><CR>
 				// The code return is according to the values of the IOErrorMessage enum.
 				// send back m_queuedError to uno.
@@ -383,8 +649,12 @@ void Interface::processOpenCommand(uchar channel, const QByteArray& cmd, bool lo
 				m_queuedError = CBM::ErrOK;
 			}
 			else {
-				// it's a DOS command, so execute it.
+				// it's a DOS command, so execute it. It reports a copy in the background that failed before, unless it fails
+				// itself.
+				CBM::IOErrorMessage copyError = m_native.takeCopyError();
 				m_queuedError = CBMDos::Command::execute(cmd, *this);
+				if(CBM::ErrOK == m_queuedError)
+					m_queuedError = copyError;
 				Log(FAC_IFACE, m_queuedError == CBM::ErrOK ? success : error, QString("CmdChannel_Response code: %1 = '%2'")
 						.arg(QString::number(m_queuedError)).arg(errorStringFromCode(m_queuedError)));
 			}
@@ -395,6 +665,7 @@ void Interface::processOpenCommand(uchar channel, const QByteArray& cmd, bool lo
 		case CBM::READPRG_CHANNEL:
 			// ...it was a open file for reading (load) command.
 			m_openState = O_NOTHING;
+			m_bufferChannel = 0;
 			if(localImageSelectionMode) {// for this we have to fall back to nativeFS driver first.
 				m_currFileDriver->unmountHostImage();
 				m_currFileDriver = &m_native;
@@ -422,6 +693,7 @@ void Interface::processOpenCommand(uchar channel, const QByteArray& cmd, bool lo
 		case CBM::WRITEPRG_CHANNEL:
 			// it was an open file for writing (save) command.
 			m_openState = O_NOTHING;
+			m_bufferChannel = 0;
 			if(0 not_eq m_currFileDriver) {
 				bool overWrite = cmd.startsWith('@');
 				const QString fileName(overWrite ? cmd.mid(1) : cmd);
@@ -450,8 +722,16 @@ void Interface::processOpenCommand(uchar channel, const QByteArray& cmd, bool lo
 			break;
 
 		default:
-			// some other channel.
-			Log(FAC_IFACE, warning, QString("processOpenCommand: got open for channel: %1, not yet implemented.").arg(channel));
+			// A direct access channel, the buffer is sent like a file when the channel is read.
+			if(cmd.startsWith('#') and channel < CBM::CMD_CHANNEL) {
+				m_queuedError = openBufferChannel(channel, cmd.mid(1));
+				m_openState = CBM::ErrOK == m_queuedError ? O_BUFFER : O_NOTHING;
+				sendOpenResponse(O_BUFFER == m_openState ? O_FILE : O_NOTHING);
+				Log(FAC_IFACE, m_queuedError == CBM::ErrOK ? success : error, QString("Open direct access channel %1 response code: %2")
+						.arg(channel).arg(QString::number(m_queuedError)));
+			}
+			else
+				Log(FAC_IFACE, warning, QString("processOpenCommand: got open for channel: %1, not yet implemented.").arg(channel));
 			break;
 	}
 } // processOpenCommand
@@ -459,8 +739,9 @@ void Interface::processOpenCommand(uchar channel, const QByteArray& cmd, bool lo
 
 void Interface::processCloseCommand()
 {
+	TraceSpan span(m_pTracer, "close");
 	QString name = m_currFileDriver->openedFileName();
-	QByteArray data;
+	FrameBuilder data(m_frame);
 	if(m_openState == O_SAVE or m_openState == O_SAVE_REPLACE or m_openState == O_FILE) {
 		// Small 'n' means last operation was a save operation.
 		data.append(m_openState == O_SAVE or m_openState == O_SAVE_REPLACE ? 'n' : 'N').append((char)name.length()).append(name);
@@ -472,12 +753,15 @@ void Interface::processCloseCommand()
 			if(0 not_eq m_pListener)
 				m_pListener->imageUnmounted();
 		}
+		// A save that didn't make it to the disk, e.g. 72, DISK FULL, shows on the next status read.
+		else if(CBM::ErrOK not_eq m_currFileDriver->closeError())
+			m_queuedError = m_currFileDriver->closeError();
 	}
 	else {
 		// Means CLOSED and the drive number (that MAY have changed due to a comamnd).
-		data.append('C').append(deviceNumber());
+		data.append('C').append((char)deviceNumber());
 	}
-	write(data);
+	write(data.frame());
 	m_openState = O_NOTHING;
 } // processCloseCommand
 
@@ -485,26 +769,28 @@ void Interface::processCloseCommand()
 void Interface::processGetOpenFileSize()
 {
 	ushort size = m_currFileDriver->openedFileSize();
+	if(bufferAddress(m_bufferChannel)) {
+		const int buffer = m_channelBuffer[m_bufferChannel];
+		size = m_bufferEnd[buffer] > m_bufferPointer[buffer] ? m_bufferEnd[buffer] - m_bufferPointer[buffer] : 0;
+	}
 
-	QByteArray data;
 	uchar high = size >> 8, low = size bitand 0xff;
-	write(data.append('S').append((char)high).append((char)low));
+	write(FrameBuilder(m_frame).append('S').append((char)high).append((char)low).frame());
 	Log(FAC_IFACE, info, QString("GetOpenFileSize: Returning file size: %1").arg(QString::number(size)));
 } // processGetOpenedFileSize
 
 
 void Interface::processLineRequest()
 {
+	TraceSpan span(m_pTracer, "line");
 	if(O_INFO == m_openState or O_DIR == m_openState) {
-		if(m_dirListing.isEmpty()) {
+		if(m_nextDirLine == m_numDirLines) {
 			// last line was produced. Send back the ending char.
-			write("l");
+			write(FrameBuilder(m_frame).append('l').frame());
 			Log(FAC_IFACE, success, "Last directory line written to arduino.");
 		}
-		else {
-			write(m_dirListing.first());
-			m_dirListing.removeFirst();
-		}
+		else
+			write(m_dirListing.at(m_nextDirLine++));
 	}
 	else {
 		// TODO: This is a strange error state. Maybe we should return something to CBM here.
@@ -515,33 +801,56 @@ void Interface::processLineRequest()
 
 void Interface::processReadFileRequest(ushort length)
 {
-	QByteArray data;
+	TraceSpan span(m_pTracer, "read file");
 	uchar count;
 	bool atEOF = false;
 
 	if(length)
 		m_currReadLength = length;
-	// NOTE: -2 here because we need two bytes for the protocol.
+	// NOTE: -2 here because we need two bytes for the protocol, they're reserved ahead of the data.
+	FrameBuilder data(m_frame, 2, m_currReadLength);
+	const ushort address = bufferAddress(m_bufferChannel);
 	for(count = 0; count < m_currReadLength - 2 and not atEOF; ++count) {
-		data.append(m_currFileDriver->getc());
-		atEOF = m_currFileDriver->isEOF();
+		if(address) {
+			// From the buffer of the direct access channel, up to the end of the data in it.
+			ushort& pointer(m_bufferPointer[m_channelBuffer[m_bufferChannel]]);
+			data.append(m_driveRAM.at(address + (pointer bitand 0xFF)));
+			atEOF = ++pointer >= m_bufferEnd[m_channelBuffer[m_bufferChannel]];
+		}
+		else {
+			data.append(m_currFileDriver->getc());
+			atEOF = m_currFileDriver->isEOF();
+		}
 	}
 	if(0 not_eq m_pListener)
-		m_pListener->bytesRead(data.size());
-	// prepend whatever count we got.
-	data.prepend(count);
-	// If we reached end of file, head byte in answer indicates with 'E' instead of 'B'.
-	data.prepend(atEOF ? 'E' : 'B');
-	write(data);
+		m_pListener->bytesRead(data.payloadSize());
+	if(0 not_eq m_pMetrics)
+		m_pMetrics->add(Metrics::LOAD_BYTES, data.payloadSize());
+	// If we reached end of file, head byte in answer indicates with 'E' instead of 'B'. Followed by whatever count we got.
+	data.setHeader(0, atEOF ? 'E' : 'B');
+	data.setHeader(1, count);
+	write(data.frame());
 } // processReadFileRequest
 
 
 void Interface::processWriteFileRequest(const QByteArray& theBytes)
 {
-	foreach(uchar theByte, theBytes)
-		m_currFileDriver->putc(theByte);
+	TraceSpan span(m_pTracer, "write file");
+	const ushort address = bufferAddress(m_bufferChannel);
+	if(address) {
+		// Into the buffer of the direct access channel at its pointer, what doesn't fit is dropped.
+		ushort& pointer(m_bufferPointer[m_channelBuffer[m_bufferChannel]]);
+		const QByteArray fits(theBytes.left(qMax(0, CBM1541_BUFFER_SIZE - pointer)));
+		writeDriveMemory(address + pointer, fits);
+		pointer += fits.size();
+	}
+	else
+		foreach(uchar theByte, theBytes)
+			m_currFileDriver->putc(theByte);
 	if(0 not_eq m_pListener)
 		m_pListener->bytesWritten(theBytes.length());
+	if(0 not_eq m_pMetrics)
+		m_pMetrics->add(Metrics::SAVE_BYTES, theBytes.length());
 } // processWriteFileRequest
 
 
@@ -569,54 +878,61 @@ QString Interface::errorStringFromCode(CBM::IOErrorMessage code) const
 // For a specific error code, we are supposed to return the corresponding error string.
 void Interface::processErrorStringRequest(CBM::IOErrorMessage code)
 {
+	TraceSpan span(m_pTracer, "error string");
+	// The Arduino asks for this message whenever it lost sync with us.
+	if(CBM::ErrSerialComm == code and 0 not_eq m_pMetrics)
+		m_pMetrics->add(Metrics::SERIAL_RESYNCS);
 	// the return message begins with ':' for sync.
-	QByteArray retStr(1, ':');
-
 	// append message and the common ending and terminate with CR.
-	write(retStr.append(errorStringFromCode(code) + s_errorEnding + '\r'));
+	write(FrameBuilder(m_frame).append(':').append(errorStringFromCode(code)).append(s_errorEnding).append('\r').frame());
 } // processErrorStringRequest
 
 
 void Interface::send(short lineNo, const QString& text)
 {
-	QByteArray line(text.toLocal8Bit());
+	// Reuse the buffer of a line sent with an earlier listing if there is one.
+	if(m_numDirLines == m_dirListing.size())
+		m_dirListing.append(QByteArray());
+	FrameBuilder line(m_dirListing[m_numDirLines++], 4, text.size() + 4);
+	line.append(text);
+	// the response byte, then the length of it all.
+	line.setHeader(0, 'L');
+	line.setHeader(1, (uchar)text.size() + 2);
 	// the line number is included with the line itself. It goes in with lobyte,hibyte.
-	line.prepend(uchar((lineNo bitand 0xFF00) >> 8));
-	line.prepend(uchar(lineNo bitand 0xFF));
-	// length of it all is the first byte.
-	line.prepend((uchar)text.size() + 2);
-	// add the response byte.
-	line.prepend('L');
-	// add it to the total dirlisting array.
-	m_dirListing.append(line);
+	line.setHeader(2, uchar(lineNo bitand 0xFF));
+	line.setHeader(3, uchar((lineNo bitand 0xFF00) >> 8));
 } // send
 
 
 void Interface::buildDirectoryOrMediaList()
 {
-	m_dirListing.clear();
+	QElapsedTimer timer;
+	timer.start();
+	m_numDirLines = m_nextDirLine = 0;
 	if(O_DIR == m_openState) {
 		Log(FAC_IFACE, info, QString("Producing directory listing for FS: \"%1\"...").arg(m_currFileDriver->extFriendly()));
-		if(not m_currFileDriver->sendListing(*this)) {
+		if(not m_currFileDriver->sendListing(*this, m_dirFilter)) {
 			m_queuedError = CBM::ErrDirectoryError;
-			Log(FAC_IFACE, warning, QString("Directory listing indicated error. Still sending: %1 chars").arg(QString::number(m_dirListing.length())));
+			Log(FAC_IFACE, warning, QString("Directory listing indicated error. Still sending: %1 lines").arg(QString::number(m_numDirLines)));
 		}
 		else {
-			Log(FAC_IFACE, success, QString("Directory listing ok (%1 lines). Ready waiting for line requests from arduino.").arg(m_dirListing.count()));
+			Log(FAC_IFACE, success, QString("Directory listing ok (%1 lines). Ready waiting for line requests from arduino.").arg(m_numDirLines));
 			m_queuedError = CBM::ErrOK;
 		}
 	}
 	else if(O_INFO == m_openState) {
 		Log(FAC_IFACE, info, QString("Producing media info for FS: \"%1\"...").arg(m_currFileDriver->extFriendly()));
 		if(not m_currFileDriver->sendMediaInfo(*this)) {
-			Log(FAC_IFACE, warning, QString("Media info listing indicated error. Still sending: %1 chars").arg(QString::number(m_dirListing.length())));
+			Log(FAC_IFACE, warning, QString("Media info listing indicated error. Still sending: %1 lines").arg(QString::number(m_numDirLines)));
 			m_queuedError = CBM::ErrDirectoryError;
 		}
 		else {
-			Log(FAC_IFACE, success, QString("Media info listing ok (%1 lines). Ready waiting for line requests from arduino.").arg(m_dirListing.count()));
+			Log(FAC_IFACE, success, QString("Media info listing ok (%1 lines). Ready waiting for line requests from arduino.").arg(m_numDirLines));
 			m_queuedError = CBM::ErrOK;
 		}
 	}
+	if(0 not_eq m_pMetrics)
+		m_pMetrics->observe(Metrics::LISTING_SECONDS, timer.nsecsElapsed());
 } // buildDirectoryOrMediaList
 
 
@@ -628,6 +944,7 @@ bool Interface::changeNativeFSDirectory(const QString& newDir)
 
 void Interface::write(const QByteArray& data, bool flush) const
 {
+	TraceSpan span(m_pTracer, "serial write");
 	if(0 not_eq m_pListener)
 		m_pListener->writePort(data, flush);
 } // write
@@ -9,9 +9,57 @@
 #include "m2idriver.hpp"
 #include "x00fs.hpp"
 #include "nativefs.hpp"
+#include "drivecodetracker.hpp"
+#include "drive1541.hpp"
+#include "tracer.hpp"
+#include "metrics.hpp"
 
 typedef QList<FileDriverBase*> FileDriverList;
 
+// Builds a response frame to the Arduino in a buffer kept between frames. Once the buffer has grown to the largest frame
+// nothing is allocated: it's truncated rather than freed for the next frame (reserve() makes QByteArray keep its
+// capacity), and it's handed to writePort() by reference. Header bytes depending on the payload, like its length, are
+// reserved up front and set when the payload is complete instead of prepending them.
+class FrameBuilder
+{
+public:
+	FrameBuilder(QByteArray& buffer, int headerSize = 0, int capacity = 0)
+		: m_buffer(buffer), m_headerSize(headerSize)
+	{
+		m_buffer.reserve(qMax(capacity, m_buffer.capacity()));
+		m_buffer.resize(headerSize);
+	}
+
+	FrameBuilder& append(char c)
+	{
+		m_buffer.append(c);
+		return *this;
+	}
+	// Characters are sent as Latin-1, one byte each, so the length sent ahead of a name matches what follows.
+	FrameBuilder& append(const QString& text)
+	{
+		foreach(const QChar& c, text)
+			m_buffer.append(c.toLatin1());
+		return *this;
+	}
+	void setHeader(int pos, char c)
+	{
+		m_buffer.data()[pos] = c;
+	}
+	int payloadSize() const
+	{
+		return m_buffer.size() - m_headerSize;
+	}
+	const QByteArray& frame() const
+	{
+		return m_buffer;
+	}
+
+private:
+	QByteArray& m_buffer;
+	int m_headerSize;
+};
+
 enum OpenState {
 	O_NOTHING,			// Nothing to send / File not found error
 	O_INFO,					// User issued a reload sd card
@@ -20,7 +68,8 @@ enum OpenState {
 	O_FILE_ERR,			// Incorrect file format opened
 	O_SAVE,					// A program file is opened for writing
 	O_SAVE_REPLACE,	// "---", but Save-with-replace is requested
-	O_CMD						//  Command channel was opened
+	O_CMD,					//  Command channel was opened
+	O_BUFFER				// A direct access channel ("#") was opened, the Arduino is told O_FILE
 };
 
 
@@ -85,6 +134,16 @@ public:
 	void processErrorStringRequest(CBM::IOErrorMessage code);
 	bool changeNativeFSDirectory(const QString &newDir);
 	void setMountNotifyListener(IFileOpsNotify *pListener);
+	// Requests served are recorded as spans while the tracer is active, null for no tracing.
+	void setTracer(Tracer* pTracer)
+	{
+		m_pTracer = pTracer;
+	}
+	// Transfer and drive metrics are maintained in pMetrics, null for none.
+	void setMetrics(Metrics* pMetrics)
+	{
+		m_pMetrics = pMetrics;
+	}
 	void setImageFilters(const QString &filters, bool showDirs);
 	void processWriteFileRequest(const QByteArray &theBytes);
 	void writePort(const QByteArray& data, bool flush = true);
@@ -94,13 +153,56 @@ public:
 		return m_currFileDriver;
 	}
 
+	// Mounted sector images are never written to, SAVEs and sector writes go to a copy-on-write overlay in dir instead.
+	// An empty dir makes mounted images read only. Takes effect with the next mount.
+	void setOverlayDirectory(const QString& dir);
+	// Number of sectors modified in the mounted image since its overlay was last merged or discarded.
+	int numImageOverlaySectors() const;
+	// Write the modifications of the mounted image back to the image file, or drop them.
+	bool mergeImageOverlay();
+	bool discardImageOverlay();
+
+	// Swap lists (.lst / .m3u, one image path per line, relative to the list) for multi-disk software. All D64 images of
+	// the set are mounted up front and kept in memory, swapping disks doesn't touch the host file system.
+	static bool isSwapList(const QString& fileName);
+	bool mountSwapList(const QString& listPath);
+	void clearSwapList();
+	// Mount the disk at index (wrapping around) of the swap list. Returns false if there is no swap list.
+	bool swapDisk(int index);
+	bool swapToNextDisk()
+	{
+		return swapDisk(m_swapIndex + 1);
+	}
+	bool swapToPreviousDisk()
+	{
+		return swapDisk(m_swapIndex - 1);
+	}
+	int swapListSize() const
+	{
+		return m_swapDisks.size();
+	}
+
 	void readDriveMemory(ushort address, ushort length, QByteArray &bytes) const;
 	void writeDriveMemory(ushort address, const QByteArray &bytes);
+	// Called on M-E / U3..U8 / B-E. The code is run on the emulated drive, uploaded code is fingerprinted in the log.
+	CBM::IOErrorMessage executeDriveMemory(ushort address);
+	// Direct access: a channel opened with "#" (any free buffer) or "#<buffer>" gets one of the drive buffers in RAM.
+	// B-R / U1 read a block of the mounted image into the buffer of a channel, B-W / U2 write it back and B-P sets its
+	// buffer pointer. Data read from or written to the channel comes from / goes to the buffer at the pointer.
+	// The B- variants treat the first byte as the number of data bytes, the U variants use the whole block.
+	CBM::IOErrorMessage readBlock(uchar channel, uchar track, uchar sector, bool wholeBlock);
+	CBM::IOErrorMessage writeBlock(uchar channel, uchar track, uchar sector, bool wholeBlock);
+	CBM::IOErrorMessage setBufferPointer(uchar channel, uchar position);
+	// B-E: Load the block into the buffer of the channel ($0500 if it has none) and execute it.
+	CBM::IOErrorMessage executeDriveBlock(uchar channel, uchar track, uchar sector);
 
 private:
 	void moveToParentOrNativeFS(bool toRoot);
 	bool removeFilePrefix(QString &cmd) const;
-	void sendOpenResponse(char code) const;
+	void sendOpenResponse(char code);
+	CBM::IOErrorMessage openBufferChannel(uchar channel, const QByteArray& name);
+	// Drive RAM address of the buffer of channel, 0 if it has none.
+	ushort bufferAddress(uchar channel) const;
 	void write(const QByteArray &data, bool flush = true) const;
 	QString errorStringFromCode(CBM::IOErrorMessage code) const;
 
@@ -113,13 +215,27 @@ private:
 	NativeFS m_native; // In fact, this is .PRG
 
 	FileDriverList m_fsList;
+	// Disks of the current swap list, their image paths and the index of the one mounted.
+	FileDriverList m_swapDisks;
+	QStringList m_swapPaths;
+	int m_swapIndex;
+	QString m_overlayDir;
 	FileDriverBase* m_currFileDriver;
 	CBM::IOErrorMessage m_queuedError;
 	OpenState m_openState;
+	// Pattern and type selection of the listing requested by the last open of the directory ($:A*=P).
+	DirFilter m_dirFilter;
 	ushort m_currReadLength;
 	QByteArray m_lastCmdString;
+	// Frame buffer of all responses but directory lines.
+	QByteArray m_frame;
+	// Directory lines are built ahead of the line requests. The buffers of lines sent are reused for the next listing.
 	QList<QByteArray> m_dirListing;
+	int m_numDirLines;
+	int m_nextDirLine;
 	IFileOpsNotify* m_pListener;
+	Tracer* m_pTracer;
+	Metrics* m_pMetrics;
 
 	// The ROM file for the 1541 drive (16 KB).
 	QByteArray m_driveROM;
@@ -129,6 +245,17 @@ private:
 	QByteArray m_via1MEM;
 	// The VIA2 control area for the 1541 drive.
 	QByteArray m_via2MEM;
+	// Keeps track of M-W uploads, to fingerprint them when they are executed.
+	DriveCodeTracker m_driveCodeTracker;
+	// Buffer of each direct access channel (-1 for none) and the channel data is read from / written to, 0 unless the
+	// last data channel opened is a direct access one. For each buffer its pointer and the end of the data read into it.
+	// Closes don't tell the channel closed, a channel keeps its buffer until it's opened again or the drive is reset.
+	int m_channelBuffer[CBM::CMD_CHANNEL];
+	uchar m_bufferChannel;
+	ushort m_bufferPointer[CBM1541_NUM_BUFFERS];
+	ushort m_bufferEnd[CBM1541_NUM_BUFFERS];
+	// The emulated drive running M-E / B-E code against the memory areas above.
+	Drive1541 m_drive;
 };
 
 #endif // INTERFACE_HPP
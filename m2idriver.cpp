@@ -45,12 +45,23 @@ const int CBMNAME_SIZE = 16;
 
 
 M2I::M2I()
+	: m_indexSize(0), m_readPos(0)
 {}
 
 bool M2I::mountHostImage(const QString& fileName)
 {
 	unmountHostImage();
 
+	// Nothing to parse if this is the file parsed last and it didn't change since.
+	const QFileInfo info(fileName);
+	if(m_indexModified.isValid() and fileName == m_hostFile.fileName() and info.lastModified() == m_indexModified
+		 and info.size() == m_indexSize) {
+		m_status = IMAGE_OK;
+		return true;
+	}
+	m_entries.clear();
+	m_indexModified = QDateTime();
+
 	// Interface has just opened the m2i file, save filename
 	m_hostFile.setFileName(fileName);
 
@@ -137,6 +148,11 @@ bool M2I::mountHostImage(const QString& fileName)
 	// We close immediately as we're done, host file (.M2I) is only kept open during parsing (or writing).
 	m_hostFile.close();
 	m_status = success ? IMAGE_OK : NOT_READY;
+	indexEntries();
+	if(success) {
+		m_indexModified = info.lastModified();
+		m_indexSize = info.size();
+	}
 
 	return success;
 } // mountHostImage
@@ -144,14 +160,13 @@ bool M2I::mountHostImage(const QString& fileName)
 
 void M2I::unmountHostImage()
 {
-	m_entries.clear();
 	if(not m_hostFile.fileName().isEmpty() and m_hostFile.isOpen())
 		m_hostFile.close();
 	m_status = NOT_READY;
 } // unmountHostImage
 
 
-bool M2I::sendListing(ISendLine &cb)
+bool M2I::sendListing(ISendLine &cb, const DirFilter& filter)
 {
 	if(not (m_status bitand IMAGE_OK)) {
 		// We are not happy with the m2i file
@@ -164,7 +179,9 @@ bool M2I::sendListing(ISendLine &cb)
 
 	// Write lines
 	foreach(const FileEntry& e, m_entries) {
-		if(FileEntry::TypeDel == e.fileType or FileEntry::TypePrg == e.fileType) {
+		if((FileEntry::TypeDel == e.fileType or FileEntry::TypePrg == e.fileType)
+			 and filter.matchesType(FileEntry::TypePrg == e.fileType ? strDotPRG : strDEL)
+			 and filter.matchesName(e.cbmName.trimmed())) {
 			QString name = '"' + e.cbmName + '"';
 			QFile f(e.nativeName.trimmed());
 			ushort fileSize = (ushort)(f.exists() ? f.size() : 0) / 256;
@@ -192,6 +209,7 @@ bool M2I::deleteFile(const QString& fileName)
 				// remove from entry list as well.
 				// NOTE: Here we can possible mark the entry as 'deleted' instead with FileEntry::Erased, but...why?
 				result = m_entries.removeOne(e);
+				indexEntries();
 				// succeeded, so rewrite the updated M2I index file.
 				if(result) {
 					result = m_hostFile.open(QFile::WriteOnly);
@@ -226,6 +244,7 @@ CBM::IOErrorMessage M2I::renameFile(const QString& oldName, const QString& newNa
 
 		modEntry.nativeName = newName.trimmed().left(NATIVENAME_SIZE);
 		modEntry.cbmName = withoutExtension(newName.trimmed().left(CBMNAME_SIZE));
+		indexEntries();
 		// Do the physical renaming of the native file system file.
 		if(f.rename(modEntry.nativeName)) {
 			// operation succeeded, so rewrite the updated M2I index file.
@@ -255,6 +274,9 @@ CBM::IOErrorMessage M2I::newDisk(const QString& name, const QString& id)
 	// disk id not supported.
 	Q_UNUSED(id);
 	unmountHostImage();
+	m_entries.clear();
+	m_indexModified = QDateTime();
+	indexEntries();
 	file.setFileName(name + ".M2I");
 	// comment out to prevent overwrite existing m2i files.
 //	if(file.exists())
@@ -281,8 +303,11 @@ bool M2I::fopen(const QString& fileName)
 	if(findEntry(fileName, e) and FileEntry::TypePrg == e.fileType) {
 		QFileInfo f(m_hostFile);
 		m_nativeFile.setFileName(QDir(f.absolutePath()).filePath(e.nativeName.trimmed()));
-		// open the corresponding native name (dos 8.3 name).
+		// open the corresponding native name (dos 8.3 name) and read it whole, it's served from memory.
 		if(m_nativeFile.open(QFile::ReadOnly)) {
+			m_readData = m_nativeFile.readAll();
+			m_readPos = 0;
+			m_nativeFile.close();
 			m_status or_eq FILE_OPEN;
 			m_openedEntry = e;
 		}
@@ -316,6 +341,7 @@ CBM::IOErrorMessage M2I::fopenWrite(const QString& fileName, bool replaceMode)
 			e.fileType = FileEntry::TypePrg;
 			e.nativeName = fileName;
 			m_entries.append(e);
+			indexEntries();
 			m_hostFile.write(QByteArray().append(generateFile()));
 			m_hostFile.close();
 		}
@@ -342,7 +368,9 @@ const QString M2I::openedFileName() const
 
 ushort M2I::openedFileSize() const
 {
-	return m_nativeFile.isOpen() ? m_nativeFile.size() : 0;
+	if(m_nativeFile.isOpen())
+		return m_nativeFile.size();
+	return m_status bitand FILE_OPEN ? m_readData.size() : 0;
 } // openedFileSize
 
 
@@ -350,7 +378,7 @@ char M2I::getc(void)
 {
 	char ret = 0;
 	if(m_status bitand FILE_OPEN and not isEOF()) {
-		m_nativeFile.read(&ret, 1);
+		ret = m_readData.at(m_readPos++);
 		return ret;
 	}
 	return 0;
@@ -367,7 +395,7 @@ bool M2I::putc(char c)
 bool M2I::isEOF(void) const
 {
 	if(m_status bitand FILE_OPEN)
-		return m_nativeFile.atEnd();
+		return m_nativeFile.isOpen() ? m_nativeFile.atEnd() : m_readPos >= m_readData.size();
 	return true;
 } // isEOF
 
@@ -377,6 +405,7 @@ bool M2I::close(void)
 {
 	m_status and_eq compl FILE_OPEN;
 	m_nativeFile.close();
+	m_readData.clear();
 
 	return true;
 } // close
@@ -393,6 +422,14 @@ bool M2I::close(void)
 bool M2I::findEntry(const QString& findName, FileEntry& entry, bool allowWildcards) const
 {
 	const QString trimmedFind(findName.trimmed());
+	// Names without wildcards are looked up in the index.
+	if(not allowWildcards or not (trimmedFind.contains('*') or trimmedFind.contains('?') or trimmedFind.contains('['))) {
+		QHash<QString, int>::const_iterator it = m_nameIndex.find(trimmedFind.toUpper());
+		if(it == m_nameIndex.end())
+			return false;
+		entry = m_entries.at(it.value());
+		return true;
+	}
 	// trimming here is mostly for disregarding any ending blanks.
 	QRegExp matcher(trimmedFind, Qt::CaseInsensitive, QRegExp::Wildcard);
 	bool found = false;
@@ -408,6 +445,18 @@ bool M2I::findEntry(const QString& findName, FileEntry& entry, bool allowWildcar
 } // findEntry
 
 
+void M2I::indexEntries()
+{
+	m_nameIndex.clear();
+	// The first entry of a name is the one found by it.
+	for(int i = 0; i < m_entries.size(); ++i) {
+		const QString name(m_entries.at(i).cbmName.trimmed().toUpper());
+		if(not m_nameIndex.contains(name))
+			m_nameIndex.insert(name, i);
+	}
+} // indexEntries
+
+
 /// Generate the host index file from the current entry list.
 /// Returns the file as a single QString, can be converted to QByteArray for writing to file.
 const QString M2I::generateFile()
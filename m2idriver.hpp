@@ -1,6 +1,9 @@
 #ifndef M2IDRIVER_H
 #define M2IDRIVER_H
 
+#include <QDateTime>
+#include <QHash>
+
 #include "filedriverbase.hpp"
 
 
@@ -29,7 +32,7 @@ public:
 		return true;
 	}
 
-	bool sendListing(ISendLine& cb);
+	bool sendListing(ISendLine& cb, const DirFilter& filter = DirFilter());
 
 	bool fopen(const QString& fileName);
 	CBM::IOErrorMessage fopenWrite(const QString& fileName, bool replaceMode = false);
@@ -78,14 +81,24 @@ private:
 
 	bool createFile(char* fileName);
 	bool findEntry(const QString& findName, FileEntry& entry, bool allowWildcards = true) const;
+	// Rebuild the name index, whenever the entries change.
+	void indexEntries();
 	const QString generateFile();
 
 	QString m_diskTitle; // 16 chars
 	EntryList m_entries;
-	// The real host file system M2I index file.
+	// Index of the entries by upper case CBM name.
+	QHash<QString, int> m_nameIndex;
+	// The real host file system M2I index file. Its entries are kept after unmounting, when mounting the same file
+	// again they're only parsed again if it changed since.
 	QFile m_hostFile;
-	// The current CBM file being read or written from/to the index.
+	QDateTime m_indexModified;
+	qint64 m_indexSize;
+	// The current CBM file being written to the index.
 	QFile m_nativeFile;
+	// The current CBM file being read, it's read whole when opened.
+	QByteArray m_readData;
+	int m_readPos;
 	FileEntry m_openedEntry;
 };
 
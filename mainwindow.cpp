@@ -16,7 +16,7 @@
 // TODO: Handle all data channel stuff. TALK, UNTALK, and so on.
 // TODO: Display the current error channel status on the UI!
 // TODO: T64 / D64 formats could/should read out entire disk into memory for caching (network performance).
-// TODO: T64 / D64 write support!
+// TODO: T64 write support!
 // TODO: Finalize handling of write protected disk.
 // TODO: If arduino is reset with a physical button on the board and it tries to resync, the PC-host application should automatically resync without having to press the 'Reset Arduino' button, meaning: listen to unexpecte "connect-request" even in connected mode.
 // TODO: When loading directories or media list, the dirlist view doesn't reflect this status.
@@ -25,6 +25,7 @@
 // TODO: Native/D64/T64: Show TRUE (actual) blocks free. Will be nice with all the space available on a harddisk or network share!
 // TODO: Add icons for disk images in image list view (T64, D64, x64, .PRG, normal folders). This make it much easier to distinguish cbm related files from each other.
 
+// DONE: D64 write support, SAVEs go to a copy-on-write overlay that can be merged into the image later.
 // DONE: Rename openHostFile() and closeHostFile() to "mount"/"unmount" respectively on all file systems?
 // DONE: Needs to be verified/tested: Need to refactor the open command 'O' so that it is not passed as a CR terminated string. This will never
 // work when issued for the CBMDOS command buffer where there can be zeroes and any other character in the buffer that could be
@@ -37,6 +38,8 @@
 #include <QDebug>
 #include <QSettings>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QStandardPaths>
 #ifdef HAS_WIRINGPI
 #include <wiringPi.h>
 #endif
@@ -146,6 +149,7 @@ MainWindow::MainWindow(QWidget* parent) :
 	, m_port(this)
 	, m_isConnected(false)
 	, m_iface()
+	, m_metricsServer(m_metrics, this)
 	, m_isInitialized(false)
 	,	m_fsWatcher(this)
 	, m_simulatedState(simsOff)
@@ -213,12 +217,16 @@ MainWindow::MainWindow(QWidget* parent) :
 
 	// register ourselves to listen for all CBM events from the Arduino so that we can reflect this on UI controls.
 	m_iface.setMountNotifyListener(this);
+	m_iface.setTracer(&m_tracer);
+	m_iface.setMetrics(&m_metrics);
 	m_iface.setImageFilters(m_appSettings.imageFilters, m_appSettings.showDirectories);
 	// This will also reset the device!
 	updateDirListColors();
 	// We want notifications when the local file system changes so that we can update the image directory list.
 	connect(&m_fsWatcher, SIGNAL(directoryChanged(const QString&)), this, SLOT(on_directoryChanged(const QString&)));
 	watchDirectory(m_appSettings.imageDirectory);
+	if(not m_appSettings.metricsSocket.isEmpty())
+		m_metricsServer.listen(m_appSettings.metricsSocket);
 	Log("MAIN", success, "Application Initialized.");
 } // ctor
 
@@ -372,6 +380,45 @@ void MainWindow::on_actionSingle_file_mount_triggered()
 } // on_actionSingle_file_mount_triggered
 
 
+void MainWindow::on_actionMerge_image_changes_triggered()
+{
+	m_iface.mergeImageOverlay();
+} // on_actionMerge_image_changes_triggered
+
+
+void MainWindow::on_actionDiscard_image_changes_triggered()
+{
+	if(m_iface.discardImageOverlay())
+		imageMounted(ui->nowMounted->text(), m_iface.currentFileDriver());
+} // on_actionDiscard_image_changes_triggered
+
+
+void MainWindow::on_actionNext_disk_triggered()
+{
+	m_iface.swapToNextDisk();
+} // on_actionNext_disk_triggered
+
+
+void MainWindow::on_actionPrevious_disk_triggered()
+{
+	m_iface.swapToPreviousDisk();
+} // on_actionPrevious_disk_triggered
+
+
+void MainWindow::on_actionRecord_trace_toggled(bool checked)
+{
+	if(checked) {
+		m_tracer.start();
+		Log("MAIN", info, "Recording trace, uncheck Record trace to save it.");
+		return;
+	}
+	m_tracer.stop();
+	QString fileName = QFileDialog::getSaveFileName(this, tr("Save Trace"), QString(), tr("Chrome Trace Files (*.json)"));
+	if(not fileName.isEmpty())
+		m_tracer.write(fileName);
+} // on_actionRecord_trace_toggled
+
+
 void MainWindow::checkVersion()
 {
 	if(m_appSettings.programVersion not_eq VER_PRODUCTVERSION_STR) {
@@ -416,6 +463,8 @@ void MainWindow::readSettings()
 	m_appSettings.emulatorPalette = sets.value("emulatorPalette", "ccs64").toString();
 	m_appSettings.cbmMachine = sets.value("cbmMachine", "C 64").toString();
 	m_appSettings.cbmBorderWidth = sets.value("cbmBorderWidth", 60).toUInt();
+	m_appSettings.metricsSocket = sets.value("metricsSocket",
+			QDir(QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation)).filePath("rpi2iec-metrics.sock")).toString();
 	ui->actionDisk_Write_Protected->setChecked(sets.value("diskWriteProtected", false).toBool());
 
 	restoreGeometry(sets.value("mainWindowGeometry").toByteArray());
@@ -458,6 +507,7 @@ void MainWindow::writeSettings() const
 	sets.setValue("emulatorPalette", m_appSettings.emulatorPalette);
 	sets.setValue("cbmMachine", m_appSettings.cbmMachine);
 	sets.setValue("cbmBorderWidth", m_appSettings.cbmBorderWidth);
+	sets.setValue("metricsSocket", m_appSettings.metricsSocket);
 
 	sets.setValue("diskWriteProtected", ui->actionDisk_Write_Protected->isChecked());
 	Logging::loggerInstance().saveFilters(sets);
@@ -517,8 +567,10 @@ bool MainWindow::checkConnectRequest(QByteArray& buffer)
 		m_isConnected = true;
 		Log("MAIN", success, "Now connected to Arduino.");
 	}
-	else
+	else {
 		Log("MAIN", warning, "Got reconnection attempt from Arduino for unknown reason. Accepting new connection.");
+		m_metrics.add(Metrics::RECONNECTS);
+	}
 
 	// give the client the version, pin configuration, current date and time in the response string.
 	const QString response = OkString.arg(QString::number(m_appSettings.deviceNumber))
@@ -778,10 +830,15 @@ void MainWindow::onCommandIssued(const QString& cmd)
 
 void MainWindow::processData(void)
 {
+	TraceSpan span(&m_tracer, "parse");
 	bool hasDataToProcess = not m_pendingBuffer.isEmpty();
 	//	if(hasDataToProcess)
 	//		LogHexData(buffer);
 	while(hasDataToProcess) {
+		// Set to the frame type when a complete request was served, for the latency metrics.
+		const char* frame = 0;
+		QElapsedTimer frameTimer;
+		frameTimer.start();
 		QString cmdString(m_pendingBuffer);
 		int crIndex =	cmdString.indexOf('\r');
 
@@ -806,9 +863,19 @@ void MainWindow::processData(void)
 				}
 				break;
 
+			case 'T': // trace marker, from an Arduino built with TRACING.
+				if(-1 == crIndex)
+					hasDataToProcess = false; // escape from here, command is incomplete.
+				else {
+					m_tracer.addArduinoMarker(cmdString.mid(1, crIndex - 1));
+					m_pendingBuffer.remove(0, crIndex + 1);
+				}
+				break;
+
 			case 'S': // request for file size in bytes before sending file to CBM
 				m_pendingBuffer.remove(0, 1);
 				m_iface.processGetOpenFileSize();
+				frame = "size";
 				break;
 
 			case 'O': // open command
@@ -820,6 +887,7 @@ void MainWindow::processData(void)
 						// Open was issued, string goes from m_pendingBuffer[2] with length - 2
 						m_iface.processOpenCommand((uchar)m_pendingBuffer.at(2), m_pendingBuffer.mid(3, length - 3));
 						m_pendingBuffer.remove(0, length);
+						frame = "open";
 					}
 					else
 						hasDataToProcess = false; // not all chars yet
@@ -835,6 +903,7 @@ void MainWindow::processData(void)
 				// read) but may be changed with 'N' command.
 				m_pendingBuffer.remove(0, 1);
 				m_iface.processReadFileRequest();
+				frame = "read";
 				break;
 
 			case 'N': // same as 'N', but we are also given the expected read size. All succeeding 'R' will be with this size.
@@ -844,6 +913,7 @@ void MainWindow::processData(void)
 					uchar length = (uchar)m_pendingBuffer.at(1);
 					m_pendingBuffer.remove(0, 2);
 					m_iface.processReadFileRequest(length);
+					frame = "read";
 				}
 				break;
 
@@ -854,6 +924,7 @@ void MainWindow::processData(void)
 						m_iface.processWriteFileRequest(m_pendingBuffer.mid(2, length - 2));
 						// discard all processed (written) bytes from buffer.
 						m_pendingBuffer.remove(0, length);
+						frame = "write";
 					}
 					else
 						hasDataToProcess = false; // not all chars yet
@@ -866,11 +937,13 @@ void MainWindow::processData(void)
 				// Just remove the BYTE from queue and do business.
 				m_pendingBuffer.remove(0, 1);
 				m_iface.processLineRequest();
+				frame = "line";
 				break;
 
 			case 'C': // close FILE command
 				m_pendingBuffer.remove(0, 1);
 				m_iface.processCloseCommand();
+				frame = "close";
 				break;
 
 			case 'E': // Ask for translation of error string from error code
@@ -879,6 +952,7 @@ void MainWindow::processData(void)
 				else {
 					m_iface.processErrorStringRequest(static_cast<CBM::IOErrorMessage>(m_pendingBuffer.at(1)));
 					m_pendingBuffer.remove(0, 2);
+					frame = "error";
 				}
 				break;
 
@@ -892,6 +966,8 @@ void MainWindow::processData(void)
 					hasDataToProcess = false;
 				break;
 		}
+		if(0 not_eq frame)
+			m_metrics.observe(Metrics::REQUEST_SECONDS, frameTimer.nsecsElapsed(), frame);
 		// if we want to continue processing, but have no data in buffer, get out anyway and wait for more data.
 		if(hasDataToProcess)
 			hasDataToProcess = not m_pendingBuffer.isEmpty();
@@ -934,7 +1010,8 @@ void MainWindow::processDebug(const QString& str)
 void MainWindow::on_resetArduino_clicked()
 {
 	m_isConnected = false;
-	m_iface.reset();
+	// Resetting the Arduino starts over, the swap list and its disks are dropped as well.
+	m_iface.reset(true);
 #ifdef HAS_WIRINGPI
 	Log("MAIN", "Moving to disconnected state and resetting arduino...", warning);
 	// pull pin 23 to reset arduino.
@@ -1217,6 +1294,8 @@ void MainWindow::imageMounted(const QString& imagePath, FileDriverBase* pFileSys
 		m_imageDirListing.clear();
 	}
 	ui->unmountCurrent->setEnabled(true);
+	ui->actionMerge_image_changes->setEnabled(true);
+	ui->actionDiscard_image_changes->setEnabled(true);
 
 	int ix = 0;
 	// select the image name in the directory file list!
@@ -1241,6 +1320,8 @@ void MainWindow::imageUnmounted()
 	ui->imageDirList->clear();
 	ui->nowMounted->setText("None, Local FS: " + m_appSettings.imageDirectory);
 	ui->unmountCurrent->setEnabled(false);
+	ui->actionMerge_image_changes->setEnabled(false);
+	ui->actionDiscard_image_changes->setEnabled(false);
 } // imageUnmounted
 
 
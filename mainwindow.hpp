@@ -91,6 +91,11 @@ private slots:
 	void simTimerExpired();
 	void simTimerExpiredNoResp();
 	void on_actionSingle_file_mount_triggered();
+	void on_actionMerge_image_changes_triggered();
+	void on_actionDiscard_image_changes_triggered();
+	void on_actionNext_disk_triggered();
+	void on_actionPrevious_disk_triggered();
+	void on_actionRecord_trace_toggled(bool checked);
 
 private:
 	bool checkConnectRequest(QByteArray& buffer);
@@ -117,6 +122,9 @@ private:
 	bool m_isConnected;
 	FacilityMap m_clientFacilities;
 	Interface m_iface;
+	Tracer m_tracer;
+	Metrics m_metrics;
+	MetricsServer m_metricsServer;
 	QList<QSerialPortInfo> m_ports;
 	QStandardItemModel* m_dirListItemModel;
 	QFileInfoList m_filteredInfoList;
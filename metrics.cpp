@@ -0,0 +1,191 @@
+#include <QLocalSocket>
+
+#include "metrics.hpp"
+#include "logger.hpp"
+
+using namespace Logging;
+
+namespace {
+const QString FAC_METRICS("METRICS");
+
+struct Definition
+{
+	const char* name;
+	const char* help;
+	// Name of the label histograms are split by, if any.
+	const char* label;
+};
+
+const Definition s_counters[Metrics::NUM_COUNTERS] = {
+	{ "uno2iec_load_bytes_total", "Bytes sent to the CBM for LOADs and reads.", 0 },
+	{ "uno2iec_save_bytes_total", "Bytes received from the CBM for SAVEs and writes.", 0 },
+	{ "uno2iec_serial_resyncs_total", "Serial communication errors (97) reported by the Arduino.", 0 },
+	{ "uno2iec_reconnects_total", "Connection requests from the Arduino while already connected.", 0 },
+	{ "uno2iec_drive_decode_cache_hits_total", "Drive code instructions found in the decode cache.", 0 },
+	{ "uno2iec_drive_decode_cache_misses_total", "Drive code instructions that had to be decoded.", 0 }
+};
+
+const Definition s_histograms[Metrics::NUM_HISTOGRAMS] = {
+	{ "uno2iec_request_duration_seconds", "Time serving a request from the Arduino.", "frame" },
+	{ "uno2iec_listing_duration_seconds", "Time producing a directory listing or media info.", 0 }
+};
+
+// Upper bounds of the histogram buckets, in seconds. Serving a request should take well below a millisecond, listing
+// large directories may take seconds.
+const double s_bucketBounds[] = { 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.5, 1, 5 };
+const int s_numBuckets = sizeof(s_bucketBounds) / sizeof(s_bucketBounds[0]);
+
+// Requests larger than this without the end of the header are dropped.
+const int s_maxRequestSize = 8192;
+
+
+void appendHeader(QByteArray& out, const Definition& def, const char* type)
+{
+	out.append(QString("# HELP %1 %2\n# TYPE %1 %3\n").arg(def.name, def.help, type).toLatin1());
+} // appendHeader
+
+
+QString labelsOf(const Definition& def, const QString& value, const QString& le = QString())
+{
+	QStringList labels;
+	if(0 not_eq def.label)
+		labels.append(QString("%1=\"%2\"").arg(def.label, value));
+	if(not le.isEmpty())
+		labels.append(QString("le=\"%1\"").arg(le));
+	return labels.isEmpty() ? QString() : "{" + labels.join(",") + "}";
+} // labelsOf
+
+} // anonymous
+
+
+Metrics::Metrics()
+	: m_counters(NUM_COUNTERS, 0)
+	, m_histograms(NUM_HISTOGRAMS)
+{
+} // ctor
+
+
+void Metrics::add(Counter counter, quint64 amount)
+{
+	m_counters[counter] += amount;
+} // add
+
+
+void Metrics::set(Counter counter, quint64 value)
+{
+	m_counters[counter] = value;
+} // set
+
+
+void Metrics::observe(Histogram histogram, qint64 nanoSeconds, const QString& label)
+{
+	Buckets& buckets = m_histograms[histogram][label];
+	if(buckets.counts.isEmpty()) {
+		buckets.counts.fill(0, s_numBuckets + 1);
+		buckets.sum = 0;
+		buckets.count = 0;
+	}
+	double seconds = nanoSeconds / 1e9;
+	int bucket = 0;
+	while(bucket < s_numBuckets and seconds > s_bucketBounds[bucket])
+		++bucket;
+	++buckets.counts[bucket];
+	buckets.sum += seconds;
+	++buckets.count;
+} // observe
+
+
+QByteArray Metrics::exposition() const
+{
+	QByteArray out;
+	for(int i = 0; i < NUM_COUNTERS; ++i) {
+		appendHeader(out, s_counters[i], "counter");
+		out.append(QString("%1 %2\n").arg(s_counters[i].name).arg(m_counters.at(i)).toLatin1());
+	}
+	for(int i = 0; i < NUM_HISTOGRAMS; ++i) {
+		const Definition& def = s_histograms[i];
+		appendHeader(out, def, "histogram");
+		QMapIterator<QString, Buckets> it(m_histograms.at(i));
+		while(it.hasNext()) {
+			it.next();
+			const Buckets& buckets = it.value();
+			quint64 cumulative = 0;
+			for(int bucket = 0; bucket <= s_numBuckets; ++bucket) {
+				cumulative += buckets.counts.at(bucket);
+				QString le = bucket < s_numBuckets ? QString::number(s_bucketBounds[bucket]) : QString("+Inf");
+				out.append(QString("%1_bucket%2 %3\n").arg(def.name, labelsOf(def, it.key(), le)).arg(cumulative).toLatin1());
+			}
+			out.append(QString("%1_sum%2 %3\n").arg(def.name, labelsOf(def, it.key())).arg(buckets.sum, 0, 'g', 9).toLatin1());
+			out.append(QString("%1_count%2 %3\n").arg(def.name, labelsOf(def, it.key())).arg(buckets.count).toLatin1());
+		}
+	}
+	return out;
+} // exposition
+
+
+MetricsServer::MetricsServer(const Metrics& metrics, QObject* parent)
+	: QObject(parent), m_metrics(metrics)
+{
+	connect(&m_server, SIGNAL(newConnection()), this, SLOT(onNewConnection()));
+} // ctor
+
+
+bool MetricsServer::listen(const QString& path)
+{
+	close();
+	QLocalServer::removeServer(path);
+	// Only local collectors of the same user should read the metrics.
+	m_server.setSocketOptions(QLocalServer::UserAccessOption);
+	if(not m_server.listen(path)) {
+		Log(FAC_METRICS, error, QString("Failed serving metrics at %1: %2").arg(path, m_server.errorString()));
+		return false;
+	}
+	Log(FAC_METRICS, success, QString("Serving metrics at %1").arg(m_server.fullServerName()));
+	return true;
+} // listen
+
+
+void MetricsServer::close()
+{
+	if(m_server.isListening())
+		m_server.close();
+} // close
+
+
+void MetricsServer::onNewConnection()
+{
+	while(m_server.hasPendingConnections()) {
+		QLocalSocket* socket = m_server.nextPendingConnection();
+		connect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+		connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+	}
+} // onNewConnection
+
+
+void MetricsServer::onReadyRead()
+{
+	QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+	if(0 == socket)
+		return;
+	// Leave the request in the socket until its header is complete.
+	QByteArray request = socket->peek(socket->bytesAvailable());
+	if(not request.contains("\r\n\r\n") and not request.contains("\n\n")) {
+		if(request.size() > s_maxRequestSize)
+			socket->abort();
+		return;
+	}
+	socket->readAll();
+	disconnect(socket, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+
+	QByteArray response;
+	if(request.startsWith("GET ")) {
+		QByteArray body = m_metrics.exposition();
+		response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+				+ QByteArray::number(body.size()) + "\r\n\r\n" + body;
+	}
+	else
+		response = "HTTP/1.0 405 Method Not Allowed\r\nContent-Length: 0\r\n\r\n";
+	socket->write(response);
+	// Closes once everything is written.
+	socket->disconnectFromServer();
+} // onReadyRead
@@ -0,0 +1,75 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <QLocalServer>
+#include <QMap>
+#include <QVector>
+
+// Counters and latency histograms of the host, for running it unattended. They are rendered in the Prometheus text
+// exposition format, see MetricsServer for how they are published.
+class Metrics
+{
+public:
+	enum Counter {
+		LOAD_BYTES,						// Bytes sent to the CBM for LOADs and reads.
+		SAVE_BYTES,						// Bytes received from the CBM for SAVEs and writes.
+		SERIAL_RESYNCS,				// Error 97 reported by the Arduino, it lost sync with us.
+		RECONNECTS,						// Connection requests from the Arduino while already connected.
+		DECODE_CACHE_HITS,		// Instructions of drive code found decoded already.
+		DECODE_CACHE_MISSES,	// Instructions of drive code that had to be decoded.
+		NUM_COUNTERS
+	};
+
+	enum Histogram {
+		REQUEST_SECONDS,			// Time serving a request frame from the Arduino, by frame type.
+		LISTING_SECONDS,			// Time producing a directory listing or media info.
+		NUM_HISTOGRAMS
+	};
+
+	Metrics();
+
+	void add(Counter counter, quint64 amount = 1);
+	// For counters maintained elsewhere, the value must not decrease.
+	void set(Counter counter, quint64 value);
+	void observe(Histogram histogram, qint64 nanoSeconds, const QString& label = QString());
+
+	QByteArray exposition() const;
+
+private:
+	struct Buckets
+	{
+		// Cumulative counts are computed when rendering, each entry counts only its own bucket.
+		QVector<quint64> counts;
+		double sum;
+		quint64 count;
+	};
+
+	QVector<quint64> m_counters;
+	// Per histogram, keyed by label value.
+	QVector<QMap<QString, Buckets> > m_histograms;
+};
+
+
+// Serves the metrics on a local (Unix domain) socket. Each connection gets one HTTP response to its GET request,
+// which is what collectors scraping a socket expect, e.g. curl --unix-socket <path> http://localhost/metrics.
+class MetricsServer : public QObject
+{
+	Q_OBJECT
+
+public:
+	MetricsServer(const Metrics& metrics, QObject* parent = 0);
+
+	// Listen at the path, replacing a socket left behind by a previous run. Returns false on failure.
+	bool listen(const QString& path);
+	void close();
+
+private slots:
+	void onNewConnection();
+	void onReadyRead();
+
+private:
+	const Metrics& m_metrics;
+	QLocalServer m_server;
+};
+
+#endif // METRICS_HPP
@@ -1,17 +1,97 @@
 #include "nativefs.hpp"
 #include "logger.hpp"
 #include <QDir>
+#include <QtConcurrentRun>
 #include <math.h>
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif
 
 using namespace Logging;
 
 namespace {
 const QString strDir("DIR");
 const QString strPrg("PRG");
+
+// Chunk size for copies not done by the kernel.
+const int COPY_CHUNK_SIZE = 64 * 1024;
+
+#ifdef Q_OS_LINUX
+// Copy as much of source to dest at destPos as the kernel does for us, without the data passing through user space.
+// copy_file_range() needs both on the same file system, sendfile() doesn't. Returns the number of bytes copied, the
+// rest is up to the caller.
+qint64 copyInKernel(QFile& source, QFile& dest, qint64 destPos)
+{
+	struct stat sourceStat, destStat;
+	int in = source.handle(), out = dest.handle();
+	if(fstat(in, &sourceStat) or fstat(out, &destStat))
+		return 0;
+	loff_t inPos = 0, outPos = destPos;
+	bool copyRange = sourceStat.st_dev == destStat.st_dev;
+	if(not copyRange and lseek(out, outPos, SEEK_SET) < 0)
+		return 0;
+	while(inPos < sourceStat.st_size) {
+		ssize_t copied;
+		if(copyRange) {
+			copied = copy_file_range(in, &inPos, out, &outPos, sourceStat.st_size - inPos, 0);
+			// Not supported by the file system (or kernel), try sendfile() for the rest.
+			if(copied < 0) {
+				copyRange = false;
+				if(lseek(out, outPos, SEEK_SET) < 0)
+					break;
+				continue;
+			}
+		}
+		else
+			copied = sendfile(out, in, &inPos, sourceStat.st_size - inPos);
+		if(copied <= 0)
+			break;
+	}
+	return inPos;
+} // copyInKernel
+#endif
+
+// Concatenate the sources into the existing (possibly preallocated) destination, in chunks. The destination is removed
+// again if anything fails.
+bool copyData(const QStringList& sourceNames, const QString& destName)
+{
+	QFile destFile(destName);
+	bool success = destFile.open(QFile::ReadWrite);
+	qint64 destPos = 0;
+	QByteArray buffer(COPY_CHUNK_SIZE, 0);
+	foreach(const QString& source, sourceNames) {
+		QFile sourceFile(source);
+		success = success and sourceFile.open(QFile::ReadOnly);
+		if(not success)
+			break;
+		qint64 copied = 0;
+#ifdef Q_OS_LINUX
+		if(1 == sourceNames.size())
+			copied = copyInKernel(sourceFile, destFile, destPos);
+#endif
+		success = sourceFile.seek(copied) and destFile.seek(destPos + copied);
+		destPos += copied;
+		while(success and (copied = sourceFile.read(buffer.data(), COPY_CHUNK_SIZE)) > 0) {
+			success = destFile.write(buffer.constData(), copied) == copied;
+			destPos += copied;
+		}
+		success = success and copied >= 0;
+	}
+	// Drop what was preallocated for sources that have shrunk in the meantime.
+	success = success and destFile.resize(destPos);
+	destFile.close();
+	if(not success)
+		destFile.remove();
+	return success;
+} // copyData
 }
 
 NativeFS::NativeFS()
-	: m_listDirectories(false)
+	: m_listDirectories(false), m_copyError(CBM::ErrOK)
 {
 } // ctor
 
@@ -39,6 +119,7 @@ void NativeFS::unmountHostImage()
 
 bool NativeFS::fopen(const QString& fileName)
 {
+	waitForCopy();
 	unmountHostImage();
 	m_hostFile.setFileName(fileName);
 	bool success = m_hostFile.open(QIODevice::ReadOnly);
@@ -50,6 +131,7 @@ bool NativeFS::fopen(const QString& fileName)
 
 CBM::IOErrorMessage NativeFS::fopenWrite(const QString &fileName, bool replaceMode)
 {
+	waitForCopy();
 	unmountHostImage();
 	m_hostFile.setFileName(fileName);
 	if(m_hostFile.exists() and not replaceMode)
@@ -103,12 +185,14 @@ bool NativeFS::fileExists(const QString &filePath)
 
 CBM::IOErrorMessage NativeFS::renameFile(const QString &oldName, const QString &newName)
 {
+	waitForCopy();
 	return QFile::rename(oldName, newName) ? CBM::ErrOK : CBM::ErrFileNotFound;
 } // renameFile
 
 
 bool NativeFS::deleteFile(const QString &fileName)
 {
+	waitForCopy();
 	return QFile::remove(fileName);
 } // deleteFile
 
@@ -135,28 +219,69 @@ bool NativeFS::close()
 
 CBM::IOErrorMessage NativeFS::copyFiles(const QStringList &sourceNames, const QString &destName)
 {
-	QFile destFile(destName);
-	if(not destFile.open(QFile::WriteOnly))
-		return CBM::ErrWriteProtectOn; // TODO: Maybe find out better reason for error.
-
-	// copy (append) each file from the list.
+	waitForCopy();
+	// What can be checked is checked here, the copy (append) of each file from the list runs on a worker so the command
+	// channel is answered right away.
+	// The worker gets absolute paths, the current directory may change while it runs.
+	qint64 size = 0;
+	QStringList sources;
 	foreach(const QString& source, sourceNames) {
-		QFile sourceFile(source);
-		if(not sourceFile.open(QFile::ReadOnly)) {
-			destFile.close();
-			destFile.remove();
+		QFileInfo sourceInfo(source);
+		if(not sourceInfo.isFile() or not sourceInfo.isReadable())
 			return CBM::ErrFileNotFound;
-		}
-		destFile.write(sourceFile.readAll());
-		sourceFile.close();
+		size += sourceInfo.size();
+		sources.append(sourceInfo.absoluteFilePath());
 	}
+	const QString dest(QFileInfo(destName).absoluteFilePath());
+
+	QFile destFile(dest);
+	if(not destFile.open(QFile::WriteOnly))
+		return CBM::ErrWriteProtectOn; // TODO: Maybe find out better reason for error.
+#ifdef Q_OS_LINUX
+	// Preallocate the destination, which also tells right away if it fits. Unlike posix_fallocate() this never falls back
+	// to writing the file out here, a file system that can't preallocate (EOPNOTSUPP) just leaves it to the copy.
+	if(size and 0 not_eq fallocate(destFile.handle(), 0, 0, size) and ENOSPC == errno) {
+		destFile.close();
+		destFile.remove();
+		return CBM::ErrDiskFullOrDirectoryFull;
+	}
+#endif
 	destFile.close();
+
+	Log("NATIVEFS", info, QString("Copying %1 file(s), %2 bytes to %3.").arg(QString::number(sourceNames.size())
+		, QString::number(size), dest));
+	m_copyDest = dest;
+	m_copy = QtConcurrent::run(copyData, sources, dest);
 	return CBM::ErrOK;
 } // copyFiles
 
 
-bool NativeFS::sendListing(ISendLine& cb)
+void NativeFS::waitForCopy()
+{
+	if(m_copyDest.isEmpty())
+		return;
+	if(m_copy.result())
+		Log("NATIVEFS", success, QString("Copied to %1.").arg(m_copyDest));
+	else {
+		Log("NATIVEFS", error, QString("Copying to %1 failed.").arg(m_copyDest));
+		m_copyError = CBM::ErrWriteVerify;
+	}
+	m_copyDest.clear();
+} // waitForCopy
+
+
+CBM::IOErrorMessage NativeFS::takeCopyError()
+{
+	waitForCopy();
+	CBM::IOErrorMessage copyError = m_copyError;
+	m_copyError = CBM::ErrOK;
+	return copyError;
+} // takeCopyError
+
+
+bool NativeFS::sendListing(ISendLine& cb, const DirFilter& filter)
 {
+	waitForCopy();
 	QDir dir(QDir::current());
 	QString dirName(dir.dirName().toUpper());
 	dirName.truncate(23);
@@ -184,13 +309,19 @@ bool NativeFS::sendListing(ISendLine& cb)
 
 	cb.send(0, line);
 
-	QFileInfoList list(dir.entryInfoList(filters, QDir::NoDot bitor QDir::Files
-																			 bitor (m_listDirectories ? QDir::AllDirs : QDir::Files), QDir::Name bitor QDir::DirsFirst));
+	// A pattern of the CBM side selects by name, directories included. The configured filters still apply to files.
+	QStringList nameFilters(filter.nameFilters());
+	QDir::Filters dirFilter(nameFilters.isEmpty() ? QDir::AllDirs : QDir::Dirs);
+	QFileInfoList list(dir.entryInfoList(nameFilters.isEmpty() ? filters : nameFilters, QDir::NoDot bitor QDir::Files
+																			 bitor (m_listDirectories ? dirFilter : QDir::Files), QDir::Name bitor QDir::DirsFirst));
 
 	Log("NATIVEFS", info, QString("Listing %1 entrie(s) to CBM.").arg(QString::number(list.count())));
 	while(not list.isEmpty()) {
 		QFileInfo entry = list.first();
 		list.removeFirst();
+		if(not filter.matchesType(entry.isDir() ? strDir : strPrg)
+			 or (not nameFilters.isEmpty() and entry.isFile() and not filters.isEmpty() and not QDir::match(filters, entry.fileName())))
+			continue;
 		line = "   \"";
 		line.append(entry.fileName().toUpper());
 		line.append("\" ");
@@ -237,6 +368,7 @@ FileDriverBase::FSStatus NativeFS::status() const
 
 bool NativeFS::setCurrentDirectory(const QString& dir)
 {
+	waitForCopy();
 	bool wasSuccess = QDir::setCurrent(dir);
 	if(wasSuccess)
 		Log("NATIVEFS", success, QString("Changing current directory to: %1").arg(QDir::currentPath()));
@@ -1,6 +1,8 @@
 #ifndef NATIVEFS_HPP
 #define NATIVEFS_HPP
 
+#include <QFuture>
+
 #include "filedriverbase.hpp"
 
 class NativeFS : public FileDriverBase
@@ -8,7 +10,9 @@ class NativeFS : public FileDriverBase
 public:
 	NativeFS();
 	virtual ~NativeFS()
-	{}
+	{
+		waitForCopy();
+	}
 
 	const QStringList& extension() const
 	{
@@ -24,7 +28,7 @@ public:
 	void unmountHostImage();
 
 	// Send realistic $ file basic listing, line by line (returning false means not supported).
-	bool sendListing(ISendLine& cb);
+	bool sendListing(ISendLine& cb, const DirFilter& filter = DirFilter());
 	bool supportsListing() const
 	{
 		return true;
@@ -51,6 +55,9 @@ public:
 	bool putc(char c);
 	bool close();
 	CBM::IOErrorMessage copyFiles(const QStringList& sourceNames, const QString &destName);
+	// Special method only for native fs: Waits for the copy running in the background (if any). Returns the error of a
+	// background copy that failed since the last call, CBM::ErrOK if there is none.
+	CBM::IOErrorMessage takeCopyError();
 
 	// Command to the command channel.
 	CBM::IOErrorMessage cmdChannel(const QString& cmd);
@@ -64,6 +71,15 @@ protected:
 	QString m_filters;
 	bool m_listDirectories;
 
+private:
+	// Copies run on a worker. Anything touching files waits for the one running (if any) to complete first.
+	void waitForCopy();
+
+	QFuture<bool> m_copy;
+	// Destination of the copy running, empty if there is none.
+	QString m_copyDest;
+	// Error of the last copy that failed and wasn't reported to the CBM yet.
+	CBM::IOErrorMessage m_copyError;
 };
 
 #endif // NATIVEFS_HPP
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui serialport
+QT       += core gui serialport network concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -68,7 +68,13 @@ SOURCES += main.cpp\
 				x64driver.cpp \
 				logfiltersetup.cpp \
 				qcmdtextedit.cpp \
-				mountspecificfile.cpp
+				mountspecificfile.cpp \
+				drivecodetracker.cpp \
+				cpu6502.cpp \
+				drive1541.cpp \
+				sectoroverlay.cpp \
+				tracer.cpp \
+				metrics.cpp
 
 HEADERS += mainwindow.hpp \
 				t64driver.hpp \
@@ -89,7 +95,13 @@ HEADERS += mainwindow.hpp \
 				logfiltersetup.hpp \
 				qcmdtextedit.h \
 				mountspecificfile.h \
-				utils.hpp
+				utils.hpp \
+				drivecodetracker.hpp \
+				cpu6502.hpp \
+				drive1541.hpp \
+				sectoroverlay.hpp \
+				tracer.hpp \
+				metrics.hpp
 
 FORMS += mainwindow.ui \
 				aboutdialog.ui \
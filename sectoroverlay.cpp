@@ -0,0 +1,149 @@
+#include <QDir>
+#include <QFileInfo>
+
+#include "sectoroverlay.hpp"
+#include "logger.hpp"
+
+using namespace Logging;
+
+namespace {
+const QString FAC_OVERLAY("OVERLAY");
+
+const QByteArray s_magic("UOV1");
+const int s_sectorSize = 256;
+const int s_offsetSize = 4;
+
+} // anonymous
+
+
+SectorOverlay::SectorOverlay()
+{
+} // ctor
+
+
+SectorOverlay::~SectorOverlay()
+{
+	close();
+} // dtor
+
+
+bool SectorOverlay::open(const QString& imagePath, const QString& overlayDir)
+{
+	close();
+	QFileInfo image(imagePath);
+	// Images of the same name in different directories must not share an overlay.
+	QString name = QString("%1-%2.ovl").arg(image.fileName())
+			.arg(qHash(image.absoluteFilePath()), 8, 16, QChar('0'));
+	m_imagePath = imagePath;
+	m_file.setFileName(QDir(overlayDir).filePath(name));
+	if(not m_file.exists())
+		return true;
+
+	if(not m_file.open(QIODevice::ReadWrite) or m_file.read(s_magic.size()) not_eq s_magic) {
+		Log(FAC_OVERLAY, error, QString("Can't use overlay file %1").arg(m_file.fileName()));
+		close();
+		return false;
+	}
+	// A record cut short (crash while writing) is ignored, the next write of that sector replaces it.
+	for(;;) {
+		QByteArray offset = m_file.read(s_offsetSize);
+		qint64 pos = m_file.pos();
+		if(offset.size() < s_offsetSize or not m_file.seek(pos + s_sectorSize) or m_file.size() < pos + s_sectorSize)
+			break;
+		qint32 imageOffset = 0;
+		for(int i = s_offsetSize - 1; i >= 0; --i)
+			imageOffset = (imageOffset << 8) bitor uchar(offset.at(i));
+		m_records[imageOffset] = pos;
+	}
+	Log(FAC_OVERLAY, info, QString("Using overlay %1 with %2 modified sectors").arg(m_file.fileName()).arg(m_records.size()));
+	return true;
+} // open
+
+
+void SectorOverlay::close()
+{
+	if(m_file.isOpen())
+		m_file.close();
+	m_records.clear();
+	m_imagePath.clear();
+} // close
+
+
+void SectorOverlay::apply(QByteArray& image)
+{
+	QMap<qint32, qint64>::const_iterator it;
+	for(it = m_records.constBegin(); it not_eq m_records.constEnd(); ++it) {
+		if(it.key() + s_sectorSize > image.size() or not m_file.seek(it.value()))
+			continue;
+		image.replace(it.key(), s_sectorSize, m_file.read(s_sectorSize));
+	}
+} // apply
+
+
+bool SectorOverlay::write(qint32 offset, const QByteArray& sector)
+{
+	if(not isOpen() or sector.size() not_eq s_sectorSize)
+		return false;
+
+	if(not m_file.isOpen()) {
+		QDir().mkpath(QFileInfo(m_file.fileName()).absolutePath());
+		if(not m_file.open(QIODevice::ReadWrite bitor QIODevice::Truncate) or m_file.write(s_magic) not_eq s_magic.size()) {
+			Log(FAC_OVERLAY, error, QString("Can't create overlay file %1").arg(m_file.fileName()));
+			m_file.close();
+			return false;
+		}
+	}
+
+	qint64 pos = m_records.value(offset, -1);
+	if(pos < 0) {
+		QByteArray record;
+		for(int i = 0; i < s_offsetSize; ++i)
+			record.append(char((offset >> (8 * i)) bitand 0xff));
+		pos = m_file.size() + s_offsetSize;
+		if(not m_file.seek(m_file.size()) or m_file.write(record) not_eq s_offsetSize)
+			return false;
+	}
+	else if(not m_file.seek(pos))
+		return false;
+
+	if(m_file.write(sector) not_eq s_sectorSize or not m_file.flush())
+		return false;
+	m_records[offset] = pos;
+	return true;
+} // write
+
+
+bool SectorOverlay::merge()
+{
+	if(not isOpen())
+		return false;
+	if(m_records.isEmpty())
+		return true;
+
+	QFile image(m_imagePath);
+	if(not image.open(QIODevice::ReadWrite)) {
+		Log(FAC_OVERLAY, error, QString("Can't open %1 for writing, overlay kept").arg(m_imagePath));
+		return false;
+	}
+	QMap<qint32, qint64>::const_iterator it;
+	for(it = m_records.constBegin(); it not_eq m_records.constEnd(); ++it) {
+		if(not m_file.seek(it.value()) or not image.seek(it.key()) or image.write(m_file.read(s_sectorSize)) not_eq s_sectorSize) {
+			Log(FAC_OVERLAY, error, QString("Writing to %1 failed, overlay kept").arg(m_imagePath));
+			return false;
+		}
+	}
+	image.close();
+	Log(FAC_OVERLAY, success, QString("Merged %1 sectors into %2").arg(m_records.size()).arg(m_imagePath));
+	return discard();
+} // merge
+
+
+bool SectorOverlay::discard()
+{
+	if(not isOpen())
+		return false;
+	m_records.clear();
+	if(m_file.isOpen())
+		m_file.close();
+	return not m_file.exists() or m_file.remove();
+} // discard
@@ -0,0 +1,51 @@
+#ifndef SECTOROVERLAY_HPP
+#define SECTOROVERLAY_HPP
+
+#include <QFile>
+#include <QMap>
+
+// Copy-on-write layer over a sector image that is itself never written to. Modified sectors are kept in a sparse
+// overlay file holding only those sectors, so mounting stays instant and the cost of a write is proportional to the
+// change. The overlay survives unmounting, it is picked up again when the same image is mounted the next time, until it
+// is merged into the image or discarded.
+//
+// Overlay file layout: The magic "UOV1", followed by records of the (little endian, 32 bit) byte offset of a sector in
+// the image and its 256 bytes of content. Writing a sector again overwrites its record in place.
+class SectorOverlay
+{
+public:
+	SectorOverlay();
+	~SectorOverlay();
+
+	// Attach to the overlay of the image at imagePath, kept in overlayDir. Nothing is created before the first write.
+	// Returns false if an existing overlay file can't be read.
+	bool open(const QString& imagePath, const QString& overlayDir);
+	void close();
+	bool isOpen() const
+	{
+		return not m_imagePath.isEmpty();
+	}
+
+	// Number of sectors modified.
+	int numSectors() const
+	{
+		return m_records.size();
+	}
+	// Copy the modified sectors over the image content.
+	void apply(QByteArray& image);
+	// Store the new content of the sector at offset in the image.
+	bool write(qint32 offset, const QByteArray& sector);
+
+	// Write all modified sectors back to the image file and remove the overlay.
+	bool merge();
+	// Drop all modifications and remove the overlay.
+	bool discard();
+
+private:
+	QString m_imagePath;
+	QFile m_file;
+	// Position of each sector's content in the overlay file, by offset in the image.
+	QMap<qint32, qint64> m_records;
+};
+
+#endif // SECTOROVERLAY_HPP
@@ -31,6 +31,8 @@ struct AppSettings {
 	QString cbmMachine;
 	QString emulatorPalette;
 	ushort cbmBorderWidth;
+	// Unix socket path the metrics are served at, empty for none.
+	QString metricsSocket;
 };
 
 
@@ -18,6 +18,8 @@ using namespace Logging;
 
 // Dir section
 #define T64_FIRST_DIR_OFFSET 0x40
+#define T64_DIR_ENTRY_SIZE 32
+#define T64_FILE_NAME_SIZE 16
 
 #define OFFSET_PRE1 0xFFFE            // "Magic" offsets used for keeping track of that the first bytes that should be returned
 #define OFFSET_PRE2 0xFFFF            // when reading from the file is the basic start address (which is actually stored in the header and not as the first bytes of the file).
@@ -25,11 +27,19 @@ using namespace Logging;
 namespace {
 const QString strTapeEnd("TAPE END.");
 const QString strPrg("PRG");
+
+// The name of a directory entry or searched for without its padding, as found in the name index.
+QByteArray withoutPadding(QByteArray name)
+{
+	while(name.endsWith(' '))
+		name.chop(1);
+	return name;
+} // withoutPadding
 }
 
 
 T64::T64(const QString& fileName)
-	:  FileDriverBase(), m_hostFile(fileName), m_dirEntries(0), m_dirEntry(0),
+	:  FileDriverBase(), m_hostFile(fileName), m_image(0), m_imageSize(0), m_dirEntries(0), m_fileData(0),
 		m_fileOffset(0), m_fileLength(0)
 {
 	if(not fileName.isEmpty())
@@ -48,27 +58,29 @@ bool T64::mountHostImage(const QString& fileName)
 	unmountHostImage();
 	m_hostFile.setFileName(fileName);
 	// Analyse the file open in host file system and if it is a valid t64, set up
-	// variables
+	// variables. The image is mapped (or read if it can't be) and its directory indexed once, here.
 	if(m_hostFile.open(QIODevice::ReadOnly)) {
-		// Before going on, check filesize. This also checks if a file IS open
-		if(hostSize() >= 64) {
-			// Verify first three bytes of file signature:
-			hostSeek(T64_SIGNATURE_OFFSET);
-
-			if((hostReadByte() == 'C') and (hostReadByte() == '6') and (hostReadByte() == '4')) {
-				// Read header, get dir information
-				hostSeek(T64_ENTRIES_LO_OFFSET);
-				m_dirEntries = (unsigned short)hostReadByte();
-				hostSeek(T64_ENTRIES_HI_OFFSET);
-				m_dirEntries or_eq (unsigned short)hostReadByte() << 8;
-
-				// We are happy
-				m_status = IMAGE_OK;
-				m_lastOpenedFileName = QString("Image: ") + fileName;
-				return true;
-			}
+		m_imageSize = m_hostFile.size();
+		if(m_imageSize)
+			m_image = m_hostFile.map(0, m_imageSize);
+		if(0 == m_image) {
+			m_imageData = m_hostFile.readAll();
+			m_image = reinterpret_cast<const uchar*>(m_imageData.constData());
+			m_imageSize = m_imageData.size();
+		}
+		// Before going on, check filesize and verify first three bytes of file signature:
+		if(m_imageSize >= T64_FIRST_DIR_OFFSET and 0 == memcmp(m_image + T64_SIGNATURE_OFFSET, "C64", 3)) {
+			// Read header, get dir information
+			m_dirEntries = m_image[T64_ENTRIES_LO_OFFSET] bitor (m_image[T64_ENTRIES_HI_OFFSET] << 8);
+			indexDirectory();
+
+			// We are happy
+			m_status = IMAGE_OK;
+			m_lastOpenedFileName = QString("Image: ") + fileName;
+			return true;
 		}
 	}
+	unmountHostImage();
 	m_lastOpenedFileName.clear();
 
 	// yikes.
@@ -78,6 +90,14 @@ bool T64::mountHostImage(const QString& fileName)
 
 void T64::unmountHostImage()
 {
+	m_entries.clear();
+	m_nameIndex.clear();
+	m_fileData = 0;
+	if(0 not_eq m_image and m_imageData.isEmpty())
+		m_hostFile.unmap(const_cast<uchar*>(m_image));
+	m_image = 0;
+	m_imageSize = 0;
+	m_imageData.clear();
 	if(not m_hostFile.fileName().isEmpty() and m_hostFile.isOpen())
 		m_hostFile.close();
 	// Reset status
@@ -85,35 +105,40 @@ void T64::unmountHostImage()
 } // unmountHostImage
 
 
-uchar T64::hostReadByte(uint length)
-{
-	char theByte;
-	qint64 numRead(m_hostFile.read(&theByte, length));
-	if(numRead < length) // shouldn't happen?
-		m_status = FILE_EOF;
-
-	return theByte;
-} // hostReadByte
-
-
-bool T64::hostSeek(qint32 pos, bool relative)
-{
-	if(relative)
-		pos += m_hostFile.pos();
-
-	return m_hostFile.seek(pos);
-} // hostSeek
-
-
-void T64::seekToTapeName(void)
+void T64::indexDirectory()
 {
-	if(m_status bitand IMAGE_OK) {
-		hostSeek(T64_TAPE_NAME_OFFSET);
-
-		// Now we have moved the file pointer, we are only tape_ok:
-		m_status = IMAGE_OK;
+	m_entries.clear();
+	m_nameIndex.clear();
+	for(int i = 0; i < m_dirEntries; ++i) {
+		qint64 pos = T64_FIRST_DIR_OFFSET + qint64(i) * T64_DIR_ENTRY_SIZE;
+		// The directory may claim more entries than the image holds.
+		if(pos + T64_DIR_ENTRY_SIZE > m_imageSize)
+			break;
+		const uchar* record = m_image + pos;
+		// Acceptable filetype?
+		if(0 == record[0] or 0 == record[1])
+			continue;
+
+		DirEntry dir;
+		dir.startAddress[0] = record[2];
+		dir.startAddress[1] = record[3];
+		dir.length = ((ushort)record[4] bitor ((ushort)record[5] << 8)) - ((ushort)record[2] bitor ((ushort)record[3] << 8));
+		dir.fileOffset = (quint32)record[8] bitor ((quint32)record[9] << 8) bitor ((quint32)record[10] << 16)
+				bitor ((quint32)record[11] << 24);
+		// Lots of T64 files have wrong end addresses, never serve more than the image holds.
+		if(dir.fileOffset > m_imageSize)
+			dir.length = 0;
+		else if(dir.fileOffset + dir.length > m_imageSize)
+			dir.length = m_imageSize - dir.fileOffset;
+		dir.fileName = QByteArray(reinterpret_cast<const char*>(record + 16), T64_FILE_NAME_SIZE);
+
+		// The first entry of a name is the one opened by it.
+		const QByteArray name(withoutPadding(dir.fileName));
+		if(not m_nameIndex.contains(name))
+			m_nameIndex.insert(name, m_entries.size());
+		m_entries.append(dir);
 	}
-} // seekToTapeName
+} // indexDirectory
 
 
 bool T64::isEOF(void) const
@@ -140,9 +165,11 @@ char T64::getc(void)
 		else if(m_fileOffset == OFFSET_PRE2) {
 			ret = m_fileStartAddress[1];
 			m_fileOffset = 0;
+			if(m_fileOffset == m_fileLength)
+				m_status or_eq FILE_EOF;
 		}
 		else {
-			ret = hostReadByte();
+			ret = m_fileData[m_fileOffset];
 			m_fileOffset++;
 
 			if(m_fileOffset == m_fileLength)
@@ -154,99 +181,63 @@ char T64::getc(void)
 } // fgetc
 
 
-bool T64::seekFirstDir(void)
+FileDriverBase::FSStatus T64::status(void) const
 {
-	if(m_status bitand IMAGE_OK) {
-		// Seek first dir:
-		hostSeek(T64_FIRST_DIR_OFFSET);
-
-		// Set correct status
-		m_status = IMAGE_OK bitor DIR_OPEN;
-		m_dirEntry = 0;
-
-		if(m_dirEntry == m_dirEntries)
-			m_status or_eq DIR_EOF;
-
-		return true;
-	}
-	return false;
-} // seekFirstDir
+	return static_cast<FSStatus>(m_status);
+} // status
 
 
-bool T64::getDirEntry(DirEntry& dir)
+// Looks up a file in the directory index. Filename * will find first file with PRG status
+//
+const T64::DirEntry* T64::findEntry(const QString& fileName) const
 {
-	// Check if correct status
-	if((m_status bitand IMAGE_OK) and (m_status bitand DIR_OPEN)
-		 and not(m_status bitand DIR_EOF)) {
-
-		uchar* pEntry = reinterpret_cast<uchar*>(&dir);
-		// OK, copy current dir to target
-		for(uchar i = 0; i < sizeof(DirEntry); i++)
-			pEntry[i] = hostReadByte();
-
-		m_dirEntry++;
+	uchar len = qMin(fileName.length(), T64_FILE_NAME_SIZE);
 
-		if(m_dirEntry == m_dirEntries)
-			m_status or_eq DIR_EOF;
-
-		return true;
+	// Without wildcards it's just a look up of the name.
+	if(not fileName.contains('?') and not fileName.contains('*')) {
+		QHash<QByteArray, int>::const_iterator it = m_nameIndex.find(withoutPadding(fileName.left(len).toLatin1()));
+		return it == m_nameIndex.end() ? 0 : &m_entries.at(it.value());
 	}
-	return false;
-} // getDirEntry
 
+	for(int entry = 0; entry < m_entries.size(); ++entry) {
+		const DirEntry& dir(m_entries.at(entry));
+		// Compare filename respecting * and ? wildcards
+		bool found = true;
+		uchar i;
+		for(i = 0; i < len and found; i++) {
+			if('?' == fileName.at(i))
+				; // This character is ignored
+			else if('*' == fileName.at(i)) // No need to check more chars
+				break;
+			else
+				found = fileName.at(i) == (uchar)dir.fileName.at(i);
+		}
 
-FileDriverBase::FSStatus T64::status(void) const
-{
-	return static_cast<FSStatus>(m_status);
-} // status
+		// If searched to end of filename, dir.file_name must end here also
+		if(found and i == len)
+			if(len < T64_FILE_NAME_SIZE)
+				found = ' ' == dir.fileName.at(i);
+		if(found)
+			return &dir;
+	}
+	return 0;
+} // findEntry
 
 
 // Opens a file. Filename * will open first file with PRG status
 //
 bool T64::fopen(const QString& fileName)
 {
-	DirEntry dir;
-	bool found = false; // be pessimistic
-	uchar len;
-
-	len = fileName.length();
+	const DirEntry* dir = findEntry(fileName);
 
-	if(fileName.length() > (int)sizeof(dir.fileName))
-		len = sizeof(dir.fileName);
-
-	seekFirstDir();
-
-	while(not found and getDirEntry(dir)) {
-		// Acceptable filetype?
-		if(0 not_eq dir.c64sFileType and 0 not_eq dir.d64FileType) {
-			// Compare filename respecting * and ? wildcards
-			found = true;
-			uchar i;
-			for(i = 0; i < len and found; i++) {
-				if('?' == fileName.at(i))
-					; // This character is ignored
-				else if('*' == fileName.at(i)) // No need to check more chars
-					break;
-				else
-					found = fileName.at(i) == dir.fileName[i];
-			}
-
-			// If searched to end of filename, dir.file_name must end here also
-			if(found and i == len)
-				if(len < sizeof(dir.fileName))
-					found = ' ' == dir.fileName[i];
-		}
-	}
-
-	if(found) {
-		// File found. Set state vars and jump to file
-		m_fileStartAddress[0] = dir.startAddressLo;
-		m_fileStartAddress[1] = dir.startAddressHi;
+	if(0 not_eq dir) {
+		// File found. Set state vars and point to its data
+		m_fileStartAddress[0] = dir->startAddress[0];
+		m_fileStartAddress[1] = dir->startAddress[1];
 
 		m_fileOffset = OFFSET_PRE1;
-		m_fileLength = calcFileLength(dir);
-
-		hostSeek(dir.fileOffset);
+		m_fileLength = dir->length;
+		m_fileData = m_image + dir->fileOffset;
 
 		m_lastOpenedFileName = fileName;
 		m_status = IMAGE_OK bitor FILE_OPEN;
@@ -254,7 +245,7 @@ bool T64::fopen(const QString& fileName)
 	else
 		m_lastOpenedFileName.clear();
 
-	return found;
+	return 0 not_eq dir;
 } // fopen
 
 
@@ -264,15 +255,6 @@ const QString T64::openedFileName() const
 } // openedFileName
 
 
-ushort T64::calcFileLength(DirEntry dir)
-{
-	return ((ushort)dir.endAddressLo
-					bitor ((ushort)dir.endAddressHi << 8))
-			- ((ushort)dir.startAddressLo
-				 bitor ((ushort)dir.startAddressHi << 8));
-} // calcFileLength
-
-
 ushort T64::openedFileSize() const
 {
 	return m_fileLength;
@@ -286,32 +268,29 @@ bool T64::close(void)
 } // close
 
 
-bool T64::sendListing(ISendLine& cb)
+bool T64::sendListing(ISendLine& cb, const DirFilter& filter)
 {
-	seekToTapeName();
+	if(not (m_status bitand IMAGE_OK))
+		return false;
 
 	QString name;
 	for(uchar i = 0; i < 19; ++i) {
-		uchar c = hostReadByte();
+		uchar c = m_image[T64_TAPE_NAME_OFFSET + i];
 		name += 0xA0 == c ? ' ' : c; // Convert padding A0 to spaces
 	}
 
 	name[16] = '"'; // Ending quote
 	cb.send(0, QString("\x12\"%1").arg(name));
 
-	// Now for the list entries
-	seekFirstDir();
-
-	DirEntry dir;
-	while(getDirEntry(dir)) {
-		// Determine if dir entry is valid:
-		if(0 not_eq dir.c64sFileType and 0 not_eq dir.d64FileType) {
-			ushort fileBlocks = (calcFileLength(dir) + T64_BLOCK_DATA - 1) / T64_BLOCK_DATA;
-			// Send filename, which is padded with spaces, line number is just zero.
-			QString line = QString("  \"%1\" %2").arg(QString::fromLocal8Bit(reinterpret_cast<char*>(dir.fileName), sizeof(dir.fileName)), strPrg);
+	// Now for the list entries, all of them valid.
+	foreach(const DirEntry& dir, m_entries) {
+		if(not filter.matchesType(strPrg) or not filter.matchesName(QString::fromLocal8Bit(withoutPadding(dir.fileName))))
+			continue;
+		ushort fileBlocks = (dir.length + T64_BLOCK_DATA - 1) / T64_BLOCK_DATA;
+		// Send filename, which is padded with spaces, line number is just zero.
+		QString line = QString("  \"%1\" %2").arg(QString::fromLocal8Bit(dir.fileName), strPrg);
 
-			cb.send(fileBlocks, line.mid((int)log10((double)fileBlocks)));
-		}
+		cb.send(fileBlocks, line.mid((int)log10((double)fileBlocks)));
 	}
 	// Write line with TAPE_END
 	cb.send(0, strTapeEnd);
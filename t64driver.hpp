@@ -1,6 +1,9 @@
 #ifndef T64DRIVER_H
 #define T64DRIVER_H
 
+#include <QHash>
+#include <QVector>
+
 #include "filedriverbase.hpp"
 
 
@@ -32,7 +35,7 @@ public:
 	// It can be checked if the disk image is considered OK:
 	FSStatus status(void) const;
 
-	bool sendListing(ISendLine& cb);
+	bool sendListing(ISendLine& cb, const DirFilter& filter = DirFilter());
 
 	bool supportsListing() const
 	{
@@ -62,70 +65,36 @@ public:
 	bool close(void);
 
 private:
-#ifdef _MSC_VER
-#pragma pack(push, before_1, 1)
-	typedef struct
-		#else
-	typedef struct __attribute__((packed))
-#endif
+	// A directory record of a file, decoded and checked against the image size when mounting.
+	struct DirEntry
 	{
-		uchar c64sFileType;
-		uchar d64FileType;
-		uchar startAddressLo;
-		uchar startAddressHi;
-		uchar endAddressLo;
-		uchar endAddressHi;
-		uchar unused[2];
-		ulong fileOffset;
-		uchar unused2[4];
-		uchar fileName[16];
-	} DirEntry; // 32 bytes
-
-
-#ifdef _MSC_VER
-	typedef struct
-		#else
-	typedef struct __attribute__((packed))
-#endif
-	{
-		uchar signature[32];
-		ushort versionNo;
-		uchar maxEntriesLo;
-		uchar maxEntriesHi;
-		uchar usedEntriesLo;
-		uchar usedEntriesHi;
-		uchar reserved[2];
-		uchar tapeName[24];
-	} Header; // 32 bytes
-
-#ifdef _MSC_VER
-#pragma pack(pop, before_1)
-#endif
-	// The real host file system D64 image file:
+		QByteArray fileName; // 16 chars padded with spaces
+		uchar startAddress[2];
+		ushort length;
+		quint32 fileOffset;
+	};
+
+	// The real host file system T64 image file. While mounted it's mapped into memory, or read into m_imageData if it
+	// can't be mapped, and everything is served from there.
 	QFile m_hostFile;
+	const uchar* m_image;
+	qint64 m_imageSize;
+	QByteArray m_imageData;
 
-	// T64 driver state variables:
-
+	// Directory slots in the header, the valid entries among them and those by name (without padding).
 	ushort m_dirEntries;
-	ushort m_dirEntry;
+	QVector<DirEntry> m_entries;
+	QHash<QByteArray, int> m_nameIndex;
 
 	// file status
 	uchar  m_fileStartAddress[2]; // first two basic bytes
+	const uchar* m_fileData;
 	ushort m_fileOffset;           // progress in file
 	ushort m_fileLength;
 	QString m_lastOpenedFileName;
 
-	qint32 hostSize() const
-	{
-		return static_cast<qint32>(m_hostFile.size());
-	}
-	uchar hostReadByte(uint length = 1);
-	bool hostSeek(qint32 pos, bool relative = false);
-
-	bool getDirEntry(DirEntry& dir);
-	ushort calcFileLength(DirEntry dir);
-	bool seekFirstDir(void);
-	void seekToTapeName(void);
+	void indexDirectory();
+	const DirEntry* findEntry(const QString& fileName) const;
 };
 
 #endif
@@ -0,0 +1,22 @@
+# Tests for the 1541 emulation that runs M-E and B-E drive code. Build and run with: qmake && make check
+
+QT       += testlib
+
+# The logger the emulation includes pulls in widgets.
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = tst_drive1541
+TEMPLATE = app
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS += -std=gnu++0x
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_drive1541.cpp \
+	../../drive1541.cpp \
+	../../cpu6502.cpp
+
+HEADERS += ../../drive1541.hpp \
+	../../cpu6502.hpp
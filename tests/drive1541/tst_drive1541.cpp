@@ -0,0 +1,55 @@
+#include <QtTest>
+
+#include "drive1541.hpp"
+#include "logger.hpp"
+
+namespace Logging {
+
+// The application's logger isn't part of the test, drop what the emulation logs.
+void Log(const QString& facility, LogLevelE level, const QString& message)
+{
+	Q_UNUSED(facility);
+	Q_UNUSED(level);
+	Q_UNUSED(message);
+} // Log
+
+} // namespace Logging
+
+
+class TestDrive1541 : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void jobInSlotWithoutBuffer();
+};
+
+
+void TestDrive1541::jobInSlotWithoutBuffer()
+{
+	QByteArray ram(CBM1541_RAM_SIZE, 0);
+	QByteArray rom(CBM1541_ROM_SIZE, 0);
+	QByteArray via1(CBM1541_VIA1_SIZE, 0);
+	QByteArray via2(CBM1541_VIA2_SIZE, 0);
+	// At $0300: queue a read job in slot 5 and an execute job in slot 4, then return.
+	const char queueJobs[] = { '\xA9', '\x80', '\x85', '\x05', '\xA9', '\xE0', '\x85', '\x04', '\x60' };
+	ram.replace(0x0300, sizeof(queueJobs), QByteArray(queueJobs, sizeof(queueJobs)));
+	// At $0700, the buffer of slot 4: end the job with result 1 (OK).
+	const char executeJob[] = { '\xA9', '\x01', '\x4C', '\x69', '\xF9' };
+	ram.replace(0x0700, sizeof(executeJob), QByteArray(executeJob, sizeof(executeJob)));
+
+	Drive1541 drive(ram, rom, via1, via2);
+	drive.reset();
+	QCOMPARE(drive.execute(0x0300, NULL), CBM::ErrOK);
+
+	// Slot 5 fails right away, without touching memory past the RAM.
+	QCOMPARE(ram.size(), CBM1541_RAM_SIZE);
+	QCOMPARE(uchar(ram.at(0x05)), uchar(0x0F));
+	// Slot 4 still runs its buffer.
+	QCOMPARE(uchar(ram.at(0x04)), uchar(0x01));
+} // jobInSlotWithoutBuffer
+
+
+QTEST_APPLESS_MAIN(TestDrive1541)
+
+#include "tst_drive1541.moc"
@@ -0,0 +1,156 @@
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "tracer.hpp"
+#include "logger.hpp"
+
+using namespace Logging;
+
+namespace {
+const QString FAC_TRACE("TRACE");
+
+// Process IDs the host and the Arduino show up as.
+const int hostPid = 1;
+const int arduinoPid = 2;
+
+// Length of the timestamp in a marker, after the phase.
+const int markerTimeLength = 8;
+
+
+QJsonObject processName(int pid, const QString& name)
+{
+	QJsonObject args;
+	args["name"] = name;
+	QJsonObject event;
+	event["name"] = QString("process_name");
+	event["ph"] = QString("M");
+	event["pid"] = pid;
+	event["args"] = args;
+	return event;
+} // processName
+
+} // anonymous
+
+
+Tracer::Tracer()
+	: m_active(false), m_lastArduinoUs(0), m_arduinoWraps(0), m_hasOffset(false), m_offsetUs(0)
+{
+} // ctor
+
+
+void Tracer::start()
+{
+	m_hostSpans.clear();
+	m_arduinoMarkers.clear();
+	m_lastArduinoUs = 0;
+	m_arduinoWraps = 0;
+	m_hasOffset = false;
+	m_offsetUs = 0;
+	m_timer.start();
+	m_active = true;
+} // start
+
+
+void Tracer::stop()
+{
+	m_active = false;
+} // stop
+
+
+qint64 Tracer::now() const
+{
+	return m_timer.nsecsElapsed() / 1000;
+} // now
+
+
+void Tracer::addSpan(const QString& name, qint64 beginUs)
+{
+	if(not m_active)
+		return;
+	HostSpan span = { name, beginUs, now() - beginUs };
+	m_hostSpans.append(span);
+} // addSpan
+
+
+bool Tracer::addArduinoMarker(const QString& marker)
+{
+	if(not m_active)
+		return true;
+	bool ok = false;
+	quint32 arduinoUs = marker.mid(1, markerTimeLength).toUInt(&ok, 16);
+	if(marker.length() <= 1 + markerTimeLength or (marker.at(0) not_eq 'B' and marker.at(0) not_eq 'E') or not ok) {
+		Log(FAC_TRACE, warning, QString("Malformed trace marker: %1").arg(marker));
+		return false;
+	}
+
+	if(not m_arduinoMarkers.isEmpty() and arduinoUs < m_lastArduinoUs)
+		++m_arduinoWraps;
+	m_lastArduinoUs = arduinoUs;
+	qint64 extendedUs = (m_arduinoWraps << 32) + arduinoUs;
+	qint64 offsetUs = now() - extendedUs;
+	if(not m_hasOffset or offsetUs < m_offsetUs) {
+		m_offsetUs = offsetUs;
+		m_hasOffset = true;
+	}
+	ArduinoMarker entry = { marker.mid(1 + markerTimeLength), marker.at(0).toLatin1(), extendedUs };
+	m_arduinoMarkers.append(entry);
+	return true;
+} // addArduinoMarker
+
+
+bool Tracer::write(const QString& fileName) const
+{
+	QJsonArray events;
+	events.append(processName(hostPid, "host"));
+	events.append(processName(arduinoPid, "arduino"));
+	foreach(const HostSpan& span, m_hostSpans) {
+		QJsonObject event;
+		event["name"] = span.name;
+		event["cat"] = QString("host");
+		event["ph"] = QString("X");
+		event["pid"] = hostPid;
+		event["tid"] = 1;
+		event["ts"] = double(span.beginUs);
+		event["dur"] = double(span.durationUs);
+		events.append(event);
+	}
+	foreach(const ArduinoMarker& marker, m_arduinoMarkers) {
+		QJsonObject event;
+		event["name"] = marker.name;
+		event["cat"] = QString("arduino");
+		event["ph"] = QString(QChar(marker.phase));
+		event["pid"] = arduinoPid;
+		event["tid"] = 1;
+		event["ts"] = double(marker.arduinoUs + m_offsetUs);
+		events.append(event);
+	}
+	QJsonObject trace;
+	trace["traceEvents"] = events;
+	trace["displayTimeUnit"] = QString("ms");
+
+	QFile file(fileName);
+	if(not file.open(QIODevice::WriteOnly) or file.write(QJsonDocument(trace).toJson()) < 0) {
+		Log(FAC_TRACE, error, QString("Failed writing trace to %1: %2").arg(fileName, file.errorString()));
+		return false;
+	}
+	Log(FAC_TRACE, success, QString("Trace of %1 host spans and %2 Arduino markers written to %3")
+			.arg(m_hostSpans.size()).arg(m_arduinoMarkers.size()).arg(fileName));
+	return true;
+} // write
+
+
+TraceSpan::TraceSpan(Tracer* pTracer, const char* name)
+	: m_pTracer(pTracer), m_name(name), m_beginUs(0)
+{
+	if(0 not_eq m_pTracer and m_pTracer->isActive())
+		m_beginUs = m_pTracer->now();
+} // ctor
+
+
+TraceSpan::~TraceSpan()
+{
+	if(0 not_eq m_pTracer and m_pTracer->isActive())
+		m_pTracer->addSpan(m_name, m_beginUs);
+} // dtor
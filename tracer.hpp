@@ -0,0 +1,76 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QString>
+
+// Records where the time goes while serving the Arduino: Spans of the host are merged with the begin / end markers an
+// Arduino built with TRACING sends (see uno2iec/log.h), and written in Chrome's trace event format, to be viewed in
+// chrome://tracing or Perfetto. Same layout as the trace of the command line tools.
+class Tracer
+{
+public:
+	Tracer();
+
+	// Starting drops whatever was recorded before.
+	void start();
+	void stop();
+	bool isActive() const
+	{
+		return m_active;
+	}
+
+	// Microseconds since start.
+	qint64 now() const;
+	// Record a span from beginUs until now.
+	void addSpan(const QString& name, qint64 beginUs);
+	// Record a marker sent by the Arduino, without the leading 'T' and the terminating '\r', received just now.
+	// Returns false if it is malformed.
+	bool addArduinoMarker(const QString& marker);
+
+	bool write(const QString& fileName) const;
+
+private:
+	struct HostSpan
+	{
+		QString name;
+		qint64 beginUs;
+		qint64 durationUs;
+	};
+	struct ArduinoMarker
+	{
+		QString name;
+		char phase;
+		// micros() of the Arduino, extended beyond 32 bits.
+		qint64 arduinoUs;
+	};
+
+	bool m_active;
+	QElapsedTimer m_timer;
+	QList<HostSpan> m_hostSpans;
+	QList<ArduinoMarker> m_arduinoMarkers;
+	// For extending the Arduino's clock when it wraps around.
+	quint32 m_lastArduinoUs;
+	qint64 m_arduinoWraps;
+	// Our time minus the Arduino's. Markers take a while to reach us, so the smallest difference seen is the best
+	// estimate.
+	bool m_hasOffset;
+	qint64 m_offsetUs;
+};
+
+
+// Records a span from construction to destruction, if the tracer is active.
+class TraceSpan
+{
+public:
+	TraceSpan(Tracer* pTracer, const char* name);
+	~TraceSpan();
+
+private:
+	Tracer* m_pTracer;
+	const char* m_name;
+	qint64 m_beginUs;
+};
+
+#endif // TRACER_HPP
@@ -8,10 +8,14 @@ namespace CBM {
 #define CBM1541_RAM_SIZE (1024 * 2)
 #define CBM1541_VIA1_OFFSET 0x1800
 #define CBM1541_VIA1_SIZE 0x10
-#define CBM1541_VIA2_OFFSET 0x1800
+#define CBM1541_VIA2_OFFSET 0x1C00
 #define CBM1541_VIA2_SIZE 0x10
 #define CBM1541_ROM_OFFSET 0xC000
 #define CBM1541_ROM_SIZE (1024 * 16)
+// The five data buffers in RAM, $0300-$07FF.
+#define CBM1541_BUFFER_OFFSET 0x0300
+#define CBM1541_BUFFER_SIZE 0x100
+#define CBM1541_NUM_BUFFERS 5
 
 // Largest Serial byte buffer request from / to arduino.
 #define MAX_BYTES_PER_REQUEST 256
@@ -17,6 +17,9 @@ typedef unsigned long ulong;
 
 // Enable this for verbose logging of IEC and CBM interfaces.
 //#define CONSOLE_DEBUG
+// Enable this to send timestamped begin / end markers for IEC operations and
+// serial frames to the host, which merges them into its own trace. See log.h.
+//#define TRACING
 // Enable this to debug the IEC lines (checking soldering and physical
 // connections). See project README.TXT
 //#define DEBUGLINES
@@ -503,19 +503,22 @@ boolean IEC::sendFNF() {
 // Set all IEC_signal lines in the correct mode
 //
 boolean IEC::init() {
-  // make sure the output states are initially LOW.
-  pinMode(m_atnPin, OUTPUT);
-  pinMode(m_dataPin, OUTPUT);
-  pinMode(m_clockPin, OUTPUT);
-  digitalWrite(m_atnPin, false);
-  digitalWrite(m_dataPin, false);
-  digitalWrite(m_clockPin, false);
+  // When sniffing, we must not touch the bus at all.
+  if (not isSnifferMode()) {
+    // make sure the output states are initially LOW.
+    pinMode(m_atnPin, OUTPUT);
+    pinMode(m_dataPin, OUTPUT);
+    pinMode(m_clockPin, OUTPUT);
+    digitalWrite(m_atnPin, false);
+    digitalWrite(m_dataPin, false);
+    digitalWrite(m_clockPin, false);
 
 #ifdef RESET_C64
-  pinMode(m_resetPin, OUTPUT);
-  digitalWrite(m_resetPin,
-               false); // only early C64's could be reset by a slave going high.
+    pinMode(m_resetPin, OUTPUT);
+    digitalWrite(m_resetPin, false); // only early C64's could be reset by a
+                                     // slave going high.
 #endif
+  }
 
   // initial pin modes in GPIO.
   pinMode(m_atnPin, INPUT);
@@ -39,6 +39,9 @@ public:
   enum { ATN_CMD_MAX_LENGTH = 40 };
   // default device number listening unless explicitly stated in ctor:
   enum { DEFAULT_IEC_DEVICE = 8 };
+  // Device number the host configures to have us watch the bus passively.
+  // 31 can't be addressed on the bus, it's the UNLISTEN / UNTALK code.
+  enum { SNIFFER_DEVICE = 31 };
 
   typedef struct _tagATNCMD {
     byte code;
@@ -58,6 +61,9 @@ public:
   // than a serial device). Returns false otherwise.
   bool isHostMode() { return deviceNumber() == 0; }
 
+  // Returns true if the driver only watches the bus, see sniffer.h.
+  bool isSnifferMode() { return deviceNumber() == SNIFFER_DEVICE; }
+
   // Checks if CBM is sending an attention message. If this is the case,
   // the message is recieved and stored in atn_cmd.
   //
@@ -102,6 +108,9 @@ public:
   byte deviceNumber() const;
   void setDeviceNumber(const byte deviceNumber);
   void setPins(byte atn, byte clock, byte data, byte srqIn, byte reset);
+  byte atnPin() const { return m_atnPin; }
+  byte clockPin() const { return m_clockPin; }
+  byte dataPin() const { return m_dataPin; }
   IECState state() const;
 
 #ifdef DEBUGLINES
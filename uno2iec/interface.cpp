@@ -75,6 +75,7 @@ void Interface::reset(void) {
 
 void Interface::sendStatus(void) {
   byte i, readResult;
+  TRACE_BEGIN("serial status");
   COMPORT.write('E'); // ask for error string from the last queued error.
   COMPORT.write(m_queuedError);
 
@@ -84,15 +85,18 @@ void Interface::sendStatus(void) {
   } while (readResult not_eq 1 or serCmdIOBuf[0] not_eq ':');
   // get the string.
   readResult = COMPORT.readBytesUntil('\r', serCmdIOBuf, sizeof(serCmdIOBuf));
+  TRACE_END("serial status");
   if (not readResult)
     return; // something went wrong with result from host.
 
+  TRACE_BEGIN("iec send");
   // Length does not include the CR, write all but the last one should be with
   // EOI.
   for (i = 0; i < readResult - 2; ++i)
     m_iec.send(serCmdIOBuf[i]);
   // ...and last byte in string as with EOI marker.
   m_iec.sendEOI(serCmdIOBuf[i]);
+  TRACE_END("iec send");
 } // sendStatus
 
 // send single basic line, including heading basic pointer and terminating zero.
@@ -121,6 +125,7 @@ void Interface::sendLine(byte len, char *text, word &basicPtr) {
 } // sendLine
 
 void Interface::sendListing() {
+  TRACE_BEGIN("listing");
   // Reset basic memory pointer:
   word basicPtr = C64_BASIC_START;
   noInterrupts();
@@ -172,6 +177,7 @@ void Interface::sendListing() {
   m_iec.send(0);
   m_iec.sendEOI(0);
   interrupts();
+  TRACE_END("listing");
 } // sendListing
 
 void Interface::sendFile() {
@@ -198,8 +204,10 @@ void Interface::sendFile() {
                                         // buffer limit for best performance /
                                         // throughput.
   do {
+    TRACE_BEGIN("serial rx");
     len = COMPORT.readBytes(serCmdIOBuf, 2); // read the ack type ('B' or 'E')
     if (2 not_eq len) {
+      TRACE_END("serial rx");
       strcpy_P(serCmdIOBuf, (PGM_P)F("2 Host bytes expected, stopping"));
       Log(Error, FAC_IFACE, serCmdIOBuf);
       success = false;
@@ -209,6 +217,7 @@ void Interface::sendFile() {
     len = serCmdIOBuf[1];
     if ('B' == resp or 'E' == resp) {
       byte actual = COMPORT.readBytes(serCmdIOBuf, len);
+      TRACE_END("serial rx");
       if (actual not_eq len) {
         strcpy_P(serCmdIOBuf, (PGM_P)F("Host bytes expected, stopping"));
         success = false;
@@ -221,6 +230,7 @@ void Interface::sendFile() {
         COMPORT.write('R'); // ask for a byte/bunch of bytes
 #endif
       // so we get some bytes, send them to CBM.
+      TRACE_BEGIN("iec send");
       for (byte i = 0; success and i < len;
            ++i) { // End if sending to CBM fails.
 #ifndef EXPERIMENTAL_SPEED_FIX
@@ -241,12 +251,14 @@ void Interface::sendFile() {
           m_pDisplay->showPercentage(bytesDone);
 #endif
       }
+      TRACE_END("iec send");
 #ifndef EXPERIMENTAL_SPEED_FIX
       if ('E' not_eq resp)  // if not received the final buffer, initiate a new
                             // buffer request while we're feeding the CBM.
         COMPORT.write('R'); // ask for a byte/bunch of bytes
 #endif
     } else {
+      TRACE_END("serial rx");
       strcpy_P(serCmdIOBuf, (PGM_P)F("Got unexp. cmd resp.char."));
       Log(Error, FAC_IFACE, serCmdIOBuf);
       success = false;
@@ -277,6 +289,7 @@ void Interface::saveFile() {
   serCmdIOBuf[0] = 'W';
   do {
     byte bytesInBuffer = 2;
+    TRACE_BEGIN("iec receive");
     do {
       noInterrupts();
       serCmdIOBuf[bytesInBuffer++] = m_iec.receive();
@@ -284,11 +297,14 @@ void Interface::saveFile() {
       done = (m_iec.state() bitand IEC::eoiFlag) or
              (m_iec.state() bitand IEC::errorFlag);
     } while ((bytesInBuffer < 0xf0) and not done);
+    TRACE_END("iec receive");
     // indicate to media host that we want to write a buffer. Give the total
     // length including the heading 'W'+length bytes.
     serCmdIOBuf[1] = bytesInBuffer;
+    TRACE_BEGIN("serial tx");
     COMPORT.write((const byte *)serCmdIOBuf, bytesInBuffer);
     COMPORT.flush();
+    TRACE_END("serial tx");
   } while (not done);
 } // saveFile
 
@@ -308,21 +324,41 @@ byte Interface::hostModeHandler(void) {
     switch (cmd) {
     case 'r':
       // We want to trigger a bus reset.
+      TRACE_BEGIN("reset");
       m_iec.triggerReset();
+      TRACE_END("reset");
       strcpy_P(serCmdIOBuf, (PGM_P)F("Performed IEC bus reset."));
       Log(Information, FAC_IFACE, serCmdIOBuf);
       break;
     case 'o':
+      TRACE_BEGIN("open");
       result = handleOpenOrPutDataRequest(IEC::ATN_CODE_OPEN);
+      TRACE_END("open");
       break;
     case 'c':
+      TRACE_BEGIN("close");
       result = handleCloseRequest();
+      TRACE_END("close");
       break;
     case 'g':
+      TRACE_BEGIN("get");
       result = handleGetDataRequest();
+      TRACE_END("get");
       break;
     case 'p':
+      TRACE_BEGIN("put");
       result = handleOpenOrPutDataRequest(IEC::ATN_CODE_DATA);
+      TRACE_END("put");
+      break;
+    case 'y':
+      // Sync request, echo the nonce instead of sending a status response.
+      if (COMPORT.readBytes(&cmd, 1) == 1) {
+        COMPORT.write('y');
+        COMPORT.write(cmd);
+        COMPORT.write('\r');
+        return IEC::ATN_IDLE;
+      }
+      result = (PGM_P)F("Incomplete sync request");
       break;
     default:
       strcpy_P(serCmdIOBuf, (PGM_P)F("UNKNOWN SERIAL COMMAND"));
@@ -361,7 +397,9 @@ const char *Interface::handleOpenOrPutDataRequest(IEC::ATNCommand cmd) {
     dataSize = 256;
   }
   if (dataSize > 0) {
+    TRACE_BEGIN("serial rx");
     int numRead = COMPORT.readBytes(serCmdIOBuf, dataSize);
+    TRACE_END("serial rx");
     if (numRead != dataSize) {
       sprintf_P(serCmdIOBuf,
                 (PGM_P)F("Received incomplete extra data for open/put data on "
@@ -372,10 +410,12 @@ const char *Interface::handleOpenOrPutDataRequest(IEC::ATNCommand cmd) {
           "Received incomplete open / put data command on serial line.");
     }
   }
+  TRACE_BEGIN("iec atn");
   noInterrupts();
   boolean hasIECError = !m_iec.sendATNToChannel(
       requestHeader[0], requestHeader[1], IEC::ATN_CODE_LISTEN, cmd);
   interrupts();
+  TRACE_END("iec atn");
   if (hasIECError) {
     // Sending ATN Open failed.
     sprintf_P(
@@ -386,6 +426,7 @@ const char *Interface::handleOpenOrPutDataRequest(IEC::ATNCommand cmd) {
     Log(Error, FAC_IFACE, serCmdIOBuf);
     result = (PGM_P)F("Sending ATN LISTEN + OPEN/DATA failed.");
   }
+  TRACE_BEGIN("iec send");
   noInterrupts();
 
   int i = 0;
@@ -399,6 +440,7 @@ const char *Interface::handleOpenOrPutDataRequest(IEC::ATNCommand cmd) {
     }
   }
   interrupts();
+  TRACE_END("iec send");
   if (hasIECError && i > 0) {
     // Sending filename failed.
     char buf[80];
@@ -484,16 +526,19 @@ const char *Interface::handleGetDataRequest(void) {
     Log(Error, FAC_IFACE, serCmdIOBuf);
     return result;
   }
+  TRACE_BEGIN("iec atn");
   noInterrupts();
   boolean hasIECError =
       !m_iec.sendATNToChannel(requestHeader[0], requestHeader[1],
                               IEC::ATN_CODE_TALK, IEC::ATN_CODE_DATA);
   interrupts();
+  TRACE_END("iec atn");
 
   bool dataStreamStarted = false;
   if (!hasIECError) {
     // Indicate that a data package is coming.
     dataStreamStarted = true;
+    TRACE_BEGIN("iec receive");
     COMPORT.write('r');
   } else {
     // Sending ATN Open failed.
@@ -531,6 +576,7 @@ const char *Interface::handleGetDataRequest(void) {
     // run into trouble.
     COMPORT.write('\r');
     COMPORT.flush();
+    TRACE_END("iec receive");
   }
 
   if (hasIECError) {
@@ -23,6 +23,8 @@
 // To be able to easily tell those commands apart, host mode uses lower case
 // characters while device mode uses upper case characters.
 //
+// A third mode only watches the bus, it is documented in sniffer.h.
+//
 // Host mode commands
 // ------------------
 //
@@ -35,12 +37,17 @@
 //      <channel>, <num data bytes>, <data to send to the channel>.
 //      If <data to send to the channel> is 0, we expect 256 bytes of data.
 // 'c': Close a channel. The following bytes are <device number>, <channel>.
+// 'y': Sync request. The following byte is a nonce, anything but '\r'. The
+//      response is 'y', the nonce and '\r' instead of a status response. The
+//      host drops everything received before it to get back in sync.
 //
 // Host mode responses
 // -------------------
 //
 // 'D': Debug / Logging output. Terminated by '\r'. (same as device mode).
 // '!': Register logging facility. (same as device mode).
+// 'T': Trace marker, only sent when built with TRACING, see log.h. (same as
+//      device mode).
 // 'r': Standard host mode data response, followed by an escaped data stream
 //      as described below (and terminated by '\r').
 // 's': Standard host mode status response, followed by a string describing
@@ -48,6 +55,7 @@
 //      means
 //      success. A status response confirms that a requested command
 //      has been executed either successfully or with an error.
+// 'y': Acknowledgement of a sync request, see above.
 //
 // Escaping rules:
 //  Response data is escaped and terminated by '\r' to avoid having to specify
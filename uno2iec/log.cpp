@@ -37,4 +37,14 @@ void Log(byte severity, char facility, char *msg) {
   COMPORT.print('\r');
 } // Log
 
+#ifdef TRACING
+void Trace(char phase, PGM_P name) {
+  char strBuf[12];
+  sprintf_P(strBuf, (PGM_P)F("T%c%08lx"), phase, micros());
+  COMPORT.print(strBuf);
+  COMPORT.print((const __FlashStringHelper *)name);
+  COMPORT.print('\r');
+} // Trace
+#endif
+
 #endif
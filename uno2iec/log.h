@@ -15,6 +15,15 @@ enum Severity { Success, Information, Warning, Error };
 void registerFacilities(void);
 void Log(byte severity, char facility, char *msg);
 
+#ifdef TRACING
+// Trace markers are sent as 'T', the phase ('B'egin or 'E'nd), micros() as
+// eight hex digits and the name of the span, terminated by '\r'. They are
+// only sent between serial frames, never in the middle of one.
+void Trace(char phase, PGM_P name);
+#define TRACE_BEGIN(name) Trace('B', PSTR(name))
+#define TRACE_END(name) Trace('E', PSTR(name))
+#endif // TRACING
+
 #else
 
 #define registerFacilities()
@@ -22,4 +31,9 @@ void Log(byte severity, char facility, char *msg);
 
 #endif // NO_LOGGING
 
+#ifndef TRACE_BEGIN
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#endif
+
 #endif
@@ -0,0 +1,124 @@
+#include "sniffer.h"
+
+// Timer1 runs at F_CPU / 64, which gives 4 us ticks on a 16 MHz board.
+#define SNIFF_TIMER_PRESCALER 64
+#define SNIFF_TICK_US (SNIFF_TIMER_PRESCALER / (F_CPU / 1000000L))
+
+// A talker signals EOI by keeping CLOCK released for more than 200 us.
+#define SNIFF_EOI_TICKS (200 / SNIFF_TICK_US)
+
+Sniffer::Sniffer(IEC &iec)
+    : m_iec(iec), m_started(false), m_atnAsserted(false), m_lastTimer(0),
+      m_now(0), m_lastRecord(0) {} // ctor
+
+void Sniffer::handler(void) {
+  if (not m_started)
+    start();
+
+  // Wait for the talker to be ready to send (CLOCK released), then for all
+  // listeners to be ready for data (DATA released).
+  if (not waitLine(m_clock, true) or not waitLine(m_data, true)) {
+    sendATNEdge();
+    return;
+  }
+
+  // The talker holds off pulling CLOCK to signal EOI, the listeners
+  // acknowledge by pulling DATA for a while.
+  byte flags = SNIFF_BYTE;
+  ulong ready = m_now;
+  while (readLine(m_clock)) {
+    if (poll()) {
+      sendATNEdge();
+      return;
+    }
+    if (not readLine(m_data) and m_now - ready >= SNIFF_EOI_TICKS)
+      flags or_eq SNIFF_EOI;
+  }
+  if (m_atnAsserted)
+    flags or_eq SNIFF_ATN;
+
+  // Bits are valid while CLOCK is released, least significant first.
+  byte data = 0;
+  for (byte n = 0; n < 8; n++) {
+    if (not waitLine(m_clock, true)) {
+      // The computer aborted the transfer.
+      sendRecord(flags bitor SNIFF_ERROR, data >> (8 - n));
+      sendATNEdge();
+      return;
+    }
+    data >>= 1;
+    data or_eq (readLine(m_data) ? (1 << 7) : 0);
+    if (not waitLine(m_clock, false)) {
+      sendRecord(flags bitor SNIFF_ERROR, data >> (7 - n));
+      sendATNEdge();
+      return;
+    }
+  }
+  sendRecord(flags, data);
+} // handler
+
+void Sniffer::start(void) {
+  initLine(m_atn, m_iec.atnPin());
+  initLine(m_clock, m_iec.clockPin());
+  initLine(m_data, m_iec.dataPin());
+
+  // Free running, no interrupts. We extend it to 32 bits in poll().
+  TCCR1A = 0;
+  TCCR1B = _BV(CS11) bitor _BV(CS10);
+  TIMSK1 = 0;
+  m_lastTimer = TCNT1;
+  m_now = 0;
+  m_lastRecord = 0;
+  m_started = true;
+
+  sendRecord(SNIFF_START, SNIFF_TICK_US);
+  if (poll())
+    sendATNEdge();
+} // start
+
+boolean Sniffer::poll(void) {
+  word timer = TCNT1;
+  m_now += (word)(timer - m_lastTimer);
+  m_lastTimer = timer;
+  return readLine(m_atn) == m_atnAsserted;
+} // poll
+
+void Sniffer::sendATNEdge(void) {
+  m_atnAsserted = not m_atnAsserted;
+  sendRecord(m_atnAsserted ? SNIFF_ATN_ASSERTED : SNIFF_ATN_RELEASED, 0);
+} // sendATNEdge
+
+boolean Sniffer::waitLine(const Line &line, boolean released) {
+  while (readLine(line) not_eq released) {
+    if (poll())
+      return false;
+  }
+  return true;
+} // waitLine
+
+void Sniffer::sendRecord(byte flags, byte data) {
+  ulong delta = m_now - m_lastRecord;
+  m_lastRecord = m_now;
+  byte record[4];
+  if (delta > 0xFFFF) {
+    word periods = delta >> 16;
+    record[0] = SNIFF_RECORD bitor SNIFF_TIME;
+    record[1] = 0;
+    record[2] = periods bitand 0xFF;
+    record[3] = periods >> 8;
+    COMPORT.write(record, sizeof(record));
+    delta -= (ulong)periods << 16;
+  }
+  record[0] = SNIFF_RECORD bitor flags;
+  record[1] = data;
+  record[2] = delta bitand 0xFF;
+  record[3] = delta >> 8;
+  COMPORT.write(record, sizeof(record));
+} // sendRecord
+
+void Sniffer::initLine(Line &line, byte pin) {
+  // Input without pullup, we never drive the line.
+  pinMode(pin, INPUT);
+  line.in = portInputRegister(digitalPinToPort(pin));
+  line.mask = digitalPinToBitMask(pin);
+} // initLine
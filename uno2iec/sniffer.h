@@ -0,0 +1,105 @@
+#ifndef SNIFFER_H
+#define SNIFFER_H
+
+#include "global_defines.h"
+#include "iec_driver.h"
+#include <Arduino.h>
+
+// Sniffer mode documentation
+// ==========================
+//
+// When the host configures device number 31 (IEC::SNIFFER_DEVICE), the
+// Arduino never drives a line. It only watches ATN, CLOCK and DATA while the
+// computer talks to real devices, and sends a record for every byte and every
+// ATN edge it sees to the host.
+//
+// Records are four bytes: <flags>, <data>, <delta low>, <delta high>. The
+// flags always have bit 7 set, so records can't be confused with log output
+// ('D' and '!'), which may still be interleaved. Bits 4-6 of the flags hold
+// the record kind:
+//
+// 0x00: A byte was transferred, <data> holds it. Flag bits 0-2 are
+//       SNIFF_EOI, SNIFF_ATN (sent under ATN) and SNIFF_ERROR (the transfer
+//       was aborted, <data> holds the bits received so far).
+// 0x10: ATN was asserted.
+// 0x20: ATN was released.
+// 0x30: No event, <delta> counts 65536 ticks. Sent ahead of a record whose
+//       delta would not fit into 16 bits.
+// 0x40: Sniffing started, <data> holds the length of a tick in us. Always
+//       the first record, with a delta of zero.
+//
+// <delta> is the time since the previous record in timer ticks, 4 us each on
+// a 16 MHz board. The time of a byte is when its last bit was clocked.
+
+class Sniffer {
+public:
+  enum RecordKind {
+    SNIFF_BYTE = 0x00,
+    SNIFF_ATN_ASSERTED = 0x10,
+    SNIFF_ATN_RELEASED = 0x20,
+    SNIFF_TIME = 0x30,
+    SNIFF_START = 0x40
+  };
+
+  enum RecordFlags {
+    SNIFF_EOI = (1 << 0),
+    SNIFF_ATN = (1 << 1),
+    SNIFF_ERROR = (1 << 2),
+    SNIFF_RECORD = (1 << 7)
+  };
+
+  Sniffer(IEC &iec);
+
+  // Wait for the next byte or ATN edge on the bus and send its record. Meant
+  // to be called repeatedly from loop(). Blocks while the bus is quiet.
+  void handler(void);
+
+private:
+  // Configure Timer1 as free running time base and send the start record.
+  void start(void);
+
+  // Advance the time from Timer1. Returns true if ATN changed since the last
+  // edge was recorded.
+  boolean poll(void);
+
+  // Send the record for an ATN edge found by poll().
+  void sendATNEdge(void);
+
+  // An IEC line, read directly from its port. Using digitalRead() would be
+  // too slow to catch the bits of a fast talker.
+  typedef struct _tagLINE {
+    volatile byte *in;
+    byte mask;
+  } Line;
+
+  // Wait for line to become released (high) or pulled (low). Returns false
+  // if ATN changed while waiting.
+  boolean waitLine(const Line &line, boolean released);
+
+  // Send a record, preceded by time records if needed.
+  void sendRecord(byte flags, byte data);
+
+  static void initLine(Line &line, byte pin);
+
+  inline boolean readLine(const Line &line) {
+    return (*line.in bitand line.mask) ? true : false;
+  }
+
+  IEC &m_iec;
+  boolean m_started;
+
+  Line m_atn;
+  Line m_clock;
+  Line m_data;
+
+  // ATN as of the last edge recorded, true if asserted.
+  boolean m_atnAsserted;
+
+  // Time in ticks, extended from the 16 bit timer, and the time of the last
+  // record sent.
+  word m_lastTimer;
+  ulong m_now;
+  ulong m_lastRecord;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "iec_driver.h"
 #include "interface.h"
 #include "log.h"
+#include "sniffer.h"
 
 #ifdef USE_LED_DISPLAY
 #include <max7219.h>
@@ -27,6 +28,7 @@ static void waitForPeer();
 // The global IEC handling singleton:
 static IEC iec(8);
 static Interface iface(iec);
+static Sniffer sniffer(iec);
 
 static ulong lastMillis = 0;
 
@@ -92,7 +94,9 @@ void loop() {
   iec.testOUTPUTS();
 // iec.testINPUTS();
 #else
-  if (IEC::ATN_RESET == iface.handler()) {
+  if (iec.isSnifferMode()) {
+    sniffer.handler();
+  } else if (IEC::ATN_RESET == iface.handler()) {
 
 #ifdef USE_LED_DISPLAY
     pMax->resetScrollText_p(myText);
@@ -164,6 +168,8 @@ static void waitForPeer() {
     sprintf_P(
         tempBuffer,
         (PGM_P)F("CONNECTED, READY FOR SENDING IEC DATA WITH CBM AS HOST."));
+  } else if (deviceNumber == IEC::SNIFFER_DEVICE) {
+    sprintf_P(tempBuffer, (PGM_P)F("CONNECTED, SNIFFING THE IEC BUS."));
   } else {
     sprintf_P(tempBuffer,
               (PGM_P)F("CONNECTED, READY FOR IEC DATA WITH CBM AS DEV %u."),